@@ -0,0 +1,281 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "illex/client_buffering.h"
+#include "illex/client_queueing.h"
+#include "illex/pull.h"
+#include "illex/server.h"
+#include "schemas.h"
+
+namespace illex::bench {
+
+/// The capacity of the buffers of the buffering client.
+constexpr size_t kBufferCapacity = 1024 * 1024;
+/// The number of buffers of the buffering client.
+constexpr size_t kNumBuffers = 4;
+/// The number of batches streamed per iteration of the loopback benchmarks.
+constexpr size_t kBatchesPerIteration = 16;
+/// The interval at which consumers check whether the client is done.
+constexpr std::chrono::milliseconds kPollInterval(10);
+/// The first port of the loopback benchmarks.
+constexpr uint16_t kFirstPort = 12000;
+/// The number of ports the loopback benchmarks cycle through.
+constexpr uint16_t kNumPorts = 1000;
+
+/**
+ * \brief Return the port for the next loopback stream.
+ *
+ * Every stream uses another port, so a server never has to wait for the sockets of the
+ * previous stream to leave the TIME_WAIT state.
+ */
+static auto NextPort() -> uint16_t {
+  static uint16_t next = 0;
+  auto port = static_cast<uint16_t>(kFirstPort + next);
+  next = (next + 1) % kNumPorts;
+  return port;
+}
+
+/// Scan a buffer of JSONs of a schema for newlines.
+static void BM_JSONBufferScan(benchmark::State& state, SchemaFactory make) {
+  PullOptions opts;
+  opts.gen.seed = 0;
+  opts.schema = make();
+  std::unique_ptr<PullGenerator> gen;
+  auto status = PullGenerator::Make(opts, &gen);
+  if (!status.ok()) {
+    state.SkipWithError(status.msg().c_str());
+    return;
+  }
+
+  std::vector<std::byte> storage(static_cast<size_t>(state.range(0)));
+  size_t num_jsons = 0;
+  size_t num_bytes = 0;
+  status = gen->GenerateInto(storage.data(), storage.size(), &num_jsons, &num_bytes);
+  if (!status.ok()) {
+    state.SkipWithError(status.msg().c_str());
+    return;
+  }
+
+  JSONBuffer buffer;
+  JSONBuffer::Create(storage.data(), storage.size(), &buffer);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(buffer.Scan(num_bytes, 0));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * num_jsons));
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * num_bytes));
+}
+
+BENCHMARK_CAPTURE(BM_JSONBufferScan, Battery, BatterySchema)
+    ->Range(4096, kBufferCapacity);
+BENCHMARK_CAPTURE(BM_JSONBufferScan, TripReport, TripReportSchema)
+    ->Range(4096, kBufferCapacity);
+
+/// Return the producer options for the loopback benchmarks.
+static auto LoopbackProduction(SchemaFactory make, size_t num_jsons) -> ProducerOptions {
+  ProducerOptions result;
+  result.gen.seed = 0;
+  result.schema = make();
+  result.batching = true;
+  result.num_batches = kBatchesPerIteration;
+  result.num_jsons = num_jsons;
+  return result;
+}
+
+/**
+ * \brief Start a server on some port that streams JSONs to a single client.
+ * \param[in]  opts          The production options.
+ * \param[in]  port          The port to listen on.
+ * \param[out] server        The server.
+ * \param[out] thread        The thread streaming the JSONs, if the server was created.
+ * \param[out] thread_status The status of streaming, which may only be read after the
+ *                           thread is joined.
+ * \return Status::OK() if the server was created, some error otherwise.
+ */
+static auto StartServer(const ProducerOptions& opts, uint16_t port, Server* server,
+                        std::thread* thread, Status* thread_status) -> Status {
+  ServerOptions server_opts;
+  server_opts.port = port;
+  ILLEX_ROE(Server::Create(server_opts, server));
+  *thread = std::thread([=]() {
+    StreamMetrics metrics;
+    // Do not wait after streaming, which would be measured.
+    *thread_status = server->SendJSONs(opts, RepeatOptions{1, 0}, &metrics);
+    server->Close();
+  });
+  return Status::OK();
+}
+
+/// Stream JSONs of a schema over the loopback interface into a buffering client.
+static void BM_LoopbackBuffering(benchmark::State& state, SchemaFactory make) {
+  auto opts = LoopbackProduction(make, static_cast<size_t>(state.range(0)));
+  const size_t total_jsons = TotalJSONs(opts);
+
+  std::vector<std::vector<std::byte>> storage(
+      kNumBuffers, std::vector<std::byte>(kBufferCapacity));
+  std::vector<JSONBuffer> buffers(kNumBuffers);
+  for (size_t i = 0; i < kNumBuffers; i++) {
+    JSONBuffer::Create(storage[i].data(), kBufferCapacity, &buffers[i]);
+  }
+
+  size_t num_bytes = 0;
+  for (auto _ : state) {
+    JSONBufferQueue free;
+    JSONBufferQueue filled;
+    for (auto& buffer : buffers) {
+      free.enqueue(&buffer);
+    }
+
+    ClientOptions client_opts;
+    client_opts.port = NextPort();
+    Server server;
+    std::thread server_thread;
+    Status server_status;
+    auto status =
+        StartServer(opts, client_opts.port, &server, &server_thread, &server_status);
+    if (!status.ok()) {
+      state.SkipWithError(status.msg().c_str());
+      return;
+    }
+
+    BufferingClient client;
+    status = BufferingClient::Create(client_opts, &free, &filled, &client);
+    if (!status.ok()) {
+      server_thread.join();
+      state.SkipWithError(status.msg().c_str());
+      return;
+    }
+    Status client_status;
+    std::atomic<bool> finished = false;
+    std::thread client_thread([&]() {
+      client_status = client.ReceiveJSONs();
+      finished = true;
+    });
+
+    // Consume the buffers, and return them, until the client is done.
+    size_t num_jsons = 0;
+    while (num_jsons < total_jsons) {
+      JSONBuffer* buffer = nullptr;
+      if (filled.wait_dequeue_timed(buffer, kPollInterval)) {
+        num_jsons += buffer->num_jsons();
+        buffer->Reset();
+        free.enqueue(buffer);
+      } else if (finished) {
+        break;
+      }
+    }
+
+    client_thread.join();
+    server_thread.join();
+    client.Close();
+    num_bytes += client.bytes_received();
+    if (!client_status.ok() || !server_status.ok() || (num_jsons != total_jsons)) {
+      state.SkipWithError("Loopback stream failed.");
+      return;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * total_jsons));
+  state.SetBytesProcessed(static_cast<int64_t>(num_bytes));
+}
+
+/**
+ * \brief Stream JSONs of a schema over the loopback interface into a queueing client.
+ *
+ * This measures splitting received bytes into queued JSONs, including the copies the
+ * queueing client makes of them.
+ */
+static void BM_LoopbackQueueing(benchmark::State& state, SchemaFactory make) {
+  auto opts = LoopbackProduction(make, static_cast<size_t>(state.range(0)));
+  const size_t total_jsons = TotalJSONs(opts);
+
+  size_t num_bytes = 0;
+  for (auto _ : state) {
+    JSONQueue queue;
+    ClientOptions client_opts;
+    client_opts.port = NextPort();
+    Server server;
+    std::thread server_thread;
+    Status server_status;
+    auto status =
+        StartServer(opts, client_opts.port, &server, &server_thread, &server_status);
+    if (!status.ok()) {
+      state.SkipWithError(status.msg().c_str());
+      return;
+    }
+
+    QueueingClient client;
+    status = QueueingClient::Create(client_opts, &queue, &client);
+    if (!status.ok()) {
+      server_thread.join();
+      state.SkipWithError(status.msg().c_str());
+      return;
+    }
+    Status client_status;
+    std::atomic<bool> finished = false;
+    std::thread client_thread([&]() {
+      client_status = client.ReceiveJSONs();
+      finished = true;
+    });
+
+    // Consume the queued JSONs, until the client is done.
+    size_t num_jsons = 0;
+    JSONItem item;
+    while (num_jsons < total_jsons) {
+      if (queue.wait_dequeue_timed(item, kPollInterval)) {
+        benchmark::DoNotOptimize(item.string.data());
+        num_jsons++;
+      } else if (finished) {
+        break;
+      }
+    }
+
+    client_thread.join();
+    server_thread.join();
+    client.Close();
+    num_bytes += client.bytes_received();
+    if (!client_status.ok() || !server_status.ok() || (num_jsons != total_jsons)) {
+      state.SkipWithError("Loopback stream failed.");
+      return;
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * total_jsons));
+  state.SetBytesProcessed(static_cast<int64_t>(num_bytes));
+}
+
+BENCHMARK_CAPTURE(BM_LoopbackBuffering, Battery, BatterySchema)
+    ->Range(256, 4096)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_LoopbackBuffering, TripReport, TripReportSchema)
+    ->Range(256, 4096)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_LoopbackQueueing, Battery, BatterySchema)
+    ->Range(256, 4096)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_LoopbackQueueing, TripReport, TripReportSchema)
+    ->Range(256, 4096)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace illex::bench
@@ -0,0 +1,67 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <future>
+#include <utility>
+
+#include "illex/producer.h"
+#include "schemas.h"
+
+namespace illex::bench {
+
+/// The number of batches produced per iteration.
+constexpr size_t kBatchesPerIteration = 8;
+
+/// Produce batches of JSONs of a schema on a single production thread.
+static void BM_ProductionThread(benchmark::State& state, SchemaFactory make,
+                                bool frame) {
+  ProducerOptions opts;
+  opts.gen.seed = 0;
+  opts.schema = make();
+  opts.num_batches = kBatchesPerIteration;
+  opts.num_jsons = static_cast<size_t>(state.range(0));
+  opts.frame = frame;
+  ProductionShare share{opts.num_batches, opts.num_jsons};
+  ProductionQueue queue(opts.num_batches);
+  BatchPool pool;
+  std::atomic<bool> shutdown = false;
+  size_t num_bytes = 0;
+
+  for (auto _ : state) {
+    std::promise<ProductionMetrics> metrics;
+    auto metrics_f = metrics.get_future();
+    ProductionThread(0, opts, share, &queue, nullptr, &pool, &shutdown,
+                     std::move(metrics));
+    // Return all batches, so their buffers are reused in the next iteration.
+    JSONBatch batch;
+    while (queue.TryDequeue(&batch)) {
+      pool.Release(&batch);
+    }
+    num_bytes += metrics_f.get().num_chars;
+  }
+  state.SetItemsProcessed(state.iterations() * opts.num_batches * opts.num_jsons);
+  state.SetBytesProcessed(static_cast<int64_t>(num_bytes));
+}
+
+BENCHMARK_CAPTURE(BM_ProductionThread, Basics, BasicsSchema, false)->Range(16, 4096);
+BENCHMARK_CAPTURE(BM_ProductionThread, Battery, BatterySchema, false)->Range(16, 4096);
+BENCHMARK_CAPTURE(BM_ProductionThread, TripReport, TripReportSchema, false)
+    ->Range(16, 4096);
+BENCHMARK_CAPTURE(BM_ProductionThread, TripReportFramed, TripReportSchema, true)
+    ->Range(16, 4096);
+
+}  // namespace illex::bench
@@ -0,0 +1,152 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <benchmark/benchmark.h>
+#include <rapidjson/stringbuffer.h>
+
+#include <memory>
+#include <vector>
+
+#include "illex/arrow.h"
+#include "illex/document.h"
+#include "illex/plan.h"
+#include "illex/value.h"
+#include "schemas.h"
+
+namespace illex::bench {
+
+/// A function constructing a value generator.
+using ValueFactory = std::shared_ptr<Value> (*)();
+
+static auto MakeNull() -> std::shared_ptr<Value> { return std::make_shared<Null>(); }
+static auto MakeBool() -> std::shared_ptr<Value> { return std::make_shared<Bool>(); }
+static auto MakeUInt64() -> std::shared_ptr<Value> {
+  return std::make_shared<Int<uint64_t>>();
+}
+static auto MakeInt64() -> std::shared_ptr<Value> {
+  return std::make_shared<Int<int64_t>>();
+}
+static auto MakeString() -> std::shared_ptr<Value> {
+  return std::make_shared<String>(1, 16);
+}
+static auto MakeDate() -> std::shared_ptr<Value> {
+  return std::make_shared<DateString>();
+}
+static auto MakePool() -> std::shared_ptr<Value> {
+  return std::make_shared<Pool>(std::make_shared<String>(1, 16), 1024, 1.0);
+}
+static auto MakeFixedSizeArray() -> std::shared_ptr<Value> {
+  return std::make_shared<FixedSizeArray>(16, std::make_shared<Int<uint64_t>>());
+}
+static auto MakeArray() -> std::shared_ptr<Value> {
+  return std::make_shared<Array>(std::make_shared<Int<uint64_t>>(), 16, 1);
+}
+static auto MakeObject() -> std::shared_ptr<Value> {
+  return std::make_shared<Object>(
+      std::vector<Member>{Member("a", std::make_shared<Int<uint64_t>>()),
+                          Member("b", std::make_shared<Bool>()),
+                          Member("c", std::make_shared<String>(1, 16))});
+}
+
+/// Generate values into DOM values.
+static void BM_ValueGet(benchmark::State& state, ValueFactory make) {
+  DocumentGenerator gen(0);
+  gen.SetRoot(make());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(gen.Get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/// Write values straight into a string buffer.
+static void BM_ValueWrite(benchmark::State& state, ValueFactory make) {
+  DocumentGenerator gen(0);
+  gen.SetRoot(make());
+  rj::StringBuffer buffer;
+  for (auto _ : state) {
+    buffer.Clear();
+    Writer writer(buffer);
+    gen.Write(&writer);
+    benchmark::DoNotOptimize(buffer.GetString());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/// Generate values through a compiled plan.
+static void BM_ValuePlan(benchmark::State& state, ValueFactory make) {
+  auto root = make();
+  Plan plan;
+  auto status = Plan::Compile(*root, &plan);
+  if (!status.ok()) {
+    state.SkipWithError(status.msg().c_str());
+    return;
+  }
+  RandomEngine engine(0);
+  rj::StringBuffer buffer;
+  for (auto _ : state) {
+    buffer.Clear();
+    plan.Write(&engine, &buffer);
+    benchmark::DoNotOptimize(buffer.GetString());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+#define ILLEX_BENCH_VALUE(NAME)                       \
+  BENCHMARK_CAPTURE(BM_ValueGet, NAME, Make##NAME);   \
+  BENCHMARK_CAPTURE(BM_ValueWrite, NAME, Make##NAME); \
+  BENCHMARK_CAPTURE(BM_ValuePlan, NAME, Make##NAME)
+
+ILLEX_BENCH_VALUE(Null);
+ILLEX_BENCH_VALUE(Bool);
+ILLEX_BENCH_VALUE(UInt64);
+ILLEX_BENCH_VALUE(Int64);
+ILLEX_BENCH_VALUE(String);
+ILLEX_BENCH_VALUE(Date);
+ILLEX_BENCH_VALUE(Pool);
+ILLEX_BENCH_VALUE(FixedSizeArray);
+ILLEX_BENCH_VALUE(Array);
+ILLEX_BENCH_VALUE(Object);
+
+/// Generate root values of a schema with DocumentGenerator::Get().
+static void BM_DocumentGet(benchmark::State& state, SchemaFactory make) {
+  auto gen = FromArrowSchema(*make(), GenerateOptions(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(gen.Get());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+/// Generate JSON strings of a schema with DocumentGenerator::GetString().
+static void BM_DocumentGetString(benchmark::State& state, SchemaFactory make,
+                                 bool pretty) {
+  auto gen = FromArrowSchema(*make(), GenerateOptions(0));
+  size_t num_bytes = 0;
+  for (auto _ : state) {
+    auto json = gen.GetString(pretty);
+    num_bytes += json.size();
+    benchmark::DoNotOptimize(json.data());
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(static_cast<int64_t>(num_bytes));
+}
+
+BENCHMARK_CAPTURE(BM_DocumentGet, Basics, BasicsSchema);
+BENCHMARK_CAPTURE(BM_DocumentGet, Battery, BatterySchema);
+BENCHMARK_CAPTURE(BM_DocumentGet, TripReport, TripReportSchema);
+BENCHMARK_CAPTURE(BM_DocumentGetString, Basics, BasicsSchema, false);
+BENCHMARK_CAPTURE(BM_DocumentGetString, Battery, BatterySchema, false);
+BENCHMARK_CAPTURE(BM_DocumentGetString, TripReport, TripReportSchema, false);
+BENCHMARK_CAPTURE(BM_DocumentGetString, TripReportPretty, TripReportSchema, true);
+
+}  // namespace illex::bench
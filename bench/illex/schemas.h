@@ -0,0 +1,77 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <arrow/api.h>
+#include <arrow/util/key_value_metadata.h>
+
+#include <memory>
+#include <string>
+
+namespace illex::bench {
+
+/// A function constructing a schema.
+using SchemaFactory = std::shared_ptr<arrow::Schema> (*)();
+
+/// Return the metadata to draw integers from a range.
+inline auto Range(const std::string& min, const std::string& max)
+    -> std::shared_ptr<const arrow::KeyValueMetadata> {
+  return arrow::key_value_metadata({"illex_MIN", "illex_MAX"}, {min, max});
+}
+
+/// The schema of examples/basics.py.
+inline auto BasicsSchema() -> std::shared_ptr<arrow::Schema> {
+  auto length = arrow::key_value_metadata({"illex_MIN_LENGTH"}, {"3"});
+  return arrow::schema(
+      {arrow::field("timestamp", arrow::date64(), false),
+       arrow::field("string", arrow::utf8(), false),
+       arrow::field("integer", arrow::uint64(), false, Range("13", "37")),
+       arrow::field("list_of_strings",
+                    arrow::list(arrow::field("item", arrow::utf8(), false)), false,
+                    length),
+       arrow::field("bool", arrow::boolean(), false)});
+}
+
+/// The schema of examples/battery.py.
+inline auto BatterySchema() -> std::shared_ptr<arrow::Schema> {
+  auto length = arrow::key_value_metadata({"illex_MIN_LENGTH", "illex_MAX_LENGTH"},
+                                          {"1", "16"});
+  auto item = arrow::field("item", arrow::uint64(), false, Range("0", "2047"));
+  return arrow::schema({arrow::field("voltage", arrow::list(item), false, length)});
+}
+
+/// The schema of examples/tripreport.py.
+inline auto TripReportSchema() -> std::shared_ptr<arrow::Schema> {
+  auto item = arrow::field("item", arrow::uint64(), false, Range("0", "4192"));
+  auto fsl = [&](const std::string& name, int32_t length) {
+    return arrow::field(name, arrow::fixed_size_list(item, length), false);
+  };
+  return arrow::schema(
+      {arrow::field("timestamp", arrow::date64(), false),
+       arrow::field("timezone", arrow::uint64(), false, Range("0", "1024")),
+       arrow::field("vin", arrow::uint64(), false),
+       arrow::field("odometer", arrow::uint64(), false, Range("0", "1000")),
+       arrow::field("hypermiling", arrow::boolean(), false),
+       arrow::field("avgspeed", arrow::uint64(), false, Range("0", "200")),
+       fsl("sec_in_band", 12), fsl("miles_in_time_range", 24),
+       fsl("const_speed_miles_in_band", 12), fsl("vary_speed_miles_in_band", 12),
+       fsl("sec_decel", 10), fsl("sec_accel", 10), fsl("braking", 6), fsl("accel", 6),
+       arrow::field("orientation", arrow::boolean(), false),
+       fsl("small_speed_var", 13), fsl("large_speed_var", 13),
+       arrow::field("accel_decel", arrow::uint64(), false, Range("0", "4192")),
+       arrow::field("speed_changes", arrow::uint64(), false, Range("0", "4192"))});
+}
+
+}  // namespace illex::bench
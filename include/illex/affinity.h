@@ -0,0 +1,64 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "illex/status.h"
+
+namespace illex {
+
+/// A set of CPUs to run threads on, e.g. the CPUs of the NUMA node of a NIC.
+using CpuSet = std::vector<size_t>;
+
+/**
+ * \brief Parse a list of CPUs, in the format of the kernel, e.g. 0-3,8,10-11.
+ * \param[in]  list The list.
+ * \param[out] out  The CPUs.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+auto ParseCpuList(std::string_view list, CpuSet* out) -> Status;
+
+/**
+ * \brief Look up the CPUs of a NUMA node.
+ * \param[in]  node The NUMA node.
+ * \param[out] out  The CPUs.
+ * \return Status::OK() if successful, or an error if the node does not exist.
+ */
+auto NodeCpus(size_t node, CpuSet* out) -> Status;
+
+/**
+ * \brief Resolve a CPU set from a list of CPUs, or from node<N> for a NUMA node.
+ * \param[in]  spec The list of CPUs, or the NUMA node.
+ * \param[out] out  The CPUs.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+auto ResolveCpuSet(std::string_view spec, CpuSet* out) -> Status;
+
+/**
+ * \brief Pin the calling thread to a set of CPUs.
+ *
+ * The kernel places the pages of a buffer on the NUMA node of the thread that first
+ * touches them. Buffers that are allocated and filled by pinned threads are therefore
+ * local to them.
+ *
+ * \param cpus The CPUs, or an empty set to leave the thread where it is.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+auto PinThread(const CpuSet& cpus) -> Status;
+
+}  // namespace illex
@@ -15,10 +15,12 @@
 #pragma once
 
 #include <arrow/api.h>
+#include <arrow/util/compression.h>
 
 #include <memory>
 
 #include "illex/document.h"
+#include "illex/protocol.h"
 #include "illex/status.h"
 #include "illex/value.h"
 
@@ -51,6 +53,15 @@ auto GetMeta(const arrow::Field& field, const std::string& key)
 auto GetUInt64Meta(const arrow::Field& field, const std::string& key)
     -> std::optional<uint64_t>;
 
+/**
+ * \brief Look up Arrow field metadata value by key, and convert it to a double.
+ * \param field The field to inspect.
+ * \param key The key to look up.
+ * \return The double value, if the KV-pair exists and was converted to a finite number.
+ */
+auto GetDoubleMeta(const arrow::Field& field, const std::string& key)
+    -> std::optional<double>;
+
 /// \brief Class to analyze an Arrow schema and populate a DocumentGenerator.
 class SchemaAnalyzer : public arrow::TypeVisitor {
  public:
@@ -64,7 +75,14 @@ class SchemaAnalyzer : public arrow::TypeVisitor {
   DocumentGenerator* out_ = nullptr;
 };
 
-/// \brief Class to analyze an Arrow field, and populate a Member generator.
+/**
+ * \brief Class to analyze an Arrow field, and populate a Member generator.
+ *
+ * The values of string and date fields are drawn from a pool of pre-generated values if
+ * the field metadata sets illex_POOL_SIZE. The values are picked uniformly, unless
+ * illex_POOL_SKEW sets a Zipfian exponent. The pool is generated from illex_POOL_SEED and
+ * the field name, so it is the same for every seed of the document generator.
+ */
 class FieldAnalyzer : public arrow::TypeVisitor {
  public:
   /// \brief Construct a new FieldAnalyzer, setting the Member generator to populate.
@@ -89,6 +107,9 @@ class FieldAnalyzer : public arrow::TypeVisitor {
   /// \brief Visit a Date64Type.
   auto Visit(const arrow::Date64Type& type) -> arrow::Status override;
 
+  /// \brief Wrap a value generator in a pool, if the field metadata asks for one.
+  auto MaybePool(std::shared_ptr<Value> value) -> std::shared_ptr<Value>;
+
   /// The field being analyzed.
   const arrow::Field* field_ = nullptr;
   /// The Member generator to populate.
@@ -106,6 +127,13 @@ class FieldAnalyzer : public arrow::TypeVisitor {
 auto ReadSchemaFromFile(const std::string& file, std::shared_ptr<arrow::Schema>* out)
     -> Status;
 
+/**
+ * \brief Check the generator metadata of all fields of an Arrow schema.
+ * \param schema The Arrow schema to check.
+ * \return An error if a field has a pool skew that is not a finite, non-negative number.
+ */
+auto ValidateSchema(const arrow::Schema& schema) -> Status;
+
 /**
  * \brief Construct a DocumentGenerator from an Arrow schema.
  * \param schema    The Arrow schema to use.
@@ -115,4 +143,13 @@ auto ReadSchemaFromFile(const std::string& file, std::shared_ptr<arrow::Schema>*
 auto FromArrowSchema(const arrow::Schema& schema,
                      GenerateOptions options = GenerateOptions()) -> DocumentGenerator;
 
+/**
+ * \brief Create an Arrow codec for compressing the JSONs of frames.
+ * \param[in]  compression The compression, which may not be Compression::None.
+ * \param[out] out         The codec.
+ * \return OK if successful, or an error if Arrow was built without the codec.
+ */
+auto MakeCodec(Compression compression, std::unique_ptr<arrow::util::Codec>* out)
+    -> Status;
+
 }  // namespace illex
\ No newline at end of file
@@ -14,7 +14,11 @@
 
 #pragma once
 
+#include <string_view>
+
+#include "illex/affinity.h"
 #include "illex/latency.h"
+#include "illex/metrics.h"
 #include "illex/protocol.h"
 #include "illex/status.h"
 
@@ -42,17 +46,69 @@ struct ClientOptions {
   uint64_t seq = 0;
   /// Protocol options
   Protocol protocol = {};
+  /**
+   * \brief Whether the server fills in send stamps, see stamp::Parse().
+   *
+   * If so, the send time of stamped JSONs is placed in stage 0 of the latency tracker,
+   * and all other stages move up by one. The server numbers JSONs from 0, so seq must be
+   * 0 as well. For streams across hosts, the system clocks of both must be synchronized,
+   * e.g. through PTP, and the latency includes any remaining clock offset.
+   */
+  bool send_stamps = false;
+  /**
+   * \brief The CPUs to pin the receiving thread to, or empty to leave it where it is.
+   *
+   * The thread calling ReceiveJSONs() is pinned, after which receive buffers that are
+   * first touched by it are placed on its NUMA node.
+   */
+  CpuSet cpus;
+  /// Live counters to add received JSONs and bytes to, or nullptr for none.
+  LiveMetrics* live = nullptr;
 };
 
 /// Abstract class for client implementations.
 class Client {
  public:
+  virtual ~Client() = default;
+
   /**
    * \brief Receive JSONs on this raw stream client and put them in a queue.
    * \return Status::OK() if successful, some error otherwise.
    */
   virtual auto ReceiveJSONs(LatencyTracker* lat_tracker = nullptr) -> Status = 0;
 
+  /**
+   * \brief Receive once on this client, and hand off the received JSONs.
+   *
+   * This allows a single thread to drive many clients, by only calling this on clients
+   * that have data available, e.g. when an epoll instance reports their native handle
+   * to be readable. The default implementation returns an error.
+   *
+   * \param[in]  lat_tracker The latency tracker, may be nullptr.
+   * \param[out] done        Set to true when the server has disconnected cleanly.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  virtual auto ReceiveOnce(LatencyTracker* lat_tracker, bool* done) -> Status;
+
+  /**
+   * \brief Return whether the last ReceiveOnce() did not receive, because the client
+   *        waits for a buffer to become available.
+   *
+   * The client should then be driven again later, even if no new data arrives.
+   */
+  [[nodiscard]] virtual auto waiting() const -> bool { return false; }
+
+  /**
+   * \brief Release any buffer that is held between calls of ReceiveOnce().
+   *
+   * Must be called from the thread that calls ReceiveOnce(), when it stops doing so
+   * before the server has disconnected.
+   */
+  virtual void ReleaseBuffers() {}
+
+  /// \brief Return the native handle of the socket of this client, or -1 if it has none.
+  [[nodiscard]] virtual auto native_handle() const -> int { return -1; }
+
   /**
    * \brief Close this raw client.
    * \return Status::OK() if successful, some error otherwise.
@@ -66,6 +122,23 @@ class Client {
   [[nodiscard]] virtual auto bytes_received() const -> size_t = 0;
 };
 
+/**
+ * \brief Place the time points of a received JSON in a latency tracker.
+ *
+ * Without send stamps, stage 0 is the receive time and stage 1 the time just before the
+ * JSON is queued. With send stamps, the send time of the JSON is placed in stage 0 if it
+ * was stamped, and the other stages move up by one.
+ *
+ * \param tracker        The latency tracker.
+ * \param seq            The sequence number of the JSON.
+ * \param json           The JSON, without trailing whitespace.
+ * \param send_stamps    Whether the server fills in send stamps.
+ * \param receive_time   The time the JSON was received.
+ * \param pre_queue_time The time just before queueing the JSON.
+ */
+void TrackLatency(LatencyTracker* tracker, Seq seq, std::string_view json,
+                  bool send_stamps, TimePoint receive_time, TimePoint pre_queue_time);
+
 /**
  * \brief Initialize a socket, by creating it and attempting to connect.
  * \param[in]  host The host to connect to.
@@ -12,6 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <arrow/util/compression.h>
+#include <blockingconcurrentqueue.h>
+
+#include <atomic>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -24,6 +29,9 @@
 
 namespace illex {
 
+/// How long a client waits for a free buffer at a time, before checking if it must stop.
+constexpr std::chrono::microseconds kBufferPollInterval(10000);
+
 /// Range of sequence numbers.
 struct SeqRange {
   /// The first sequence number in the range.
@@ -47,7 +55,9 @@ class JSONBuffer {
   /**
    * \brief Scan the first num_bytes bytes in the buffer for newline delimited JSONs.
    *
-   * This function returns the number of newline delimited JSONs.
+   * This function returns the number of newline delimited JSONs. Empty lines are not
+   * counted as JSONs. The offsets of all newlines found in the buffer are made available
+   * through newlines().
    *
    * \param num_bytes Number of bytes to scan from the start.
    * \param seq       THe starting sequence number for the JSONs in this buffer.
@@ -55,6 +65,19 @@ class JSONBuffer {
    */
   auto Scan(size_t num_bytes, uint64_t seq) -> std::pair<size_t, size_t>;
 
+  /**
+   * \brief Set the records of the buffer from the JSON lengths of a received frame.
+   *
+   * The JSONs of the frame must be at the start of the buffer. The buffer is not
+   * scanned. The offset of the whitespace character at the end of every JSON is made
+   * available through newlines(), so records can be found in the same way as after a
+   * Scan(), even if the JSONs themselves contain newlines.
+   *
+   * \param lengths The length of every JSON, including its whitespace character.
+   * \param seq     The starting sequence number for the JSONs in this buffer.
+   */
+  void SetFrame(const std::vector<uint32_t>& lengths, uint64_t seq);
+
   /// \brief Return a pointer to mutate the buffer contents.
   auto mutable_data() -> std::byte* { return buffer_; }
 
@@ -74,6 +97,18 @@ class JSONBuffer {
   [[nodiscard]] inline auto range() const -> SeqRange { return seq_range; }
   [[nodiscard]] auto num_jsons() const -> size_t;
 
+  /**
+   * \brief Return the offsets of all newlines found by the last Scan().
+   *
+   * Downstream parsers can use these as record boundaries, instead of scanning the
+   * buffer again. A record ends at its newline and starts after the previous newline, or
+   * at the start of the buffer. Note that records may be empty if the buffer contains
+   * empty lines.
+   */
+  [[nodiscard]] inline auto newlines() const -> const std::vector<size_t>& {
+    return newlines_;
+  }
+
   /// \brief Modify the number of valid of bytes in the buffer without bounds checking.
   inline void SetSizeUnsafe(size_t size) { size_ = size; }
 
@@ -103,17 +138,57 @@ class JSONBuffer {
   SeqRange seq_range = {0, 0};
   /// The TCP receive time point of this buffer.
   TimePoint recv_time_;
+  /// Offsets of the newlines in the buffer, reused between scans.
+  std::vector<size_t> newlines_;
 };
 
+/// A queue to hand off buffers between the client and downstream threads.
+using JSONBufferQueue = moodycamel::BlockingConcurrentQueue<JSONBuffer*>;
+
+/**
+ * \brief Place the time points of all JSONs in a buffer in a latency tracker.
+ *
+ * The receive time of every JSON is the receive time of the buffer. See TrackLatency().
+ *
+ * \param tracker     The latency tracker.
+ * \param buf         The buffer, just before it is handed off.
+ * \param send_stamps Whether the server fills in send stamps.
+ */
+void TrackBuffer(LatencyTracker* tracker, JSONBuffer* buf, bool send_stamps);
+
 /**
  * \brief A client that buffers received JSONs.
  *
  * This client can be supplied to work with multiple, lockable buffers. When the client
  * has obtained a buffer lock, it will attempt to fill the buffer until it is full, or
- * until there are no TCP packets to deliver. It will then unlock the buffer. This allows
- * multiple downstream threads to consume from multiple buffers simultaneously.
+ * until there are no TCP packets to deliver. It will then unlock the buffer, once it
+ * holds a complete JSON. This allows multiple downstream threads to consume from
+ * multiple buffers simultaneously.
+ *
+ * Alternatively, the buffers can be handed off through a queue of free buffers and a
+ * queue of filled buffers. The client then blocks until a free buffer is available, and
+ * downstream threads can block until a filled buffer is available, so no side has to
+ * poll. Stop() makes a client that is waiting for a free buffer return.
+ *
+ * ReceiveOnce() never waits for a buffer, and receives at most once, so a single thread
+ * can drive many clients. If no buffer is available, waiting() is set, and the client
+ * continues where it left off on the next call. Incomplete frames are kept in their
+ * buffer between calls.
+ *
+ * The bytes of a JSON that was not completely received into a buffer are copied to the
+ * start of the next buffer before the buffer is handed off. Downstream threads may
+ * therefore modify the buffers they consume, and clients may share buffers. If no other
+ * buffer is free at that point, the bytes are kept in a spill vector instead, and copied
+ * into the next buffer once one is acquired. A single JSON must fit in a buffer.
  *
  * The client keeps track of the order of received JSONs by adding sequence numbers.
+ * Like the QueueingClient, it places the time points of received JSONs in a latency
+ * tracker, including their send stamps, just before their buffer is handed off.
+ *
+ * With length framing, the client receives every frame into a buffer of its own, without
+ * scanning it. A frame must then fit in a buffer. Compressed frames are decompressed
+ * straight into the buffer. Frames must arrive in order, which is checked through the
+ * sequence number in their header.
  */
 class BufferingClient : public Client {
  public:
@@ -133,22 +208,131 @@ class BufferingClient : public Client {
                      const std::vector<std::mutex*>& mutexes, BufferingClient* out)
       -> Status;
 
+  /**
+   * \brief Create a new buffering client that hands off buffers through queues.
+   *
+   * The client dequeues buffers from the free queue, fills them, and enqueues them in
+   * the filled queue. Downstream threads must Reset() a buffer after consuming it and
+   * return it to the free queue. The free queue should initially contain all buffers.
+   *
+   * \param options The options for this client.
+   * \param free    The queue of buffers that can be filled.
+   * \param filled  The queue of buffers that contain JSONs.
+   * \param out     The BufferingClient object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const ClientOptions& options, JSONBufferQueue* free,
+                     JSONBufferQueue* filled, BufferingClient* out) -> Status;
+
   auto ReceiveJSONs(LatencyTracker* lat_tracker = nullptr) -> Status override;
+  auto ReceiveOnce(LatencyTracker* lat_tracker, bool* done) -> Status override;
+  void ReleaseBuffers() override;
+  [[nodiscard]] auto waiting() const -> bool override { return waiting_; }
+  [[nodiscard]] auto native_handle() const -> int override;
   auto Close() -> Status override;
   [[nodiscard]] auto jsons_received() const -> size_t override;
   [[nodiscard]] auto bytes_received() const -> size_t override;
 
+  /**
+   * \brief Make ReceiveJSONs() return, once the client has stopped waiting for data.
+   *
+   * A client that is waiting for a free buffer notices this within kBufferPollInterval.
+   * May be called from any thread.
+   */
+  void Stop() { stopped = true; }
+
+  /// \brief Return the time spent decompressing frames, in seconds.
+  [[nodiscard]] auto decompress_time() const -> double { return decompress_time_; }
+
  private:
+  /// The parts of a frame, in the order in which they are received. A buffer is obtained
+  /// after the header, so the lengths can be checked against its capacity.
+  enum class FramePart { Header, Buffer, Lengths, JSONs };
+
+  /// Apply the framing and compression of the protocol.
+  auto SetProtocol(const Protocol& protocol) -> Status;
+  /**
+   * \brief Obtain an empty buffer as the current buffer, and carry over the remaining
+   *        bytes into it.
+   *
+   * Sets waiting_ if no buffer became available within the timeout.
+   *
+   * \param timeout The maximum time to wait for a buffer, or zero to not wait.
+   * \return Status::OK() if successful, an error if the remaining bytes do not fit.
+   */
+  auto Acquire(std::chrono::microseconds timeout) -> Status;
+  /// Receive once into the current buffer, and hand it off if it holds any JSON.
+  auto ReceiveScanned(LatencyTracker* lat_tracker, bool* done) -> Status;
+  /// Receive once into a buffer after the remaining bytes, and scan it for JSONs.
+  auto Fill(JSONBuffer* buf) -> int;
+  /**
+   * \brief Hand off the current buffer, and continue with the next buffer, if any.
+   *
+   * The remaining bytes after the valid bytes of the current buffer are copied straight
+   * into a free buffer, which becomes the current buffer. If there is none, they are
+   * copied into the spill vector, and there is no current buffer.
+   *
+   * \return Status::OK() if successful, an error if the remaining bytes do not fit.
+   */
+  auto Advance() -> Status;
+  /// Hand off the current buffer to downstream threads.
+  void HandOff();
+  /// Reset the current buffer and return it to the free queue, or unlock it.
+  void ReturnCurrent();
+  /// Receive once into the part of a length-prefixed frame that is being received.
+  auto ReceiveFrame(LatencyTracker* lat_tracker, bool* done) -> Status;
+  /// Receive once into a part of a frame of some size, after the received bytes.
+  auto ReceiveFramePart(std::byte* part, size_t size, bool* disconnected) -> Status;
+  /// Decompress the compressed JSONs of the frame into a buffer.
+  auto Decompress(JSONBuffer* buf) -> Status;
+
   /// The mutexes to manage buffer access.
   std::vector<std::mutex*> mutexes;
   /// The buffers.
   std::vector<JSONBuffer*> buffers;
+  /// The queue of free buffers, if buffers are handed off through queues.
+  JSONBufferQueue* free_queue = nullptr;
+  /// The queue of filled buffers, if buffers are handed off through queues.
+  JSONBufferQueue* filled_queue = nullptr;
   // Whether the client must be closed.
   bool must_be_closed = false;
-  // The current buffer to receive the TCP data in.
-  size_t buffer_idx = 0;
+  /// Whether the client must stop receiving.
+  std::atomic<bool> stopped = false;
+  /// The current buffer to receive the TCP data in.
+  JSONBuffer* current = nullptr;
+  /// The lock on the current buffer, if buffers are locked.
+  std::unique_lock<std::mutex> current_lock;
+  /// Whether the last receive found no buffer to receive into.
+  bool waiting_ = false;
+  /// The bytes of an incomplete JSON at the end of the previous buffer, if no next
+  /// buffer was free when it was handed off. Reused between buffers.
+  std::vector<std::byte> spill;
+  /// The number of bytes of the incomplete JSON.
+  size_t remaining = 0;
+  /// Whether the stream is length framed.
+  bool framed = false;
+  /// The part of the frame that is being received.
+  FramePart frame_part = FramePart::Header;
+  /// The number of received bytes of the part of the frame.
+  size_t frame_offset = 0;
+  /// The header of the frame that is being received.
+  frame::Header frame_header{};
+  /// The JSON lengths of the last frame, reused between frames.
+  std::vector<uint32_t> frame_lengths;
+  /// The codec to decompress frames with, if the stream is compressed.
+  std::unique_ptr<arrow::util::Codec> codec;
+  /// The compressed JSONs of the last frame, reused between frames.
+  std::vector<std::byte> compressed_jsons;
+  /// The time spent decompressing frames.
+  double decompress_time_ = 0.0;
   /// The next available sequence number.
   Seq seq = 0;
+  /// Whether the server fills in send stamps.
+  bool send_stamps = false;
+  /// The CPUs to pin the receiving thread to.
+  CpuSet cpus;
+  /// Live counters to add received JSONs and bytes to, if any.
+  LiveMetrics* live = nullptr;
   /// The number of received JSONs.
   size_t jsons_received_ = 0;
   /// The number of received bytes.
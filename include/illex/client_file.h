@@ -0,0 +1,142 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "illex/client.h"
+#include "illex/client_buffering.h"
+#include "illex/client_queueing.h"
+#include "illex/status.h"
+
+namespace illex {
+
+/// Options for the file client.
+struct FileClientOptions {
+  /// The path of a file with newline-delimited JSONs.
+  std::string path;
+  /// The starting sequence number of the first JSON read.
+  uint64_t seq = 0;
+  /// The maximum number of bytes to read at once, like a single receive of a TCP client.
+  size_t chunk_size = ILLEX_DEFAULT_TCP_BUFSIZE;
+  /**
+   * \brief Whether buffers refer straight to the mapped file, instead of into copies.
+   *
+   * Only applies when handing off buffers. Views are always zero-copy.
+   */
+  bool zero_copy = false;
+  /// The maximum number of zero-copy buffers handed off at the same time.
+  size_t num_slices = 8;
+};
+
+/**
+ * \brief A client that reads JSONs from a memory-mapped file instead of a socket.
+ *
+ * This allows profiling downstream consumers at memory bandwidth, using the same
+ * integration code as for the TCP clients. The client hands off JSONs the same way as
+ * the BufferingClient with buffer queues, or the QueueingClient, including sequence
+ * numbers and latency tracker stages. The file is processed in chunks, that take the
+ * place of the bytes of a single receive. As with TCP clients, bytes after the last
+ * newline are not considered a JSON. Files hold no send stamps, so stage 0 of the latency
+ * tracker is always the time a chunk was read.
+ *
+ * In zero-copy buffer mode, the client hands off buffers of its own, that refer to
+ * slices of the mapping. Downstream threads must return them to the free queue as
+ * usual, which must initially be empty. The mapping is private, so modifying the
+ * buffers does not modify the file. Zero-copy buffers may not be used after the client
+ * is destructed. JSON views keep the mapping alive by themselves.
+ */
+class FileClient : public Client {
+ public:
+  /**
+   * \brief Create a client that queues copies of the JSONs.
+   * \param[in]  options The options for this client.
+   * \param[in]  queue   The queue to dump JSONs in.
+   * \param[out] out     The FileClient object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const FileClientOptions& options, JSONQueue* queue, FileClient* out)
+      -> Status;
+
+  /**
+   * \brief Create a client that queues views straight into the mapped file.
+   * \param[in]  options The options for this client.
+   * \param[in]  queue   The queue to dump JSON views in.
+   * \param[out] out     The FileClient object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const FileClientOptions& options, JSONViewQueue* queue,
+                     FileClient* out) -> Status;
+
+  /**
+   * \brief Create a client that hands off buffers through queues.
+   *
+   * Without zero-copy, this follows the buffer queue protocol of the BufferingClient.
+   *
+   * \param[in]  options The options for this client.
+   * \param[in]  free    The queue of buffers that can be filled.
+   * \param[in]  filled  The queue of buffers that contain JSONs.
+   * \param[out] out     The FileClient object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const FileClientOptions& options, JSONBufferQueue* free,
+                     JSONBufferQueue* filled, FileClient* out) -> Status;
+
+  auto ReceiveJSONs(LatencyTracker* lat_tracker = nullptr) -> Status override;
+  auto Close() -> Status override;
+  [[nodiscard]] auto jsons_received() const -> size_t override { return jsons_received_; }
+  [[nodiscard]] auto bytes_received() const -> size_t override { return bytes_received_; }
+
+ private:
+  struct Mapping;
+
+  /// Map the file of the options.
+  auto Open(const FileClientOptions& options) -> Status;
+  /// Return the length of the chunk at some offset, ending after a newline if possible.
+  [[nodiscard]] auto ChunkLength(size_t offset, size_t max_length) const -> size_t;
+  /// Queue copies or views of the JSONs.
+  auto ReceiveItems(LatencyTracker* lat_tracker) -> Status;
+  /// Hand off copies of the file in buffers.
+  auto ReceiveBuffers() -> Status;
+  /// Hand off buffers referring to the mapped file.
+  auto ReceiveSlices() -> Status;
+
+  /// The mapped file.
+  std::shared_ptr<Mapping> mapping;
+  /// The client options.
+  FileClientOptions opts;
+  /// The queue to dump JSONs in.
+  JSONQueue* queue = nullptr;
+  /// The queue to dump JSON views in.
+  JSONViewQueue* view_queue = nullptr;
+  /// The queue of free buffers.
+  JSONBufferQueue* free_queue = nullptr;
+  /// The queue of filled buffers.
+  JSONBufferQueue* filled_queue = nullptr;
+  /// Buffers referring to slices of the mapping, in zero-copy buffer mode.
+  std::vector<std::unique_ptr<JSONBuffer>> slices;
+  /// The next available sequence number.
+  Seq seq = 0;
+  /// The number of read JSONs.
+  size_t jsons_received_ = 0;
+  /// The number of read bytes.
+  size_t bytes_received_ = 0;
+  /// Newline offsets of the last chunk, reused between chunks.
+  std::vector<size_t> newlines;
+};
+
+}  // namespace illex
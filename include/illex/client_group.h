@@ -0,0 +1,212 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "illex/client.h"
+#include "illex/client_buffering.h"
+#include "illex/client_queueing.h"
+#include "illex/status.h"
+
+namespace illex {
+
+/// The default size of the range of sequence numbers of every connection.
+constexpr uint64_t kDefaultConnectionSeqRange = uint64_t{1} << 40;
+
+/// How long the epoll engine waits before driving connections that wait for a buffer.
+constexpr std::chrono::milliseconds kStallInterval(1);
+
+/// Engines to drive the connections of a group.
+enum class ReceiveEngine {
+  Threads,  ///< Receive on every connection on its own thread.
+  Epoll     ///< Receive on all connections from a few threads, waiting with epoll.
+};
+
+/// Options for a group of client connections.
+struct ClientGroupOptions {
+  /// The options of every connection. The sequence number is that of the first one.
+  ClientOptions client;
+  /// The number of connections to open.
+  size_t num_connections = 1;
+  /**
+   * \brief The size of the range of sequence numbers of every connection.
+   *
+   * Connection c numbers its JSONs from client.seq + c * seq_range, so sequence numbers
+   * are unique across the group, and identify both the connection and the position of a
+   * JSON in the stream of that connection.
+   */
+  uint64_t seq_range = kDefaultConnectionSeqRange;
+  /// The engine to drive the connections with.
+  ReceiveEngine engine = ReceiveEngine::Threads;
+  /// The number of threads of the epoll engine. Connections are spread over them.
+  size_t num_engine_threads = 1;
+};
+
+/**
+ * \brief A group of client connections, receiving in parallel.
+ *
+ * A single connection is limited to the throughput of one receiving core and one TCP
+ * flow. A group opens multiple connections, e.g. to a server streaming to multiple
+ * clients, and receives on all of them in parallel. All connections hand off their
+ * JSONs to the same queue or set of buffers, in the same way as a single
+ * QueueingClient or BufferingClient would.
+ *
+ * When the connections share buffers, every connection keeps the bytes of its own
+ * incomplete JSON out of the buffers it hands off, and carries them over into the next
+ * buffer it fills. A buffer therefore only holds complete JSONs of a single connection,
+ * which is identified by the sequence numbers of the buffer.
+ *
+ * JSONs of different connections are interleaved arbitrarily. Their order can be
+ * restored through their sequence numbers, see ClientGroupOptions::seq_range.
+ */
+class ClientGroup : public Client {
+ public:
+  /**
+   * \brief Create a group of connections that queue copies of the JSONs.
+   * \param[in]  options     The options for this group.
+   * \param[in]  queue       The queue to dump JSONs in.
+   * \param[out] out         The ClientGroup object to populate.
+   * \param[in]  buffer_size The TCP receive buffer size of every connection.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const ClientGroupOptions& options, JSONQueue* queue,
+                     ClientGroup* out, size_t buffer_size = ILLEX_DEFAULT_TCP_BUFSIZE)
+      -> Status;
+
+  /**
+   * \brief Create a group of connections that queue views into pooled receive slabs.
+   *
+   * Every connection has its own slab pool.
+   *
+   * \param[in]  options   The options for this group.
+   * \param[in]  queue     The queue to dump JSON views in.
+   * \param[out] out       The ClientGroup object to populate.
+   * \param[in]  slab_size The size of a receive slab.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const ClientGroupOptions& options, JSONViewQueue* queue,
+                     ClientGroup* out, size_t slab_size = ILLEX_DEFAULT_TCP_BUFSIZE)
+      -> Status;
+
+  /**
+   * \brief Create a group of connections that fill a shared set of lockable buffers.
+   * \param[in]  options The options for this group.
+   * \param[in]  buffers The buffers on which to operate.
+   * \param[in]  mutexes The mutexes to obtain locks on each buffer.
+   * \param[out] out     The ClientGroup object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const ClientGroupOptions& options,
+                     const std::vector<JSONBuffer*>& buffers,
+                     const std::vector<std::mutex*>& mutexes, ClientGroup* out)
+      -> Status;
+
+  /**
+   * \brief Create a group of connections that hand off buffers through shared queues.
+   * \param[in]  options The options for this group.
+   * \param[in]  free    The queue of buffers that can be filled.
+   * \param[in]  filled  The queue of buffers that contain JSONs.
+   * \param[out] out     The ClientGroup object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const ClientGroupOptions& options, JSONBufferQueue* free,
+                     JSONBufferQueue* filled, ClientGroup* out) -> Status;
+
+  /**
+   * \brief Receive JSONs on all connections, using the engine of the options, until all
+   *        are done.
+   *
+   * Latency trackers are not thread-safe, so only the first connection places its time
+   * points in the tracker. Its sequence numbers start at the sequence number of the
+   * options, so send stamps can be tracked as well.
+   *
+   * \param lat_tracker The latency tracker of the first connection, may be nullptr.
+   * \return Status::OK() if successful, the first error of any connection otherwise.
+   */
+  auto ReceiveJSONs(LatencyTracker* lat_tracker = nullptr) -> Status override;
+  auto Close() -> Status override;
+  [[nodiscard]] auto jsons_received() const -> size_t override;
+  [[nodiscard]] auto bytes_received() const -> size_t override;
+
+  /// \brief Return the number of connections.
+  [[nodiscard]] auto num_connections() const -> size_t { return clients.size(); }
+
+  /// \brief Return the index of the connection that received the JSON with some seq.
+  [[nodiscard]] auto connection(Seq seq) const -> size_t {
+    return (seq - first_seq) / seq_range;
+  }
+
+  /// \brief Return the position of a JSON in the stream of its connection.
+  [[nodiscard]] auto connection_seq(Seq seq) const -> Seq {
+    return (seq - first_seq) % seq_range;
+  }
+
+ private:
+  /// Validate the options of a group.
+  static auto Validate(const ClientGroupOptions& options) -> Status;
+  /// Return the options of connection c.
+  static auto ConnectionOptions(const ClientGroupOptions& options, size_t c)
+      -> ClientOptions;
+  /**
+   * \brief Create a group of connections of some client type.
+   * \tparam T       The client type.
+   * \param options  The group options.
+   * \param create   Creates a client of type T from the options of its connection.
+   * \param out      The group to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  template <typename T, typename Factory>
+  static auto Make(const ClientGroupOptions& options, const Factory& create,
+                   ClientGroup* out) -> Status;
+
+  /// Receive on every connection on its own thread.
+  auto ReceiveThreads(LatencyTracker* lat_tracker) -> Status;
+  /// Receive on the connections with the epoll engine.
+  auto ReceiveEpoll(LatencyTracker* lat_tracker) -> Status;
+  /// Register connection c with an epoll instance.
+  auto Register(int epfd, size_t c) -> Status;
+  /**
+   * \brief Receive on some connections from a single thread, waiting with epoll.
+   *
+   * Every connection is driven one receive at a time, and never blocks the thread.
+   * Connections that wait for a buffer are driven again every kStallInterval.
+   *
+   * \param conns       The indices of the connections to receive on.
+   * \param lat_tracker The latency tracker of the first connection, may be nullptr.
+   * \return Status::OK() if successful, the first error of any connection otherwise.
+   */
+  auto EpollLoop(const std::vector<size_t>& conns, LatencyTracker* lat_tracker)
+      -> Status;
+
+  /// The connections.
+  std::vector<std::unique_ptr<Client>> clients;
+  /// The sequence number of the first JSON of the first connection.
+  Seq first_seq = 0;
+  /// The size of the range of sequence numbers of every connection.
+  uint64_t seq_range = kDefaultConnectionSeqRange;
+  /// The engine to drive the connections with.
+  ReceiveEngine engine = ReceiveEngine::Threads;
+  /// The number of threads of the epoll engine.
+  size_t num_engine_threads = 1;
+  /// The CPUs to pin the engine threads to.
+  CpuSet cpus;
+};
+
+}  // namespace illex
@@ -21,8 +21,11 @@
 #include <cstdint>
 #include <future>
 #include <kissnet.hpp>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 #include "illex/client.h"
 #include "illex/client_queueing.h"
@@ -45,8 +48,61 @@ struct JSONItem {
 /// A JSON queue for downstream tools.
 using JSONQueue = moodycamel::BlockingConcurrentQueue<JSONItem>;
 
+/**
+ * \brief A single JSON item referring to bytes owned by something else.
+ *
+ * The bytes remain valid for as long as the owner is held. Downstream tools should
+ * simply drop the view when they are done with the JSON.
+ */
+struct JSONView {
+  /// Sequence number.
+  Seq seq = 0;
+  /// Raw JSON string.
+  std::string_view string;
+  /// Reference to the owner of the bytes of the JSON string.
+  std::shared_ptr<const void> owner;
+};
+
+/// A JSON view queue for downstream tools.
+using JSONViewQueue = moodycamel::BlockingConcurrentQueue<JSONView>;
+
+/**
+ * \brief A pool of fixed-size receive slabs.
+ *
+ * Slabs are handed out as reference-counted pointers. When the last reference to a slab
+ * is released, which may happen on any thread, the slab is returned to the pool, so it
+ * can be reused without allocating. The pool may be destructed before all slabs are
+ * released.
+ */
+class SlabPool {
+ public:
+  explicit SlabPool(size_t slab_size = ILLEX_DEFAULT_TCP_BUFSIZE);
+
+  /**
+   * \brief Acquire a slab from the pool, allocating a new one if none are free.
+   * \param[out] out The acquired slab.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  auto Acquire(std::shared_ptr<std::byte>* out) -> Status;
+
+  /// \brief Return the size of the slabs in this pool.
+  [[nodiscard]] auto slab_size() const -> size_t;
+
+  /// \brief Return the number of slabs allocated by this pool.
+  [[nodiscard]] auto num_allocated() const -> size_t;
+
+ private:
+  struct State;
+  /// State shared with the slabs, so they can be returned after the pool is destructed.
+  std::shared_ptr<State> state_;
+};
+
 /**
  * \brief A client that attempts to immediately queue received JSONs.
+ *
+ * The client either queues copies of the JSONs as JSONItems, or queues JSONViews that
+ * refer directly to the receive slabs of a SlabPool. In the latter case, only JSONs that
+ * span two slabs are copied. Length framing and compression are not supported.
  */
 struct QueueingClient : public Client {
  public:
@@ -55,12 +111,37 @@ struct QueueingClient : public Client {
   static auto Create(const ClientOptions& options, JSONQueue* queue, QueueingClient* out,
                      size_t buffer_size = ILLEX_DEFAULT_TCP_BUFSIZE) -> Status;
 
+  /**
+   * \brief Create a client that queues views into pooled receive slabs.
+   * \param[in]  options    The client options.
+   * \param[in]  queue      The queue to dump JSON views in.
+   * \param[out] out        The resulting client.
+   * \param[in]  slab_size  The size of a receive slab. A single JSON may not be larger
+   *                        than this.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const ClientOptions& options, JSONViewQueue* queue,
+                     QueueingClient* out, size_t slab_size = ILLEX_DEFAULT_TCP_BUFSIZE)
+      -> Status;
+
   auto ReceiveJSONs(LatencyTracker* lat_tracker = nullptr) -> Status override;
+  auto ReceiveOnce(LatencyTracker* lat_tracker, bool* done) -> Status override;
+  [[nodiscard]] auto native_handle() const -> int override;
   auto Close() -> Status override;
   [[nodiscard]] auto jsons_received() const -> size_t override { return received_; }
   [[nodiscard]] auto bytes_received() const -> size_t override { return bytes_received_; }
 
+  /// \brief Return the pool of receive slabs.
+  [[nodiscard]] auto slab_pool() const -> const SlabPool& { return pool; }
+
  private:
+  /// Receive once into the TCP buffer and queue copies of the JSONs.
+  auto ReceiveItems(LatencyTracker* lat_tracker, size_t* bytes_received,
+                    int* sock_status) -> Status;
+  /// Receive once into a pooled slab and queue views on the JSONs.
+  auto ReceiveView(LatencyTracker* lat_tracker, size_t* bytes_received,
+                   int* sock_status) -> Status;
+
   // TCP receive buffer.
   std::byte* buffer = nullptr;
   // TCP receive buffer size.
@@ -69,14 +150,34 @@ struct QueueingClient : public Client {
   bool must_be_closed = false;
   // The queue to dump JSONs in.
   JSONQueue* queue = nullptr;
+  // The queue to dump JSON views in.
+  JSONViewQueue* view_queue = nullptr;
+  /// The pool of receive slabs, when queueing views.
+  SlabPool pool;
+  /// The slab that is currently being filled, when queueing views.
+  std::shared_ptr<std::byte> slab;
+  /// The number of valid bytes in the current slab.
+  size_t fill = 0;
+  /// The offset of the first byte in the current slab that is not part of a queued JSON.
+  size_t json_start = 0;
+  /// Buffer for a JSON spanning multiple receives, reused to prevent allocations.
+  std::string json_string;
   /// The next available sequence number.
   Seq seq = 0;
+  /// Whether the server fills in send stamps.
+  bool send_stamps = false;
+  /// The CPUs to pin the receiving thread to.
+  CpuSet cpus;
+  /// Live counters to add received JSONs and bytes to, if any.
+  LiveMetrics* live = nullptr;
   /// The number of received JSONs.
   size_t received_ = 0;
   /// The number of received bytes.
   size_t bytes_received_ = 0;
   /// The TCP socket.
   std::shared_ptr<Socket> client = nullptr;
+  /// Newline offsets of the last received buffer, reused between receives.
+  std::vector<size_t> newlines;
 };
 
 }  // namespace illex
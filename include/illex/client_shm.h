@@ -0,0 +1,109 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "illex/client.h"
+#include "illex/client_buffering.h"
+#include "illex/shm.h"
+#include "illex/status.h"
+
+namespace illex {
+
+/// Options for the shared-memory ring client.
+struct RingClientOptions {
+  /// The path of the ring file, created by a server streaming into a ring.
+  std::string path;
+  /// The starting sequence number of the first JSON read.
+  uint64_t seq = 0;
+  /// Whether the server fills in send stamps, see ClientOptions::send_stamps.
+  bool send_stamps = false;
+  /// The CPUs to pin the reading thread to, or empty to leave it where it is.
+  CpuSet cpus;
+};
+
+/**
+ * \brief A client that reads JSONs from a shared-memory ring on the same host.
+ *
+ * This removes the copies and kernel involvement of loopback TCP, so downstream
+ * consumers can be measured on their own. The client hands off the ring slots as
+ * buffers, following the buffer queue protocol of the BufferingClient, but without
+ * copying them. Every slot takes the place of the bytes of a single receive, and its
+ * JSONs are placed in a latency tracker with the time the slot was read as their receive
+ * time.
+ *
+ * As with the zero-copy FileClient, the client hands off buffers of its own, one per
+ * ring slot, and the free queue must initially be empty. Downstream threads must Reset()
+ * a buffer after consuming it and return it to the free queue, after which its slot is
+ * reused by the server. Slots are released in order, so a buffer that is held for long
+ * stalls the ring. Modifying a buffer modifies the ring slot. Buffers may not be used
+ * after the client is closed.
+ */
+class RingClient : public Client {
+ public:
+  ~RingClient();
+
+  /**
+   * \brief Create a client that hands off ring slots through queues.
+   * \param[in]  options The options for this client.
+   * \param[in]  free    The queue of buffers returned by downstream threads.
+   * \param[in]  filled  The queue of buffers that contain JSONs.
+   * \param[out] out     The RingClient object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const RingClientOptions& options, JSONBufferQueue* free,
+                     JSONBufferQueue* filled, RingClient* out) -> Status;
+
+  auto ReceiveJSONs(LatencyTracker* lat_tracker = nullptr) -> Status override;
+  auto Close() -> Status override;
+  [[nodiscard]] auto jsons_received() const -> size_t override { return jsons_received_; }
+  [[nodiscard]] auto bytes_received() const -> size_t override { return bytes_received_; }
+
+ private:
+  /// Mark the slot of a returned buffer as released, and release the ring up to the
+  /// first slot that is still handed off.
+  void Reclaim(JSONBuffer* buf);
+
+  /// The ring.
+  ShmRing ring;
+  /// The queue of returned buffers.
+  JSONBufferQueue* free_queue = nullptr;
+  /// The queue of filled buffers.
+  JSONBufferQueue* filled_queue = nullptr;
+  /// A buffer for every ring slot.
+  std::vector<JSONBuffer> slots;
+  /// Whether the buffer of every ring slot was returned.
+  std::vector<bool> returned;
+  /// The position of the next slot to read.
+  uint64_t read = 0;
+  /// The position of the first slot that is not released.
+  uint64_t released = 0;
+  /// Whether the client must be closed.
+  bool must_be_closed = false;
+  /// The next available sequence number.
+  Seq seq = 0;
+  /// Whether the server fills in send stamps.
+  bool send_stamps = false;
+  /// The CPUs to pin the reading thread to.
+  CpuSet cpus;
+  /// The number of read JSONs.
+  size_t jsons_received_ = 0;
+  /// The number of read bytes.
+  size_t bytes_received_ = 0;
+};
+
+}  // namespace illex
@@ -19,6 +19,7 @@
 #include <random>
 #include <utility>
 
+#include "illex/random.h"
 #include "illex/value.h"
 
 namespace illex {
@@ -33,13 +34,16 @@ struct GenerateOptions {
   explicit GenerateOptions(int seed) : seed(seed) {}
   /// The seed used in pseudo-random generators.
   int seed;
+  /// The algorithm of the random engine.
+  RandomAlgorithm algorithm = RandomAlgorithm::Xoshiro256pp;
 };
 
 /// \brief Allows the generation of a JSON DOM root.
 class DocumentGenerator {
  public:
   /// \brief Construct a new DocumentGenerator, and feed the random engine with a seed.
-  explicit DocumentGenerator(int seed);
+  explicit DocumentGenerator(int seed,
+                             RandomAlgorithm algorithm = RandomAlgorithm::Xoshiro256pp);
   /// \brief Set a new root value generator.
   void SetRoot(std::shared_ptr<Value> root);
 
@@ -49,6 +53,19 @@ class DocumentGenerator {
   /// \brief Generate a root value.
   auto Get() -> rj::Value;
 
+  /// \brief Generate a root value directly into a writer, without building a DOM.
+  void Write(Writer* writer);
+
+  /**
+   * \brief Reseed the random engine for the JSON with some index.
+   *
+   * After this, the next JSON is a pure function of the seed and the index, regardless
+   * of the JSONs generated before.
+   *
+   * \param index The index of the next JSON.
+   */
+  void Seek(uint64_t index);
+
   /// \brief Generate a JSON into a raw JSON string. Pretty printed when pretty is true.
   auto GetString(bool pretty = false) -> std::string;
 
@@ -58,6 +75,8 @@ class DocumentGenerator {
  protected:
   /// A placeholder for a rapidjson Document. Used to obtain an allocator.
   rj::Document doc_;
+  /// The seed of the random engine.
+  uint64_t seed_;
   /// The random engine used by child generators.
   RandomEngine engine_;
   /// The context pointing to the rapidjson document allocator and random engine.
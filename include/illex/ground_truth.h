@@ -0,0 +1,129 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <arrow/api.h>
+#include <rapidjson/document.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "illex/document.h"
+#include "illex/status.h"
+
+namespace illex {
+
+namespace rj = rapidjson;
+
+/// The default maximum number of rows of a ground truth record batch.
+constexpr size_t kDefaultGroundTruthRows = 64 * 1024;
+
+/**
+ * \brief Convert a date string generated by DateString to milliseconds since the epoch.
+ * \param[in]  str The date string, formatted as YYYY-MM-DDTHH:MM:SS+hh:00.
+ * \param[out] out The number of milliseconds since 1970-01-01T00:00:00 UTC.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+auto DateToMillis(std::string_view str, int64_t* out) -> Status;
+
+/**
+ * \brief Appends generated JSON values to the builders of Arrow record batches.
+ *
+ * The values are taken from the DOM of a generated JSON, before it is serialized, so the
+ * columns hold exactly the values of the JSON text without parsing it. Date strings are
+ * converted to milliseconds since the epoch. Members that are not in the schema, e.g.
+ * send stamps, are ignored.
+ */
+class RecordBatchAppender {
+ public:
+  /**
+   * \brief Create a new record batch appender.
+   * \param[in]  schema The schema the JSONs were generated from.
+   * \param[out] out    The appender to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Make(const std::shared_ptr<arrow::Schema>& schema,
+                   std::unique_ptr<RecordBatchAppender>* out) -> Status;
+
+  /**
+   * \brief Append a JSON object as a row.
+   * \param json The root value of the JSON, generated from the schema.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  auto Append(const rj::Value& json) -> Status;
+
+  /**
+   * \brief Turn all appended rows into a record batch, and start a new one.
+   * \param[out] out The record batch.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  auto Flush(std::shared_ptr<arrow::RecordBatch>* out) -> Status;
+
+  /// \brief Return the number of rows appended since the last flush.
+  [[nodiscard]] auto num_rows() const -> size_t { return num_rows_; }
+
+ private:
+  RecordBatchAppender() = default;
+
+  /// The schema.
+  std::shared_ptr<arrow::Schema> schema_;
+  /// The builders of all columns.
+  std::unique_ptr<arrow::RecordBatchBuilder> builder_;
+  /// The number of rows appended since the last flush.
+  size_t num_rows_ = 0;
+};
+
+/// Options for generating the columnar ground truth of a range of JSONs.
+struct GroundTruthOptions {
+  /// Random generation options, the same as those of the JSONs.
+  GenerateOptions gen;
+  /// The Arrow schema the JSONs are based on.
+  std::shared_ptr<arrow::Schema> schema = nullptr;
+  /// The number of JSONs.
+  size_t num_jsons = 0;
+  /// The index of the first JSON.
+  size_t first_json = 0;
+  /// The maximum number of rows of a record batch.
+  size_t max_rows = kDefaultGroundTruthRows;
+};
+
+/**
+ * \brief Generate the columnar ground truth of deterministically generated JSONs.
+ *
+ * Every JSON is generated again from the seed and its index, like in the deterministic
+ * mode of the producer and the pull generator, and appended as a row. The rows are in
+ * order of the JSON indices.
+ *
+ * \param[in]  opts The options.
+ * \param[out] out  The record batches, which are appended to.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+auto GenerateGroundTruth(const GroundTruthOptions& opts,
+                         std::vector<std::shared_ptr<arrow::RecordBatch>>* out)
+    -> Status;
+
+/**
+ * \brief Generate the columnar ground truth of JSONs into an Arrow IPC file.
+ * \param opts The options.
+ * \param path The path of the file.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+auto WriteGroundTruth(const GroundTruthOptions& opts, const std::string& path)
+    -> Status;
+
+}  // namespace illex
@@ -14,8 +14,17 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "illex/status.h"
 
@@ -24,12 +33,293 @@ namespace illex {
 using Timer = std::chrono::steady_clock;
 using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
 
+/**
+ * \brief A histogram of durations in nanoseconds, with logarithmically sized buckets.
+ *
+ * Like an HDR histogram, every power of two is divided into a fixed number of linear
+ * sub-buckets, so every recorded value is known with a relative error of at most
+ * 1 / kSubBuckets, from one nanosecond up to the full range of 64-bit values, in a
+ * fixed amount of memory.
+ */
+class LatencyHistogram {
+ public:
+  /// The number of bits of precision of a bucket.
+  static constexpr size_t kSubBucketBits = 7;
+  /// The number of buckets per power of two.
+  static constexpr size_t kSubBuckets = size_t{1} << kSubBucketBits;
+  /// The total number of buckets.
+  static constexpr size_t kNumBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+  LatencyHistogram() : counts_(kNumBuckets, 0) {}
+
+  /// \brief Return the index of the bucket holding a value.
+  static inline auto BucketIndex(uint64_t value) -> size_t {
+    if (value < kSubBuckets) {
+      return value;
+    }
+    const size_t shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+    return ((shift + 1) << kSubBucketBits) + ((value >> shift) - kSubBuckets);
+  }
+
+  /// \brief Return the lowest value in a bucket.
+  static inline auto BucketLowest(size_t index) -> uint64_t {
+    if (index < kSubBuckets) {
+      return index;
+    }
+    const size_t shift = (index >> kSubBucketBits) - 1;
+    return static_cast<uint64_t>((index & (kSubBuckets - 1)) + kSubBuckets) << shift;
+  }
+
+  /// \brief Return the highest value in a bucket.
+  static inline auto BucketHighest(size_t index) -> uint64_t {
+    const size_t shift = index < kSubBuckets ? 0 : (index >> kSubBucketBits) - 1;
+    return BucketLowest(index) + ((uint64_t{1} << shift) - 1);
+  }
+
+  /// \brief Record a duration in nanoseconds.
+  inline void Record(uint64_t nanoseconds) {
+    Add(BucketIndex(nanoseconds), 1, nanoseconds, nanoseconds, nanoseconds);
+  }
+
+  /// \brief Add all values recorded by another histogram.
+  void Merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      counts_[i] += other.counts_[i];
+    }
+    AddTotals(other.count_, other.sum_, other.min_, other.max_);
+  }
+
+  /**
+   * \brief Return a percentile of the recorded values.
+   *
+   * This returns the highest value that is equivalent to the value at the percentile,
+   * i.e. the highest value of its bucket, but never more than the maximum.
+   *
+   * \param percentile The percentile, in [0, 100].
+   * \return The value at the percentile in nanoseconds, or 0 if the histogram is empty.
+   */
+  [[nodiscard]] auto Percentile(double percentile) const -> uint64_t {
+    if (count_ == 0) {
+      return 0;
+    }
+    auto rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(count_));
+    rank = std::clamp<uint64_t>(rank, 1, count_);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::min(BucketHighest(i), max_);
+      }
+    }
+    return max_;
+  }
+
+  /// \brief Return the number of recorded values.
+  [[nodiscard]] auto count() const -> uint64_t { return count_; }
+  /// \brief Return the smallest recorded value, or 0 if the histogram is empty.
+  [[nodiscard]] auto min() const -> uint64_t { return count_ == 0 ? 0 : min_; }
+  /// \brief Return the largest recorded value.
+  [[nodiscard]] auto max() const -> uint64_t { return max_; }
+  /// \brief Return the mean of the recorded values.
+  [[nodiscard]] auto mean() const -> double {
+    return count_ == 0 ? 0.0 : static_cast<double>(sum_) / static_cast<double>(count_);
+  }
+  /// \brief Return the number of values recorded in a bucket.
+  [[nodiscard]] auto bucket_count(size_t index) const -> uint64_t {
+    return counts_[index];
+  }
+
+ private:
+  friend class LatencyRecorder;
+
+  /// Add values to a bucket, and update the totals.
+  inline void Add(size_t index, uint64_t count, uint64_t sum, uint64_t min,
+                  uint64_t max) {
+    counts_[index] += count;
+    AddTotals(count, sum, min, max);
+  }
+
+  /// Update the totals.
+  inline void AddTotals(uint64_t count, uint64_t sum, uint64_t min, uint64_t max) {
+    if (count == 0) {
+      return;
+    }
+    count_ += count;
+    sum_ += sum;
+    min_ = std::min(min_, min);
+    max_ = std::max(max_, max);
+  }
+
+  /// The number of values per bucket.
+  std::vector<uint64_t> counts_;
+  /// The number of values.
+  uint64_t count_ = 0;
+  /// The sum of all values.
+  uint64_t sum_ = 0;
+  /// The smallest value.
+  uint64_t min_ = UINT64_MAX;
+  /// The largest value.
+  uint64_t max_ = 0;
+};
+
+/**
+ * \brief Records durations of a number of stages into histograms, from many threads.
+ *
+ * Every thread records into histograms of its own, without locks or atomic
+ * read-modify-write operations. A snapshot merges the histograms of all threads on
+ * demand, and may be taken while threads keep recording. Memory use is fixed per
+ * recording thread, so this is suitable for recording indefinitely.
+ */
+class LatencyRecorder {
+ public:
+  /// \brief Construct a recorder for some number of stages.
+  explicit LatencyRecorder(size_t num_stages) : num_stages_(num_stages), id_(NextId()) {}
+
+  /// \brief Record a duration in nanoseconds of a stage.
+  inline void Record(size_t stage, uint64_t nanoseconds) {
+    assert(stage < num_stages_);
+    LocalShard()->Record(stage, nanoseconds);
+  }
+
+  /// \brief Record the duration between two time points of a stage.
+  inline void Record(size_t stage, TimePoint start, TimePoint end) {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    Record(stage, ns > 0 ? static_cast<uint64_t>(ns) : 0);
+  }
+
+  /// \brief Return the merged histogram of a stage over all threads.
+  [[nodiscard]] auto Snapshot(size_t stage) const -> LatencyHistogram {
+    assert(stage < num_stages_);
+    LatencyHistogram result;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& shard : shards_) {
+      shard->AddTo(stage, &result);
+    }
+    return result;
+  }
+
+  /// \brief Print the count, mean, and p50, p99, p99.9 and max per stage, in us.
+  void Print(std::ostream* out) const {
+    *out << "stage,count,mean,p50,p99,p99.9,max\n";
+    for (size_t s = 0; s < num_stages_; s++) {
+      auto h = Snapshot(s);
+      *out << s << "," << h.count() << "," << h.mean() * 1E-3 << ","
+           << h.Percentile(50.0) * 1E-3 << "," << h.Percentile(99.0) * 1E-3 << ","
+           << h.Percentile(99.9) * 1E-3 << "," << h.max() * 1E-3 << "\n";
+    }
+  }
+
+  /// \brief Dump the non-empty buckets of all stages, with their lowest value in ns.
+  void Dump(std::ostream* out) const {
+    *out << "stage,lowest,count\n";
+    for (size_t s = 0; s < num_stages_; s++) {
+      auto h = Snapshot(s);
+      for (size_t i = 0; i < LatencyHistogram::kNumBuckets; i++) {
+        if (h.bucket_count(i) > 0) {
+          *out << s << "," << LatencyHistogram::BucketLowest(i) << ","
+               << h.bucket_count(i) << "\n";
+        }
+      }
+    }
+  }
+
+  /// \brief Return the number of stages.
+  [[nodiscard]] auto num_stages() const -> size_t { return num_stages_; }
+
+ private:
+  /// Counters of a single recording thread. Only that thread writes to them.
+  struct Shard {
+    explicit Shard(size_t num_stages)
+        : counts(new std::atomic<uint64_t>[num_stages * LatencyHistogram::kNumBuckets]()),
+          totals(new std::atomic<uint64_t>[num_stages * kNumTotals]()) {
+      for (size_t s = 0; s < num_stages; s++) {
+        totals[s * kNumTotals + kMin] = UINT64_MAX;
+      }
+    }
+
+    /// Increment a counter. There is a single writer, so no read-modify-write is used.
+    static inline void Bump(std::atomic<uint64_t>* counter, uint64_t value) {
+      counter->store(counter->load(std::memory_order_relaxed) + value,
+                     std::memory_order_relaxed);
+    }
+
+    inline void Record(size_t stage, uint64_t value) {
+      Bump(&counts[stage * LatencyHistogram::kNumBuckets +
+                   LatencyHistogram::BucketIndex(value)],
+           1);
+      auto* t = &totals[stage * kNumTotals];
+      Bump(&t[kCount], 1);
+      Bump(&t[kSum], value);
+      if (value < t[kMin].load(std::memory_order_relaxed)) {
+        t[kMin].store(value, std::memory_order_relaxed);
+      }
+      if (value > t[kMax].load(std::memory_order_relaxed)) {
+        t[kMax].store(value, std::memory_order_relaxed);
+      }
+    }
+
+    void AddTo(size_t stage, LatencyHistogram* out) const {
+      const auto* c = &counts[stage * LatencyHistogram::kNumBuckets];
+      for (size_t i = 0; i < LatencyHistogram::kNumBuckets; i++) {
+        out->counts_[i] += c[i].load(std::memory_order_relaxed);
+      }
+      const auto* t = &totals[stage * kNumTotals];
+      out->AddTotals(t[kCount].load(std::memory_order_relaxed),
+                     t[kSum].load(std::memory_order_relaxed),
+                     t[kMin].load(std::memory_order_relaxed),
+                     t[kMax].load(std::memory_order_relaxed));
+    }
+
+    /// Indices of the totals of a stage.
+    enum Total : size_t { kCount, kSum, kMin, kMax, kNumTotals };
+    /// Bucket counters of all stages.
+    std::unique_ptr<std::atomic<uint64_t>[]> counts;
+    /// Totals of all stages.
+    std::unique_ptr<std::atomic<uint64_t>[]> totals;
+  };
+
+  /// Return a unique id for a recorder, so threads can cache their shard.
+  static auto NextId() -> uint64_t {
+    static std::atomic<uint64_t> next_id = 1;
+    return next_id++;
+  }
+
+  /// Return the shard of the calling thread, creating it on first use.
+  inline auto LocalShard() -> Shard* {
+    thread_local uint64_t cached_id = 0;
+    thread_local Shard* cached_shard = nullptr;
+    if (cached_id != id_) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto& shard = by_thread_[std::this_thread::get_id()];
+      if (shard == nullptr) {
+        shards_.push_back(std::make_unique<Shard>(num_stages_));
+        shard = shards_.back().get();
+      }
+      cached_id = id_;
+      cached_shard = shard;
+    }
+    return cached_shard;
+  }
+
+  /// The number of stages.
+  size_t num_stages_;
+  /// The unique id of this recorder.
+  uint64_t id_;
+  /// Protects the shards.
+  mutable std::mutex mutex_;
+  /// The shards of all recording threads.
+  std::vector<std::unique_ptr<Shard>> shards_;
+  /// The shard of every recording thread.
+  std::unordered_map<std::thread::id, Shard*> by_thread_;
+};
+
 class LatencyTracker {
  public:
   LatencyTracker(size_t num_samples, size_t num_stages, size_t sample_interval)
       : num_samples_(num_samples),
         num_stages_(num_stages),
-        sample_interval_(sample_interval) {
+        sample_interval_(sample_interval),
+        seqs_(num_samples, kNoSeq) {
     // Allocate a contiguous buffer to store time points.
     points_ = new TimePoint[num_samples_ * num_stages_];
   }
@@ -50,6 +340,14 @@ class LatencyTracker {
    * around when sequence numbers divided by the sample interval exceeds the number of
    * samples.
    *
+   * Every sample is tagged with the sequence number it holds. The first time point of a
+   * newer sequence number clears the sample, and time points of an older sequence number
+   * that arrive after their sample was taken over are not put, so time points of
+   * different sequence numbers are never paired.
+   *
+   * If a recorder is attached and the time point of the previous stage of the sample was
+   * put, the interval between them is recorded as well.
+   *
    * This function is unsafe. When supplying an incorrect stage, it can write outside
    * internal buffer bounds.
    *
@@ -61,13 +359,31 @@ class LatencyTracker {
   inline auto Put(size_t seq, size_t stage, TimePoint value) -> bool {
     assert(stage < num_stages_);
     if (seq % sample_interval_ == 0) {
-      points_[((seq / sample_interval_) % num_samples_) * num_stages_ + stage] = value;
+      const size_t index = (seq / sample_interval_) % num_samples_;
+      auto* sample = &points_[index * num_stages_];
+      if (seqs_[index] != seq) {
+        if ((seqs_[index] != kNoSeq) && (seqs_[index] > seq)) {
+          return false;
+        }
+        std::fill(sample, sample + num_stages_, TimePoint());
+        seqs_[index] = seq;
+      }
+      sample[stage] = value;
+      if ((recorder_ != nullptr) && (stage > 0) && (sample[stage - 1] != TimePoint()) &&
+          (sample[stage - 1] <= value)) {
+        recorder_->Record(stage - 1, sample[stage - 1], value);
+      }
       return true;
     } else {
       return false;
     }
   }
 
+  /// \brief Return whether time points of a sequence number are stored.
+  [[nodiscard]] inline auto IsSampled(size_t seq) const -> bool {
+    return seq % sample_interval_ == 0;
+  }
+
   /**
    * \brief Returns a TimePoint from the latency tracker.
    *
@@ -105,11 +421,32 @@ class LatencyTracker {
   /// Return the number of samples.
   [[nodiscard]] inline auto num_samples() const -> size_t { return num_samples_; }
 
+  /**
+   * \brief Also record the intervals between stages in histograms.
+   *
+   * Unlike sampled time points, histograms are never overwritten, so they can be used for
+   * long-running measurements. The interval between stage s and s + 1 is recorded as
+   * stage s of the recorder.
+   *
+   * \param recorder The recorder with at least one stage less than this tracker, or
+   *                 nullptr to stop recording.
+   */
+  void SetRecorder(LatencyRecorder* recorder) {
+    assert((recorder == nullptr) || (recorder->num_stages() + 1 >= num_stages_));
+    recorder_ = recorder;
+  }
+
  private:
   size_t sample_interval_;
   size_t num_samples_;
   size_t num_stages_;
   TimePoint* points_;
+  /// The sequence number held by every sample.
+  std::vector<size_t> seqs_;
+  LatencyRecorder* recorder_ = nullptr;
+
+  /// Tag of a sample that holds no sequence number yet.
+  static constexpr size_t kNoSeq = SIZE_MAX;
 };
 
 }  // namespace illex
\ No newline at end of file
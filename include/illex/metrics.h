@@ -0,0 +1,230 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <kissnet.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "illex/status.h"
+
+namespace illex {
+
+/**
+ * \brief Counters of a running stream, that can be read while it runs.
+ *
+ * Producers, senders and clients add to these with relaxed atomic operations, so
+ * updating them is cheap and never blocks. Every component holding a pointer to the
+ * counters adds to them; a nullptr disables live metrics.
+ */
+struct LiveMetrics {
+  /// Number of JSONs produced.
+  std::atomic<uint64_t> jsons_produced = 0;
+  /// Number of bytes produced, before compression.
+  std::atomic<uint64_t> bytes_produced = 0;
+  /// Time producers were blocked on a full queue, in nanoseconds.
+  std::atomic<uint64_t> producer_blocked_ns = 0;
+  /// Number of JSONs sent.
+  std::atomic<uint64_t> jsons_sent = 0;
+  /// Number of bytes sent.
+  std::atomic<uint64_t> bytes_sent = 0;
+  /// Time senders were starved waiting for batches, in nanoseconds.
+  std::atomic<uint64_t> sender_starved_ns = 0;
+  /// Number of ready batches in the production queue, when a sender last took one.
+  std::atomic<uint64_t> queue_depth = 0;
+  /// Number of JSONs received.
+  std::atomic<uint64_t> jsons_received = 0;
+  /// Number of bytes received.
+  std::atomic<uint64_t> bytes_received = 0;
+  /// Time clients spent decompressing frames, in nanoseconds.
+  std::atomic<uint64_t> decompress_ns = 0;
+
+  /// \brief Add to a counter.
+  static inline void Add(std::atomic<uint64_t>* counter, uint64_t n) {
+    counter->fetch_add(n, std::memory_order_relaxed);
+  }
+
+  /// \brief Add a time in seconds to a counter of nanoseconds.
+  static inline void AddSeconds(std::atomic<uint64_t>* counter, double seconds) {
+    if (seconds > 0.0) {
+      Add(counter, static_cast<uint64_t>(seconds * 1E9));
+    }
+  }
+};
+
+/// A copy of the live counters at some point in time.
+struct MetricsSnapshot {
+  /// \brief Read all counters.
+  static auto Take(const LiveMetrics& live) -> MetricsSnapshot;
+
+  /// The time at which the counters were read.
+  std::chrono::steady_clock::time_point time;
+  /// Number of JSONs produced.
+  uint64_t jsons_produced = 0;
+  /// Number of bytes produced.
+  uint64_t bytes_produced = 0;
+  /// Time producers were blocked, in seconds.
+  double producer_blocked = 0.0;
+  /// Number of JSONs sent.
+  uint64_t jsons_sent = 0;
+  /// Number of bytes sent.
+  uint64_t bytes_sent = 0;
+  /// Time senders were starved, in seconds.
+  double sender_starved = 0.0;
+  /// Number of ready batches in the production queue.
+  uint64_t queue_depth = 0;
+  /// Number of JSONs received.
+  uint64_t jsons_received = 0;
+  /// Number of bytes received.
+  uint64_t bytes_received = 0;
+  /// Time clients spent decompressing frames, in seconds.
+  double decompress_time = 0.0;
+};
+
+/**
+ * \brief Rates of the live counters over the interval between two snapshots.
+ *
+ * Blocked and starved time are summed over all threads, so with multiple producers or
+ * senders they can exceed the length of the interval.
+ */
+struct MetricsInterval {
+  /// \brief Compute the rates between a snapshot and a later one.
+  static auto Between(const MetricsSnapshot& first, const MetricsSnapshot& last)
+      -> MetricsInterval;
+
+  /// The length of the interval in seconds.
+  double seconds = 0.0;
+  /// JSONs produced per second.
+  double jsons_produced_per_second = 0.0;
+  /// JSONs sent per second.
+  double jsons_sent_per_second = 0.0;
+  /// Bits sent per second.
+  double bits_sent_per_second = 0.0;
+  /// JSONs received per second.
+  double jsons_received_per_second = 0.0;
+  /// Bits received per second.
+  double bits_received_per_second = 0.0;
+  /// Fraction of the interval producers were blocked.
+  double producer_blocked = 0.0;
+  /// Fraction of the interval senders were starved.
+  double sender_starved = 0.0;
+  /// Number of ready batches in the production queue at the end of the interval.
+  uint64_t queue_depth = 0;
+
+  /// \brief Log the rates on a single line.
+  void Log() const;
+};
+
+/**
+ * \brief Format counters and rates in the Prometheus text exposition format.
+ * \param snapshot The counters.
+ * \param interval The rates of the last interval.
+ * \return The metrics, one sample per line.
+ */
+auto ToPrometheus(const MetricsSnapshot& snapshot, const MetricsInterval& interval)
+    -> std::string;
+
+/**
+ * \brief Format counters and rates as a JSON object.
+ * \param snapshot The counters.
+ * \param interval The rates of the last interval.
+ * \return The metrics, as a single JSON object of counters and rates.
+ */
+auto ToJSON(const MetricsSnapshot& snapshot, const MetricsInterval& interval)
+    -> std::string;
+
+/// Options for reporting live metrics.
+struct MetricsOptions {
+  /// The interval between logged reports in milliseconds, or 0 to not log reports.
+  size_t interval_ms = 0;
+  /**
+   * \brief The port of the HTTP endpoint exposing the metrics, or 0 for no endpoint.
+   *
+   * GET /metrics returns the Prometheus text format, GET /metrics.json returns JSON.
+   */
+  uint16_t port = 0;
+
+  /// \brief Return whether any reporting is enabled.
+  [[nodiscard]] auto enabled() const -> bool { return (interval_ms > 0) || (port > 0); }
+};
+
+/**
+ * \brief Periodically reports live metrics, and optionally serves them over HTTP.
+ *
+ * A reporter thread takes a snapshot every interval, and logs the rates since the
+ * previous one. Scrapes of the endpoint are served by another thread, with the current
+ * counters and the rates of the last complete interval. If only the endpoint is enabled,
+ * the rates are computed over intervals of kDefaultInterval without being logged.
+ */
+class MetricsReporter {
+ public:
+  /// The interval of the rates served by the endpoint, if reports are not logged.
+  static constexpr std::chrono::milliseconds kDefaultInterval{1000};
+
+  /**
+   * \brief Start reporting live metrics.
+   * \param[in]  options The reporting options.
+   * \param[in]  live    The counters to report, which must outlive the reporter.
+   * \param[out] out     The reporter, which stops when it is destructed.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Start(const MetricsOptions& options, const LiveMetrics* live,
+                    std::unique_ptr<MetricsReporter>* out) -> Status;
+
+  /// \brief Stop reporting, and wait for the reporting threads to finish.
+  void Stop();
+
+  ~MetricsReporter();
+
+ private:
+  /// The TCP socket.
+  using Socket = kissnet::socket<kissnet::protocol::tcp>;
+
+  MetricsReporter() = default;
+  /// Take a snapshot every interval, and log the rates since the previous one if enabled.
+  void ReportLoop(MetricsSnapshot previous);
+  /// Accept and serve scrapes of the endpoint until stopped.
+  void ServeLoop();
+  /// Respond to a single HTTP request.
+  void Serve(Socket* client);
+
+  /// The reporting options.
+  MetricsOptions options_;
+  /// The counters to report.
+  const LiveMetrics* live_ = nullptr;
+  /// The listening socket of the endpoint.
+  std::unique_ptr<Socket> socket_;
+  /// Whether to stop reporting.
+  bool stop_ = false;
+  /// Protects the stop flag and the last interval.
+  std::mutex mutex_;
+  /// Signals the reporter thread to stop.
+  std::condition_variable stopped_;
+  /// The rates of the last complete interval.
+  MetricsInterval last_;
+  /// The reporter thread.
+  std::thread reporter_;
+  /// The endpoint thread.
+  std::thread server_;
+};
+
+}  // namespace illex
@@ -0,0 +1,214 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <rapidjson/stringbuffer.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "illex/status.h"
+#include "illex/value.h"
+
+namespace illex {
+
+namespace rj = rapidjson;
+
+/// Operations of a generation plan.
+enum class OpCode : uint8_t {
+  Literal,         ///< Emit b bytes from offset a of the literal pool.
+  Bool,            ///< Emit a random boolean.
+  UInt64,          ///< Emit a random unsigned integer in [a, b].
+  Int64,           ///< Emit a random signed integer in [a, b], stored as two's complement.
+  String,          ///< Emit a random string with a length in [a, b].
+  Date,            ///< Emit a random date string using date generator a.
+  Pooled,          ///< Emit a random value from pool a.
+  BeginList,       ///< Begin a list with a random length in [a, b].
+  BeginFixedList,  ///< Begin a list with a fixed length of a.
+  EndList          ///< End a list item, repeat the list body while items remain.
+};
+
+/// A single operation of a generation plan.
+struct Op {
+  /// The operation code.
+  OpCode code;
+  /// First operand.
+  uint64_t a = 0;
+  /// Second operand.
+  uint64_t b = 0;
+  /**
+   * \brief The index of a related op.
+   *
+   * For list begin ops this is the index of the matching end op, for list end ops this
+   * is the index of the first op of the list body.
+   */
+  size_t jump = 0;
+};
+
+/**
+ * \brief An output stream into a fixed region of memory, that spills once it is full.
+ *
+ * Plans generate JSONs without knowing their size up front. Once a Push() does not fit
+ * in the region, the bytes written since the last Mark() are moved into a spill buffer,
+ * and all following bytes go there as well, so the record that did not fit is kept in
+ * one piece.
+ */
+class RegionStream {
+ public:
+  typedef char Ch;
+
+  /// \brief Start writing at the start of a region, and clear the spill buffer.
+  void Reset(char* data, size_t capacity);
+
+  /// \brief Mark the start of a record.
+  inline void Mark() { mark_ = size_; }
+
+  /// \brief Reserve n bytes and return a pointer to them.
+  inline auto Push(size_t n) -> char* {
+    if (!spilling_ && (size_ + n <= capacity_)) {
+      char* result = data_ + size_;
+      size_ += n;
+      return result;
+    }
+    return Spill(n);
+  }
+
+  /// \brief Drop the last n bytes, which must have been reserved by the last Push().
+  inline void Pop(size_t n) {
+    if (spilling_) {
+      spill_.resize(spill_.size() - n);
+    } else {
+      size_ -= n;
+    }
+  }
+
+  /// \brief Write a single byte.
+  inline void Put(char c) { *Push(1) = c; }
+
+  /// \brief Return the number of bytes written to the region.
+  [[nodiscard]] auto size() const -> size_t { return size_; }
+
+  /// \brief Return whether the last record spilled.
+  [[nodiscard]] auto spilling() const -> bool { return spilling_; }
+
+  /// \brief Return the spilled bytes of the last record.
+  [[nodiscard]] auto spilled() const -> std::string_view { return spill_; }
+
+ private:
+  /// Move the current record into the spill buffer, and reserve n bytes there.
+  auto Spill(size_t n) -> char*;
+
+  /// The region.
+  char* data_ = nullptr;
+  /// The capacity of the region.
+  size_t capacity_ = 0;
+  /// The number of bytes written to the region.
+  size_t size_ = 0;
+  /// The offset of the current record in the region.
+  size_t mark_ = 0;
+  /// Whether the current record is written to the spill buffer.
+  bool spilling_ = false;
+  /// The spilled bytes of the current record.
+  std::string spill_;
+};
+
+/**
+ * \brief A generator tree lowered into a flat, devirtualized sequence of operations.
+ *
+ * A plan is run by a single interpreter loop. Structs are flattened into the sequence,
+ * and lists are handled with an explicit stack of item counters, so no recursion or
+ * virtual calls take place while generating. For the same random engine state, a plan
+ * generates exactly the same JSON as the generator tree it was compiled from.
+ */
+class Plan {
+ public:
+  /**
+   * \brief Compile a value generator tree into a plan.
+   * \param[in]  root The root of the value generator tree.
+   * \param[out] out  The plan to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Compile(const Value& root, Plan* out) -> Status;
+
+  /**
+   * \brief Generate a JSON according to this plan.
+   *
+   * Instantiated for rapidjson string buffers and region streams.
+   *
+   * \param engine The random engine to draw from.
+   * \param out    The buffer to append the JSON to.
+   */
+  template <typename Stream>
+  void Write(RandomEngine* engine, Stream* out);
+
+  /**
+   * \brief Append an op emitting constant bytes.
+   *
+   * Consecutive constants are coalesced into a single fragment in the literal pool, so
+   * e.g. the end of an object and the key of the next member are copied at once.
+   *
+   * \param bytes The bytes to emit.
+   */
+  void AddLiteral(std::string_view bytes);
+  /// \brief Append an op and return its index.
+  auto AddOp(Op op) -> size_t;
+  /// \brief Append a date generator to use in Date ops, and return its index.
+  auto AddDate(const DateString& date) -> size_t;
+  /// \brief Append the values of a pool to use in Pooled ops, and return its index.
+  auto AddPool(const Pool& pool) -> size_t;
+  /// \brief Begin a list. Returns the index of the begin op to pass to EndList.
+  auto BeginList(OpCode code, uint64_t a, uint64_t b = 0) -> size_t;
+  /// \brief End the list that was started with the begin op at index begin.
+  void EndList(size_t begin);
+
+  /// \brief Return the bytes that a Literal op emits.
+  [[nodiscard]] auto literal(const Op& op) const -> std::string_view;
+
+  /// \brief Return the ops of this plan.
+  [[nodiscard]] auto ops() const -> const std::vector<Op>& { return ops_; }
+
+  /// \brief Return the maximum list nesting depth of this plan.
+  [[nodiscard]] auto max_depth() const -> size_t { return max_depth_; }
+
+ private:
+  /// The values of a pool, of which the serialized bytes are in the literal pool.
+  struct PoolValues {
+    /// The offset of the first value in the literal pool.
+    size_t base;
+    /// The offsets of the values relative to the base, followed by their total size.
+    std::vector<size_t> offsets;
+    /// The distribution to pick values with.
+    ZipfDistribution dist;
+  };
+
+  /// The sequence of operations.
+  std::vector<Op> ops_;
+  /// Storage for all literal bytes.
+  std::string literals_;
+  /// Date generators referred to by Date ops.
+  std::vector<DateString> dates_;
+  /// Pools referred to by Pooled ops.
+  std::vector<PoolValues> pools_;
+  /// Remaining list items per nesting level, reused between runs.
+  std::vector<size_t> counters_;
+  /// The current list nesting depth while compiling.
+  size_t depth_ = 0;
+  /// The maximum list nesting depth.
+  size_t max_depth_ = 0;
+};
+
+}  // namespace illex
@@ -14,16 +14,241 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <kissnet.hpp>
+#include <string_view>
 #include <variant>
 
 namespace illex {
 
+/// How JSONs are delimited in a stream.
+enum class Framing {
+  /// JSONs are delimited by newlines, which clients scan for.
+  Newline,
+  /// Batches of JSONs are preceded by a frame header with the length of every JSON.
+  Length
+};
+
+/// Compression of the JSONs in a stream.
+enum class Compression {
+  None,  ///< JSONs are sent as plain text.
+  LZ4,   ///< The JSONs of every frame are compressed with LZ4, in the LZ4 frame format.
+  Zstd   ///< The JSONs of every frame are compressed with Zstandard.
+};
+
+/**
+ * \brief Parse the name of a compression codec.
+ * \param[in]  name The name, one of none, lz4 or zstd.
+ * \param[out] out  The compression.
+ * \return True if the name is known, false otherwise.
+ */
+inline auto ParseCompression(std::string_view name, Compression* out) -> bool {
+  if (name == "none") {
+    *out = Compression::None;
+  } else if (name == "lz4") {
+    *out = Compression::LZ4;
+  } else if (name == "zstd") {
+    *out = Compression::Zstd;
+  } else {
+    return false;
+  }
+  return true;
+}
+
 /// Protocol options for the raw streaming client/server
 struct Protocol {
-  // This protocol has no options.
+  /// How JSONs are delimited in the stream.
+  Framing framing = Framing::Newline;
+  /// Compression of the JSONs. Requires length framing.
+  Compression compression = Compression::None;
+};
+
+/**
+ * \brief Length-prefixed frames.
+ *
+ * With length framing, every batch of JSONs is sent as a frame, consisting of a header,
+ * the length of every JSON as a 32-bit unsigned integer, and the JSONs themselves:
+ *
+ *   | magic | num_jsons | length | seq | length of JSON 0 | ... | JSON 0 | JSON 1 | ...
+ *
+ * All integers are in the byte order of the host, as framing is meant for clients on
+ * similar machines. Every JSON is followed by a single whitespace character, which is
+ * included in its length, so clients can hand off records without scanning them, and
+ * JSONs may contain newlines, e.g. when pretty-printed.
+ *
+ * In a compressed frame, the JSONs are compressed as a whole, and the lengths still
+ * refer to the decompressed JSONs. Compressed frames have their own magic number, so
+ * clients can tell them apart.
+ */
+namespace frame {
+
+/// Marks the start of a frame.
+constexpr uint32_t kMagic = 0x4d415246;  // "FRAM"
+/// Marks the start of a compressed frame.
+constexpr uint32_t kCompressedMagic = 0x5a415246;  // "FRAZ"
+
+/// The header of a frame.
+struct Header {
+  /// Must be kMagic.
+  uint32_t magic;
+  /// The number of JSONs in the frame.
+  uint32_t num_jsons;
+  /// The number of bytes of all JSONs in the frame, excluding the header and lengths.
+  uint64_t length;
+  /// The sequence number of the first JSON in the frame.
+  uint64_t seq;
+  /// The number of bytes of all JSONs as sent, i.e. after compression.
+  uint64_t wire_length;
 };
 
+static_assert(sizeof(Header) == 32, "Frame header must not be padded.");
+
+/// \brief Return the number of bytes before the JSONs of a frame with some JSONs.
+inline auto Size(size_t num_jsons) -> size_t {
+  return sizeof(Header) + num_jsons * sizeof(uint32_t);
+}
+
+/**
+ * \brief Write the header and lengths of a frame.
+ * \param out       The start of the frame, with room for Size(num_jsons) bytes.
+ * \param lengths   The length of every JSON, including its whitespace.
+ * \param num_jsons The number of JSONs.
+ * \param seq       The sequence number of the first JSON.
+ */
+inline void Write(char* out, const uint32_t* lengths, size_t num_jsons, uint64_t seq) {
+  Header header{kMagic, static_cast<uint32_t>(num_jsons), 0, seq, 0};
+  for (size_t i = 0; i < num_jsons; i++) {
+    header.length += lengths[i];
+  }
+  header.wire_length = header.length;
+  std::memcpy(out, &header, sizeof(Header));
+  std::memcpy(out + sizeof(Header), lengths, num_jsons * sizeof(uint32_t));
+}
+
+/// \brief Fill in the sequence number of the first JSON of a frame.
+inline void WriteSeq(char* out, uint64_t seq) {
+  std::memcpy(out + offsetof(Header, seq), &seq, sizeof(seq));
+}
+
+/// \brief Mark a frame as compressed, with the number of bytes of the compressed JSONs.
+inline void WriteCompressed(char* out, uint64_t wire_length) {
+  std::memcpy(out + offsetof(Header, magic), &kCompressedMagic, sizeof(kCompressedMagic));
+  std::memcpy(out + offsetof(Header, wire_length), &wire_length, sizeof(wire_length));
+}
+
+/**
+ * \brief Check the lengths of the JSONs of a frame against its header.
+ * \param header  The frame header.
+ * \param lengths The lengths of the JSONs.
+ * \return True if the header is valid, and every JSON has its whitespace character.
+ */
+inline auto Valid(const Header& header, const uint32_t* lengths) -> bool {
+  if ((header.magic != kCompressedMagic) &&
+      ((header.magic != kMagic) || (header.wire_length != header.length))) {
+    return false;
+  }
+  uint64_t total = 0;
+  for (size_t i = 0; i < header.num_jsons; i++) {
+    if (lengths[i] == 0) {
+      return false;
+    }
+    total += lengths[i];
+  }
+  return total == header.length;
+}
+
+}  // namespace frame
+
+/**
+ * \brief Send stamps.
+ *
+ * A server can close every JSON object with a stamp of fixed size, holding the sequence
+ * number of the JSON in the stream and the time at which it was handed to the socket:
+ *
+ *   {..., "_illex_seq":                   8,"_illex_ts": 1601471000123456789}
+ *
+ * Both numbers are right-aligned and padded with spaces, so they can be filled in just
+ * before sending without moving any bytes, and the JSON remains valid at all times. The
+ * time is in nanoseconds since the epoch of the system clock. A time of 0 means the JSON
+ * was not stamped.
+ */
+namespace stamp {
+
+/// The key of the sequence number, including the separator of the previous member.
+constexpr std::string_view kSeqKey = ",\"_illex_seq\":";
+/// The key of the send time.
+constexpr std::string_view kTimeKey = ",\"_illex_ts\":";
+/// The width of the numbers.
+constexpr size_t kDigits = 20;
+/// The offset of the sequence number in the stamp.
+constexpr size_t kSeqOffset = kSeqKey.size();
+/// The offset of the send time in the stamp.
+constexpr size_t kTimeOffset = kSeqOffset + kDigits + kTimeKey.size();
+/// The size of a stamp, including the closing brace.
+constexpr size_t kSize = kTimeOffset + kDigits + 1;
+
+/// \brief Write a number right-aligned into a field of kDigits characters.
+inline void WriteNumber(char* field, uint64_t value) {
+  size_t i = kDigits;
+  do {
+    field[--i] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while ((value != 0) && (i > 0));
+  while (i > 0) {
+    field[--i] = ' ';
+  }
+}
+
+/// \brief Write an empty stamp, with a sequence number and time of 0.
+inline void WriteEmpty(char* out) {
+  kSeqKey.copy(out, kSeqKey.size());
+  WriteNumber(out + kSeqOffset, 0);
+  kTimeKey.copy(out + kSeqOffset + kDigits, kTimeKey.size());
+  WriteNumber(out + kTimeOffset, 0);
+  out[kSize - 1] = '}';
+}
+
+/// Parse a number from a field of kDigits characters. Returns false if it is malformed.
+inline auto ParseNumber(const char* field, uint64_t* out) -> bool {
+  size_t i = 0;
+  while ((i < kDigits) && (field[i] == ' ')) {
+    i++;
+  }
+  if (i == kDigits) {
+    return false;
+  }
+  uint64_t value = 0;
+  for (; i < kDigits; i++) {
+    if ((field[i] < '0') || (field[i] > '9')) {
+      return false;
+    }
+    value = value * 10 + static_cast<uint64_t>(field[i] - '0');
+  }
+  *out = value;
+  return true;
+}
+
+/**
+ * \brief Parse the stamp at the end of a JSON.
+ * \param[in]  json The JSON, without trailing whitespace.
+ * \param[out] seq  The sequence number.
+ * \param[out] time The send time in nanoseconds since the system clock epoch.
+ * \return True if the JSON ends with a stamp, false otherwise.
+ */
+inline auto Parse(std::string_view json, uint64_t* seq, uint64_t* time) -> bool {
+  if (json.size() < kSize + 1) {
+    return false;
+  }
+  auto stamp = json.substr(json.size() - kSize);
+  return (stamp.back() == '}') && (stamp.substr(0, kSeqKey.size()) == kSeqKey) &&
+         (stamp.substr(kSeqOffset + kDigits, kTimeKey.size()) == kTimeKey) &&
+         ParseNumber(stamp.data() + kSeqOffset, seq) &&
+         ParseNumber(stamp.data() + kTimeOffset, time);
+}
+
+}  // namespace stamp
+
 }  // namespace illex
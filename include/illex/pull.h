@@ -0,0 +1,154 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <arrow/api.h>
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "illex/document.h"
+#include "illex/plan.h"
+#include "illex/status.h"
+
+namespace illex {
+
+/// Options for generating JSONs into caller-provided memory.
+struct PullOptions {
+  /// Random generation options.
+  GenerateOptions gen;
+  /// The Arrow schema to base the JSONs on.
+  std::shared_ptr<arrow::Schema> schema = nullptr;
+  /// The number of JSONs to generate in total, unlimited by default.
+  size_t num_jsons = std::numeric_limits<size_t>::max();
+  /// The whitespace character to insert after every JSON.
+  char whitespace_char = '\n';
+  /**
+   * \brief Whether every JSON is a pure function of the seed and its index.
+   *
+   * The generator is reseeded from the seed and the index of every JSON, like in the
+   * deterministic mode of the producer.
+   */
+  bool deterministic = false;
+  /// The index of the first JSON to generate, in deterministic mode.
+  size_t first_json = 0;
+};
+
+/**
+ * \brief Generates JSONs straight into memory provided by the caller.
+ *
+ * This allows consumers that link the library to fill their own buffers in place, without
+ * any production threads, queues or copies. Every JSON is followed by a whitespace
+ * character, and JSONs are never split across buffers. If the next JSON does not fit in
+ * a buffer, it is held back and written at the start of the next buffer.
+ */
+class PullGenerator {
+ public:
+  /**
+   * \brief Create a new pull generator.
+   *
+   * The generator tree must compile into a plan, see Plan::Compile().
+   *
+   * \param[in]  opts The options.
+   * \param[out] out  The pull generator to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Make(const PullOptions& opts, std::unique_ptr<PullGenerator>* out)
+      -> Status;
+
+  /**
+   * \brief Generate as many JSONs as fit into a buffer.
+   * \param[in]  dst           The buffer.
+   * \param[in]  capacity      The capacity of the buffer.
+   * \param[out] jsons_written The number of JSONs written.
+   * \param[out] bytes_written The number of bytes written, may be nullptr.
+   * \return Status::OK() if successful, or an error if a single JSON does not fit.
+   */
+  auto GenerateInto(std::byte* dst, size_t capacity, size_t* jsons_written,
+                    size_t* bytes_written = nullptr) -> Status;
+
+  /**
+   * \brief Start over with another seed and first JSON index.
+   *
+   * This drops any held back JSON, and generates the same JSONs as a new generator with
+   * this seed and first JSON index.
+   *
+   * \param seed       The seed.
+   * \param first_json The index of the first JSON, in deterministic mode.
+   */
+  void Reset(int seed, size_t first_json);
+
+  /// \brief Return whether all JSONs have been written.
+  [[nodiscard]] auto done() const -> bool;
+
+  /// \brief Return the number of JSONs written so far.
+  [[nodiscard]] auto num_jsons() const -> size_t { return num_written_; }
+
+ private:
+  explicit PullGenerator(const PullOptions& opts);
+
+  /// The options.
+  PullOptions opts_;
+  /// The current seed.
+  int seed_;
+  /// The index of the first JSON, in deterministic mode.
+  size_t first_json_;
+  /// The generator tree, which owns the random engine.
+  DocumentGenerator gen_;
+  /// The plan compiled from the generator tree.
+  Plan plan_;
+  /// The stream into the current buffer.
+  RegionStream stream_;
+  /// A JSON that did not fit in the previous buffer.
+  std::string held_;
+  /// The number of JSONs generated, including a held back JSON.
+  size_t num_generated_ = 0;
+  /// The number of JSONs written.
+  size_t num_written_ = 0;
+};
+
+/// A region of caller memory to fill with JSONs.
+struct Region {
+  /// The start of the region.
+  std::byte* data = nullptr;
+  /// The capacity of the region.
+  size_t capacity = 0;
+  /// The number of JSONs written to the region.
+  size_t num_jsons = 0;
+  /// The number of bytes written to the region.
+  size_t num_bytes = 0;
+};
+
+/**
+ * \brief Fill a number of regions with JSONs, in parallel.
+ *
+ * Every region is filled with as many JSONs as fit, up to the number of JSONs in the
+ * options, from a generator seeded with the seed plus the index of the region. In
+ * deterministic mode, the seed is kept, and every region starts at the index of its first
+ * JSON as if all regions were filled up to the number of JSONs instead, which must then
+ * be limited. Threads take regions in order, and reuse their generator for every region.
+ *
+ * \param[in]     opts        The options of every region.
+ * \param[in,out] regions     The regions, of which the written counts are set.
+ * \param[in]     num_threads The number of threads to fill the regions with.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+auto GenerateParallel(const PullOptions& opts, std::vector<Region>* regions,
+                      size_t num_threads) -> Status;
+
+}  // namespace illex
@@ -0,0 +1,169 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string_view>
+
+namespace illex {
+
+/// Algorithms of the random engine.
+enum class RandomAlgorithm {
+  /// xoshiro256++, see: https://prng.di.unimi.it/
+  Xoshiro256pp,
+  /// PCG64 with the XSL-RR output function, see: https://www.pcg-random.org/
+  PCG64,
+  /// wyrand, see: https://github.com/wangyi-fudan/wyhash
+  Wyrand,
+  /// std::ranlux48_base, the engine used by earlier versions.
+  Ranlux48
+};
+
+/**
+ * \brief Parse the name of a random algorithm.
+ * \param[in]  name The name, i.e. xoshiro256++, pcg64, wyrand or ranlux48.
+ * \param[out] out  The algorithm.
+ * \return True if the name is known, false otherwise.
+ */
+auto ParseRandomAlgorithm(std::string_view name, RandomAlgorithm* out) -> bool;
+
+/**
+ * \brief A random engine producing 64-bit values, with a choice of algorithms.
+ *
+ * The algorithm is selected at run time. Single draws branch on it, which is well
+ * predicted since it never changes. The bulk fill functions branch only once per call,
+ * so generators with many draws per value should prefer those.
+ *
+ * For the same seed and algorithm, all platforms produce the same values.
+ */
+class RandomEngine {
+ public:
+  using result_type = uint64_t;
+
+  /// \brief Construct a new random engine, and feed it with a seed.
+  explicit RandomEngine(uint64_t seed = 0,
+                        RandomAlgorithm algorithm = RandomAlgorithm::Xoshiro256pp);
+
+  /// \brief Reseed the engine.
+  void seed(uint64_t seed);
+
+  /**
+   * \brief Reseed the engine from a seed and a counter.
+   *
+   * Both are hashed into a new seed, so the state after this is a pure function of the
+   * seed and the counter, and unrelated to the states of neighbouring counters. This
+   * allows any thread to generate the values of any counter.
+   *
+   * \param seed    The seed.
+   * \param counter The counter.
+   */
+  void seed(uint64_t seed, uint64_t counter);
+
+  /// \brief Return the next random value.
+  inline auto operator()() -> uint64_t {
+    switch (algorithm_) {
+      case RandomAlgorithm::Xoshiro256pp:
+        return NextXoshiro();
+      case RandomAlgorithm::PCG64:
+        return NextPCG();
+      case RandomAlgorithm::Wyrand:
+        return NextWyrand();
+      case RandomAlgorithm::Ranlux48:
+        break;
+    }
+    return NextRanlux();
+  }
+
+  /**
+   * \brief Fill a buffer with random values.
+   * \param out The buffer.
+   * \param n   The number of values to write.
+   */
+  void Fill(uint64_t* out, size_t n);
+
+  /**
+   * \brief Fill a buffer with random characters in the range [lo, hi].
+   *
+   * Each random value is split into eight bytes, so this draws one value per eight
+   * characters. Every byte is mapped onto the range with a multiply-shift, which
+   * compilers vectorize.
+   *
+   * \param out The buffer.
+   * \param n   The number of characters to write.
+   * \param lo  The lowest character.
+   * \param hi  The highest character.
+   */
+  void FillChars(char* out, size_t n, char lo, char hi);
+
+  /// \brief Return the algorithm of this engine.
+  [[nodiscard]] auto algorithm() const -> RandomAlgorithm { return algorithm_; }
+
+  static constexpr auto min() -> uint64_t { return 0; }
+  static constexpr auto max() -> uint64_t { return std::numeric_limits<uint64_t>::max(); }
+
+ private:
+  static inline auto Rotl(uint64_t x, int k) -> uint64_t {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  inline auto NextXoshiro() -> uint64_t {
+    const uint64_t result = Rotl(s_[0] + s_[3], 23) + s_[0];
+    const uint64_t t = s_[1] << 17;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = Rotl(s_[3], 45);
+    return result;
+  }
+
+  inline auto NextPCG() -> uint64_t {
+    constexpr __uint128_t kMultiplier =
+        (static_cast<__uint128_t>(0x2360ED051FC65DA4ULL) << 64) | 0x4385DF649FCCF645ULL;
+    pcg_ = pcg_ * kMultiplier + pcg_inc_;
+    auto value = static_cast<uint64_t>(pcg_ >> 64) ^ static_cast<uint64_t>(pcg_);
+    auto rot = static_cast<int>(pcg_ >> 122);
+    return (value >> rot) | (value << ((64 - rot) & 63));
+  }
+
+  inline auto NextWyrand() -> uint64_t {
+    s_[0] += 0xA0761D6478BD642FULL;
+    auto product = static_cast<__uint128_t>(s_[0]) * (s_[0] ^ 0xE7037ED1A0B428DBULL);
+    return static_cast<uint64_t>(product >> 64) ^ static_cast<uint64_t>(product);
+  }
+
+  inline auto NextRanlux() -> uint64_t {
+    // Spread the 48 bits over the full width, so both high and low bits are random.
+    auto value = ranlux_();
+    return (value << 16) | (value >> 32);
+  }
+
+  /// The algorithm.
+  RandomAlgorithm algorithm_;
+  /// The state of xoshiro256++, of which wyrand uses the first word.
+  uint64_t s_[4] = {};
+  /// The state of PCG64.
+  __uint128_t pcg_ = 0;
+  /// The increment of PCG64.
+  __uint128_t pcg_inc_ = 0;
+  /// The state of ranlux48_base.
+  std::ranlux48_base ranlux_;
+};
+
+}  // namespace illex
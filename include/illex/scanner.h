@@ -0,0 +1,35 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace illex {
+
+/**
+ * \brief Find the offsets of all newline characters in a buffer, in a single pass.
+ *
+ * On x86-64, this uses AVX-512BW, AVX2 or SSE2, depending on what the CPU supports at
+ * run time. On ARM, NEON is used when available. Other platforms use a scalar fallback.
+ *
+ * \param[in]  data    The buffer to scan.
+ * \param[in]  size    The number of bytes to scan.
+ * \param[out] offsets The vector to append the offsets of the newlines to. Supply the
+ *                     same vector for multiple calls to reuse its allocation.
+ */
+void ScanNewlines(const std::byte* data, size_t size, std::vector<size_t>* offsets);
+
+}  // namespace illex
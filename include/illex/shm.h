@@ -0,0 +1,169 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "illex/status.h"
+
+namespace illex {
+
+/// The default number of slots of a shared-memory ring.
+constexpr size_t kDefaultRingSlots = 64;
+/// The default capacity of a single slot of a shared-memory ring.
+constexpr size_t kDefaultRingSlotSize = 1024 * 1024;
+/// How long a writer waits for the reader to release all slots after finishing.
+constexpr std::chrono::seconds kRingDrainTimeout(30);
+
+/// Options for a shared-memory ring.
+struct RingOptions {
+  /// The path of the ring file, on a memory-backed file system such as /dev/shm.
+  std::string path;
+  /// The number of slots in the ring.
+  size_t num_slots = kDefaultRingSlots;
+  /// The capacity of a single slot in bytes. Every JSON must fit in a slot.
+  size_t slot_size = kDefaultRingSlotSize;
+
+  /// \brief Return whether a ring should be used instead of TCP.
+  [[nodiscard]] auto enabled() const -> bool { return !path.empty(); }
+};
+
+/**
+ * \brief A single-producer, single-consumer ring of slots in a shared-memory file.
+ *
+ * The writer creates the ring file and copies newline-delimited JSONs into the slots.
+ * The reader maps the same file, and may hand off the slots it reads without copying
+ * them, as long as it releases them in order. Both sides communicate only through a
+ * write and a release cursor in the shared header, so no system calls are involved
+ * once the ring is mapped. A side waiting for the other polls the cursors, yielding at
+ * first and sleeping after a while.
+ *
+ * The writer removes the ring file when it is destructed. Mappings of the reader remain
+ * valid.
+ */
+class ShmRing {
+ public:
+  /**
+   * \brief Create a new ring file, replacing any file at the path, and map it.
+   * \param[in]  options The ring options.
+   * \param[out] out     The ShmRing object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(const RingOptions& options, ShmRing* out) -> Status;
+
+  /**
+   * \brief Map an existing ring file, to read from it.
+   * \param[in]  path The path of the ring file.
+   * \param[out] out  The ShmRing object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Open(const std::string& path, ShmRing* out) -> Status;
+
+  /**
+   * \brief Copy newline-delimited JSONs into the ring, waiting for free slots.
+   *
+   * Data that does not fit in a single slot is split after the last newline that does.
+   *
+   * \param data     The JSONs.
+   * \param shutdown Shutdown signal to stop waiting for free slots, may be nullptr.
+   * \return Status::OK() if successful, an error if a JSON does not fit in a slot.
+   */
+  auto Write(std::string_view data, const std::atomic<bool>* shutdown = nullptr)
+      -> Status;
+
+  /// \brief Signal the reader that no more slots will be written.
+  void Finish();
+
+  /**
+   * \brief Wait until the reader has released all written slots.
+   * \param timeout  The maximum time to wait.
+   * \param shutdown Shutdown signal to stop waiting, may be nullptr.
+   * \return True if all slots were released, false if the wait was cut short.
+   */
+  auto Drain(std::chrono::milliseconds timeout,
+             const std::atomic<bool>* shutdown = nullptr) -> bool;
+
+  /**
+   * \brief Wait until the slot at some position is written.
+   * \param position The position of the slot, counting all slots ever written.
+   * \return True if the slot was written, false if the writer has finished before it.
+   */
+  auto Wait(uint64_t position) -> bool;
+
+  /**
+   * \brief Release all slots before some position, so the writer can reuse them.
+   * \param position The position one past the last slot to release.
+   */
+  void Release(uint64_t position);
+
+  /// \brief Return a pointer to the data of the slot at some position.
+  [[nodiscard]] auto slot(uint64_t position) const -> std::byte*;
+
+  /// \brief Return the number of bytes written to the slot at some position.
+  [[nodiscard]] auto slot_length(uint64_t position) const -> size_t;
+
+  /// \brief Return the index of the slot at some position.
+  [[nodiscard]] auto slot_index(uint64_t position) const -> size_t {
+    return position % num_slots_;
+  }
+
+  /// \brief Return the number of slots written so far.
+  [[nodiscard]] auto written() const -> uint64_t;
+
+  /// \brief Return the number of slots in the ring.
+  [[nodiscard]] auto num_slots() const -> size_t { return num_slots_; }
+
+  /// \brief Return the capacity of a single slot.
+  [[nodiscard]] auto slot_size() const -> size_t { return slot_size_; }
+
+  ShmRing() = default;
+  ShmRing(const ShmRing&) = delete;
+  auto operator=(const ShmRing&) -> ShmRing& = delete;
+  ~ShmRing();
+
+ private:
+  struct Header;
+
+  /// Return the size of a ring file.
+  static auto FileSize(size_t num_slots, size_t slot_size) -> size_t;
+  /// Map a ring file.
+  auto Map(int fd, size_t size) -> Status;
+  /// Locate the slot lengths and slot data, using the geometry in the header.
+  void Locate();
+
+  /// The shared header with the cursors.
+  Header* header_ = nullptr;
+  /// The number of bytes written to every slot.
+  uint64_t* lengths_ = nullptr;
+  /// The data of the first slot.
+  std::byte* slots_ = nullptr;
+  /// The mapped ring file.
+  void* map_ = nullptr;
+  /// The size of the mapping.
+  size_t size_ = 0;
+  /// The number of slots.
+  size_t num_slots_ = 0;
+  /// The capacity of a slot.
+  size_t slot_size_ = 0;
+  /// The path of the ring file, if the ring file must be removed.
+  std::string owned_path_;
+};
+
+}  // namespace illex
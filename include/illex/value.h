@@ -15,20 +15,28 @@
 #pragma once
 
 #include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
 
 #include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <random>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <utility>
+#include <vector>
+
+#include "illex/random.h"
+#include "illex/status.h"
 
 namespace illex {
 
 namespace rj = rapidjson;
 
-// The random number engine we will use is a default subtract_with_carry_engine, since
-// this is documented to be the fastest engine.
-// See: https://en.cppreference.com/w/cpp/numeric/random
-using RandomEngine = std::ranlux48_base;
+class Plan;
 
 // Need to roll our own distributions, since the STL distributions give implementation
 // defined results and may differ between platforms.
@@ -47,9 +55,39 @@ class UniformIntDistribution {
 
   template <class G>
   auto operator()(G& gen) -> T {
-    auto gen_range = static_cast<double>(gen.max() - gen.min());
-    auto scale = (max_ - min_) / (gen_range + 1);
-    return min_ + static_cast<T>((gen() - gen.min()) * scale);
+    uint64_t bits = 0;
+    if constexpr ((G::min() == 0) && (G::max() == std::numeric_limits<uint64_t>::max())) {
+      bits = gen();
+    } else {
+      // Scale the draws of narrower generators onto 64 bits.
+      constexpr double kRange = static_cast<double>(G::max() - G::min()) + 1.0;
+      auto fraction = static_cast<double>(gen() - G::min()) / kRange;
+      bits = static_cast<uint64_t>(std::min(fraction * 0x1p64, 0x1p64 - 0x1p11));
+    }
+    return Split(&bits);
+  }
+
+  /**
+   * \brief Map random bits onto the range of this distribution, and keep the rest.
+   *
+   * The value is the high word of the product of the bits and the size of the range,
+   * which requires no division. The low word replaces the bits, so multiple values can be
+   * drawn from a single random number, as long as the product of their range sizes is
+   * far below 2^64.
+   *
+   * \param bits The random bits.
+   * \return The value.
+   */
+  auto Split(uint64_t* bits) const -> T {
+    // Unsigned arithmetic wraps, so this also yields the span of signed ranges.
+    const uint64_t span = static_cast<uint64_t>(max_) - static_cast<uint64_t>(min_);
+    if (span == std::numeric_limits<uint64_t>::max()) {
+      return static_cast<T>(*bits);
+    }
+    auto product = static_cast<__uint128_t>(*bits) * (span + 1);
+    *bits = static_cast<uint64_t>(product);
+    return static_cast<T>(static_cast<uint64_t>(min_) +
+                          static_cast<uint64_t>(product >> 64));
   }
 
   [[nodiscard]] auto min() const -> T { return min_; }
@@ -60,8 +98,45 @@ class UniformIntDistribution {
   T max_;
 };
 
+/**
+ * \brief A cross-platform distribution of indices in [0, n), uniform or Zipfian.
+ *
+ * With a skew s > 0, index i is drawn with a probability proportional to 1 / (i + 1)^s,
+ * through a binary search of a table of cumulative probabilities. With any other skew,
+ * e.g. 0, the indices are uniformly distributed, and no table is used.
+ */
+class ZipfDistribution {
+ public:
+  typedef size_t result_type;
+
+  explicit ZipfDistribution(size_t n = 1, double skew = 0.0);
+
+  template <class G>
+  auto operator()(G& gen) -> size_t {
+    if (cdf_.empty()) {
+      return uniform_(gen);
+    }
+    auto bits = UniformIntDistribution<uint64_t>()(gen);
+    return std::upper_bound(cdf_.begin(), cdf_.end(), bits) - cdf_.begin();
+  }
+
+  [[nodiscard]] auto n() const -> size_t { return uniform_.max() + 1; }
+  [[nodiscard]] auto skew() const -> double { return skew_; }
+
+ private:
+  /// The distribution of indices if there is no skew.
+  UniformIntDistribution<size_t> uniform_;
+  /// The Zipfian exponent.
+  double skew_;
+  /// The cumulative probabilities of all but the last index, scaled onto 64 bits.
+  std::vector<uint64_t> cdf_;
+};
+
 using Allocator = rj::Document::AllocatorType;
 
+/// The SAX-style writer that generators can emit values into directly.
+using Writer = rj::Writer<rj::StringBuffer>;
+
 /**
  * \brief Context for generators to operate in.
  */
@@ -79,6 +154,25 @@ class Value {
  public:
   /// \brief Returns a value from this generator.
   virtual auto Get() -> rj::Value = 0;
+  /**
+   * \brief Generate a value and emit it directly into a writer, without building a DOM.
+   *
+   * The default implementation falls back to Get(), so generators that do not override
+   * this still work, but pay for the DOM construction.
+   *
+   * \param writer The writer to emit the value into.
+   */
+  virtual void Write(Writer* writer);
+  /**
+   * \brief Lower this generator into a generation plan.
+   *
+   * The default implementation returns an error, so generators that do not override this
+   * cannot be compiled.
+   *
+   * \param plan The plan to append the operations of this generator to.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  [[nodiscard]] virtual auto Compile(Plan* plan) const -> Status;
   /// \brief Set the context for this generator.
   void SetContext(Context context);
 
@@ -92,6 +186,10 @@ class Null : public Value {
  public:
   /// \brief Returns a null value (always).
   auto Get() -> rj::Value override;
+  /// \brief Writes a null value (always).
+  void Write(Writer* writer) override;
+  /// \brief Lower this generator into a generation plan.
+  auto Compile(Plan* plan) const -> Status override;
 };
 
 /// \brief Boolean value generator.
@@ -99,6 +197,10 @@ class Bool : public Value {
  public:
   /// \brief Returns an either "true" or "false" value.
   auto Get() -> rj::Value override;
+  /// \brief Writes an either "true" or "false" value.
+  void Write(Writer* writer) override;
+  /// \brief Lower this generator into a generation plan.
+  auto Compile(Plan* plan) const -> Status override;
 };
 
 /// \brief Number value generator for integers.
@@ -118,11 +220,34 @@ class Int : public Value {
     return result;
   }
 
+  /// \brief Writes a numeric value representing an integer.
+  void Write(Writer* writer) override {
+    auto value = dist_(*context_.engine_);
+    if constexpr (std::is_signed_v<T>) {
+      writer->Int64(static_cast<int64_t>(value));
+    } else {
+      writer->Uint64(static_cast<uint64_t>(value));
+    }
+  }
+
+  /// \brief Lower this generator into a generation plan.
+  auto Compile(Plan* plan) const -> Status override;
+
  private:
   /// The distribution to pull from for integer generation.
   UniformIntDistribution<T> dist_;
 };
 
+// Int<T>::Compile is defined along with the plan, for all fixed-width integer types.
+extern template class Int<int8_t>;
+extern template class Int<int16_t>;
+extern template class Int<int32_t>;
+extern template class Int<int64_t>;
+extern template class Int<uint8_t>;
+extern template class Int<uint16_t>;
+extern template class Int<uint32_t>;
+extern template class Int<uint64_t>;
+
 /// \brief String value generator.
 struct String : public Value {
  public:
@@ -131,16 +256,23 @@ struct String : public Value {
 
   /// \brief Returns a string value with some random characters between a-z.
   auto Get() -> rj::Value override;
+  /// \brief Writes a string value with some random characters between a-z.
+  void Write(Writer* writer) override;
+  /// \brief Lower this generator into a generation plan.
+  auto Compile(Plan* plan) const -> Status override;
 
  private:
+  /// \brief Fill the scratch buffer with a new random string.
+  void Generate();
+
   /// Maximum length for generated stings.
   size_t length_max_;
   /// Minimum length for generated strings.
   size_t length_min_;
   /// The normal distribution to pull the length from.
   UniformIntDistribution<size_t> len_dist_;
-  /// The uniform distribution to pull characters from.
-  UniformIntDistribution<char> chars_dist_;
+  /// Scratch buffer for generated strings, reused to prevent allocations.
+  std::string buffer_;
 };
 
 /// \brief String value generator for ISO 8601-like date and time.
@@ -149,6 +281,24 @@ struct DateString : public Value {
   DateString();
   /// \brief Returns a string value formatted according to an ISO 8601 date and time.
   auto Get() -> rj::Value override;
+  /// \brief Writes a string value formatted according to an ISO 8601 date and time.
+  void Write(Writer* writer) override;
+  /// \brief Lower this generator into a generation plan.
+  auto Compile(Plan* plan) const -> Status override;
+
+  /// The maximum length of a formatted date string.
+  static constexpr size_t kMaxLength = 32;
+  /**
+   * \brief Format a random date and time into a character buffer.
+   *
+   * All fields are drawn from a single random number, and formatted without any
+   * formatting library.
+   *
+   * \param engine The random engine to draw from.
+   * \param out    A buffer of at least kMaxLength characters.
+   * \return The number of characters written.
+   */
+  auto Format(RandomEngine* engine, char* out) -> size_t;
 
  private:
   /// Year distribution.
@@ -167,12 +317,66 @@ struct DateString : public Value {
   UniformIntDistribution<int8_t> timezone;
 };
 
+/**
+ * \brief Value generator that picks values from a pool of pre-generated values.
+ *
+ * The pool is generated once, at construction, and every pooled value is serialized once.
+ * Writing a value then costs one random draw and a copy of its serialized bytes. Like in
+ * real data, values repeat, either uniformly or following a Zipfian distribution.
+ */
+class Pool : public Value {
+ public:
+  /**
+   * \brief Construct a new pool value generator.
+   *
+   * The pool is generated with a random engine of its own, so it does not depend on the
+   * context of this generator. This changes the context of the item generator, which is
+   * not used afterwards.
+   *
+   * \param item The generator of the pooled values.
+   * \param size The number of values in the pool, at least one.
+   * \param skew The Zipfian exponent, or 0 to pick values uniformly.
+   * \param seed The seed of the random engine to generate the pool with.
+   */
+  Pool(const std::shared_ptr<Value>& item, size_t size, double skew = 0.0,
+       uint64_t seed = 0);
+  /// \brief Returns a copy of a value picked from the pool.
+  auto Get() -> rj::Value override;
+  /// \brief Writes the serialized bytes of a value picked from the pool.
+  void Write(Writer* writer) override;
+  /// \brief Lower this generator into a generation plan.
+  auto Compile(Plan* plan) const -> Status override;
+
+  /// \brief Return the serialized values of the pool, back to back.
+  [[nodiscard]] auto serialized() const -> std::string_view { return serialized_; }
+  /// \brief Return the offset of every serialized value, followed by their total size.
+  [[nodiscard]] auto offsets() const -> const std::vector<size_t>& { return offsets_; }
+  /// \brief Return the distribution of the pool indices.
+  [[nodiscard]] auto distribution() const -> const ZipfDistribution& { return dist_; }
+
+ private:
+  /// The document owning the pooled values.
+  std::shared_ptr<rj::Document> doc_;
+  /// The pooled values.
+  std::vector<rj::Value> values_;
+  /// The serialized pooled values, back to back.
+  std::string serialized_;
+  /// The offsets of the serialized values, followed by their total size.
+  std::vector<size_t> offsets_;
+  /// The distribution to pick values with.
+  ZipfDistribution dist_;
+};
+
 /// \brief Array value generator for fixed-length arrays.
 struct FixedSizeArray : public Value {
   /// \brief Construct a FixedSizeArray generator with a given length and value generator.
   FixedSizeArray(size_t length, std::shared_ptr<Value> item_generator);
   /// \brief Return an array of fixed length with items generated through its value gen.
   auto Get() -> rj::Value override;
+  /// \brief Write an array of fixed length with items generated through its value gen.
+  void Write(Writer* writer) override;
+  /// \brief Lower this generator into a generation plan.
+  auto Compile(Plan* plan) const -> Status override;
 
  private:
   /// The generator for the array values.
@@ -188,6 +392,10 @@ struct Array : public Value {
                  size_t min_length = 0);
   /// \brief Return array of fixed length, with items generated through its value gen.
   auto Get() -> rj::Value override;
+  /// \brief Write array of random length, with items generated through its value gen.
+  void Write(Writer* writer) override;
+  /// \brief Lower this generator into a generation plan.
+  auto Compile(Plan* plan) const -> Status override;
 
  private:
   size_t min_length;
@@ -234,6 +442,12 @@ class Member {
    */
   void AddTo(rj::Value* object);
 
+  /**
+   * \brief Generate a member and write its key and value to the supplied writer.
+   * \param writer The writer to emit the member into. Must be inside an object.
+   */
+  void WriteTo(Writer* writer);
+
  protected:
   /// The context child generators must work in.
   Context context_;
@@ -252,8 +466,14 @@ class Object : public Value {
   explicit Object(const std::vector<Member>& members);
   /// \brief Returns an object, with members generated by its member generators.
   auto Get() -> rj::Value override;
+  /// \brief Writes an object, with members generated by its member generators.
+  void Write(Writer* writer) override;
+  /// \brief Lower this generator into a generation plan.
+  auto Compile(Plan* plan) const -> Status override;
   /// \brief Add a member generator to this object generator.
   void AddMember(Member member);
+  /// \brief Return the member generators of this object generator.
+  [[nodiscard]] auto members() const -> const std::vector<Member>& { return members_; }
 
  protected:
   /// The member generators of this object generator.
@@ -0,0 +1,115 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/affinity.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+
+namespace illex {
+
+/// Parse a decimal CPU number, of which the characters must all be digits.
+static auto ParseCpu(std::string_view str, size_t* out) -> bool {
+  if (str.empty()) {
+    return false;
+  }
+  size_t value = 0;
+  for (char c : str) {
+    if ((c < '0') || (c > '9')) {
+      return false;
+    }
+    value = value * 10 + (c - '0');
+  }
+  *out = value;
+  return true;
+}
+
+auto ParseCpuList(std::string_view list, CpuSet* out) -> Status {
+  CpuSet result;
+  while (!list.empty()) {
+    auto comma = list.find(',');
+    auto range = list.substr(0, comma);
+    list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+    // Allow a trailing newline, as in the files of the kernel.
+    while (!range.empty() && ((range.back() == '\n') || (range.back() == ' '))) {
+      range.remove_suffix(1);
+    }
+    size_t first = 0;
+    size_t last = 0;
+    auto dash = range.find('-');
+    bool valid = dash == std::string_view::npos
+                     ? ParseCpu(range, &first) && ParseCpu(range, &last)
+                     : ParseCpu(range.substr(0, dash), &first) &&
+                           ParseCpu(range.substr(dash + 1), &last);
+    if (!valid || (first > last) || (last >= CPU_SETSIZE)) {
+      return Status(Error::GenericError,
+                    "Invalid CPU range \"" + std::string(range) + "\" in CPU list.");
+    }
+    for (size_t cpu = first; cpu <= last; cpu++) {
+      result.push_back(cpu);
+    }
+  }
+  *out = std::move(result);
+  return Status::OK();
+}
+
+auto NodeCpus(size_t node, CpuSet* out) -> Status {
+  auto path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+  std::ifstream file(path);
+  std::string list;
+  if (!file.is_open() || !std::getline(file, list)) {
+    return Status(Error::IOError, "Unable to read CPUs of NUMA node from " + path);
+  }
+  return ParseCpuList(list, out);
+}
+
+auto ResolveCpuSet(std::string_view spec, CpuSet* out) -> Status {
+  constexpr std::string_view kNode = "node";
+  if (spec.substr(0, kNode.size()) == kNode) {
+    size_t node = 0;
+    if (!ParseCpu(spec.substr(kNode.size()), &node)) {
+      return Status(Error::GenericError,
+                    "Invalid NUMA node \"" + std::string(spec) + "\".");
+    }
+    return NodeCpus(node, out);
+  }
+  return ParseCpuList(spec, out);
+}
+
+auto PinThread(const CpuSet& cpus) -> Status {
+  if (cpus.empty()) {
+    return Status::OK();
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    if (cpu >= CPU_SETSIZE) {
+      return Status(Error::GenericError, "CPU " + std::to_string(cpu) + " out of range.");
+    }
+    CPU_SET(cpu, &set);
+  }
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    return Status(Error::GenericError,
+                  std::string("Unable to pin thread to CPUs: ") + std::strerror(err));
+  }
+  return Status::OK();
+}
+
+}  // namespace illex
@@ -18,6 +18,8 @@
 #include <arrow/io/api.h>
 #include <arrow/ipc/api.h>
 
+#include <cmath>
+
 #include "illex/log.h"
 #include "illex/status.h"
 #include "illex/value.h"
@@ -95,13 +97,47 @@ auto FieldAnalyzer::Visit(const arrow::BooleanType& type) -> arrow::Status {
   return arrow::Status::OK();
 }
 
+/// Hash a field name with FNV-1a, which gives the same result on every platform.
+static auto HashName(const std::string& name) -> uint64_t {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (char c : name) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+auto FieldAnalyzer::MaybePool(std::shared_ptr<Value> value) -> std::shared_ptr<Value> {
+  auto size = GetUInt64Meta(*field_, META(POOL_SIZE));
+  if (!size) {
+    return value;
+  }
+  if (*size == 0) {
+    spdlog::warn("While parsing field metadata of field {}", field_->name());
+    spdlog::warn("  Pool size must be at least 1.");
+    spdlog::warn("  Reverting to generating every value.");
+    return value;
+  }
+  auto skew = GetDoubleMeta(*field_, META(POOL_SKEW)).value_or(0.0);
+  if (skew < 0.0) {
+    spdlog::warn("While parsing field metadata of field {}", field_->name());
+    spdlog::warn("  Pool skew {} is negative.", skew);
+    spdlog::warn("  Reverting to picking values uniformly.");
+    skew = 0.0;
+  }
+  auto seed = GetUInt64Meta(*field_, META(POOL_SEED)).value_or(0);
+  // Mix in the field name, so fields with the same options get different pools.
+  RandomEngine engine;
+  engine.seed(seed, HashName(field_->name()));
+  return std::make_shared<Pool>(value, *size, skew, engine());
+}
+
 auto FieldAnalyzer::Visit(const arrow::StringType& type) -> arrow::Status {
-  member_out_->SetValue(std::make_shared<String>());
+  member_out_->SetValue(MaybePool(std::make_shared<String>()));
   return arrow::Status::OK();
 }
 
 auto FieldAnalyzer::Visit(const arrow::Date64Type& type) -> arrow::Status {
-  member_out_->SetValue(std::make_shared<DateString>());
+  member_out_->SetValue(MaybePool(std::make_shared<DateString>()));
   return arrow::Status::OK();
 }
 
@@ -172,12 +208,55 @@ auto ReadSchemaFromFile(const std::string& file, std::shared_ptr<arrow::Schema>*
 
   auto status = fis->Close();
 
+  return ValidateSchema(**out);
+}
+
+/// Check the generator metadata of a field and all of its children.
+static auto ValidateField(const arrow::Field& field) -> Status {
+  if (GetMeta(field, META(POOL_SKEW))) {
+    auto skew = GetDoubleMeta(field, META(POOL_SKEW));
+    if (!skew || (*skew < 0.0)) {
+      return Status(Error::GenericError, "Pool skew of field " + field.name() +
+                                             " must be a finite, non-negative number.");
+    }
+  }
+  for (const auto& child : field.type()->fields()) {
+    ILLEX_ROE(ValidateField(*child));
+  }
+  return Status::OK();
+}
+
+auto ValidateSchema(const arrow::Schema& schema) -> Status {
+  for (const auto& field : schema.fields()) {
+    ILLEX_ROE(ValidateField(*field));
+  }
+  return Status::OK();
+}
+
+auto MakeCodec(Compression compression, std::unique_ptr<arrow::util::Codec>* out)
+    -> Status {
+  arrow::Compression::type type;
+  switch (compression) {
+    case Compression::LZ4:
+      type = arrow::Compression::LZ4_FRAME;
+      break;
+    case Compression::Zstd:
+      type = arrow::Compression::ZSTD;
+      break;
+    default:
+      return Status(Error::GenericError, "No codec for uncompressed JSONs.");
+  }
+  auto codec = arrow::util::Codec::Create(type);
+  if (!codec.ok()) {
+    return Status(Error::GenericError, codec.status().message());
+  }
+  *out = codec.ValueOrDie();
   return Status::OK();
 }
 
 auto FromArrowSchema(const arrow::Schema& schema, GenerateOptions options)
     -> DocumentGenerator {
-  DocumentGenerator doc(options.seed);
+  DocumentGenerator doc(options.seed, options.algorithm);
   auto sa = SchemaAnalyzer(&doc);
   sa.Analyze(schema);
   return doc;
@@ -242,4 +321,34 @@ auto GetUInt64Meta(const arrow::Field& field, const std::string& key)
   }
 }
 
-}  // namespace illex
\ No newline at end of file
+auto GetDoubleMeta(const arrow::Field& field, const std::string& key)
+    -> std::optional<double> {
+  auto str = GetMeta(field, key);
+  if (!str) {
+    return std::nullopt;
+  }
+  double value = 0.0;
+  size_t parsed = 0;
+  try {
+    value = std::stod(str.value(), &parsed);
+  } catch (const std::logic_error& e) {
+    spdlog::warn("Metadata key {} set for field {}, but value {} is not a valid double.",
+                 key, field.name(), str.value());
+    return std::nullopt;
+  }
+  if (!std::isfinite(value)) {
+    spdlog::warn("Metadata key {} set for field {}, but value {} is not finite.", key,
+                 field.name(), str.value());
+    return std::nullopt;
+  }
+  // Warn if there is garbage at the end.
+  if (parsed != str.value().length()) {
+    spdlog::warn(
+        "Metadata key {} with value {} for field {} is parsed as {}, "
+        "but seems to contain additional garbage.",
+        key, field.name(), str.value(), value);
+  }
+  return value;
+}
+
+}  // namespace illex
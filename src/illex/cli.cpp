@@ -16,13 +16,14 @@
 
 #include "illex/arrow.h"
 #include "illex/file.h"
+#include "illex/random.h"
 #include "illex/status.h"
 
 namespace illex {
 
 /// \brief Common options for all subcommands
 static void AddCommonOpts(CLI::App* sub, ProducerOptions* prod,
-                          std::string* schema_file) {
+                          std::string* schema_file, std::string* rng, std::string* cpus) {
   sub->add_option("input,-i,--input", *schema_file,
                   "An Arrow schema to generate the JSON from.")
       ->required()
@@ -31,6 +32,18 @@ static void AddCommonOpts(CLI::App* sub, ProducerOptions* prod,
                   "Number of JSONs to produce (per batch, if applicable) (default=1).");
   sub->add_option("-s,--seed", prod->gen.seed,
                   "Random generator seed (default: taken from random device).");
+  sub->add_option("--rng", *rng,
+                  "Random engine: xoshiro256++, pcg64, wyrand or ranlux48 "
+                  "(default=xoshiro256++).");
+  sub->add_flag("--deterministic", prod->deterministic,
+                "Generate every JSON from the seed and its index only, so the same JSONs "
+                "are generated for any number of threads.");
+  sub->add_flag("--ordered", prod->ordered,
+                "Output batches in order when using multiple threads. Combined with "
+                "--deterministic, the output does not depend on the number of threads.");
+  sub->add_option("--reorder-window", prod->reorder_window,
+                  "Maximum number of batches that threads may run ahead in ordered mode "
+                  "(default: twice the number of threads).");
   sub->add_flag("--pretty", prod->pretty, "Generate \"pretty-printed\" JSONs.");
   sub->add_flag("-v", prod->verbose,
                 "Print the JSONs to stdout, even if -o or --output is used.");
@@ -38,11 +51,30 @@ static void AddCommonOpts(CLI::App* sub, ProducerOptions* prod,
                   "Number of threads to use to generate JSONs (default=1).");
   sub->add_flag("--batch", prod->batching, "Enable batching.");
   sub->add_option("-m", prod->num_batches, "Number of batches to produce.");
+  sub->add_option("--batch-bytes", prod->batch_bytes,
+                  "Close batches once they hold this many bytes, instead of after a "
+                  "fixed number of JSONs. The total number of JSONs is unchanged.");
+  sub->add_flag("--adaptive-batching", prod->adaptive_batching,
+                "Shrink byte-sized batches while consumers are starved, and grow them "
+                "back to --batch-bytes while the queue is full.");
+  sub->add_option("--queue-capacity", prod->queue_capacity,
+                  "Maximum number of produced batches waiting to be consumed (default=" +
+                      std::to_string(kDefaultProductionQueueCapacity) + ").")
+      ->check(CLI::PositiveNumber);
+  sub->add_option("--producer-cpus", *cpus,
+                  "Pin the production threads to a list of CPUs, e.g. 0-3,8, or to the "
+                  "CPUs of a NUMA node, e.g. node1.");
 }
 
 auto AppOptions::FromArguments(int argc, char* argv[], AppOptions* out) -> Status {
   AppOptions result;
   std::string schema_file;
+  std::string rng = "xoshiro256++";
+  bool broadcast = false;
+  bool framed = false;
+  std::string compression = "none";
+  std::string producer_cpus;
+  std::string sender_cpus;
 
   CLI::App app{std::string(AppOptions::name) + ": " + AppOptions::desc};
 
@@ -50,14 +82,25 @@ auto AppOptions::FromArguments(int argc, char* argv[], AppOptions* out) -> Statu
 
   // File mode:
   auto* file = app.add_subcommand("file", "Generate a file with JSONs.");
-  AddCommonOpts(file, &result.file.production, &schema_file);
+  AddCommonOpts(file, &result.file.production, &schema_file, &rng, &producer_cpus);
   file->add_option("-o,--output", result.file.out_path,
                    "Output file. JSONs will be written to stdout if not set.");
+  file->add_flag("--direct", result.file.writer.direct,
+                 "Write the output file with O_DIRECT, bypassing the page cache.");
+  file->add_option("--writers", result.file.writer.num_threads,
+                   "Number of threads writing to the output file concurrently.")
+      ->default_val(result.file.writer.num_threads);
+  file->add_flag("--shard", result.file.shard,
+                 "Write one output file per thread. The output path must contain an "
+                 "integer conversion for the shard index, e.g. out-%04d.jsonl.");
+  file->add_option("--arrow-output", result.file.arrow_path,
+                   "Also write the values of all JSONs as Arrow record batches to this "
+                   "Arrow IPC file. Implies --deterministic.");
 
   // Streaming server mode:
   auto* stream =
       app.add_subcommand("stream", "Stream raw JSONs over a TCP network socket.");
-  AddCommonOpts(stream, &result.stream.production, &schema_file);
+  AddCommonOpts(stream, &result.stream.production, &schema_file, &rng, &producer_cpus);
   stream->add_option("-p,--port", result.stream.server.port, "Port to listen on.")
       ->default_val(ILLEX_DEFAULT_PORT);
   stream
@@ -71,6 +114,60 @@ auto AppOptions::FromArguments(int argc, char* argv[], AppOptions* out) -> Statu
                    "(milliseconds).")
       ->default_val(250);
 
+  stream->add_option("--clients", result.stream.server.num_clients,
+                     "Number of clients to accept and stream to.")
+      ->default_val(1);
+  stream->add_flag(
+      "--broadcast", broadcast,
+      "Send the same JSONs to all clients, instead of a disjoint share to each client.");
+  stream->add_option("--rate-jsons", result.stream.server.pacing.jsons_per_second,
+                     "Pace the stream to this many JSONs per second.");
+  stream->add_option("--rate-bits", result.stream.server.pacing.bits_per_second,
+                     "Pace the stream to this many bits per second, e.g. 1e9.");
+  stream->add_option("--coalesce", result.stream.server.sender.max_coalesce,
+                     "Maximum number of ready batches to send with a single call.")
+      ->default_val(result.stream.server.sender.max_coalesce);
+  stream->add_flag("--zerocopy", result.stream.server.sender.zerocopy,
+                   "Send large batches using MSG_ZEROCOPY, if supported.");
+  stream->add_option("--stamp", result.stream.server.sender.stamp_interval,
+                     "Embed a sequence number and send time in every JSON whose sequence "
+                     "number is a multiple of this. All JSONs are extended with a stamp "
+                     "member.");
+  stream->add_flag("--pregenerate", result.stream.replay.pregenerate,
+                   "Generate all JSONs once before clients connect, and send the same "
+                   "JSONs on every repeat.");
+  stream->add_option("--replay", result.stream.replay.path,
+                     "Send the newline-delimited JSONs of this file, e.g. produced by "
+                     "illex file, on every repeat, instead of generating JSONs.");
+  stream->add_flag("--sendfile", result.stream.replay.sendfile,
+                   "Send replayed JSONs with sendfile(). Not supported with pacing.");
+  stream->add_flag("--framed", framed,
+                   "Precede every batch with a frame header holding the length of every "
+                   "JSON, so clients do not have to scan for newlines. Allows "
+                   "pretty-printed JSONs to be streamed.");
+  stream->add_option("--compress", compression,
+                     "Compress the JSONs of every batch on the production threads: none, "
+                     "lz4 or zstd (default=none). Implies --framed.");
+  stream->add_option("--ring", result.stream.server.ring.path,
+                     "Stream into a shared-memory ring file for a client on the same "
+                     "host, e.g. /dev/shm/illex, instead of over TCP.");
+  stream->add_option("--ring-slots", result.stream.server.ring.num_slots,
+                     "Number of slots of the shared-memory ring.")
+      ->default_val(result.stream.server.ring.num_slots);
+  stream->add_option("--ring-slot-size", result.stream.server.ring.slot_size,
+                     "Capacity of a slot of the shared-memory ring in bytes.")
+      ->default_val(result.stream.server.ring.slot_size);
+
+  stream->add_option("--sender-cpus", sender_cpus,
+                     "Pin the sender threads to a list of CPUs, e.g. 0-3,8, or to the "
+                     "CPUs of a NUMA node, e.g. node1.");
+  stream->add_option("--metrics-interval", result.stream.server.metrics.interval_ms,
+                     "Log the throughput, queue depth and blocked and starved time of "
+                     "every interval of this many milliseconds while streaming.");
+  stream->add_option("--metrics-port", result.stream.server.metrics.port,
+                     "Serve live metrics over HTTP on this port, in the Prometheus text "
+                     "format at /metrics and as JSON at /metrics.json.");
+
   // Attempt to parse the CLI arguments.
   try {
     app.parse(argc, argv);
@@ -82,6 +179,34 @@ auto AppOptions::FromArguments(int argc, char* argv[], AppOptions* out) -> Statu
     return Status(Error::CLIError, e.get_name() + ": " + e.what() + "\n" + app.help());
   }
 
+  RandomAlgorithm algorithm;
+  if (!ParseRandomAlgorithm(rng, &algorithm)) {
+    return Status(Error::CLIError, "Unknown random engine: " + rng);
+  }
+  result.file.production.gen.algorithm = algorithm;
+  result.stream.production.gen.algorithm = algorithm;
+
+  if (!producer_cpus.empty()) {
+    CpuSet cpus;
+    auto cpu_status = ResolveCpuSet(producer_cpus, &cpus);
+    if (!cpu_status.ok()) {
+      return Status(Error::CLIError, cpu_status.msg());
+    }
+    result.file.production.cpus = cpus;
+    result.stream.production.cpus = cpus;
+  }
+  if (!sender_cpus.empty()) {
+    auto cpu_status = ResolveCpuSet(sender_cpus, &result.stream.server.sender.cpus);
+    if (!cpu_status.ok()) {
+      return Status(Error::CLIError, cpu_status.msg());
+    }
+  }
+
+  auto* protocol = &result.stream.server.protocol;
+  if (!ParseCompression(compression, &protocol->compression)) {
+    return Status(Error::CLIError, "Unknown compression: " + compression);
+  }
+
   // Handle subcommands. All of them require to load a serialized Arrow schema, so we
   // can just return the status of attempting to load that.
   Status status;
@@ -90,6 +215,21 @@ auto AppOptions::FromArguments(int argc, char* argv[], AppOptions* out) -> Statu
     status = ReadSchemaFromFile(schema_file, &result.file.production.schema);
   } else if (stream->parsed()) {
     result.sub = SubCommand::STREAM;
+    if (broadcast) {
+      result.stream.server.fan_out = FanOut::Broadcast;
+    }
+    if (framed || (protocol->compression != Compression::None)) {
+      protocol->framing = Framing::Length;
+    }
+    result.stream.production.stamp = result.stream.server.sender.stamp_interval > 0;
+    const auto& replay = result.stream.replay;
+    if (result.stream.production.stamp &&
+        (!replay.path.empty() || replay.pregenerate || replay.sendfile)) {
+      // The same data is sent on every repeat, so it cannot hold fresh send stamps.
+      return Status(Error::CLIError,
+                    "--stamp cannot be combined with --replay, --pregenerate or "
+                    "--sendfile.");
+    }
     status = ReadSchemaFromFile(schema_file, &result.stream.production.schema);
   } else {
     result.sub = SubCommand::NONE;
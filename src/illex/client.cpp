@@ -14,10 +14,44 @@
 
 #include "illex/client.h"
 
+#include <chrono>
+
 #include "illex/log.h"
 
 namespace illex {
 
+void TrackLatency(LatencyTracker* tracker, Seq seq, std::string_view json,
+                  bool send_stamps, TimePoint receive_time, TimePoint pre_queue_time) {
+  size_t stage = 0;
+  if (send_stamps) {
+    uint64_t stamp_seq = 0;
+    uint64_t stamp_time = 0;
+    // Only parse stamps of sampled JSONs. The server numbers the same JSONs.
+    if (!tracker->IsSampled(seq)) {
+      return;
+    }
+    if (stamp::Parse(json, &stamp_seq, &stamp_time) && (stamp_seq == seq) &&
+        (stamp_time != 0)) {
+      // Convert the system clock send time to the steady clock of the tracker, through
+      // its age.
+      auto age = std::chrono::system_clock::now().time_since_epoch() -
+                 std::chrono::nanoseconds(stamp_time);
+      auto send_time = Timer::now() - std::chrono::duration_cast<Timer::duration>(age);
+      tracker->Put(seq, 0, send_time);
+    } else {
+      // The JSON was not stamped, so its send time is unknown.
+      tracker->Put(seq, 0, TimePoint());
+    }
+    stage = 1;
+  }
+  tracker->Put(seq, stage, receive_time);
+  tracker->Put(seq, stage + 1, pre_queue_time);
+}
+
+auto Client::ReceiveOnce(LatencyTracker* /*lat_tracker*/, bool* /*done*/) -> Status {
+  return Status(Error::ClientError, "Client does not support receiving once.");
+}
+
 auto InitSocket(const std::string& host, uint16_t port, std::shared_ptr<Socket>* out)
     -> Status {
   // Create an endpoint.
@@ -16,13 +16,16 @@
 
 #include <chrono>
 #include <cstddef>
+#include <cstring>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "illex/arrow.h"
 #include "illex/latency.h"
 #include "illex/log.h"
+#include "illex/scanner.h"
 #include "illex/status.h"
 
 namespace illex {
@@ -49,6 +52,17 @@ auto JSONBuffer::SetSize(size_t size) -> Status {
   }
 }
 
+auto BufferingClient::SetProtocol(const Protocol& protocol) -> Status {
+  framed = protocol.framing == Framing::Length;
+  if (protocol.compression != Compression::None) {
+    if (!framed) {
+      return Status(Error::ClientError, "Compression requires length framing.");
+    }
+    ILLEX_ROE(MakeCodec(protocol.compression, &codec));
+  }
+  return Status::OK();
+}
+
 auto BufferingClient::Create(const ClientOptions& options,
                              const std::vector<JSONBuffer*>& buffers,
                              const std::vector<std::mutex*>& mutexes,
@@ -62,6 +76,31 @@ auto BufferingClient::Create(const ClientOptions& options,
   out->mutexes = mutexes;
   out->buffers = buffers;
   out->seq = options.seq;
+  out->send_stamps = options.send_stamps;
+  out->cpus = options.cpus;
+  out->live = options.live;
+  ILLEX_ROE(out->SetProtocol(options.protocol));
+
+  ILLEX_ROE(InitSocket(options.host, options.port, &out->client));
+
+  // Connect successful, remember we have to close it on deconstruction.
+  out->must_be_closed = true;
+
+  return Status::OK();
+}
+
+auto BufferingClient::Create(const ClientOptions& options, JSONBufferQueue* free,
+                             JSONBufferQueue* filled, BufferingClient* out) -> Status {
+  if ((free == nullptr) || (filled == nullptr)) {
+    return Status(Error::ClientError, "Cannot create client. Buffer queues missing.");
+  }
+  out->free_queue = free;
+  out->filled_queue = filled;
+  out->seq = options.seq;
+  out->send_stamps = options.send_stamps;
+  out->cpus = options.cpus;
+  out->live = options.live;
+  ILLEX_ROE(out->SetProtocol(options.protocol));
 
   ILLEX_ROE(InitSocket(options.host, options.port, &out->client));
 
@@ -72,41 +111,43 @@ auto BufferingClient::Create(const ClientOptions& options,
 }
 
 auto JSONBuffer::Scan(size_t num_bytes, uint64_t seq) -> std::pair<size_t, size_t> {
-  size_t first = seq;
+  // Find all newlines in a single pass.
+  newlines_.clear();
+  ScanNewlines(this->data(), num_bytes, &newlines_);
+
+  // Count the non-empty records.
   size_t num_jsons = 0;
-  // Scan the buffer for a newline.
-  const auto* recv_chars = reinterpret_cast<const char*>(this->data());
-  const char* json_start = recv_chars;
-  const char* json_end = recv_chars + this->size();
-  size_t remaining = num_bytes;
-  do {
-    json_end = static_cast<const char*>(std::memchr(json_start, '\n', remaining));
-    if (json_end != nullptr) {
-      auto json_len = json_end - json_start;
-      if (json_len > 0) {
-        num_jsons++;
-      }
-      // Move the start scan index to the character after the newline.
-      // But only if the json end is not the last character.
-      if (json_start != json_end - 1) {
-        json_start = json_end + 1;
-      }
-      // Calculate the remaining number of bytes to scan in the buffer.
-      remaining = (recv_chars + num_bytes) - json_start;
+  size_t json_start = 0;
+  for (auto newline : newlines_) {
+    if (newline > json_start) {
+      num_jsons++;
     }
-    // Repeat until there are no remaining bytes.
-  } while ((json_end != nullptr) && (json_start != json_end));
+    // Move the start to the character after the newline.
+    json_start = newline + 1;
+  }
 
   // Set contained sequence numbers.
-  SetRange({first, first + num_jsons - 1});
+  SetRange({seq, seq + num_jsons - 1});
 
   // Return number of JSONs and number of remaining bytes.
-  return {num_jsons, remaining};
+  return {num_jsons, num_bytes - json_start};
+}
+
+void JSONBuffer::SetFrame(const std::vector<uint32_t>& lengths, uint64_t seq) {
+  newlines_.clear();
+  size_t offset = 0;
+  for (auto length : lengths) {
+    offset += length;
+    newlines_.push_back(offset - 1);
+  }
+  size_ = offset;
+  SetRange({seq, seq + lengths.size() - 1});
 }
 
 void JSONBuffer::Reset() {
   size_ = 0;
   seq_range = {0, 0};
+  newlines_.clear();
 }
 
 auto JSONBuffer::num_jsons() const -> size_t {
@@ -130,80 +171,387 @@ auto TryGetEmptyBuffer(const std::vector<JSONBuffer*>& buffers,
   return false;
 }
 
-auto BufferingClient::ReceiveJSONs(LatencyTracker* lat_tracker) -> Status {
-  // Buffer to temporary place leftover bytes from a buffer.
-  auto* spill = static_cast<std::byte*>(std::malloc(ILLEX_DEFAULT_TCP_BUFSIZE));
-  // Bytes leftover from previous buffer.
-  size_t remaining = 0;
+/**
+ * \brief Copy the bytes of an incomplete JSON to the start of the next buffer.
+ * \param leftover  The bytes of the incomplete JSON.
+ * \param remaining The number of bytes of the incomplete JSON.
+ * \param next      The next buffer.
+ * \return Status::OK() if successful, an error if the JSON does not fit the next buffer.
+ */
+static auto CarryOver(const std::byte* leftover, size_t remaining, JSONBuffer* next)
+    -> Status {
+  if (remaining >= next->capacity()) {
+    return Status(Error::ClientError,
+                  "Received JSON larger than buffer capacity of " +
+                      std::to_string(next->capacity()) + " bytes.");
+  }
+  if (remaining > 0) {
+    std::memcpy(next->mutable_data(), leftover, remaining);
+  }
+  return Status::OK();
+}
 
+void TrackBuffer(LatencyTracker* tracker, JSONBuffer* buf, bool send_stamps) {
+  const auto receive_time = buf->recv_time();
+  const auto pre_queue_time = Timer::now();
+  const auto* chars = reinterpret_cast<const char*>(buf->data());
+  auto seq = buf->range().first;
+  size_t json_start = 0;
+  for (auto newline : buf->newlines()) {
+    // Empty records are not JSONs, and have no sequence number.
+    if (newline > json_start) {
+      std::string_view json(chars + json_start, newline - json_start);
+      TrackLatency(tracker, seq++, json, send_stamps, receive_time, pre_queue_time);
+    }
+    json_start = newline + 1;
+  }
+}
+
+/**
+ * \brief Handle the socket status of a receive.
+ * \param[in]  sock_status The socket status.
+ * \param[out] done        Set to true if the server has disconnected cleanly.
+ * \return Status::OK() if the socket is still valid or disconnected cleanly.
+ */
+static auto HandleSocketStatus(int sock_status, bool* done) -> Status {
+  // Perhaps the server disconnected because it's done sending JSONs, check the status.
+  if (sock_status == kissnet::socket_status::cleanly_disconnected) {
+    SPDLOG_DEBUG("Server has cleanly disconnected.");
+    *done = true;
+  } else if (sock_status != kissnet::socket_status::valid) {
+    // Otherwise, if it's not valid, there is something wrong.
+    return Status(Error::ClientError,
+                  "Server error. Status: " + std::to_string(sock_status));
+  }
+  return Status::OK();
+}
+
+auto BufferingClient::ReceiveJSONs(LatencyTracker* lat_tracker) -> Status {
+  ILLEX_ROE(PinThread(cpus));
+  bool done = false;
+  Status status;
   // Loop while the socket is still valid.
-  while (client->is_valid()) {
-    try {
-      // Attempt to get a lock on an empty buffer.
-      JSONBuffer* buf = nullptr;
+  while (status.ok() && !done && !stopped && client->is_valid()) {
+    status = ReceiveOnce(lat_tracker, &done);
+    if (status.ok() && waiting_) {
+      // Sleep until a free buffer is available, or until the client must stop.
+      status = Acquire(kBufferPollInterval);
+    }
+  }
+  // Return a buffer that was not handed off when stopped, or when acquiring failed.
+  ReturnCurrent();
+  return status;
+}
+
+auto BufferingClient::ReceiveOnce(LatencyTracker* lat_tracker, bool* done) -> Status {
+  const size_t jsons_received = jsons_received_;
+  const size_t bytes_received = bytes_received_;
+  waiting_ = false;
+  Status status;
+  try {
+    if (framed) {
+      status = ReceiveFrame(lat_tracker, done);
+    } else {
+      status = ReceiveScanned(lat_tracker, done);
+    }
+  } catch (const std::exception& e) {
+    // But first we catch any exceptions.
+    status = Status(Error::ClientError, e.what());
+  }
+  if (*done || !status.ok()) {
+    // Return the buffer that was not handed off.
+    ReturnCurrent();
+  }
+  if (live != nullptr) {
+    LiveMetrics::Add(&live->jsons_received, jsons_received_ - jsons_received);
+    LiveMetrics::Add(&live->bytes_received, bytes_received_ - bytes_received);
+  }
+  return status;
+}
+
+void BufferingClient::ReleaseBuffers() { ReturnCurrent(); }
+
+auto BufferingClient::Acquire(std::chrono::microseconds timeout) -> Status {
+  JSONBuffer* buf = nullptr;
+  if (free_queue != nullptr) {
+    bool acquired = timeout.count() > 0
+                        ? free_queue->wait_dequeue_timed(buf, timeout.count())
+                        : free_queue->try_dequeue(buf);
+    if (!acquired) {
+      waiting_ = true;
+      return Status::OK();
+    }
+  } else {
+    size_t lock_idx = 0;
+    if (!TryGetEmptyBuffer(buffers, mutexes, &buf, &lock_idx)) {
+      // Buffers are unlocked without notice, so they can only be polled for.
+      if (timeout.count() > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+      waiting_ = true;
+      return Status::OK();
+    }
+    current_lock = std::unique_lock<std::mutex>(*mutexes[lock_idx], std::adopt_lock);
+  }
+  current = buf;
+  // Move leftovers that were spilled from the previous buffer into the new buffer.
+  return CarryOver(spill.data(), remaining, current);
+}
+
+auto BufferingClient::Fill(JSONBuffer* buf) -> int {
+  // Attempt to receive some bytes.
+  auto recv_status =
+      client->recv(buf->mutable_data() + remaining, buf->capacity() - remaining);
+  // Set receive time point.
+  buf->SetRecvTime(Timer::now());
+
+  // Get some stats from recv() return value.
+  auto bytes_received = std::get<0>(recv_status);
+  auto sock_status = std::get<1>(recv_status).get_value();
+  this->bytes_received_ += bytes_received;
+
+  // Scan the buffer for JSONs.
+  auto scan_size = remaining + bytes_received;
+  auto scan = buf->Scan(scan_size, this->seq);
+
+  // Increase current sequence number.
+  this->seq += scan.first;
+  // Increase number of received JSONs.
+  this->jsons_received_ += scan.first;
+
+  // Deal with the remaining bytes, which are left in place after the valid bytes.
+  remaining = scan.second;
+  buf->SetSizeUnsafe(scan_size - remaining);
+  return sock_status;
+}
+
+auto BufferingClient::ReceiveScanned(LatencyTracker* lat_tracker, bool* done) -> Status {
+  if (current == nullptr) {
+    ILLEX_ROE(Acquire(std::chrono::microseconds(0)));
+    if (waiting_) {
+      return Status::OK();
+    }
+  } else if (remaining >= current->capacity()) {
+    // The current buffer is full, without containing a complete JSON.
+    return Status(Error::ClientError, "Received JSON larger than buffer capacity of " +
+                                          std::to_string(current->capacity()) +
+                                          " bytes.");
+  }
+
+  auto sock_status = Fill(current);
+  if (!current->empty()) {
+    // Hand off the buffer. Downstream threads may modify it as soon as it is dequeued or
+    // unlocked.
+    if (lat_tracker != nullptr) {
+      TrackBuffer(lat_tracker, current, send_stamps);
+    }
+    ILLEX_ROE(Advance());
+  }
+  // Otherwise, no complete JSON was received yet, and the leftover bytes are still at
+  // the start of the current buffer, so it can be filled further.
+  return HandleSocketStatus(sock_status, done);
+}
+
+auto BufferingClient::Advance() -> Status {
+  JSONBuffer* next = nullptr;
+  std::unique_lock<std::mutex> next_lock;
+  if (remaining > 0) {
+    // The current buffer is not empty, so it cannot be obtained again.
+    if (free_queue != nullptr) {
+      free_queue->try_dequeue(next);
+    } else {
       size_t lock_idx = 0;
-      if (TryGetEmptyBuffer(buffers, mutexes, &buf, &lock_idx)) {
-        // Copy leftovers from previous buffer into new buffer.
-        if (remaining > 0) {
-          std::memcpy(buf->mutable_data(), spill, remaining);
-        }
+      if (TryGetEmptyBuffer(buffers, mutexes, &next, &lock_idx)) {
+        next_lock = std::unique_lock<std::mutex>(*mutexes[lock_idx], std::adopt_lock);
+      }
+    }
+  }
+  if (next == nullptr) {
+    // Keep the leftover bytes until a buffer is acquired.
+    const auto* leftover = current->data() + current->size();
+    spill.assign(leftover, leftover + remaining);
+    HandOff();
+    return Status::OK();
+  }
+  auto status = CarryOver(current->data() + current->size(), remaining, next);
+  HandOff();
+  current = next;
+  current_lock = std::move(next_lock);
+  return status;
+}
 
-        // Attempt to receive some bytes.
-        auto recv_status =
-            client->recv(buf->mutable_data() + remaining, buf->capacity() - remaining);
-        // Set receive time point.
-        buf->SetRecvTime(Timer::now());
-
-        // Get some stats from recv() return value.
-        auto bytes_received = std::get<0>(recv_status);
-        auto sock_status = std::get<1>(recv_status).get_value();
-        this->bytes_received_ += bytes_received;
-
-        // Scan the buffer for JSONs.
-        auto scan_size = remaining + bytes_received;
-        auto scan = buf->Scan(scan_size, this->seq);
-
-        // Increase current sequence number.
-        this->seq += scan.first;
-        // Increase number of received JSONs.
-        this->jsons_received_ += scan.first;
-
-        // Deal with the remaining bytes.
-        remaining = scan.second;
-        ILLEX_ROE(buf->SetSize(scan_size - remaining));
-        // Copy leftover bytes to temporary buffer.
-        if (remaining > 0) {
-          std::memcpy(spill, buf->data() + buf->size(), remaining);
-        }
+void BufferingClient::HandOff() {
+  if (free_queue != nullptr) {
+    filled_queue->enqueue(current);
+  } else {
+    current_lock.unlock();
+  }
+  current = nullptr;
+}
 
-        // Perhaps the server disconnected because it's done sending JSONs, check the
-        // status.
-        if (sock_status == kissnet::socket_status::cleanly_disconnected) {
-          SPDLOG_DEBUG("Server has cleanly disconnected.");
-          mutexes[lock_idx]->unlock();
-          free(spill);
-          return Status::OK();
-        } else if (sock_status != kissnet::socket_status::valid) {
-          // Otherwise, if it's not valid, there is something wrong.
-          return Status(Error::ClientError,
-                        "Server error. Status: " + std::to_string(sock_status));
-        }
+void BufferingClient::ReturnCurrent() {
+  if (current != nullptr) {
+    current->Reset();
+    if (free_queue != nullptr) {
+      free_queue->enqueue(current);
+    } else {
+      current_lock.unlock();
+    }
+    current = nullptr;
+  }
+}
 
-        // Unlock the buffer.
-        mutexes[lock_idx]->unlock();
-      } else {
-        std::this_thread::sleep_for(std::chrono::microseconds(100));
+auto BufferingClient::ReceiveFramePart(std::byte* part, size_t size, bool* disconnected)
+    -> Status {
+  auto recv_status = client->recv(part + frame_offset, size - frame_offset);
+  auto bytes_received = std::get<0>(recv_status);
+  auto sock_status = std::get<1>(recv_status).get_value();
+  frame_offset += bytes_received;
+  this->bytes_received_ += bytes_received;
+  if (sock_status == kissnet::socket_status::cleanly_disconnected) {
+    *disconnected = true;
+    return Status::OK();
+  }
+  bool unused = false;
+  return HandleSocketStatus(sock_status, &unused);
+}
+
+auto BufferingClient::ReceiveFrame(LatencyTracker* lat_tracker, bool* done) -> Status {
+  const bool compressed = frame_header.magic == frame::kCompressedMagic;
+  if (frame_part == FramePart::Buffer) {
+    // Obtain a buffer for the JSONs, now that their length is known.
+    if (current == nullptr) {
+      ILLEX_ROE(Acquire(std::chrono::microseconds(0)));
+      if (waiting_) {
+        return Status::OK();
+      }
+    }
+    if (frame_header.length > current->capacity()) {
+      return Status(Error::ClientError, "Received frame larger than buffer capacity of " +
+                                            std::to_string(current->capacity()) +
+                                            " bytes.");
+    }
+    // Every JSON holds at least its whitespace character, so this bounds the lengths.
+    if (frame_header.num_jsons > frame_header.length) {
+      return Status(Error::ClientError, "Received invalid frame header.");
+    }
+    frame_lengths.resize(frame_header.num_jsons);
+    if (compressed) {
+      // The JSONs cannot compress to more bytes than the codec allows for in the worst
+      // case, which bounds the compressed JSONs as well.
+      const auto max_wire_length = static_cast<uint64_t>(
+          codec->MaxCompressedLen(static_cast<int64_t>(frame_header.length), nullptr));
+      if (frame_header.wire_length > max_wire_length) {
+        return Status(Error::ClientError, "Received compressed frame larger than " +
+                                              std::to_string(max_wire_length) +
+                                              " bytes.");
+      }
+      compressed_jsons.resize(frame_header.wire_length);
+    }
+    frame_part = FramePart::Lengths;
+  }
+
+  // Receive the next bytes of the part of the frame that is being received. The JSONs
+  // are received straight into the buffer, or decompressed into the buffer, and handed
+  // off without scanning.
+  auto* part = reinterpret_cast<std::byte*>(&frame_header);
+  size_t part_size = sizeof(frame_header);
+  if (frame_part == FramePart::Lengths) {
+    part = reinterpret_cast<std::byte*>(frame_lengths.data());
+    part_size = frame_lengths.size() * sizeof(uint32_t);
+  } else if (frame_part == FramePart::JSONs) {
+    part = compressed ? compressed_jsons.data() : current->mutable_data();
+    part_size = compressed ? frame_header.wire_length : frame_header.length;
+  }
+  if (frame_offset < part_size) {
+    bool disconnected = false;
+    ILLEX_ROE(ReceiveFramePart(part, part_size, &disconnected));
+    if (disconnected) {
+      if ((frame_part == FramePart::Header) && (frame_offset == 0)) {
+        SPDLOG_DEBUG("Server has cleanly disconnected.");
+        *done = true;
+        return Status::OK();
       }
-    } catch (const std::exception& e) {
-      // But first we catch any exceptions.
-      return Status(Error::ClientError, e.what());
+      return Status(Error::ClientError, "Server disconnected in the middle of frame.");
+    }
+    if (frame_offset < part_size) {
+      return Status::OK();
     }
   }
 
-  free(spill);
+  // The part is complete.
+  frame_offset = 0;
+  switch (frame_part) {
+    case FramePart::Header:
+      if ((frame_header.magic != frame::kMagic) &&
+          (frame_header.magic != frame::kCompressedMagic)) {
+        return Status(Error::ClientError, "Received invalid frame header.");
+      }
+      if ((frame_header.magic == frame::kCompressedMagic) && (codec == nullptr)) {
+        return Status(Error::ClientError, "Received compressed frame without a codec.");
+      }
+      // The server numbers the JSONs of every connection from 0.
+      if (frame_header.seq != jsons_received_) {
+        return Status(Error::ClientError,
+                      "Received frame starting at JSON " +
+                          std::to_string(frame_header.seq) + ", expected JSON " +
+                          std::to_string(jsons_received_) + ".");
+      }
+      frame_part = FramePart::Buffer;
+      break;
+    case FramePart::Lengths:
+      if (!frame::Valid(frame_header, frame_lengths.data())) {
+        return Status(Error::ClientError, "Received invalid frame header.");
+      }
+      frame_part = FramePart::JSONs;
+      break;
+    default:
+      if (compressed) {
+        ILLEX_ROE(Decompress(current));
+      }
+      current->SetRecvTime(Timer::now());
+      current->SetFrame(frame_lengths, this->seq);
+      this->seq += frame_header.num_jsons;
+      this->jsons_received_ += frame_header.num_jsons;
+      if (frame_header.num_jsons > 0) {
+        if (lat_tracker != nullptr) {
+          TrackBuffer(lat_tracker, current, send_stamps);
+        }
+        HandOff();
+      } else {
+        ReturnCurrent();
+      }
+      frame_part = FramePart::Header;
+      break;
+  }
+  return Status::OK();
+}
+
+auto BufferingClient::Decompress(JSONBuffer* buf) -> Status {
+  auto start = Timer::now();
+  auto decompressed =
+      codec->Decompress(static_cast<int64_t>(frame_header.wire_length),
+                        reinterpret_cast<const uint8_t*>(compressed_jsons.data()),
+                        static_cast<int64_t>(buf->capacity()),
+                        reinterpret_cast<uint8_t*>(buf->mutable_data()));
+  auto seconds = std::chrono::duration<double>(Timer::now() - start).count();
+  decompress_time_ += seconds;
+  if (live != nullptr) {
+    LiveMetrics::AddSeconds(&live->decompress_ns, seconds);
+  }
+  if (!decompressed.ok()) {
+    return Status(Error::ClientError, decompressed.status().message());
+  }
+  if (static_cast<uint64_t>(*decompressed) != frame_header.length) {
+    return Status(Error::ClientError, "Decompressed frame has an unexpected length.");
+  }
   return Status::OK();
 }
 
+auto BufferingClient::native_handle() const -> int {
+  return client != nullptr ? static_cast<int>(client->get_native()) : -1;
+}
+
 auto BufferingClient::Close() -> Status {
   if (must_be_closed) {
     client->close();
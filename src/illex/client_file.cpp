@@ -0,0 +1,259 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/client_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include "illex/latency.h"
+#include "illex/log.h"
+#include "illex/scanner.h"
+
+namespace illex {
+
+/// A private, read-write mapping of a file.
+struct FileClient::Mapping {
+  ~Mapping() {
+    if (data != nullptr) {
+      munmap(data, size);
+    }
+  }
+  /// The mapped bytes.
+  std::byte* data = nullptr;
+  /// The number of mapped bytes.
+  size_t size = 0;
+};
+
+auto FileClient::Open(const FileClientOptions& options) -> Status {
+  if (options.chunk_size == 0) {
+    return Status(Error::ClientError, "Chunk size cannot be 0.");
+  }
+  opts = options;
+  seq = options.seq;
+
+  int fd = open(options.path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(Error::IOError,
+                  "Unable to open " + options.path + ": " + std::strerror(errno));
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return Status(Error::IOError, "Unable to query size of " + options.path);
+  }
+
+  mapping = std::make_shared<Mapping>();
+  mapping->size = static_cast<size_t>(st.st_size);
+  if (mapping->size > 0) {
+    // Map privately, so buffers can be mutable without modifying the file.
+    void* data = mmap(nullptr, mapping->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      return Status(Error::IOError,
+                    "Unable to map " + options.path + ": " + std::strerror(errno));
+    }
+    mapping->data = static_cast<std::byte*>(data);
+    // Advice values are not flags, so every advice takes a call of its own. They are
+    // only hints, so reading continues without them.
+    if (madvise(data, mapping->size, MADV_SEQUENTIAL) != 0) {
+      spdlog::warn("Unable to advise sequential access to {}: {}", options.path,
+                   std::strerror(errno));
+    }
+    if (madvise(data, mapping->size, MADV_WILLNEED) != 0) {
+      spdlog::warn("Unable to advise reading ahead {}: {}", options.path,
+                   std::strerror(errno));
+    }
+  }
+  // The mapping remains valid after closing the file.
+  close(fd);
+
+  return Status::OK();
+}
+
+auto FileClient::Create(const FileClientOptions& options, JSONQueue* queue,
+                        FileClient* out) -> Status {
+  if (queue == nullptr) {
+    return Status(Error::ClientError, "Cannot create client. JSON queue missing.");
+  }
+  out->queue = queue;
+  return out->Open(options);
+}
+
+auto FileClient::Create(const FileClientOptions& options, JSONViewQueue* queue,
+                        FileClient* out) -> Status {
+  if (queue == nullptr) {
+    return Status(Error::ClientError, "Cannot create client. JSON view queue missing.");
+  }
+  out->view_queue = queue;
+  return out->Open(options);
+}
+
+auto FileClient::Create(const FileClientOptions& options, JSONBufferQueue* free,
+                        JSONBufferQueue* filled, FileClient* out) -> Status {
+  if ((free == nullptr) || (filled == nullptr)) {
+    return Status(Error::ClientError, "Cannot create client. Buffer queues missing.");
+  }
+  if (options.zero_copy && (options.num_slices == 0)) {
+    return Status(Error::ClientError, "Number of zero-copy buffers cannot be 0.");
+  }
+  out->free_queue = free;
+  out->filled_queue = filled;
+  return out->Open(options);
+}
+
+auto FileClient::ChunkLength(size_t offset, size_t max_length) const -> size_t {
+  const auto* data = reinterpret_cast<const char*>(mapping->data);
+  const size_t end = std::min(offset + max_length, mapping->size);
+  if (end == mapping->size) {
+    return end - offset;
+  }
+  // End the chunk after the last newline, or after the first one beyond the maximum
+  // length, if a single JSON is larger.
+  const auto* last = static_cast<const char*>(memrchr(data + offset, '\n', end - offset));
+  if (last == nullptr) {
+    last = static_cast<const char*>(std::memchr(data + end, '\n', mapping->size - end));
+  }
+  return last != nullptr ? last - (data + offset) + 1 : mapping->size - offset;
+}
+
+auto FileClient::ReceiveJSONs(LatencyTracker* lat_tracker) -> Status {
+  if (mapping == nullptr) {
+    return Status(Error::ClientError, "Client is closed.");
+  }
+  if (free_queue != nullptr) {
+    return opts.zero_copy ? ReceiveSlices() : ReceiveBuffers();
+  }
+  return ReceiveItems(lat_tracker);
+}
+
+auto FileClient::ReceiveItems(LatencyTracker* lat_tracker) -> Status {
+  const auto* chars = reinterpret_cast<const char*>(mapping->data);
+  size_t offset = 0;
+  while (offset < mapping->size) {
+    auto length = ChunkLength(offset, opts.chunk_size);
+    auto receive_time = Timer::now();
+
+    newlines.clear();
+    ScanNewlines(mapping->data + offset, length, &newlines);
+    size_t json_start = offset;
+    for (auto newline : newlines) {
+      auto json_end = offset + newline;
+      auto pre_queue_time = Timer::now();
+      if (view_queue != nullptr) {
+        view_queue->enqueue(JSONView{
+            seq, std::string_view(chars + json_start, json_end - json_start), mapping});
+      } else {
+        queue->enqueue(
+            JSONItem{seq, std::string(chars + json_start, json_end - json_start)});
+      }
+      if (lat_tracker != nullptr) {
+        lat_tracker->Put(seq, 0, receive_time);
+        lat_tracker->Put(seq, 1, pre_queue_time);
+      }
+      seq++;
+      jsons_received_++;
+      json_start = json_end + 1;
+    }
+
+    bytes_received_ += length;
+    offset += length;
+  }
+  return Status::OK();
+}
+
+auto FileClient::ReceiveBuffers() -> Status {
+  size_t offset = 0;
+  while (offset < mapping->size) {
+    // Sleep until a free buffer is available.
+    JSONBuffer* buf = nullptr;
+    free_queue->wait_dequeue(buf);
+    auto length = ChunkLength(offset, std::min(opts.chunk_size, buf->capacity()));
+    if (length > buf->capacity()) {
+      free_queue->enqueue(buf);
+      return Status(Error::ClientError,
+                    "Read JSON larger than buffer capacity of " +
+                        std::to_string(buf->capacity()) + " bytes.");
+    }
+    std::memcpy(buf->mutable_data(), mapping->data + offset, length);
+    buf->SetRecvTime(Timer::now());
+
+    auto scan = buf->Scan(length, seq);
+    seq += scan.first;
+    jsons_received_ += scan.first;
+    buf->SetSizeUnsafe(length - scan.second);
+    bytes_received_ += length;
+    offset += length;
+
+    if (!buf->empty()) {
+      filled_queue->enqueue(buf);
+    } else {
+      // Only bytes after the last newline of the file were left.
+      buf->Reset();
+      free_queue->enqueue(buf);
+    }
+  }
+  return Status::OK();
+}
+
+auto FileClient::ReceiveSlices() -> Status {
+  size_t offset = 0;
+  while (offset < mapping->size) {
+    // Recycle a returned buffer, or create a new one if not too many are handed off.
+    JSONBuffer* buf = nullptr;
+    if (!free_queue->try_dequeue(buf)) {
+      if (slices.size() < opts.num_slices) {
+        slices.push_back(std::make_unique<JSONBuffer>());
+        buf = slices.back().get();
+      } else {
+        free_queue->wait_dequeue(buf);
+      }
+    }
+    auto length = ChunkLength(offset, opts.chunk_size);
+    ILLEX_ROE(JSONBuffer::Create(mapping->data + offset, length, buf));
+    buf->SetRecvTime(Timer::now());
+
+    auto scan = buf->Scan(length, seq);
+    seq += scan.first;
+    jsons_received_ += scan.first;
+    buf->SetSizeUnsafe(length - scan.second);
+    bytes_received_ += length;
+    offset += length;
+
+    if (!buf->empty()) {
+      filled_queue->enqueue(buf);
+    } else {
+      free_queue->enqueue(buf);
+    }
+  }
+  return Status::OK();
+}
+
+auto FileClient::Close() -> Status {
+  if (mapping == nullptr) {
+    return Status(Error::ClientError, "Client was already closed.");
+  }
+  // Views may still hold on to the mapping. It is unmapped when they are released.
+  mapping.reset();
+  return Status::OK();
+}
+
+}  // namespace illex
@@ -0,0 +1,281 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/client_group.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace illex {
+
+auto ClientGroup::Validate(const ClientGroupOptions& options) -> Status {
+  if (options.num_connections == 0) {
+    return Status(Error::ClientError, "Number of connections must be at least 1.");
+  }
+  if (options.seq_range == 0) {
+    return Status(Error::ClientError, "Sequence number range must be at least 1.");
+  }
+  if (options.num_engine_threads == 0) {
+    return Status(Error::ClientError, "Number of engine threads must be at least 1.");
+  }
+  return Status::OK();
+}
+
+auto ClientGroup::ConnectionOptions(const ClientGroupOptions& options, size_t c)
+    -> ClientOptions {
+  auto result = options.client;
+  result.seq = options.client.seq + c * options.seq_range;
+  // Stamps carry the sequence numbers of the server, which only match for the first
+  // connection.
+  result.send_stamps = options.client.send_stamps && (c == 0);
+  return result;
+}
+
+template <typename T, typename Factory>
+auto ClientGroup::Make(const ClientGroupOptions& options, const Factory& create,
+                       ClientGroup* out) -> Status {
+  ILLEX_ROE(Validate(options));
+  for (size_t c = 0; c < options.num_connections; c++) {
+    auto client = std::make_unique<T>();
+    ILLEX_ROE(create(ConnectionOptions(options, c), client.get()));
+    out->clients.push_back(std::move(client));
+  }
+  out->first_seq = options.client.seq;
+  out->seq_range = options.seq_range;
+  out->engine = options.engine;
+  out->num_engine_threads = options.num_engine_threads;
+  out->cpus = options.client.cpus;
+  return Status::OK();
+}
+
+auto ClientGroup::Create(const ClientGroupOptions& options, JSONQueue* queue,
+                         ClientGroup* out, size_t buffer_size) -> Status {
+  return Make<QueueingClient>(
+      options,
+      [&](const ClientOptions& client_opts, QueueingClient* client) {
+        return QueueingClient::Create(client_opts, queue, client, buffer_size);
+      },
+      out);
+}
+
+auto ClientGroup::Create(const ClientGroupOptions& options, JSONViewQueue* queue,
+                         ClientGroup* out, size_t slab_size) -> Status {
+  return Make<QueueingClient>(
+      options,
+      [&](const ClientOptions& client_opts, QueueingClient* client) {
+        return QueueingClient::Create(client_opts, queue, client, slab_size);
+      },
+      out);
+}
+
+auto ClientGroup::Create(const ClientGroupOptions& options,
+                         const std::vector<JSONBuffer*>& buffers,
+                         const std::vector<std::mutex*>& mutexes, ClientGroup* out)
+    -> Status {
+  return Make<BufferingClient>(
+      options,
+      [&](const ClientOptions& client_opts, BufferingClient* client) {
+        return BufferingClient::Create(client_opts, buffers, mutexes, client);
+      },
+      out);
+}
+
+auto ClientGroup::Create(const ClientGroupOptions& options, JSONBufferQueue* free,
+                         JSONBufferQueue* filled, ClientGroup* out) -> Status {
+  return Make<BufferingClient>(
+      options,
+      [&](const ClientOptions& client_opts, BufferingClient* client) {
+        return BufferingClient::Create(client_opts, free, filled, client);
+      },
+      out);
+}
+
+auto ClientGroup::ReceiveJSONs(LatencyTracker* lat_tracker) -> Status {
+  switch (engine) {
+    case ReceiveEngine::Epoll:
+      return ReceiveEpoll(lat_tracker);
+    default:
+      return ReceiveThreads(lat_tracker);
+  }
+}
+
+auto ClientGroup::ReceiveThreads(LatencyTracker* lat_tracker) -> Status {
+  std::vector<Status> statuses(clients.size());
+  std::vector<std::thread> threads;
+  threads.reserve(clients.size());
+  for (size_t c = 0; c < clients.size(); c++) {
+    threads.emplace_back([this, c, lat_tracker, &statuses]() {
+      statuses[c] = clients[c]->ReceiveJSONs(c == 0 ? lat_tracker : nullptr);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& status : statuses) {
+    ILLEX_ROE(status);
+  }
+  return Status::OK();
+}
+
+auto ClientGroup::ReceiveEpoll(LatencyTracker* lat_tracker) -> Status {
+  // Spread the connections round-robin over the engine threads.
+  auto num_threads = std::min(num_engine_threads, clients.size());
+  std::vector<std::vector<size_t>> conns(num_threads);
+  for (size_t c = 0; c < clients.size(); c++) {
+    conns[c % num_threads].push_back(c);
+  }
+  if (num_threads == 1) {
+    return EpollLoop(conns[0], lat_tracker);
+  }
+
+  std::vector<Status> statuses(num_threads);
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (size_t t = 0; t < num_threads; t++) {
+    threads.emplace_back([this, t, lat_tracker, &conns, &statuses]() {
+      statuses[t] = EpollLoop(conns[t], lat_tracker);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& status : statuses) {
+    ILLEX_ROE(status);
+  }
+  return Status::OK();
+}
+
+auto ClientGroup::Register(int epfd, size_t c) -> Status {
+  int fd = clients[c]->native_handle();
+  if (fd < 0) {
+    return Status(Error::ClientError, "Connection has no native handle.");
+  }
+  // Level-triggered, so a connection with more bytes pending than one receive takes is
+  // reported again by the next wait.
+  struct epoll_event ev {};
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.u64 = c;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    return Status(Error::ClientError,
+                  std::string("Unable to register connection: ") + std::strerror(errno));
+  }
+  return Status::OK();
+}
+
+auto ClientGroup::EpollLoop(const std::vector<size_t>& conns, LatencyTracker* lat_tracker)
+    -> Status {
+  ILLEX_ROE(PinThread(cpus));
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    return Status(Error::ClientError, std::string("Unable to create epoll instance: ") +
+                                          std::strerror(errno));
+  }
+
+  // Register the connections.
+  Status result;
+  size_t active = 0;
+  for (auto c : conns) {
+    result = Register(epfd, c);
+    if (!result.ok()) {
+      break;
+    }
+    active++;
+  }
+
+  // Connections that wait for a buffer are removed from the epoll instance, so their
+  // pending bytes do not wake it up over and over again, and are driven again after the
+  // next wait.
+  std::vector<size_t> stalled;
+  std::vector<struct epoll_event> events(conns.size());
+  while (result.ok() && active > 0) {
+    const int timeout = stalled.empty() ? -1 : static_cast<int>(kStallInterval.count());
+    int num_events =
+        epoll_wait(epfd, events.data(), static_cast<int>(events.size()), timeout);
+    if (num_events < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      auto msg = std::string("Unable to wait for connections: ") + std::strerror(errno);
+      result = Status(Error::ClientError, msg);
+      break;
+    }
+    // Register stalled connections again, they are reported once they are readable.
+    for (auto c : stalled) {
+      if (result.ok()) {
+        result = Register(epfd, c);
+      }
+    }
+    stalled.clear();
+    for (int e = 0; e < num_events && result.ok(); e++) {
+      auto c = static_cast<size_t>(events[e].data.u64);
+      auto* client = clients[c].get();
+      // A disconnect is also reported as readable, the receive then reports it. Only one
+      // receive is done, so it does not block.
+      bool done = false;
+      result = client->ReceiveOnce(c == 0 ? lat_tracker : nullptr, &done);
+      if (result.ok() && (done || client->waiting())) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, client->native_handle(), nullptr);
+        if (done) {
+          active--;
+        } else {
+          stalled.push_back(c);
+        }
+      }
+    }
+  }
+
+  // Connections that have not completed keep no buffers.
+  for (auto c : conns) {
+    clients[c]->ReleaseBuffers();
+  }
+  close(epfd);
+  return result;
+}
+
+auto ClientGroup::Close() -> Status {
+  // Close all connections, even if closing one of them fails.
+  Status result;
+  for (auto& client : clients) {
+    auto status = client->Close();
+    if (result.ok() && !status.ok()) {
+      result = status;
+    }
+  }
+  return result;
+}
+
+auto ClientGroup::jsons_received() const -> size_t {
+  size_t result = 0;
+  for (const auto& client : clients) {
+    result += client->jsons_received();
+  }
+  return result;
+}
+
+auto ClientGroup::bytes_received() const -> size_t {
+  size_t result = 0;
+  for (const auto& client : clients) {
+    result += client->bytes_received();
+  }
+  return result;
+}
+
+}  // namespace illex
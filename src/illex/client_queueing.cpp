@@ -14,15 +14,60 @@
 
 #include "illex/client_queueing.h"
 
+#include <concurrentqueue.h>
+
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 #include "illex/latency.h"
+#include "illex/scanner.h"
 
 namespace illex {
 
+struct SlabPool::State {
+  explicit State(size_t slab_size) : slab_size(slab_size) {}
+  ~State() {
+    std::byte* slab = nullptr;
+    while (free.try_dequeue(slab)) {
+      std::free(slab);
+    }
+  }
+  /// The size of every slab.
+  size_t slab_size;
+  /// The number of allocated slabs.
+  std::atomic<size_t> allocated = 0;
+  /// Slabs that are not referenced anymore.
+  moodycamel::ConcurrentQueue<std::byte*> free;
+};
+
+SlabPool::SlabPool(size_t slab_size) : state_(std::make_shared<State>(slab_size)) {}
+
+auto SlabPool::Acquire(std::shared_ptr<std::byte>* out) -> Status {
+  std::byte* slab = nullptr;
+  if (!state_->free.try_dequeue(slab)) {
+    slab = static_cast<std::byte*>(std::malloc(state_->slab_size));
+    if (slab == nullptr) {
+      return Status(Error::ClientError, "Could not allocate receive slab.");
+    }
+    state_->allocated++;
+  }
+  // The deleter keeps the state alive, so the slab can be returned to the free list even
+  // if the pool itself is gone.
+  *out = std::shared_ptr<std::byte>(
+      slab, [state = state_](std::byte* slab) { state->free.enqueue(slab); });
+  return Status::OK();
+}
+
+auto SlabPool::slab_size() const -> size_t { return state_->slab_size; }
+
+auto SlabPool::num_allocated() const -> size_t { return state_->allocated; }
+
 auto QueueingClient::Close() -> Status {
   if (must_be_closed) {
     client->close();
@@ -44,8 +89,16 @@ auto QueueingClient::Create(const ClientOptions& options, JSONQueue* queue,
                             QueueingClient* out, size_t buffer_size) -> Status {
   assert(out != nullptr);
   assert(queue != nullptr);
+  if ((options.protocol.framing != Framing::Newline) ||
+      (options.protocol.compression != Compression::None)) {
+    return Status(Error::ClientError,
+                  "Framing and compression require a BufferingClient.");
+  }
 
   out->seq = options.seq;
+  out->send_stamps = options.send_stamps;
+  out->cpus = options.cpus;
+  out->live = options.live;
   out->buffer = static_cast<std::byte*>(malloc(buffer_size));
   if (out->buffer == nullptr) {
     return Status(Error::ClientError, "Could not allocate TCP recv buffer.");
@@ -53,7 +106,31 @@ auto QueueingClient::Create(const ClientOptions& options, JSONQueue* queue,
   out->buffer_size = buffer_size;
   out->queue = queue;
 
-  InitSocket(options.host, options.port, &out->client);
+  ILLEX_ROE(InitSocket(options.host, options.port, &out->client));
+
+  out->must_be_closed = true;
+
+  return Status::OK();
+}
+
+auto QueueingClient::Create(const ClientOptions& options, JSONViewQueue* queue,
+                            QueueingClient* out, size_t slab_size) -> Status {
+  assert(out != nullptr);
+  assert(queue != nullptr);
+  if ((options.protocol.framing != Framing::Newline) ||
+      (options.protocol.compression != Compression::None)) {
+    return Status(Error::ClientError,
+                  "Framing and compression require a BufferingClient.");
+  }
+
+  out->seq = options.seq;
+  out->send_stamps = options.send_stamps;
+  out->cpus = options.cpus;
+  out->live = options.live;
+  out->pool = SlabPool(slab_size);
+  out->view_queue = queue;
+
+  ILLEX_ROE(InitSocket(options.host, options.port, &out->client));
 
   out->must_be_closed = true;
 
@@ -62,112 +139,211 @@ auto QueueingClient::Create(const ClientOptions& options, JSONQueue* queue,
 
 /**
  * \brief Enqueue all JSONs in the TCP buffer.
- * \param[out]      json_buffer     Reusable JSON string buffer.
- * \param[in,out]   recv_buffer     The TCP buffer that is cleared after all JSONs are
- *                                  queued.
+ * \param[in,out]   json_buffer     Reusable buffer for a JSON spanning multiple
+ *                                  receives.
+ * \param[in]       recv_buffer     The TCP buffer.
  * \param[in]       tcp_valid_bytes Number of valid bytes in the TCP buffer.
  * \param[out]      queue           The queue to enqueue the JSON queue items in.
  * \param[in,out]   seq             The sequence number for the next JSON item, is
  *                                  increased when item is enqueued.
  * \param[in]       receive_time    Point in time when this buffer was received.
+ * \param[in,out]   newlines        Reusable vector for the newline offsets.
+ * \param[in]       send_stamps     Whether the server fills in send stamps.
  * \param[out]      tracker         Latency tracking device, set to nullptr if unused.
  * \return The number of JSONs enqueued.
  */
-static auto EnqueueAllJSONsInBuffer(std::string* json_buffer, std::byte* recv_buffer,
+static auto EnqueueAllJSONsInBuffer(std::string* json_buffer,
+                                    const std::byte* recv_buffer,
                                     size_t tcp_valid_bytes, JSONQueue* queue,
                                     uint64_t* seq, TimePoint receive_time,
+                                    std::vector<size_t>* newlines, bool send_stamps,
                                     LatencyTracker* tracker = nullptr) -> size_t {
   size_t queued = 0;
   // TODO(johanpel): implement mechanism to allow newlines within JSON objects,
   //   this only works for non-pretty printed JSONs now.
-  auto* recv_chars = reinterpret_cast<char*>(recv_buffer);
-
-  // Scan the buffer for a newline.
-  char* json_start = recv_chars;
-  char* json_end = recv_chars + tcp_valid_bytes;
-  size_t remaining = tcp_valid_bytes;
-  do {
-    json_end = static_cast<char*>(std::memchr(json_start, '\n', remaining));
-    if (json_end == nullptr) {
-      // Append the remaining characters to the JSON buffer.
-      json_buffer->append(json_start, remaining);
-      // We appended everything up to the end of the buffer, so we can set remaining
-      // bytes to 0.
-      remaining = 0;
-    } else {
-      // There is a newline. Only append the remaining characters to the json_msg.
-      json_buffer->append(json_start, json_end - json_start);
+  const auto* recv_chars = reinterpret_cast<const char*>(recv_buffer);
 
-      // Copy the JSON string into the consumption queue.
-      auto pre_queue_time = Timer::now();
-      queue->enqueue(JSONItem{*seq, *json_buffer});
+  // Find all newlines in the buffer in a single pass.
+  newlines->clear();
+  ScanNewlines(recv_buffer, tcp_valid_bytes, newlines);
+
+  size_t json_start = 0;
+  for (auto json_end : *newlines) {
+    auto pre_queue_time = Timer::now();
+    if (json_buffer->empty()) {
+      // Construct the JSON string in the queue item straight from the TCP buffer.
+      std::string_view json(recv_chars + json_start, json_end - json_start);
       // Place the receive time for this JSON in the tracker.
       if (tracker != nullptr) {
-        tracker->Put(*seq, 0, receive_time);
-        tracker->Put(*seq, 1, pre_queue_time);
+        TrackLatency(tracker, *seq, json, send_stamps, receive_time, pre_queue_time);
       }
-      (*seq)++;
-      queued++;
-
-      // Clear the JSON string buffer. The implementation of std::string is allowed to
-      // change its allocated buffer here, but there are no implementations that actually
-      // do it, they retain the allocated buffer. An implementation using
-      // std::vector<char> might be desired here just to make sure.
+      queue->enqueue(JSONItem{*seq, std::string(json)});
+    } else {
+      // The JSON started in a previous receive. Complete it and move it into the queue.
+      json_buffer->append(recv_chars + json_start, json_end - json_start);
+      if (tracker != nullptr) {
+        TrackLatency(tracker, *seq, *json_buffer, send_stamps, receive_time,
+                     pre_queue_time);
+      }
+      queue->enqueue(JSONItem{*seq, std::move(*json_buffer)});
       json_buffer->clear();
-
-      // Move the start to the character after the newline.
-      json_start = json_end + 1;
-
-      // Calculate the remaining number of bytes in the buffer.
-      remaining = (recv_chars + tcp_valid_bytes) - json_start;
     }
-    // Repeat until there are no remaining bytes.
-  } while (remaining > 0);
+    (*seq)++;
+    queued++;
 
-  // Clear the buffer when finished.
-  memset(recv_buffer, 0, ILLEX_DEFAULT_TCP_BUFSIZE);
+    // Move the start to the character after the newline.
+    json_start = json_end + 1;
+  }
+
+  // Keep the remaining characters of an incomplete JSON for the next receive.
+  json_buffer->append(recv_chars + json_start, tcp_valid_bytes - json_start);
 
   return queued;
 }
 
-auto QueueingClient::ReceiveJSONs(LatencyTracker* lat_tracker) -> Status {
-  // Buffer to store the JSON string, is reused to prevent allocations.
-  std::string json_string;
+/**
+ * \brief Enqueue views on all JSONs that were received in a slab.
+ * \param[in]       slab            The slab.
+ * \param[in]       json_start      Offset of the first JSON in the slab.
+ * \param[in]       recv_offset     Offset of the received bytes in the slab.
+ * \param[in]       recv_bytes      Number of received bytes.
+ * \param[out]      queue           The queue to enqueue the JSON views in.
+ * \param[in,out]   seq             The sequence number for the next JSON view, is
+ *                                  increased when a view is enqueued.
+ * \param[in]       receive_time    Point in time when the bytes were received.
+ * \param[in,out]   newlines        Reusable vector for the newline offsets.
+ * \param[in]       send_stamps     Whether the server fills in send stamps.
+ * \param[out]      tracker         Latency tracking device, set to nullptr if unused.
+ * \return The offset of the first byte in the slab that is not part of a queued JSON.
+ */
+static auto EnqueueAllJSONsInSlab(const std::shared_ptr<std::byte>& slab,
+                                  size_t json_start, size_t recv_offset,
+                                  size_t recv_bytes, JSONViewQueue* queue, uint64_t* seq,
+                                  TimePoint receive_time, std::vector<size_t>* newlines,
+                                  bool send_stamps, LatencyTracker* tracker = nullptr)
+    -> size_t {
+  const auto* chars = reinterpret_cast<const char*>(slab.get());
+
+  // Only the received bytes have to be scanned, the bytes before that cannot contain
+  // newlines anymore.
+  newlines->clear();
+  ScanNewlines(slab.get() + recv_offset, recv_bytes, newlines);
+
+  for (auto newline : *newlines) {
+    auto json_end = recv_offset + newline;
+    auto pre_queue_time = Timer::now();
+    std::string_view json(chars + json_start, json_end - json_start);
+    if (tracker != nullptr) {
+      TrackLatency(tracker, *seq, json, send_stamps, receive_time, pre_queue_time);
+    }
+    queue->enqueue(JSONView{*seq, json, slab});
+    (*seq)++;
+    json_start = json_end + 1;
+  }
 
+  return json_start;
+}
+
+auto QueueingClient::ReceiveJSONs(LatencyTracker* lat_tracker) -> Status {
+  ILLEX_ROE(PinThread(cpus));
+  bool done = false;
   // Loop while the socket is still valid.
-  while (client->is_valid()) {
-    try {
-      // Attempt to receive some bytes.
-      auto recv_status = client->recv(buffer, buffer_size);
-      auto receive_time = Timer::now();
-
-      // Perhaps the server disconnected because it's done sending JSONs, check the
-      // status.
-      auto bytes_received = std::get<0>(recv_status);
-      auto sock_status = std::get<1>(recv_status).get_value();
-
-      this->bytes_received_ += bytes_received;
-      // We must now handle the received bytes in the TCP buffer.
-      auto num_enqueued =
-          EnqueueAllJSONsInBuffer(&json_string, buffer, bytes_received, queue, &this->seq,
-                                  receive_time, lat_tracker);
-      this->received_ += num_enqueued;
-
-      if (sock_status == kissnet::socket_status::cleanly_disconnected) {
-        SPDLOG_DEBUG("Server has cleanly disconnected.");
-        return Status::OK();
-      } else if (sock_status != kissnet::socket_status::valid) {
-        // Otherwise, if it's not valid, there is something wrong.
-        return Status(Error::ClientError,
-                      "Server error. Status: " + std::to_string(sock_status));
-      }
-    } catch (const std::exception& e) {
-      // But first we catch any exceptions.
-      return Status(Error::ClientError, e.what());
+  while (!done && client->is_valid()) {
+    ILLEX_ROE(ReceiveOnce(lat_tracker, &done));
+  }
+  return Status::OK();
+}
+
+auto QueueingClient::ReceiveOnce(LatencyTracker* lat_tracker, bool* done) -> Status {
+  const size_t jsons_received = received_;
+  try {
+    size_t bytes_received = 0;
+    int sock_status = kissnet::socket_status::valid;
+    if (view_queue != nullptr) {
+      ILLEX_ROE(ReceiveView(lat_tracker, &bytes_received, &sock_status));
+    } else {
+      ILLEX_ROE(ReceiveItems(lat_tracker, &bytes_received, &sock_status));
+    }
+    this->bytes_received_ += bytes_received;
+    if (live != nullptr) {
+      LiveMetrics::Add(&live->jsons_received, received_ - jsons_received);
+      LiveMetrics::Add(&live->bytes_received, bytes_received);
+    }
+
+    // Perhaps the server disconnected because it's done sending JSONs, check the
+    // status.
+    if (sock_status == kissnet::socket_status::cleanly_disconnected) {
+      SPDLOG_DEBUG("Server has cleanly disconnected.");
+      *done = true;
+    } else if (sock_status != kissnet::socket_status::valid) {
+      // Otherwise, if it's not valid, there is something wrong.
+      return Status(Error::ClientError,
+                    "Server error. Status: " + std::to_string(sock_status));
+    }
+  } catch (const std::exception& e) {
+    // But first we catch any exceptions.
+    return Status(Error::ClientError, e.what());
+  }
+  return Status::OK();
+}
+
+auto QueueingClient::ReceiveItems(LatencyTracker* lat_tracker, size_t* bytes_received,
+                                  int* sock_status) -> Status {
+  // Attempt to receive some bytes.
+  auto recv_status = client->recv(buffer, buffer_size);
+  auto receive_time = Timer::now();
+  *bytes_received = std::get<0>(recv_status);
+  *sock_status = std::get<1>(recv_status).get_value();
+
+  // We must now handle the received bytes in the TCP buffer.
+  auto num_enqueued =
+      EnqueueAllJSONsInBuffer(&json_string, buffer, *bytes_received, queue, &this->seq,
+                              receive_time, &newlines, send_stamps, lat_tracker);
+  this->received_ += num_enqueued;
+  return Status::OK();
+}
+
+auto QueueingClient::ReceiveView(LatencyTracker* lat_tracker, size_t* bytes_received,
+                                 int* sock_status) -> Status {
+  const auto slab_size = pool.slab_size();
+  if (slab == nullptr) {
+    ILLEX_ROE(pool.Acquire(&slab));
+    fill = 0;
+    json_start = 0;
+  } else if (fill == slab_size) {
+    // The slab is full. Continue in a fresh slab. Queued views keep the old slab alive
+    // until they are all released. The bytes of a JSON that was not completely received
+    // yet are the only bytes that need to be copied.
+    auto tail = fill - json_start;
+    if (tail == slab_size) {
+      return Status(Error::ClientError, "JSON larger than receive slab size of " +
+                                            std::to_string(slab_size) + " bytes.");
     }
+    std::shared_ptr<std::byte> next;
+    ILLEX_ROE(pool.Acquire(&next));
+    std::memcpy(next.get(), slab.get() + json_start, tail);
+    slab = std::move(next);
+    fill = tail;
+    json_start = 0;
   }
 
+  // Attempt to receive some bytes.
+  auto recv_status = client->recv(slab.get() + fill, slab_size - fill);
+  auto receive_time = Timer::now();
+  *bytes_received = std::get<0>(recv_status);
+  *sock_status = std::get<1>(recv_status).get_value();
+
+  auto seq_before = this->seq;
+  json_start = EnqueueAllJSONsInSlab(slab, json_start, fill, *bytes_received, view_queue,
+                                     &this->seq, receive_time, &newlines, send_stamps,
+                                     lat_tracker);
+  this->received_ += this->seq - seq_before;
+  fill += *bytes_received;
   return Status::OK();
 }
 
+auto QueueingClient::native_handle() const -> int {
+  return client != nullptr ? static_cast<int>(client->get_native()) : -1;
+}
+
 }  // namespace illex
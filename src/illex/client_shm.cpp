@@ -0,0 +1,113 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/client_shm.h"
+
+#include "illex/latency.h"
+#include "illex/log.h"
+
+namespace illex {
+
+auto RingClient::Create(const RingClientOptions& options, JSONBufferQueue* free,
+                        JSONBufferQueue* filled, RingClient* out) -> Status {
+  if ((free == nullptr) || (filled == nullptr)) {
+    return Status(Error::ClientError, "Cannot create client. Buffer queues missing.");
+  }
+  ILLEX_ROE(ShmRing::Open(options.path, &out->ring));
+  out->free_queue = free;
+  out->filled_queue = filled;
+  out->slots.resize(out->ring.num_slots());
+  out->returned.resize(out->ring.num_slots(), false);
+  out->seq = options.seq;
+  out->send_stamps = options.send_stamps;
+  out->cpus = options.cpus;
+  out->must_be_closed = true;
+  SPDLOG_DEBUG("Mapped ring {} with {} slots of {} bytes.", options.path,
+               out->ring.num_slots(), out->ring.slot_size());
+  return Status::OK();
+}
+
+void RingClient::Reclaim(JSONBuffer* buf) {
+  returned[buf - slots.data()] = true;
+  while ((released < read) && returned[ring.slot_index(released)]) {
+    returned[ring.slot_index(released)] = false;
+    released++;
+  }
+  ring.Release(released);
+}
+
+auto RingClient::ReceiveJSONs(LatencyTracker* lat_tracker) -> Status {
+  if (!must_be_closed) {
+    return Status(Error::ClientError, "Client is closed.");
+  }
+  ILLEX_ROE(PinThread(cpus));
+  JSONBuffer* buf = nullptr;
+  while (true) {
+    // Reclaim all returned buffers.
+    while (free_queue->try_dequeue(buf)) {
+      Reclaim(buf);
+    }
+    // If all slots are handed off, the server cannot continue until one is returned.
+    if (read - released == slots.size()) {
+      free_queue->wait_dequeue(buf);
+      Reclaim(buf);
+      continue;
+    }
+    if (!ring.Wait(read)) {
+      SPDLOG_DEBUG("Server has finished writing to the ring.");
+      break;
+    }
+
+    auto length = ring.slot_length(read);
+    buf = &slots[ring.slot_index(read)];
+    ILLEX_ROE(JSONBuffer::Create(ring.slot(read), length, buf));
+    buf->SetRecvTime(Timer::now());
+
+    auto scan = buf->Scan(length, seq);
+    seq += scan.first;
+    jsons_received_ += scan.first;
+    buf->SetSizeUnsafe(length - scan.second);
+    bytes_received_ += length;
+    read++;
+
+    if (!buf->empty()) {
+      if (lat_tracker != nullptr) {
+        TrackBuffer(lat_tracker, buf, send_stamps);
+      }
+      filled_queue->enqueue(buf);
+    } else {
+      Reclaim(buf);
+    }
+  }
+  return Status::OK();
+}
+
+auto RingClient::Close() -> Status {
+  if (!must_be_closed) {
+    return Status(Error::ClientError, "Client was already closed.");
+  }
+  // Buffers may no longer be used, so release all slots that were handed off.
+  ring.Release(read);
+  released = read;
+  must_be_closed = false;
+  return Status::OK();
+}
+
+RingClient::~RingClient() {
+  if (must_be_closed) {
+    Close();
+  }
+}
+
+}  // namespace illex
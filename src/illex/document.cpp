@@ -26,7 +26,8 @@ namespace illex {
 
 namespace rj = rapidjson;
 
-DocumentGenerator::DocumentGenerator(int seed) : engine_(RandomEngine(seed)) {
+DocumentGenerator::DocumentGenerator(int seed, RandomAlgorithm algorithm)
+    : seed_(seed), engine_(RandomEngine(seed, algorithm)) {
   context_.engine_ = &engine_;
   context_.allocator_ = &doc_.GetAllocator();
   root_ = std::make_shared<Null>();
@@ -46,20 +47,29 @@ auto DocumentGenerator::Get() -> rj::Value {
   return root_->Get();
 }
 
+void DocumentGenerator::Write(Writer* writer) {
+  // Generators without a Write implementation fall back to using the allocator.
+  context_.allocator_->Clear();
+  root_->Write(writer);
+}
+
+void DocumentGenerator::Seek(uint64_t index) { engine_.seed(seed_, index); }
+
 auto DocumentGenerator::GetString(bool pretty) -> std::string {
   rapidjson::StringBuffer buffer;
-  // Generate a value.
-  auto json = this->Get();
   // Check whether we must pretty-prent the JSON
   if (pretty) {
+    // Generate a value.
+    auto json = this->Get();
     rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
     writer.SetFormatOptions(rj::PrettyFormatOptions::kFormatSingleLineArray);
     json.Accept(writer);
   } else {
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    json.Accept(writer);
+    // Write the value without building a DOM first.
+    Writer writer(buffer);
+    this->Write(&writer);
   }
-  return std::string(buffer.GetString());
+  return std::string(buffer.GetString(), buffer.GetSize());
 }
 
 }  // namespace illex
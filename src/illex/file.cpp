@@ -14,57 +14,176 @@
 
 #include "illex/file.h"
 
-#include <chrono>
-#include <fstream>
+#include <putong/timer.h>
+
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
+#include <regex>
 #include <thread>
+#include <vector>
 
+#include "illex/ground_truth.h"
+#include "illex/log.h"
 #include "illex/status.h"
 
 namespace illex {
 
-auto RunFile(const FileOptions& opt, std::ostream* o) -> Status {
+/**
+ * \brief Produce JSONs, and write them to a file and/or an output stream.
+ * \param[in]  opts        The production options.
+ * \param[in]  path        The path of the file, or empty to not write a file.
+ * \param[in]  writer_opts The options for writing the file.
+ * \param[in]  o           The output stream to print the JSONs to, or nullptr.
+ * \param[out] metrics     The production metrics.
+ * \param[out] num_bytes   The number of bytes written to the file.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+static auto ProduceToFile(const ProducerOptions& opts, const std::string& path,
+                          const WriterOptions& writer_opts, std::ostream* o,
+                          ProductionMetrics* metrics, size_t* num_bytes) -> Status {
+  // Open file for writing, if required.
+  std::shared_ptr<FileWriter> writer;
+  if (!path.empty()) {
+    ILLEX_ROE(FileWriter::Open(path, writer_opts, &writer));
+  }
+
   // Produce JSON data.
-  ProductionQueue queue(1, opt.production.num_threads, 0);
+  ProductionQueue queue(opts.queue_capacity);
+  BatchPool pool;
 
   std::atomic<bool> shutdown = false;
   std::shared_ptr<Producer> producer;
-  ILLEX_ROE(Producer::Make(opt.production, &queue, &producer));
+  ILLEX_ROE(Producer::Make(opts, &queue, &pool, &producer));
   producer->Start(&shutdown);
 
-  // Open file for writing, if required.
-  std::ofstream ofs;
-  if (!opt.out_path.empty()) {
-    ofs.open(opt.out_path);
-    if (!ofs.good()) {
-      return Status(Error::IOError, "Could not open " + opt.out_path + " for writing.");
-    }
-  }
-
   // Dump all JSONs.
+  const size_t total = TotalJSONs(opts);
   size_t num_jsons = 0;
+  // Time spent waiting for the producer.
+  double starved = 0.0;
+  Status status;
   JSONBatch batch;
-  while ((num_jsons < (opt.production.num_batches * opt.production.num_jsons)) &&
-         !shutdown.load()) {
-    if (queue.try_dequeue(batch)) {
-      // Print it to stdout if requested.
-      if (opt.production.verbose || opt.out_path.empty()) {
-        (*o) << batch.data;
+  while ((num_jsons < total) && !shutdown.load()) {
+    if (queue.Dequeue(&batch, kShutdownPollInterval, &starved)) {
+      auto data = batch.data();
+      if (o != nullptr) {
+        (*o) << data;
       }
-      // Write it to a file.
-      if (!opt.out_path.empty()) {
-        ofs << batch.data;
+      if (writer != nullptr) {
+        status = writer->Write(data);
       }
       num_jsons += batch.num_jsons;
-    } else {
-      std::this_thread::sleep_for(std::chrono::microseconds(100));
+      // Return the buffer to the pool, so the producer can reuse it.
+      pool.Release(&batch);
+      if (!status.ok()) {
+        shutdown.store(true);
+      }
     }
   }
 
   producer->Finish();
+  ILLEX_ROE(status);
+
+  *metrics = producer->metrics();
+  metrics->starved_time = starved;
+  if (writer != nullptr) {
+    ILLEX_ROE(writer->Close());
+    *num_bytes = writer->num_bytes();
+  }
+  return Status::OK();
+}
+
+/// Return the path of a shard, given a path with an integer conversion.
+static auto ShardPath(const std::string& pattern, size_t shard, std::string* out)
+    -> Status {
+  static const std::regex conversion("[^%]*%0?[0-9]*d[^%]*");
+  if (!std::regex_match(pattern, conversion)) {
+    return Status(Error::CLIError,
+                  "Sharded output path must contain a single integer conversion, e.g. "
+                  "out-%04d.jsonl.");
+  }
+  std::vector<char> buffer(pattern.length() + 32);
+  std::snprintf(buffer.data(), buffer.size(), pattern.c_str(), static_cast<int>(shard));
+  *out = buffer.data();
+  return Status::OK();
+}
+
+auto RunFile(const FileOptions& opt, std::ostream* o) -> Status {
+  auto production = opt.production;
+  if (!opt.arrow_path.empty()) {
+    // The ground truth is generated again from the index of every JSON, so the JSONs
+    // must be as well, and must end up in the file in order of their index.
+    production.deterministic = true;
+    if (!opt.shard && (production.num_threads > 1)) {
+      if (production.batch_bytes > 0) {
+        return Status(Error::CLIError,
+                      "Arrow output of byte-sized batches requires a single thread or "
+                      "sharded output.");
+      }
+      production.ordered = true;
+    }
+  }
+
+  ProductionMetrics metrics;
+  size_t num_bytes = 0;
+  putong::Timer<> t(true);
+
+  if (!opt.shard) {
+    // Print to stdout if requested, or if there is no file.
+    bool print = production.verbose || opt.out_path.empty();
+    ILLEX_ROE(ProduceToFile(production, opt.out_path, opt.writer,
+                            print ? o : nullptr, &metrics, &num_bytes));
+  } else {
+    if (production.verbose || opt.out_path.empty()) {
+      return Status(Error::CLIError, "Sharded output can only be written to files.");
+    }
+    // Every shard gets its own single-threaded producer and writer.
+    const size_t num_shards = std::max<size_t>(1, production.num_threads);
+    std::vector<std::string> paths(num_shards);
+    for (size_t s = 0; s < num_shards; s++) {
+      ILLEX_ROE(ShardPath(opt.out_path, s, &paths[s]));
+    }
+    std::vector<Status> statuses(num_shards);
+    std::vector<ProductionMetrics> shard_metrics(num_shards);
+    std::vector<size_t> shard_bytes(num_shards, 0);
+    std::vector<std::thread> threads;
+    for (size_t s = 0; s < num_shards; s++) {
+      auto shard_opts = PartitionProduction(production, s, num_shards);
+      shard_opts.num_threads = 1;
+      threads.emplace_back([&, s, shard_opts]() {
+        statuses[s] = ProduceToFile(shard_opts, paths[s], opt.writer, nullptr,
+                                    &shard_metrics[s], &shard_bytes[s]);
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    for (size_t s = 0; s < num_shards; s++) {
+      ILLEX_ROE(statuses[s]);
+      metrics += shard_metrics[s];
+      num_bytes += shard_bytes[s];
+    }
+  }
+  t.Stop();
 
   if (!opt.out_path.empty()) {
-    producer->metrics().Log(opt.production.num_threads);
+    metrics.Log(production.num_threads);
+    spdlog::info("Wrote {} bytes in {:.4f} seconds.", num_bytes, t.seconds());
+    spdlog::info("  {:.2f} GB/s.", static_cast<double>(num_bytes) * 1E-9 / t.seconds());
+  }
+
+  if (!opt.arrow_path.empty()) {
+    GroundTruthOptions truth;
+    truth.gen = production.gen;
+    truth.schema = production.schema;
+    truth.num_jsons = TotalJSONs(production);
+    truth.first_json = production.first_json;
+    putong::Timer<> tt(true);
+    ILLEX_ROE(WriteGroundTruth(truth, opt.arrow_path));
+    tt.Stop();
+    spdlog::info("Wrote ground truth of {} JSONs to {} in {:.4f} seconds.",
+                 truth.num_jsons, opt.arrow_path, tt.seconds());
   }
 
   return Status::OK();
@@ -22,6 +22,7 @@
 #include "illex/document.h"
 #include "illex/producer.h"
 #include "illex/status.h"
+#include "illex/writer.h"
 
 namespace illex {
 
@@ -31,6 +32,24 @@ struct FileOptions {
   ProducerOptions production;
   /// The output file path.
   std::string out_path;
+  /// Options for writing the output file.
+  WriterOptions writer;
+  /**
+   * \brief Whether to write one shard per production thread.
+   *
+   * The output path must then contain a single integer conversion of the shard index,
+   * e.g. out-%04d.jsonl. Every shard is produced by its own thread, with its own share
+   * of the JSONs.
+   */
+  bool shard = false;
+  /**
+   * \brief The path of an Arrow IPC file to write the ground truth to, or empty for none.
+   *
+   * The file holds record batches with the same values as the JSONs, in the same order,
+   * see WriteGroundTruth(). This makes the production deterministic, and ordered if it is
+   * neither sharded nor single-threaded.
+   */
+  std::string arrow_path;
 };
 
 /**
@@ -0,0 +1,295 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/ground_truth.h"
+
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+
+#include <functional>
+#include <utility>
+
+#include "illex/arrow.h"
+#include "illex/status.h"
+
+namespace illex {
+
+/// Return the number of days since 1970-01-01 of a date in the proleptic Gregorian
+/// calendar.
+static auto DaysFromCivil(int64_t year, int64_t month, int64_t day) -> int64_t {
+  year -= month <= 2 ? 1 : 0;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int64_t year_of_era = year - era * 400;
+  const int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const int64_t day_of_era =
+      year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+/// Parse a fixed number of decimal digits.
+static auto ParseDigits(std::string_view str, size_t pos, size_t num, int64_t* out)
+    -> bool {
+  int64_t result = 0;
+  for (size_t i = pos; i < pos + num; i++) {
+    if ((str[i] < '0') || (str[i] > '9')) {
+      return false;
+    }
+    result = result * 10 + (str[i] - '0');
+  }
+  *out = result;
+  return true;
+}
+
+auto DateToMillis(std::string_view str, int64_t* out) -> Status {
+  // YYYY-MM-DDTHH:MM:SS+hh:00, see DateString::Format.
+  int64_t y, mo, d, h, mi, s, tz;
+  bool ok = (str.length() == 25) && (str[4] == '-') && (str[7] == '-') &&
+            (str[10] == 'T') && (str[13] == ':') && (str[16] == ':') &&
+            ((str[19] == '+') || (str[19] == '-')) && (str.substr(22) == ":00");
+  ok = ok && ParseDigits(str, 0, 4, &y) && ParseDigits(str, 5, 2, &mo) &&
+       ParseDigits(str, 8, 2, &d) && ParseDigits(str, 11, 2, &h) &&
+       ParseDigits(str, 14, 2, &mi) && ParseDigits(str, 17, 2, &s) &&
+       ParseDigits(str, 20, 2, &tz);
+  if (!ok) {
+    return Status(Error::GenericError, "Malformed date string: " + std::string(str));
+  }
+  if (str[19] == '-') {
+    tz = -tz;
+  }
+  // The timezone is the offset of the local time from UTC.
+  const int64_t seconds = DaysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+  *out = (seconds - tz * 3600) * 1000;
+  return Status::OK();
+}
+
+/// \brief Class to append a generated JSON value to an Arrow array builder of its type.
+class ValueAppender : public arrow::TypeVisitor {
+ public:
+  /// \brief Construct a new ValueAppender, setting the value and the builder.
+  ValueAppender(const rj::Value* value, arrow::ArrayBuilder* builder)
+      : value_(value), builder_(builder) {}
+  /// \brief Append the value to the builder.
+  auto Append() -> arrow::Status { return builder_->type()->Accept(this); }
+
+ protected:
+  /// \brief Visit a StringType.
+  auto Visit(const arrow::StringType& type) -> arrow::Status override {
+    if (!value_->IsString()) {
+      return arrow::Status::Invalid("Expected a string.");
+    }
+    return static_cast<arrow::StringBuilder*>(builder_)->Append(
+        value_->GetString(), static_cast<int32_t>(value_->GetStringLength()));
+  }
+
+  /// \brief Visit a ListType.
+  auto Visit(const arrow::ListType& type) -> arrow::Status override {
+    if (!value_->IsArray()) {
+      return arrow::Status::Invalid("Expected an array.");
+    }
+    auto* builder = static_cast<arrow::ListBuilder*>(builder_);
+    ARROW_RETURN_NOT_OK(builder->Append());
+    for (const auto& item : value_->GetArray()) {
+      ARROW_RETURN_NOT_OK(ValueAppender(&item, builder->value_builder()).Append());
+    }
+    return arrow::Status::OK();
+  }
+
+  /// \brief Visit a FixedSizeListType.
+  auto Visit(const arrow::FixedSizeListType& type) -> arrow::Status override {
+    if (!value_->IsArray() ||
+        (value_->Size() != static_cast<rj::SizeType>(type.list_size()))) {
+      return arrow::Status::Invalid("Expected an array of ", type.list_size(),
+                                    " items.");
+    }
+    auto* builder = static_cast<arrow::FixedSizeListBuilder*>(builder_);
+    ARROW_RETURN_NOT_OK(builder->Append());
+    for (const auto& item : value_->GetArray()) {
+      ARROW_RETURN_NOT_OK(ValueAppender(&item, builder->value_builder()).Append());
+    }
+    return arrow::Status::OK();
+  }
+
+  /// \brief Visit a StructType.
+  auto Visit(const arrow::StructType& type) -> arrow::Status override {
+    if (!value_->IsObject()) {
+      return arrow::Status::Invalid("Expected an object.");
+    }
+    auto* builder = static_cast<arrow::StructBuilder*>(builder_);
+    ARROW_RETURN_NOT_OK(builder->Append());
+    for (int i = 0; i < type.num_fields(); i++) {
+      const auto& name = type.field(i)->name();
+      auto member = value_->FindMember(name.c_str());
+      if (member == value_->MemberEnd()) {
+        return arrow::Status::Invalid("Missing member ", name, ".");
+      }
+      auto appender = ValueAppender(&member->value, builder->field_builder(i));
+      ARROW_RETURN_NOT_OK(appender.Append());
+    }
+    return arrow::Status::OK();
+  }
+
+  /// \brief Visit a UInt64Type.
+  auto Visit(const arrow::UInt64Type& type) -> arrow::Status override {
+    if (!value_->IsUint64()) {
+      return arrow::Status::Invalid("Expected an unsigned integer.");
+    }
+    return static_cast<arrow::UInt64Builder*>(builder_)->Append(value_->GetUint64());
+  }
+
+  /// \brief Visit a BooleanType.
+  auto Visit(const arrow::BooleanType& type) -> arrow::Status override {
+    if (!value_->IsBool()) {
+      return arrow::Status::Invalid("Expected a boolean.");
+    }
+    return static_cast<arrow::BooleanBuilder*>(builder_)->Append(value_->GetBool());
+  }
+
+  /// \brief Visit a Date64Type.
+  auto Visit(const arrow::Date64Type& type) -> arrow::Status override {
+    if (!value_->IsString()) {
+      return arrow::Status::Invalid("Expected a date string.");
+    }
+    int64_t millis = 0;
+    auto status = DateToMillis(
+        std::string_view(value_->GetString(), value_->GetStringLength()), &millis);
+    if (!status.ok()) {
+      return arrow::Status::Invalid(status.msg());
+    }
+    return static_cast<arrow::Date64Builder*>(builder_)->Append(millis);
+  }
+
+  /// The value to append.
+  const rj::Value* value_ = nullptr;
+  /// The builder to append the value to.
+  arrow::ArrayBuilder* builder_ = nullptr;
+};
+
+auto RecordBatchAppender::Make(const std::shared_ptr<arrow::Schema>& schema,
+                               std::unique_ptr<RecordBatchAppender>* out) -> Status {
+  if (schema == nullptr) {
+    return Status(Error::GenericError, "Record batch appender requires a schema.");
+  }
+  auto result = std::unique_ptr<RecordBatchAppender>(new RecordBatchAppender());
+  result->schema_ = schema;
+  auto status = arrow::RecordBatchBuilder::Make(schema, arrow::default_memory_pool(),
+                                                &result->builder_);
+  if (!status.ok()) {
+    return Status(Error::GenericError, status.message());
+  }
+  *out = std::move(result);
+  return Status::OK();
+}
+
+auto RecordBatchAppender::Append(const rj::Value& json) -> Status {
+  if (!json.IsObject()) {
+    return Status(Error::GenericError, "Rows must be JSON objects.");
+  }
+  for (int i = 0; i < schema_->num_fields(); i++) {
+    const auto& name = schema_->field(i)->name();
+    auto member = json.FindMember(name.c_str());
+    if (member == json.MemberEnd()) {
+      return Status(Error::GenericError, "Missing member " + name + ".");
+    }
+    auto status = ValueAppender(&member->value, builder_->GetField(i)).Append();
+    if (!status.ok()) {
+      return Status(Error::GenericError,
+                    "Could not append member " + name + ": " + status.message());
+    }
+  }
+  num_rows_++;
+  return Status::OK();
+}
+
+auto RecordBatchAppender::Flush(std::shared_ptr<arrow::RecordBatch>* out) -> Status {
+  auto status = builder_->Flush(out);
+  if (!status.ok()) {
+    return Status(Error::GenericError, status.message());
+  }
+  num_rows_ = 0;
+  return Status::OK();
+}
+
+/// A function to hand off a record batch of ground truth to.
+using BatchConsumer = std::function<Status(std::shared_ptr<arrow::RecordBatch>)>;
+
+/// Generate the ground truth of a range of JSONs, handing off every record batch.
+static auto Generate(const GroundTruthOptions& opts, const BatchConsumer& consume)
+    -> Status {
+  if (opts.max_rows == 0) {
+    return Status(Error::GenericError, "Record batches must hold at least one row.");
+  }
+  std::unique_ptr<RecordBatchAppender> appender;
+  ILLEX_ROE(RecordBatchAppender::Make(opts.schema, &appender));
+  ILLEX_ROE(ValidateSchema(*opts.schema));
+
+  auto gen = FromArrowSchema(*opts.schema, opts.gen);
+  for (size_t i = 0; i < opts.num_jsons; i++) {
+    // Reseed like the deterministic producer, and build the DOM of the same JSON.
+    gen.Seek(opts.first_json + i);
+    ILLEX_ROE(appender->Append(gen.Get()));
+    if ((appender->num_rows() == opts.max_rows) || (i + 1 == opts.num_jsons)) {
+      std::shared_ptr<arrow::RecordBatch> batch;
+      ILLEX_ROE(appender->Flush(&batch));
+      ILLEX_ROE(consume(std::move(batch)));
+    }
+  }
+  return Status::OK();
+}
+
+auto GenerateGroundTruth(const GroundTruthOptions& opts,
+                         std::vector<std::shared_ptr<arrow::RecordBatch>>* out)
+    -> Status {
+  return Generate(opts, [out](std::shared_ptr<arrow::RecordBatch> batch) {
+    out->push_back(std::move(batch));
+    return Status::OK();
+  });
+}
+
+auto WriteGroundTruth(const GroundTruthOptions& opts, const std::string& path)
+    -> Status {
+  if (opts.schema == nullptr) {
+    return Status(Error::GenericError, "Ground truth requires a schema.");
+  }
+  auto file = arrow::io::FileOutputStream::Open(path);
+  if (!file.ok()) {
+    return Status(Error::IOError, file.status().message());
+  }
+  auto sink = file.ValueOrDie();
+  auto writer = arrow::ipc::MakeFileWriter(sink, opts.schema);
+  if (!writer.ok()) {
+    return Status(Error::IOError, writer.status().message());
+  }
+  auto batch_writer = writer.ValueOrDie();
+
+  ILLEX_ROE(Generate(opts, [&](std::shared_ptr<arrow::RecordBatch> batch) {
+    auto status = batch_writer->WriteRecordBatch(*batch);
+    if (!status.ok()) {
+      return Status(Error::IOError, status.message());
+    }
+    return Status::OK();
+  }));
+
+  // Closing the writer writes the footer, but does not close the file.
+  auto status = batch_writer->Close();
+  if (status.ok()) {
+    status = sink->Close();
+  }
+  if (!status.ok()) {
+    return Status(Error::IOError, status.message());
+  }
+  return Status::OK();
+}
+
+}  // namespace illex
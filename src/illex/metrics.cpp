@@ -0,0 +1,308 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/metrics.h"
+
+#include <poll.h>
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "illex/log.h"
+
+namespace illex {
+
+namespace kn = kissnet;
+
+/// The time to wait for a scrape, or for its request, before checking for a stop.
+constexpr int kPollTimeoutMs = 100;
+/// The number of polls to wait for the request of a scrape.
+constexpr int kRequestPolls = 10;
+
+auto MetricsSnapshot::Take(const LiveMetrics& live) -> MetricsSnapshot {
+  constexpr auto relaxed = std::memory_order_relaxed;
+  auto seconds = [](const std::atomic<uint64_t>& ns) {
+    return static_cast<double>(ns.load(relaxed)) * 1E-9;
+  };
+  MetricsSnapshot result;
+  result.time = std::chrono::steady_clock::now();
+  result.jsons_produced = live.jsons_produced.load(relaxed);
+  result.bytes_produced = live.bytes_produced.load(relaxed);
+  result.producer_blocked = seconds(live.producer_blocked_ns);
+  result.jsons_sent = live.jsons_sent.load(relaxed);
+  result.bytes_sent = live.bytes_sent.load(relaxed);
+  result.sender_starved = seconds(live.sender_starved_ns);
+  result.queue_depth = live.queue_depth.load(relaxed);
+  result.jsons_received = live.jsons_received.load(relaxed);
+  result.bytes_received = live.bytes_received.load(relaxed);
+  result.decompress_time = seconds(live.decompress_ns);
+  return result;
+}
+
+auto MetricsInterval::Between(const MetricsSnapshot& first, const MetricsSnapshot& last)
+    -> MetricsInterval {
+  MetricsInterval result;
+  result.seconds = std::chrono::duration<double>(last.time - first.time).count();
+  result.queue_depth = last.queue_depth;
+  if (result.seconds <= 0.0) {
+    return result;
+  }
+  auto rate = [&](uint64_t a, uint64_t b) {
+    return static_cast<double>(b - a) / result.seconds;
+  };
+  result.jsons_produced_per_second = rate(first.jsons_produced, last.jsons_produced);
+  result.jsons_sent_per_second = rate(first.jsons_sent, last.jsons_sent);
+  result.bits_sent_per_second = 8.0 * rate(first.bytes_sent, last.bytes_sent);
+  result.jsons_received_per_second = rate(first.jsons_received, last.jsons_received);
+  result.bits_received_per_second = 8.0 * rate(first.bytes_received, last.bytes_received);
+  auto fraction = [&](double a, double b) { return (b - a) / result.seconds; };
+  result.producer_blocked = fraction(first.producer_blocked, last.producer_blocked);
+  result.sender_starved = fraction(first.sender_starved, last.sender_starved);
+  return result;
+}
+
+void MetricsInterval::Log() const {
+  spdlog::info(
+      "Produced {:.1f} JSON/s | Sent {:.1f} JSON/s, {:.4f} Gbit/s | "
+      "Received {:.1f} JSON/s, {:.4f} Gbit/s | Queue {} | Blocked {:.1f}% | "
+      "Starved {:.1f}%",
+      jsons_produced_per_second, jsons_sent_per_second, bits_sent_per_second * 1E-9,
+      jsons_received_per_second, bits_received_per_second * 1E-9, queue_depth,
+      producer_blocked * 100.0, sender_starved * 100.0);
+}
+
+/// Append a single Prometheus metric with its help and type.
+template <typename T>
+static void AppendMetric(std::string* out, std::string_view name, std::string_view type,
+                         std::string_view help, T value) {
+  out->append("# HELP illex_").append(name).append(" ").append(help).append("\n");
+  out->append("# TYPE illex_").append(name).append(" ").append(type).append("\n");
+  out->append("illex_").append(name).append(" ").append(std::to_string(value));
+  out->append("\n");
+}
+
+auto ToPrometheus(const MetricsSnapshot& snapshot, const MetricsInterval& interval)
+    -> std::string {
+  std::string result;
+  AppendMetric(&result, "jsons_produced_total", "counter", "Number of JSONs produced.",
+               snapshot.jsons_produced);
+  AppendMetric(&result, "bytes_produced_total", "counter", "Number of bytes produced.",
+               snapshot.bytes_produced);
+  AppendMetric(&result, "producer_blocked_seconds_total", "counter",
+               "Time producers were blocked on a full queue.", snapshot.producer_blocked);
+  AppendMetric(&result, "jsons_sent_total", "counter", "Number of JSONs sent.",
+               snapshot.jsons_sent);
+  AppendMetric(&result, "bytes_sent_total", "counter", "Number of bytes sent.",
+               snapshot.bytes_sent);
+  AppendMetric(&result, "sender_starved_seconds_total", "counter",
+               "Time senders waited for batches.", snapshot.sender_starved);
+  AppendMetric(&result, "queue_depth", "gauge", "Number of ready batches in the queue.",
+               snapshot.queue_depth);
+  AppendMetric(&result, "jsons_received_total", "counter", "Number of JSONs received.",
+               snapshot.jsons_received);
+  AppendMetric(&result, "bytes_received_total", "counter", "Number of bytes received.",
+               snapshot.bytes_received);
+  AppendMetric(&result, "decompress_seconds_total", "counter",
+               "Time clients spent decompressing frames.", snapshot.decompress_time);
+  AppendMetric(&result, "jsons_sent_per_second", "gauge",
+               "JSONs sent per second over the last interval.",
+               interval.jsons_sent_per_second);
+  AppendMetric(&result, "bits_sent_per_second", "gauge",
+               "Bits sent per second over the last interval.",
+               interval.bits_sent_per_second);
+  AppendMetric(&result, "jsons_received_per_second", "gauge",
+               "JSONs received per second over the last interval.",
+               interval.jsons_received_per_second);
+  AppendMetric(&result, "bits_received_per_second", "gauge",
+               "Bits received per second over the last interval.",
+               interval.bits_received_per_second);
+  return result;
+}
+
+auto ToJSON(const MetricsSnapshot& snapshot, const MetricsInterval& interval)
+    -> std::string {
+  std::string result = "{";
+  auto member = [&](std::string_view name, auto value) {
+    if (result.size() > 1) {
+      result.append(",");
+    }
+    result.append("\"").append(name).append("\":").append(std::to_string(value));
+  };
+  member("jsons_produced", snapshot.jsons_produced);
+  member("bytes_produced", snapshot.bytes_produced);
+  member("producer_blocked_seconds", snapshot.producer_blocked);
+  member("jsons_sent", snapshot.jsons_sent);
+  member("bytes_sent", snapshot.bytes_sent);
+  member("sender_starved_seconds", snapshot.sender_starved);
+  member("queue_depth", snapshot.queue_depth);
+  member("jsons_received", snapshot.jsons_received);
+  member("bytes_received", snapshot.bytes_received);
+  member("decompress_seconds", snapshot.decompress_time);
+  member("interval_seconds", interval.seconds);
+  member("jsons_produced_per_second", interval.jsons_produced_per_second);
+  member("jsons_sent_per_second", interval.jsons_sent_per_second);
+  member("bits_sent_per_second", interval.bits_sent_per_second);
+  member("jsons_received_per_second", interval.jsons_received_per_second);
+  member("bits_received_per_second", interval.bits_received_per_second);
+  member("producer_blocked", interval.producer_blocked);
+  member("sender_starved", interval.sender_starved);
+  result.append("}");
+  return result;
+}
+
+auto MetricsReporter::Start(const MetricsOptions& options, const LiveMetrics* live,
+                            std::unique_ptr<MetricsReporter>* out) -> Status {
+  assert(live != nullptr);
+  assert(out != nullptr);
+  auto result = std::unique_ptr<MetricsReporter>(new MetricsReporter());
+  result->options_ = options;
+  result->live_ = live;
+
+  if (options.port > 0) {
+    result->socket_ =
+        std::make_unique<Socket>(kn::endpoint("0.0.0.0:" + std::to_string(options.port)));
+    try {
+      result->socket_->bind();
+    } catch (const std::runtime_error& e) {
+      return Status(Error::ServerError, e.what());
+    }
+    result->socket_->listen();
+    spdlog::info("Serving metrics on port {}...", options.port);
+    result->server_ = std::thread([r = result.get()]() { r->ServeLoop(); });
+  }
+  auto first = MetricsSnapshot::Take(*live);
+  result->reporter_ = std::thread([r = result.get(), first]() { r->ReportLoop(first); });
+
+  *out = std::move(result);
+  return Status::OK();
+}
+
+void MetricsReporter::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stopped_.notify_all();
+  if (reporter_.joinable()) {
+    reporter_.join();
+  }
+  if (server_.joinable()) {
+    server_.join();
+  }
+  if (socket_ != nullptr) {
+    socket_->close();
+    socket_ = nullptr;
+  }
+}
+
+MetricsReporter::~MetricsReporter() { Stop(); }
+
+void MetricsReporter::ReportLoop(MetricsSnapshot previous) {
+  const auto interval = options_.interval_ms > 0
+                            ? std::chrono::milliseconds(options_.interval_ms)
+                            : kDefaultInterval;
+  auto next = previous.time + interval;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopped_.wait_until(lock, next, [this]() { return stop_; })) {
+    auto current = MetricsSnapshot::Take(*live_);
+    last_ = MetricsInterval::Between(previous, current);
+    previous = current;
+    // Skip intervals that were missed, rather than reporting them in a burst.
+    next += interval;
+    if (next <= current.time) {
+      next = current.time + interval;
+    }
+    if (options_.interval_ms > 0) {
+      last_.Log();
+    }
+  }
+}
+
+void MetricsReporter::ServeLoop() {
+  struct pollfd pfd = {socket_->get_native(), POLLIN, 0};
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_) {
+        return;
+      }
+    }
+    if (poll(&pfd, 1, kPollTimeoutMs) <= 0) {
+      continue;
+    }
+    try {
+      auto client = socket_->accept();
+      Serve(&client);
+      client.close();
+    } catch (const std::exception& e) {
+      spdlog::warn("Could not serve metrics: {}", e.what());
+    }
+  }
+}
+
+void MetricsReporter::Serve(Socket* client) {
+  // Wait for the request line, so a silent client cannot stall the endpoint.
+  struct pollfd pfd = {client->get_native(), POLLIN, 0};
+  int polls = 0;
+  while (poll(&pfd, 1, kPollTimeoutMs) <= 0) {
+    if (++polls == kRequestPolls) {
+      return;
+    }
+  }
+  std::array<std::byte, 4096> request{};
+  auto size = std::get<0>(client->recv(request.data(), request.size()));
+  std::string_view line(reinterpret_cast<const char*>(request.data()), size);
+  line = line.substr(0, line.find('\r'));
+
+  // Only the path of the request line matters.
+  std::string body;
+  std::string content_type;
+  std::string code = "200 OK";
+  auto snapshot = MetricsSnapshot::Take(*live_);
+  MetricsInterval interval;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    interval = last_;
+  }
+  if ((line.rfind("GET /metrics ", 0) == 0) || (line.rfind("GET / ", 0) == 0)) {
+    body = ToPrometheus(snapshot, interval);
+    content_type = "text/plain; version=0.0.4";
+  } else if (line.rfind("GET /metrics.json ", 0) == 0) {
+    body = ToJSON(snapshot, interval);
+    content_type = "application/json";
+  } else {
+    code = "404 Not Found";
+    body = "Not found.\n";
+    content_type = "text/plain";
+  }
+
+  std::string response = "HTTP/1.1 " + code + "\r\nContent-Type: " + content_type +
+                         "\r\nContent-Length: " + std::to_string(body.size()) +
+                         "\r\nConnection: close\r\n\r\n" + body;
+  size_t sent = 0;
+  while (sent < response.size()) {
+    auto result = client->send(reinterpret_cast<const std::byte*>(response.data()) + sent,
+                               response.size() - sent);
+    if (std::get<1>(result) != kn::socket_status::valid) {
+      return;
+    }
+    sent += std::get<0>(result);
+  }
+}
+
+}  // namespace illex
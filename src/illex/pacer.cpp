@@ -0,0 +1,117 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/pacer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "illex/log.h"
+
+namespace illex {
+
+using Seconds = std::chrono::duration<double>;
+
+auto Pacer::Fits(size_t jsons, size_t bytes) const -> bool {
+  if (jsons <= 1) {
+    return true;
+  }
+  const double quantum = Seconds(kQuantum).count();
+  if ((options_.jsons_per_second > 0.0) &&
+      (static_cast<double>(jsons) > options_.jsons_per_second * quantum)) {
+    return false;
+  }
+  if ((options_.bits_per_second > 0.0) &&
+      (static_cast<double>(bytes) * 8.0 > options_.bits_per_second * quantum)) {
+    return false;
+  }
+  return true;
+}
+
+void Pacer::Wait(size_t jsons, size_t bytes) {
+  auto now = Clock::now();
+  if (!started_) {
+    started_ = true;
+    start_ = now;
+    next_ = now;
+  }
+
+  // Do not let the schedule fall behind further than the burst allowance, so a stall is
+  // not followed by an unbounded burst.
+  next_ = std::max(next_, now - std::chrono::duration_cast<Clock::duration>(kBurst));
+  const auto scheduled = next_;
+
+  // Sleep for most of the time, and spin for the last part.
+  if (scheduled - now > kSpin) {
+    std::this_thread::sleep_for(scheduled - now - kSpin);
+  }
+  while ((now = Clock::now()) < scheduled) {
+  }
+
+  auto lateness = Seconds(now - scheduled).count();
+  metrics_.num_sends++;
+  metrics_.total_lateness += lateness;
+  metrics_.max_lateness = std::max(metrics_.max_lateness, lateness);
+
+  // Advance the schedule by the time the rates allow for these JSONs and bytes.
+  double cost = 0.0;
+  if (options_.jsons_per_second > 0.0) {
+    cost = std::max(cost, static_cast<double>(jsons) / options_.jsons_per_second);
+  }
+  if (options_.bits_per_second > 0.0) {
+    cost = std::max(cost, static_cast<double>(bytes) * 8.0 / options_.bits_per_second);
+  }
+  next_ += std::chrono::duration_cast<Clock::duration>(Seconds(cost));
+
+  jsons_ += jsons;
+  bytes_ += bytes;
+}
+
+void Pacer::Stop() {
+  // The last send is only complete once the time its rate allows has passed.
+  end_ = std::max(Clock::now(), next_);
+}
+
+auto Pacer::metrics() const -> PacingMetrics {
+  auto result = metrics_;
+  result.target_jsons_per_second = options_.jsons_per_second;
+  result.target_bits_per_second = options_.bits_per_second;
+  if (started_ && (end_ > start_)) {
+    auto elapsed = Seconds(end_ - start_).count();
+    result.jsons_per_second = static_cast<double>(jsons_) / elapsed;
+    result.bits_per_second = static_cast<double>(bytes_) * 8.0 / elapsed;
+  }
+  return result;
+}
+
+void PacingMetrics::Log() const {
+  if (target_jsons_per_second > 0.0) {
+    spdlog::info("  Paced at {:.1f} JSON/s, target {:.1f} JSON/s ({:+.3f}%).",
+                 jsons_per_second, target_jsons_per_second,
+                 (jsons_per_second / target_jsons_per_second - 1.0) * 100.0);
+  }
+  if (target_bits_per_second > 0.0) {
+    spdlog::info("  Paced at {:.4f} Gbit/s, target {:.4f} Gbit/s ({:+.3f}%).",
+                 bits_per_second * 1E-9, target_bits_per_second * 1E-9,
+                 (bits_per_second / target_bits_per_second - 1.0) * 100.0);
+  }
+  if (num_sends > 0) {
+    spdlog::info("  Sends started {:.2f} us late on average, {:.2f} us at most.",
+                 total_lateness / static_cast<double>(num_sends) * 1E6,
+                 max_lateness * 1E6);
+  }
+}
+
+}  // namespace illex
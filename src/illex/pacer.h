@@ -0,0 +1,137 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace illex {
+
+/// Options for rate-paced streaming. A rate of zero means it is not limited.
+struct PacingOptions {
+  /// The target number of JSONs per second.
+  double jsons_per_second = 0.0;
+  /// The target number of bits per second.
+  double bits_per_second = 0.0;
+
+  /// \brief Return whether any rate is limited.
+  [[nodiscard]] auto enabled() const -> bool {
+    return (jsons_per_second > 0.0) || (bits_per_second > 0.0);
+  }
+};
+
+/// Statistics of rate-paced streaming.
+struct PacingMetrics {
+  /// The sum of the target JSON rates.
+  double target_jsons_per_second = 0.0;
+  /// The sum of the target bit rates.
+  double target_bits_per_second = 0.0;
+  /// The sum of the achieved JSON rates.
+  double jsons_per_second = 0.0;
+  /// The sum of the achieved bit rates.
+  double bits_per_second = 0.0;
+  /// The number of paced sends.
+  size_t num_sends = 0;
+  /// The total time by which sends started later than scheduled.
+  double total_lateness = 0.0;
+  /// The maximum time by which a send started later than scheduled.
+  double max_lateness = 0.0;
+
+  inline auto operator+=(const PacingMetrics& rhs) -> PacingMetrics& {
+    target_jsons_per_second += rhs.target_jsons_per_second;
+    target_bits_per_second += rhs.target_bits_per_second;
+    jsons_per_second += rhs.jsons_per_second;
+    bits_per_second += rhs.bits_per_second;
+    num_sends += rhs.num_sends;
+    total_lateness += rhs.total_lateness;
+    max_lateness = std::max(max_lateness, rhs.max_lateness);
+    return *this;
+  }
+
+  void Log() const;
+};
+
+/**
+ * \brief Paces sends according to a token bucket.
+ *
+ * Every send is scheduled on a virtual clock that advances by the time the rate allows
+ * for the sent JSONs and bytes. If both a JSON rate and a bit rate are set, both apply.
+ * Waiting is done by sleeping for most of the time, and spinning for the last part, so
+ * sends start with sub-millisecond precision. When sends fall behind schedule, e.g.
+ * because production cannot keep up, at most a small burst is allowed to catch up.
+ */
+class Pacer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /// The amount of time worth of data to send at once.
+  static constexpr std::chrono::microseconds kQuantum{100};
+  /// The amount of time by which sends may catch up after falling behind.
+  static constexpr std::chrono::microseconds kBurst{1000};
+  /// The remaining waiting time below which the pacer spins instead of sleeping.
+  static constexpr std::chrono::microseconds kSpin{100};
+
+  Pacer() = default;
+  explicit Pacer(const PacingOptions& options) : options_(options) {}
+
+  /// \brief Return whether this pacer limits any rate.
+  [[nodiscard]] auto enabled() const -> bool { return options_.enabled(); }
+
+  /**
+   * \brief Return whether a chunk of JSONs fits in a single pacing quantum.
+   *
+   * This can be used to split batches into chunks that are sent smoothly. A single JSON
+   * always fits.
+   *
+   * \param jsons The number of JSONs in the chunk.
+   * \param bytes The number of bytes in the chunk.
+   * \return True if the chunk fits, false otherwise.
+   */
+  [[nodiscard]] auto Fits(size_t jsons, size_t bytes) const -> bool;
+
+  /**
+   * \brief Wait until a number of JSONs and bytes may be sent.
+   * \param jsons The number of JSONs to send.
+   * \param bytes The number of bytes to send.
+   */
+  void Wait(size_t jsons, size_t bytes);
+
+  /// \brief Mark the end of pacing, to calculate the achieved rates.
+  void Stop();
+
+  /// \brief Return the statistics of this pacer.
+  [[nodiscard]] auto metrics() const -> PacingMetrics;
+
+ private:
+  /// The pacing options.
+  PacingOptions options_;
+  /// Whether the first send was paced.
+  bool started_ = false;
+  /// The time of the first send.
+  Clock::time_point start_;
+  /// The time at which the next send is scheduled.
+  Clock::time_point next_;
+  /// The time at which pacing ended.
+  Clock::time_point end_;
+  /// The number of paced JSONs.
+  size_t jsons_ = 0;
+  /// The number of paced bytes.
+  size_t bytes_ = 0;
+  /// Statistics.
+  PacingMetrics metrics_;
+};
+
+}  // namespace illex
@@ -0,0 +1,309 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/plan.h"
+
+#include <rapidjson/internal/itoa.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "illex/status.h"
+#include "illex/value.h"
+
+namespace illex {
+
+/// Maximum number of characters of a 64-bit integer, including its sign.
+constexpr size_t kMaxIntLength = 20;
+
+auto Plan::Compile(const Value& root, Plan* out) -> Status {
+  Plan result;
+  ILLEX_ROE(root.Compile(&result));
+  result.counters_.resize(result.max_depth_);
+  *out = std::move(result);
+  return Status::OK();
+}
+
+void Plan::AddLiteral(std::string_view bytes) {
+  if (bytes.empty()) {
+    return;
+  }
+  // If the previous op emits the last bytes in the pool, extend it, so consecutive
+  // constants such as closing brackets, separators and keys are copied as one fragment.
+  // This never merges across a jump target; list body ops always follow a begin op,
+  // and ops after a list always follow an end op.
+  if (!ops_.empty()) {
+    auto& last = ops_.back();
+    if ((last.code == OpCode::Literal) && (last.a + last.b == literals_.size())) {
+      last.b += bytes.length();
+      literals_.append(bytes);
+      return;
+    }
+  }
+  AddOp({OpCode::Literal, literals_.size(), bytes.length()});
+  literals_.append(bytes);
+}
+
+auto Plan::literal(const Op& op) const -> std::string_view {
+  assert(op.code == OpCode::Literal);
+  return std::string_view(literals_.data() + op.a, op.b);
+}
+
+auto Plan::AddOp(Op op) -> size_t {
+  ops_.push_back(op);
+  return ops_.size() - 1;
+}
+
+auto Plan::AddDate(const DateString& date) -> size_t {
+  dates_.push_back(date);
+  return dates_.size() - 1;
+}
+
+auto Plan::AddPool(const Pool& pool) -> size_t {
+  // Appending to the literal pool prevents the next literal from being merged into the
+  // previous one.
+  pools_.push_back({literals_.size(), pool.offsets(), pool.distribution()});
+  literals_.append(pool.serialized());
+  return pools_.size() - 1;
+}
+
+auto Plan::BeginList(OpCode code, uint64_t a, uint64_t b) -> size_t {
+  depth_++;
+  max_depth_ = std::max(max_depth_, depth_);
+  return AddOp({code, a, b});
+}
+
+void Plan::EndList(size_t begin) {
+  // The end op jumps back to the first op of the list body, the begin op jumps to the
+  // end op when the list is empty.
+  auto end = AddOp({OpCode::EndList, 0, 0, begin + 1});
+  ops_[begin].jump = end;
+  depth_--;
+}
+
+void RegionStream::Reset(char* data, size_t capacity) {
+  data_ = data;
+  capacity_ = capacity;
+  size_ = 0;
+  mark_ = 0;
+  spilling_ = false;
+  spill_.clear();
+}
+
+auto RegionStream::Spill(size_t n) -> char* {
+  if (!spilling_) {
+    spill_.assign(data_ + mark_, size_ - mark_);
+    size_ = mark_;
+    spilling_ = true;
+  }
+  spill_.resize(spill_.size() + n);
+  return spill_.data() + spill_.size() - n;
+}
+
+template <typename Stream>
+void Plan::Write(RandomEngine* engine, Stream* out) {
+  if (counters_.size() < max_depth_) {
+    counters_.resize(max_depth_);
+  }
+  const Op* ops = ops_.data();
+  const size_t num_ops = ops_.size();
+  size_t* counters = counters_.data();
+  size_t depth = 0;
+  size_t pc = 0;
+
+  // Note that every op must draw from the engine in exactly the same way as the value
+  // generator it was lowered from, so the plan generates the same JSONs as the tree.
+  while (pc < num_ops) {
+    const Op& op = ops[pc];
+    switch (op.code) {
+      case OpCode::Literal: {
+        std::memcpy(out->Push(op.b), literals_.data() + op.a, op.b);
+        break;
+      }
+      case OpCode::Bool: {
+        if ((*engine)() % 2 == 0) {
+          std::memcpy(out->Push(4), "true", 4);
+        } else {
+          std::memcpy(out->Push(5), "false", 5);
+        }
+        break;
+      }
+      case OpCode::UInt64: {
+        auto value = UniformIntDistribution<uint64_t>(op.a, op.b)(*engine);
+        char* begin = out->Push(kMaxIntLength);
+        char* end = rj::internal::u64toa(value, begin);
+        out->Pop(kMaxIntLength - (end - begin));
+        break;
+      }
+      case OpCode::Int64: {
+        auto value = UniformIntDistribution<int64_t>(static_cast<int64_t>(op.a),
+                                                     static_cast<int64_t>(op.b))(*engine);
+        char* begin = out->Push(kMaxIntLength);
+        char* end = rj::internal::i64toa(value, begin);
+        out->Pop(kMaxIntLength - (end - begin));
+        break;
+      }
+      case OpCode::String: {
+        auto length = UniformIntDistribution<size_t>(op.a, op.b)(*engine);
+        char* dst = out->Push(length + 2);
+        dst[0] = '"';
+        engine->FillChars(dst + 1, length, 'a', 'z');
+        dst[length + 1] = '"';
+        break;
+      }
+      case OpCode::Date: {
+        char* dst = out->Push(DateString::kMaxLength + 2);
+        dst[0] = '"';
+        auto length = dates_[op.a].Format(engine, dst + 1);
+        dst[length + 1] = '"';
+        out->Pop(DateString::kMaxLength - length);
+        break;
+      }
+      case OpCode::Pooled: {
+        auto& pool = pools_[op.a];
+        auto i = pool.dist(*engine);
+        auto length = pool.offsets[i + 1] - pool.offsets[i];
+        std::memcpy(out->Push(length), literals_.data() + pool.base + pool.offsets[i],
+                    length);
+        break;
+      }
+      case OpCode::BeginList:
+      case OpCode::BeginFixedList: {
+        size_t length = op.a;
+        if (op.code == OpCode::BeginList) {
+          auto drawn = UniformIntDistribution<int32_t>(op.a, op.b)(*engine);
+          length = drawn > 0 ? drawn : 0;
+        }
+        out->Put('[');
+        if (length == 0) {
+          // Skip the list body entirely.
+          out->Put(']');
+          pc = op.jump + 1;
+          continue;
+        }
+        counters[depth++] = length;
+        break;
+      }
+      case OpCode::EndList: {
+        if (--counters[depth - 1] > 0) {
+          // Repeat the list body for the next item.
+          out->Put(',');
+          pc = op.jump;
+          continue;
+        }
+        depth--;
+        out->Put(']');
+        break;
+      }
+    }
+    pc++;
+  }
+}
+
+template void Plan::Write(RandomEngine* engine, rj::StringBuffer* out);
+template void Plan::Write(RandomEngine* engine, RegionStream* out);
+
+auto Value::Compile(Plan* plan) const -> Status {
+  return Status(Error::GenericError, "Value generator does not support compilation.");
+}
+
+auto Null::Compile(Plan* plan) const -> Status {
+  plan->AddLiteral("null");
+  return Status::OK();
+}
+
+auto Bool::Compile(Plan* plan) const -> Status {
+  plan->AddOp({OpCode::Bool});
+  return Status::OK();
+}
+
+template <typename T>
+auto Int<T>::Compile(Plan* plan) const -> Status {
+  // All integer types are widened to 64 bits, which yields the same values.
+  if constexpr (std::is_signed_v<T>) {
+    plan->AddOp({OpCode::Int64, static_cast<uint64_t>(static_cast<int64_t>(dist_.min())),
+                 static_cast<uint64_t>(static_cast<int64_t>(dist_.max()))});
+  } else {
+    plan->AddOp({OpCode::UInt64, dist_.min(), dist_.max()});
+  }
+  return Status::OK();
+}
+
+template class Int<int8_t>;
+template class Int<int16_t>;
+template class Int<int32_t>;
+template class Int<int64_t>;
+template class Int<uint8_t>;
+template class Int<uint16_t>;
+template class Int<uint32_t>;
+template class Int<uint64_t>;
+
+auto String::Compile(Plan* plan) const -> Status {
+  plan->AddOp({OpCode::String, length_min_, length_max_});
+  return Status::OK();
+}
+
+auto DateString::Compile(Plan* plan) const -> Status {
+  plan->AddOp({OpCode::Date, plan->AddDate(*this)});
+  return Status::OK();
+}
+
+auto Pool::Compile(Plan* plan) const -> Status {
+  plan->AddOp({OpCode::Pooled, plan->AddPool(*this)});
+  return Status::OK();
+}
+
+auto FixedSizeArray::Compile(Plan* plan) const -> Status {
+  auto begin = plan->BeginList(OpCode::BeginFixedList, length_);
+  ILLEX_ROE(item_->Compile(plan));
+  plan->EndList(begin);
+  return Status::OK();
+}
+
+auto Array::Compile(Plan* plan) const -> Status {
+  auto begin = plan->BeginList(OpCode::BeginList, min_length, max_length);
+  ILLEX_ROE(item_->Compile(plan));
+  plan->EndList(begin);
+  return Status::OK();
+}
+
+auto Object::Compile(Plan* plan) const -> Status {
+  if (members_.empty()) {
+    plan->AddLiteral("{}");
+    return Status::OK();
+  }
+  for (size_t i = 0; i < members_.size(); i++) {
+    // Pre-serialize the fragment leading up to the member value, i.e. {"key": for the
+    // first member and ,"key": for the others. The key is serialized through a writer
+    // once, so it is escaped properly.
+    auto name = members_[i].name();
+    rj::StringBuffer fragment;
+    fragment.Put(i == 0 ? '{' : ',');
+    Writer writer(fragment);
+    writer.String(name.c_str(), name.length());
+    fragment.Put(':');
+    plan->AddLiteral(std::string_view(fragment.GetString(), fragment.GetSize()));
+    ILLEX_ROE(members_[i].value()->Compile(plan));
+  }
+  plan->AddLiteral("}");
+  return Status::OK();
+}
+
+}  // namespace illex
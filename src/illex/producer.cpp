@@ -17,17 +17,231 @@
 #include <putong/timer.h>
 #include <rapidjson/prettywriter.h>
 
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <memory>
+#include <utility>
 
 #include "illex/arrow.h"
 #include "illex/log.h"
+#include "illex/plan.h"
+#include "illex/protocol.h"
 
 namespace illex {
 
 namespace rj = rapidjson;
 
-void ProductionThread(size_t thread_id, const ProducerOptions& opt, size_t num_batches,
-                      size_t num_items, ProductionQueue* queue,
+auto BatchPool::Acquire() -> std::unique_ptr<BatchBuffer> {
+  std::unique_ptr<BatchBuffer> result;
+  if (!free_.try_dequeue(result)) {
+    result = std::make_unique<BatchBuffer>();
+  }
+  return result;
+}
+
+void BatchPool::Release(JSONBatch* batch) {
+  if (batch->buffer != nullptr) {
+    // Clearing the buffer retains its allocation.
+    batch->buffer->Clear();
+    free_.enqueue(std::move(batch->buffer));
+  }
+  batch->num_jsons = 0;
+  batch->index = 0;
+  batch->stamps.clear();
+  batch->framed = false;
+}
+
+ReorderBuffer::ReorderBuffer(size_t window) : slots_(std::max<size_t>(1, window)) {}
+
+auto ReorderBuffer::Admit(size_t index, const std::atomic<bool>& shutdown,
+                          double* blocked) -> bool {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Fast path: the batch is within the window.
+  if (index < next_ + slots_.size()) {
+    return true;
+  }
+  putong::Timer<> t(true);
+  while ((index >= next_ + slots_.size()) && !shutdown.load()) {
+    advanced_.wait_for(lock, kShutdownPollInterval);
+  }
+  t.Stop();
+  *blocked += t.seconds();
+  return index < next_ + slots_.size();
+}
+
+auto ReorderBuffer::Insert(JSONBatch&& batch, ProductionQueue* queue,
+                           const std::atomic<bool>& shutdown, double* blocked) -> bool {
+  std::unique_lock<std::mutex> lock(mutex_);
+  assert((batch.index >= next_) && (batch.index < next_ + slots_.size()));
+  slots_[batch.index % slots_.size()] = std::move(batch);
+  // Only one thread at a time enqueues, so batches are enqueued in order. It also
+  // enqueues the batches that are inserted while it waits for room in the queue.
+  if (enqueuing_) {
+    return true;
+  }
+  enqueuing_ = true;
+  while (true) {
+    // Take all batches that are next in order out of their slots.
+    auto* slot = &slots_[next_ % slots_.size()];
+    while (slot->has_value()) {
+      ready_.push_back(std::move(**slot));
+      slot->reset();
+      next_++;
+      slot = &slots_[next_ % slots_.size()];
+    }
+    if (ready_.empty()) {
+      break;
+    }
+    advanced_.notify_all();
+    // Enqueueing may wait for room in the queue, so it must not block other threads.
+    lock.unlock();
+    bool enqueued = true;
+    for (auto& ready : ready_) {
+      if (!queue->Enqueue(std::move(ready), shutdown, blocked)) {
+        enqueued = false;
+        break;
+      }
+    }
+    ready_.clear();
+    lock.lock();
+    if (!enqueued) {
+      enqueuing_ = false;
+      return false;
+    }
+  }
+  enqueuing_ = false;
+  return true;
+}
+
+/**
+ * \brief Replace the closing brace of the JSON object at the end of a buffer by an empty
+ *        send stamp.
+ * \param[in,out] buffer     The buffer.
+ * \param[in]     json_start The offset of the JSON in the buffer.
+ * \param[out]    stamps     The offsets of the stamps, to append the offset of this one.
+ */
+static void AppendStamp(BatchBuffer* buffer, size_t json_start,
+                        std::vector<size_t>* stamps) {
+  const size_t size = buffer->GetSize();
+  const char* data = buffer->GetString();
+  // Only non-empty objects can be stamped.
+  if ((size < json_start + 3) || (data[size - 1] != '}') || (data[size - 2] == '{')) {
+    stamps->push_back(kNoStamp);
+    return;
+  }
+  buffer->Pop(1);
+  stamps->push_back(size - 1);
+  stamp::WriteEmpty(buffer->Push(stamp::kSize));
+}
+
+/**
+ * \brief Compress the JSONs of a frame into another buffer, as a compressed frame.
+ * \param[in]  codec     The codec.
+ * \param[in]  num_jsons The number of JSONs in the frame.
+ * \param[in]  raw       The buffer holding the uncompressed frame.
+ * \param[out] out       The buffer to write the compressed frame to.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+static auto CompressFrame(arrow::util::Codec* codec, size_t num_jsons,
+                          const BatchBuffer& raw, BatchBuffer* out) -> Status {
+  const size_t header_size = frame::Size(num_jsons);
+  const auto* jsons = reinterpret_cast<const uint8_t*>(raw.GetString() + header_size);
+  const auto length = static_cast<int64_t>(raw.GetSize() - header_size);
+  const auto max_length = codec->MaxCompressedLen(length, jsons);
+
+  out->Clear();
+  char* data = out->Push(header_size + max_length);
+  std::memcpy(data, raw.GetString(), header_size);
+  auto compressed = codec->Compress(length, jsons, max_length,
+                                    reinterpret_cast<uint8_t*>(data + header_size));
+  if (!compressed.ok()) {
+    return Status(Error::GenericError, compressed.status().message());
+  }
+  out->Pop(max_length - *compressed);
+  frame::WriteCompressed(data, *compressed);
+  return Status::OK();
+}
+
+auto TotalJSONs(const ProducerOptions& opts) -> size_t {
+  return opts.batching ? opts.num_batches * opts.num_jsons : opts.num_jsons;
+}
+
+auto PartitionProduction(const ProducerOptions& opts, size_t part, size_t num_parts)
+    -> ProducerOptions {
+  auto share = [&](size_t n) { return n / num_parts + (part < n % num_parts ? 1 : 0); };
+  // The number of items in the shares of all preceding partitions.
+  auto offset = [&](size_t n) {
+    return part * (n / num_parts) + std::min(part, n % num_parts);
+  };
+  auto result = opts;
+  if (opts.batching) {
+    result.num_batches = share(opts.num_batches);
+    result.first_json += offset(opts.num_batches) * opts.num_jsons;
+  } else {
+    result.num_jsons = share(opts.num_jsons);
+    result.first_json += offset(opts.num_jsons);
+  }
+  if (!opts.deterministic) {
+    result.gen.seed += part * opts.num_threads;
+  }
+  return result;
+}
+
+BatchSizer::BatchSizer(size_t max_bytes, bool adaptive)
+    : max_(max_bytes),
+      min_(std::max<size_t>(1, max_bytes / kAdaptiveBatchRange)),
+      target_(max_bytes),
+      adaptive_(adaptive) {}
+
+void BatchSizer::Observe(size_t depth, size_t capacity) {
+  if (!adaptive_ || (capacity == 0)) {
+    return;
+  }
+  // Smooth the occupancy, so a single empty or full queue does not change the target.
+  constexpr double weight = 0.25;
+  const double occupancy = static_cast<double>(depth) / static_cast<double>(capacity);
+  occupancy_ = (1.0 - weight) * occupancy_ + weight * occupancy;
+  if (occupancy_ < 0.25) {
+    target_ = std::max(min_, target_ / 2);
+  } else if (occupancy_ > 0.75) {
+    target_ = std::min(max_, target_ * 2);
+  }
+}
+
+auto ThreadShare(const ProducerOptions& opt, size_t thread_id) -> ProductionShare {
+  const size_t t = thread_id;
+  const size_t n = std::max<size_t>(1, opt.num_threads);
+  ProductionShare result;
+  if (opt.batch_bytes > 0) {
+    // Every thread gets a contiguous range of the JSONs, which it cuts into batches.
+    const size_t total = TotalJSONs(opt);
+    result.num_batches = 1;
+    result.num_items = total / n + (t < total % n ? 1 : 0);
+    result.first_batch = t;
+    result.batch_stride = n;
+    result.first_json = opt.first_json + t * (total / n) + std::min(t, total % n);
+  } else if (opt.batching) {
+    result.num_batches = opt.num_batches / n + (t < opt.num_batches % n ? 1 : 0);
+    result.num_items = opt.num_jsons;
+    result.first_batch = t;
+    result.batch_stride = n;
+    result.first_json = opt.first_json + t * opt.num_jsons;
+    result.json_stride = n * opt.num_jsons;
+  } else {
+    result.num_batches = 1;
+    result.num_items = opt.num_jsons / n + (t < opt.num_jsons % n ? 1 : 0);
+    result.first_batch = t;
+    result.first_json =
+        opt.first_json + t * (opt.num_jsons / n) + std::min(t, opt.num_jsons % n);
+  }
+  return result;
+}
+
+void ProductionThread(size_t thread_id, const ProducerOptions& opt,
+                      const ProductionShare& share, ProductionQueue* queue,
+                      ReorderBuffer* reorder, BatchPool* pool,
                       std::atomic<bool>* shutdown,
                       std::promise<ProductionMetrics>&& metrics_promise) {
   using PrettyWriter = rapidjson::PrettyWriter<rapidjson::StringBuffer>;
@@ -37,54 +251,209 @@ void ProductionThread(size_t thread_id, const ProducerOptions& opt, size_t num_b
 
   ProductionMetrics metrics;
 
+  // Pin this thread before allocating anything, so its memory is local to the CPUs.
+  auto pinned = PinThread(opt.cpus);
+  if (!pinned.ok()) {
+    spdlog::error("Thread {}: {}", thread_id, pinned.msg());
+    shutdown->store(true);
+    metrics_promise.set_value(metrics);
+    return;
+  }
+
   // Generation options. We increment the seed by the thread id, so we get different
-  // values from each thread.
+  // values from each thread. In deterministic mode, every JSON is seeded from its index
+  // instead.
   auto gen_opt = opt.gen;
-  gen_opt.seed += thread_id;
+  if (!opt.deterministic) {
+    gen_opt.seed += thread_id;
+  }
 
   // Set up generator.
   auto gen = FromArrowSchema(*opt.schema, gen_opt);
 
+  // Attempt to compile the generator into a plan, which generates the same JSONs but
+  // avoids walking the generator tree. Fall back to the tree if that fails.
+  Plan plan;
+  bool compiled = false;
+  if (!opt.pretty) {
+    auto status = Plan::Compile(*gen.root(), &plan);
+    if (status.ok()) {
+      compiled = true;
+    } else {
+      SPDLOG_DEBUG("Thread {}: could not compile generator: {}", thread_id, status.msg());
+    }
+  }
+
+  // Set up compression. Frames are compressed into a spare buffer, which is then swapped
+  // with the batch buffer, so the spare buffer is reused for every batch.
+  std::unique_ptr<arrow::util::Codec> codec;
+  std::unique_ptr<BatchBuffer> spare;
+  if (opt.compression != Compression::None) {
+    auto status = MakeCodec(opt.compression, &codec);
+    if (!status.ok()) {
+      spdlog::error("Thread {}: could not create codec: {}", thread_id, status.msg());
+      shutdown->store(true);
+      metrics_promise.set_value(metrics);
+      return;
+    }
+    spare = std::make_unique<BatchBuffer>();
+  }
+
   // Set up RapidJSON
-  rapidjson::StringBuffer buffer;
   std::shared_ptr<rapidjson::Writer<rapidjson::StringBuffer>> writer;
   if (opt.pretty) {
-    auto pw = std::make_shared<PrettyWriter>(buffer);
+    auto pw = std::make_shared<PrettyWriter>();
     pw->SetFormatOptions(rj::PrettyFormatOptions::kFormatSingleLineArray);
     writer = pw;
   } else {
-    writer = std::make_shared<NormalWriter>(buffer);
+    writer = std::make_shared<NormalWriter>();
+  }
+
+  const size_t num_items = share.num_items;
+  std::vector<uint32_t> lengths;
+  if (opt.frame && (opt.batch_bytes == 0)) {
+    lengths.reserve(num_items);
   }
 
-  for (size_t b = 0; b < num_batches; b++) {
-    buffer.Clear();
-    // Generate num_items JSON items in the buffer.
-    for (size_t m = 0; m < num_items; m++) {
-      // Get a new value.
+  // Generate the JSON with some global index at the end of a buffer.
+  auto generate = [&](BatchBuffer* buffer, size_t json_index,
+                      std::vector<size_t>* stamps) {
+    const size_t json_start = buffer->GetSize();
+    if (opt.deterministic) {
+      gen.Seek(json_index);
+    }
+    // Reset writer and write a new value to the buffer.
+    writer->Reset(*buffer);
+    if (opt.pretty) {
+      // The pretty writer does not override the writer interface virtually, so pretty
+      // printing goes through the DOM.
       auto json = gen.Get();
-      // Reset writer and write it to the buffer.
-      writer->Reset(buffer);
-      if (opt.pretty) {
-        json.Accept(*std::static_pointer_cast<PrettyWriter>(writer));
-      } else {
-        json.Accept(*writer);
-      }
-      // Check if we need to append whitespace.
-      if (opt.whitespace) {
-        buffer.Put(opt.whitespace_char);
-      }
+      json.Accept(*std::static_pointer_cast<PrettyWriter>(writer));
+    } else if (compiled) {
+      // Generate the value straight into the buffer through the compiled plan.
+      plan.Write(gen.context().engine_, buffer);
+    } else {
+      // Emit the value straight into the writer, without building a DOM.
+      gen.Write(writer.get());
+    }
+    if (opt.stamp) {
+      AppendStamp(buffer, json_start, stamps);
+    }
+    // Check if we need to append whitespace.
+    if (opt.whitespace) {
+      buffer->Put(opt.whitespace_char);
+    }
+    if (opt.frame) {
+      lengths.push_back(static_cast<uint32_t>(buffer->GetSize() - json_start));
+    }
+  };
+
+  // Finish a batch, of which the frame header is reserved if it is framed, and move it
+  // into the queue. Returns false if production must stop.
+  auto emit = [&](std::unique_ptr<BatchBuffer> buffer, size_t num_jsons, size_t index,
+                  std::vector<size_t> stamps) {
+    if (opt.frame) {
+      // The buffer is not shared yet, so its bytes can still be modified.
+      frame::Write(const_cast<char*>(buffer->GetString()), lengths.data(), num_jsons, 0);
     }
 
-    // Put the batch of JSON strings in the queue.
-    JSONBatch batch = {std::string(buffer.GetString()), num_items};
     // Accumulate the number of bytes in the batch to all that this drone has produced.
-    metrics.num_chars += batch.data.size();
-    metrics.num_jsons += num_items;
+    const size_t num_chars = buffer->GetSize();
+    metrics.num_chars += num_chars;
+    if (codec != nullptr) {
+      putong::Timer<> tc(true);
+      auto status = CompressFrame(codec.get(), num_jsons, *buffer, spare.get());
+      tc.Stop();
+      metrics.compress_time += tc.seconds();
+      if (!status.ok()) {
+        spdlog::error("Thread {}: could not compress batch: {}", thread_id, status.msg());
+        shutdown->store(true);
+        return false;
+      }
+      std::swap(buffer, spare);
+      metrics.num_compressed_chars += buffer->GetSize();
+    }
+    metrics.num_jsons += num_jsons;
     metrics.num_batches++;
-    // Place the batch in the queue.
-    while (!queue->try_enqueue(batch) && !shutdown->load()) {
-      metrics.queue_full++;
-      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    const double blocked_time = metrics.blocked_time;
+    // Move the batch of JSON strings into the queue, waiting for room if it is full.
+    JSONBatch batch = {std::move(buffer), num_jsons, index, std::move(stamps), opt.frame};
+    bool enqueued =
+        reorder != nullptr
+            ? reorder->Insert(std::move(batch), queue, *shutdown, &metrics.blocked_time)
+            : queue->Enqueue(std::move(batch), *shutdown, &metrics.blocked_time);
+    if (opt.live != nullptr) {
+      LiveMetrics::Add(&opt.live->jsons_produced, num_jsons);
+      LiveMetrics::Add(&opt.live->bytes_produced, num_chars);
+      LiveMetrics::AddSeconds(&opt.live->producer_blocked_ns,
+                              metrics.blocked_time - blocked_time);
+    }
+    return enqueued;
+  };
+
+  if (opt.batch_bytes > 0) {
+    // The share is a contiguous range of JSONs, which is cut into batches that are closed
+    // once they reach the target size.
+    BatchSizer sizer(opt.batch_bytes, opt.adaptive_batching);
+    size_t num_produced = 0;
+    for (size_t b = 0; num_produced < num_items; b++) {
+      auto buffer = pool != nullptr ? pool->Acquire() : std::make_unique<BatchBuffer>();
+      std::vector<size_t> stamps;
+      lengths.clear();
+      size_t num_jsons = 0;
+      while ((num_produced + num_jsons < num_items) &&
+             (buffer->GetSize() < sizer.target())) {
+        generate(buffer.get(), share.first_json + num_produced + num_jsons, &stamps);
+        num_jsons++;
+      }
+      if (opt.frame) {
+        // The number of JSONs is only known now, so move them to make room for the
+        // frame header.
+        const size_t header_size = frame::Size(num_jsons);
+        const size_t size = buffer->GetSize();
+        buffer->Push(header_size);
+        char* data = const_cast<char*>(buffer->GetString());
+        std::memmove(data + header_size, data, size);
+        for (auto& stamp : stamps) {
+          if (stamp != kNoStamp) {
+            stamp += header_size;
+          }
+        }
+      }
+      num_produced += num_jsons;
+      if (!emit(std::move(buffer), num_jsons, share.first_batch + b * share.batch_stride,
+                std::move(stamps))) {
+        break;
+      }
+      sizer.Observe(queue->size_approx(), queue->capacity());
+    }
+    SPDLOG_DEBUG("Thread {}: final batch target {} bytes.", thread_id, sizer.target());
+  } else {
+    for (size_t b = 0; b < share.num_batches; b++) {
+      const size_t index = share.first_batch + b * share.batch_stride;
+      // In ordered mode, wait until this batch falls within the reorder window.
+      if ((reorder != nullptr) &&
+          !reorder->Admit(index, *shutdown, &metrics.blocked_time)) {
+        break;
+      }
+      // Obtain a buffer to generate the batch in directly.
+      auto buffer = pool != nullptr ? pool->Acquire() : std::make_unique<BatchBuffer>();
+      std::vector<size_t> stamps;
+      if (opt.stamp) {
+        stamps.reserve(num_items);
+      }
+      if (opt.frame) {
+        // Leave room for the frame header, which is written once all lengths are known.
+        lengths.clear();
+        buffer->Push(frame::Size(num_items));
+      }
+      // Generate num_items JSON items in the buffer.
+      for (size_t m = 0; m < num_items; m++) {
+        generate(buffer.get(), share.first_json + b * share.json_stride + m, &stamps);
+      }
+      if (!emit(std::move(buffer), num_items, index, std::move(stamps))) {
+        break;
+      }
     }
   }
   t.Stop();
@@ -93,39 +462,47 @@ void ProductionThread(size_t thread_id, const ProducerOptions& opt, size_t num_b
   metrics_promise.set_value(metrics);
 }
 
-auto Producer::Make(const ProducerOptions& opt, ProductionQueue* queue,
+auto Producer::Make(const ProducerOptions& opt, ProductionQueue* queue, BatchPool* pool,
                     std::shared_ptr<Producer>* out) -> Status {
+  if (opt.schema == nullptr) {
+    return Status(Error::GenericError, "Producer requires a schema.");
+  }
+  ILLEX_ROE(ValidateSchema(*opt.schema));
+  if (opt.queue_capacity == 0) {
+    return Status(Error::GenericError, "Production queue capacity must be at least 1.");
+  }
+  if (opt.frame && !opt.whitespace) {
+    return Status(Error::GenericError,
+                  "Framed batches require a whitespace after every JSON.");
+  }
+  if ((opt.batch_bytes > 0) && opt.ordered && (opt.num_threads > 1)) {
+    return Status(Error::GenericError,
+                  "Byte-sized batches cannot be ordered over multiple threads.");
+  }
+  if (opt.compression != Compression::None) {
+    if (!opt.frame) {
+      return Status(Error::GenericError, "Compressed batches must be framed.");
+    }
+    if (opt.stamp) {
+      return Status(Error::GenericError, "Compressed batches cannot be stamped.");
+    }
+    // Check whether Arrow supports the codec before spawning threads.
+    std::unique_ptr<arrow::util::Codec> codec;
+    ILLEX_ROE(MakeCodec(opt.compression, &codec));
+  }
   auto result = std::shared_ptr<Producer>(new Producer());
   result->opts_ = opt;
   result->queue_ = queue;
+  result->pool_ = pool;
   *out = result;
   return Status::OK();
 }
 
 auto Producer::Start(std::atomic<bool>* shutdown) -> Status {
   assert(shutdown != nullptr);
-  // Number of JSONs to produce per thread
-  size_t batches_per_thread = 1;
-  size_t batches_remainder = 0;
-  auto jsons_per_thread = opts_.num_jsons / opts_.num_threads;
-  // Remainder for the first thread.
-  size_t jsons_remainder = 0;
-  if (jsons_per_thread == 0) {
-    jsons_remainder = opts_.num_jsons;
-  } else {
-    jsons_remainder = opts_.num_jsons % jsons_per_thread;
-  }
-
-  // Recalculate if batching is enabled.
-  if (opts_.batching) {
-    jsons_per_thread = opts_.num_jsons;
-    batches_per_thread = opts_.num_batches / opts_.num_threads;
-    // Remainder for the first thread.
-    if (batches_per_thread == 0) {
-      batches_remainder = opts_.num_batches;
-    } else {
-      batches_remainder = opts_.num_batches % batches_per_thread;
-    }
+  if (opts_.ordered && (opts_.num_threads > 1)) {
+    auto window = opts_.reorder_window > 0 ? opts_.reorder_window : 2 * opts_.num_threads;
+    reorder_ = std::make_unique<ReorderBuffer>(window);
   }
 
   threads_.reserve(opts_.num_threads);
@@ -137,17 +514,22 @@ auto Producer::Start(std::atomic<bool>* shutdown) -> Status {
     std::promise<ProductionMetrics> metrics_promise;
     thread_metrics_.push_back(metrics_promise.get_future());
 
-    // Spawn the threads and let the first thread do the remainder of the work.
-    size_t thread_jsons = jsons_per_thread + (thread == 0 ? jsons_remainder : 0);
-    size_t thread_batches = batches_per_thread + (thread == 0 ? batches_remainder : 0);
-
-    threads_.emplace_back(ProductionThread, thread, opts_, thread_batches, thread_jsons,
-                          queue_, shutdown, std::move(metrics_promise));
+    threads_.emplace_back(ProductionThread, thread, opts_, ThreadShare(opts_, thread),
+                          queue_, reorder_.get(), pool_, shutdown,
+                          std::move(metrics_promise));
   }
 
   return Status::OK();
 }
 
+Producer::~Producer() {
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
 auto Producer::Finish() -> Status {
   // Wait for all threads to complete.
   for (auto& thread : threads_) {
@@ -169,7 +551,15 @@ void ProductionMetrics::Log(size_t threads) const {
   spdlog::info("Spent average of {:.4f} seconds/thread in {} threads.", t_avg, threads);
   spdlog::info("  {:.1f} JSON/s (avg).", num_jsons / t_avg);
   spdlog::info("  {:.2f} GB/s   (avg).", (static_cast<double>(num_chars) * 1E-9) / t_avg);
-  spdlog::info("  Queue was full {} times.", queue_full);
+  spdlog::info("  Producers blocked on full queue for {:.4f} seconds (total).",
+               blocked_time);
+  spdlog::info("  Consumer starved on empty queue for {:.4f} seconds.", starved_time);
+  if (num_compressed_chars > 0) {
+    auto ratio =
+        static_cast<double>(num_chars) / static_cast<double>(num_compressed_chars);
+    spdlog::info("  Compressed to {} bytes (ratio {:.2f}) in {:.4f} seconds (total).",
+                 num_compressed_chars, ratio, compress_time);
+  }
 }
 
 }  // namespace illex
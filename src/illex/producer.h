@@ -16,25 +16,272 @@
 
 #include <arrow/api.h>
 #include <blockingconcurrentqueue.h>
+#include <concurrentqueue.h>
+#include <lightweightsemaphore.h>
 #include <putong/timer.h>
+#include <rapidjson/stringbuffer.h>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <utility>
+#include <vector>
 
+#include "illex/affinity.h"
 #include "illex/document.h"
+#include "illex/metrics.h"
+#include "illex/protocol.h"
 #include "illex/status.h"
 
 namespace illex {
 
+/// A buffer holding the JSON data of a batch.
+using BatchBuffer = rapidjson::StringBuffer;
+
 /// A batch of JSONs.
 struct JSONBatch {
-  /// The JSON data.
-  std::string data;
+  /// The buffer holding the JSON data.
+  std::unique_ptr<BatchBuffer> buffer;
   /// The number of JSON objects contained within the batch.
-  size_t num_jsons;
+  size_t num_jsons = 0;
+  /// The index of the batch in the production of its producer.
+  size_t index = 0;
+  /**
+   * \brief The offsets of the send stamps of every JSON, if stamps are enabled.
+   *
+   * JSONs that could not be stamped have an offset of kNoStamp.
+   */
+  std::vector<size_t> stamps;
+  /// Whether the data starts with a frame header, see frame::Header.
+  bool framed = false;
+
+  /// \brief Return the data, including the frame header if the batch is framed.
+  [[nodiscard]] auto data() const -> std::string_view {
+    return std::string_view(buffer->GetString(), buffer->GetSize());
+  }
+
+  /// \brief Return the JSONs, without the frame header if the batch is framed.
+  [[nodiscard]] auto jsons() const -> std::string_view {
+    return data().substr(framed ? frame::Size(num_jsons) : 0);
+  }
+};
+
+/// The stamp offset of a JSON without a stamp.
+constexpr size_t kNoStamp = SIZE_MAX;
+
+/// The default maximum number of batches in a production queue.
+constexpr size_t kDefaultProductionQueueCapacity = 8;
+
+/// The interval at which blocked production pipeline stages check for shutdown.
+constexpr std::chrono::microseconds kShutdownPollInterval(10000);
+
+/**
+ * \brief A bounded queue of batches between pipeline stages.
+ *
+ * Producing threads block while the queue is full, and consuming threads block while it
+ * is empty, so neither side has to poll. Waits are done in intervals, so that blocked
+ * threads notice a shutdown signal.
+ *
+ * \tparam T The type of the batches.
+ */
+template <typename T>
+class BoundedQueue {
+ public:
+  /// \brief Construct a queue that holds at most capacity batches.
+  explicit BoundedQueue(size_t capacity = kDefaultProductionQueueCapacity)
+      : capacity_(capacity),
+        queue_(capacity),
+        slots_(static_cast<moodycamel::LightweightSemaphore::ssize_t>(capacity)) {}
+
+  /**
+   * \brief Enqueue a batch, blocking while the queue is full.
+   * \param[in]     batch    The batch to enqueue.
+   * \param[in]     shutdown A signal to stop waiting.
+   * \param[in,out] blocked  The number of seconds spent waiting is added to this.
+   * \return True if the batch was enqueued, false if shutdown was signaled before that.
+   */
+  auto Enqueue(T&& batch, const std::atomic<bool>& shutdown, double* blocked) -> bool {
+    // Fast path: there is room in the queue.
+    if (!slots_.tryWait()) {
+      putong::Timer<> t(true);
+      bool acquired = false;
+      while (!acquired && !shutdown.load()) {
+        acquired = slots_.wait(kShutdownPollInterval.count());
+      }
+      t.Stop();
+      *blocked += t.seconds();
+      if (!acquired) {
+        return false;
+      }
+    }
+    queue_.enqueue(std::move(batch));
+    return true;
+  }
+
+  /**
+   * \brief Dequeue a batch, blocking while the queue is empty.
+   * \param[out]    out      The dequeued batch.
+   * \param[in]     timeout  The maximum time to wait for a batch.
+   * \param[in,out] starved  The number of seconds spent waiting is added to this.
+   * \return True if a batch was dequeued, false if the timeout expired.
+   */
+  auto Dequeue(T* out, std::chrono::microseconds timeout, double* starved) -> bool {
+    // Fast path: there is a batch in the queue.
+    if (!queue_.try_dequeue(*out)) {
+      putong::Timer<> t(true);
+      bool dequeued = queue_.wait_dequeue_timed(*out, timeout.count());
+      t.Stop();
+      *starved += t.seconds();
+      if (!dequeued) {
+        return false;
+      }
+    }
+    slots_.signal();
+    return true;
+  }
+
+  /// \brief Dequeue a batch without blocking. Returns true if successful.
+  auto TryDequeue(T* out) -> bool {
+    if (queue_.try_dequeue(*out)) {
+      slots_.signal();
+      return true;
+    }
+    return false;
+  }
+
+  /// \brief Return the maximum number of batches in the queue.
+  [[nodiscard]] auto capacity() const -> size_t { return capacity_; }
+
+  /// \brief Return the approximate number of batches in the queue.
+  [[nodiscard]] auto size_approx() const -> size_t { return queue_.size_approx(); }
+
+ private:
+  /// The maximum number of batches.
+  size_t capacity_;
+  /// The batches.
+  moodycamel::BlockingConcurrentQueue<T> queue_;
+  /// The number of free slots in the queue.
+  moodycamel::LightweightSemaphore slots_;
+};
+
+/// A bounded queue of JSON batches between production threads and a consumer.
+using ProductionQueue = BoundedQueue<JSONBatch>;
+
+/**
+ * \brief A pool of recyclable batch buffers.
+ *
+ * Production threads acquire buffers to generate batches in, and consumers release them
+ * once they have sent or written a batch. Released buffers retain their allocation, so
+ * in steady state, producing a batch does not allocate. Buffers can be acquired and
+ * released from any thread.
+ */
+class BatchPool {
+ public:
+  /// \brief Acquire an empty buffer from the pool, allocating one if none are free.
+  auto Acquire() -> std::unique_ptr<BatchBuffer>;
+
+  /// \brief Return the buffer of a batch to the pool.
+  void Release(JSONBatch* batch);
+
+ private:
+  /// Buffers that are not in use.
+  moodycamel::ConcurrentQueue<std::unique_ptr<BatchBuffer>> free_;
+};
+
+/**
+ * \brief Restores the order of batches produced by multiple threads.
+ *
+ * Production threads insert batches in any order, and the batches are enqueued in the
+ * order of their indices by whichever thread inserts the next one. Batches are enqueued
+ * without holding the lock, so threads are not blocked while inserting when the queue
+ * is full. Generation itself is not serialized. To bound the number of held batches,
+ * threads wait in Admit() before generating a batch that falls outside of the window
+ * following the next batch.
+ */
+class ReorderBuffer {
+ public:
+  /// \brief Construct a reorder buffer with a window of some number of batches.
+  explicit ReorderBuffer(size_t window);
+
+  /**
+   * \brief Wait until a batch falls within the window.
+   * \param[in]     index    The index of the batch.
+   * \param[in]     shutdown A signal to stop waiting.
+   * \param[in,out] blocked  The number of seconds spent waiting is added to this.
+   * \return True if the batch may be produced, false if shutdown was signaled.
+   */
+  auto Admit(size_t index, const std::atomic<bool>& shutdown, double* blocked) -> bool;
+
+  /**
+   * \brief Insert an admitted batch, and enqueue all batches that are next in order.
+   * \param[in]     batch    The batch.
+   * \param[in]     queue    The queue to enqueue the batches in.
+   * \param[in]     shutdown A signal to stop waiting for room in the queue.
+   * \param[in,out] blocked  The number of seconds spent waiting is added to this.
+   * \return True if successful, false if shutdown was signaled.
+   */
+  auto Insert(JSONBatch&& batch, ProductionQueue* queue,
+              const std::atomic<bool>& shutdown, double* blocked) -> bool;
+
+ private:
+  /// Held batches, indexed by their index modulo the window.
+  std::vector<std::optional<JSONBatch>> slots_;
+  /// The index of the next batch to take out of the slots.
+  size_t next_ = 0;
+  /// Whether a thread is enqueueing batches taken out of the slots.
+  bool enqueuing_ = false;
+  /// Batches taken out of the slots by the enqueueing thread.
+  std::vector<JSONBatch> ready_;
+  /// Protects the slots, the next index and the enqueueing flag.
+  std::mutex mutex_;
+  /// Signals threads waiting for admission when the next index advances.
+  std::condition_variable advanced_;
 };
 
-using ProductionQueue = moodycamel::BlockingConcurrentQueue<JSONBatch>;
+/// The factor by which adaptive batching may shrink the target size of batches.
+constexpr size_t kAdaptiveBatchRange = 16;
+
+/**
+ * \brief Tracks the target size of byte-sized batches.
+ *
+ * If adaptive, the target follows a smoothed occupancy of the production queue. When the
+ * queue runs empty, the consumer is starved, so batches are made smaller to hand them off
+ * sooner. When the queue fills up, the consumer is the bottleneck, so batches are made
+ * larger again, up to the configured size, so they are sent with fewer calls.
+ */
+class BatchSizer {
+ public:
+  /**
+   * \brief Construct a new batch sizer.
+   * \param max_bytes The initial and maximum target size of batches.
+   * \param adaptive  Whether to tune the target to the occupancy of the queue.
+   */
+  BatchSizer(size_t max_bytes, bool adaptive);
+
+  /// \brief Return the current target size of batches in bytes.
+  [[nodiscard]] auto target() const -> size_t { return target_; }
+
+  /// \brief Observe the number of batches in the queue after enqueueing a batch.
+  void Observe(size_t depth, size_t capacity);
+
+ private:
+  /// The maximum target size.
+  size_t max_;
+  /// The minimum target size.
+  size_t min_;
+  /// The current target size.
+  size_t target_;
+  /// Whether the target is tuned.
+  bool adaptive_;
+  /// The smoothed fraction of the queue capacity that is occupied.
+  double occupancy_ = 0.5;
+};
 
 /// Options for the Producer.
 struct ProducerOptions {
@@ -60,8 +307,88 @@ struct ProducerOptions {
   bool batching = false;
   /// Number of batches to produce.
   size_t num_batches = 1;
+  /**
+   * \brief The target size of a batch in bytes, or 0 to size batches by JSON count.
+   *
+   * If set, every thread produces a contiguous range of the TotalJSONs(), and closes a
+   * batch once it holds at least this many bytes, so a batch exceeds the target by less
+   * than the size of one JSON. The total number of JSONs remains exact, but the number of
+   * batches depends on the sizes of the JSONs. Cannot be combined with ordered output
+   * over multiple threads.
+   */
+  size_t batch_bytes = 0;
+  /// Whether to tune the target size of batches to the occupancy of the queue.
+  bool adaptive_batching = false;
+  /// Maximum number of produced batches waiting to be consumed.
+  size_t queue_capacity = kDefaultProductionQueueCapacity;
+  /**
+   * \brief Whether to close every JSON object with an empty send stamp.
+   *
+   * The sequence number of a JSON, and therefore whether it is sampled, is only known
+   * once it is sent, so all JSONs get a stamp, even if only some of them are filled in.
+   */
+  bool stamp = false;
+  /**
+   * \brief Whether every JSON is a pure function of the seed and its global index.
+   *
+   * The generator is reseeded from the seed and the index of every JSON, so the same
+   * JSONs are produced for any number of threads or partitions. Batches are assigned to
+   * threads round-robin.
+   */
+  bool deterministic = false;
+  /// The global index of the first JSON to produce, in deterministic mode.
+  size_t first_json = 0;
+  /// Whether to enqueue the batches in the order of their indices.
+  bool ordered = false;
+  /**
+   * \brief The maximum number of batches that threads may run ahead of the next batch
+   *        in order, or 0 for twice the number of threads.
+   */
+  size_t reorder_window = 0;
+  /**
+   * \brief Whether to start every batch with a frame header, see frame::Header.
+   *
+   * The sequence number in the header is filled in when the batch is sent. Requires a
+   * whitespace after every JSON.
+   */
+  bool frame = false;
+  /**
+   * \brief Compression of the JSONs of every frame, on the production threads.
+   *
+   * Requires framing, and cannot be combined with stamps, which are filled in after
+   * production. Verbose output shows the compressed bytes.
+   */
+  Compression compression = Compression::None;
+  /**
+   * \brief The CPUs to pin the production threads to, or empty to not pin them.
+   *
+   * Batch buffers are allocated and filled by the production threads, so their pages are
+   * placed on the NUMA node of these CPUs.
+   */
+  CpuSet cpus;
+  /// Live counters to add produced JSONs and blocked time to, or nullptr for none.
+  LiveMetrics* live = nullptr;
 };
 
+/// \brief Return the total number of JSONs that a producer with some options produces.
+auto TotalJSONs(const ProducerOptions& opts) -> size_t;
+
+/**
+ * \brief Return the production options for one partition of the total production.
+ *
+ * Every partition produces a disjoint share of the JSONs, i.e. of the batches if batching
+ * is enabled, with its own range of generator seeds. In deterministic mode, partitions
+ * keep the seed and produce consecutive ranges of JSON indices instead, so together they
+ * produce the same JSONs as the total production.
+ *
+ * \param opts      The options of the total production.
+ * \param part      The index of the partition.
+ * \param num_parts The number of partitions.
+ * \return The production options of the partition.
+ */
+auto PartitionProduction(const ProducerOptions& opts, size_t part, size_t num_parts)
+    -> ProducerOptions;
+
 /// Metrics on JSON production.
 struct ProductionMetrics {
   /// The time spent producing all JSONs
@@ -72,14 +399,23 @@ struct ProductionMetrics {
   size_t num_jsons = 0;
   /// The number of batches produced;
   size_t num_batches = 0;
-  /// Number of times the production queue was full.
-  size_t queue_full = 0;
+  /// The time production threads spent waiting for the production queue to have room.
+  double blocked_time = 0.0;
+  /// The time the consumer spent waiting for the production queue to have a batch.
+  double starved_time = 0.0;
+  /// The number of bytes of all batches after compression, if batches are compressed.
+  size_t num_compressed_chars = 0;
+  /// The time spent compressing batches.
+  double compress_time = 0.0;
 
   inline auto operator+=(const ProductionMetrics& rhs) -> ProductionMetrics& {
     time += rhs.time;
     num_chars += rhs.num_chars;
+    num_compressed_chars += rhs.num_compressed_chars;
+    compress_time += rhs.compress_time;
     num_jsons += rhs.num_jsons;
-    queue_full += rhs.queue_full;
+    blocked_time += rhs.blocked_time;
+    starved_time += rhs.starved_time;
     num_batches += rhs.num_batches;
     return *this;
   }
@@ -94,12 +430,17 @@ class Producer {
    * \brief Create a JSON producer.
    * \param opt   The production options.
    * \param queue The queue to produce JSON batches into.
+   * \param pool  The pool to acquire batch buffers from, or nullptr to allocate a new
+   *              buffer for every batch.
    * \param out   A shared ptr in which to store the producer.
    * \return Status::OK() if successful, some error otherwise.
    */
-  static auto Make(const ProducerOptions& opt, ProductionQueue* queue,
+  static auto Make(const ProducerOptions& opt, ProductionQueue* queue, BatchPool* pool,
                    std::shared_ptr<Producer>* out) -> Status;
 
+  /// \brief Join threads that were not finished, e.g. after the shutdown signal.
+  ~Producer();
+
   /**
    * \brief Start the producer, spawning its threads in the background. Non-blocking.
    * \param shutdown A signal for threads they need to shut down early, can be asserted
@@ -128,20 +469,55 @@ class Producer {
   std::vector<std::future<ProductionMetrics>> thread_metrics_;
   ProductionMetrics metrics_;
   ProductionQueue* queue_ = nullptr;
+  BatchPool* pool_ = nullptr;
+  std::unique_ptr<ReorderBuffer> reorder_;
+};
+
+/// The share of the total production of a single production thread.
+struct ProductionShare {
+  /// Number of batches to produce.
+  size_t num_batches = 0;
+  /// Number of JSONs to produce per batch.
+  size_t num_items = 0;
+  /// The index of the first batch.
+  size_t first_batch = 0;
+  /// The difference of the indices of consecutive batches.
+  size_t batch_stride = 1;
+  /// The global index of the first JSON, in deterministic mode.
+  size_t first_json = 0;
+  /// The difference of the global indices of the first JSONs of consecutive batches.
+  size_t json_stride = 0;
 };
 
+/**
+ * \brief Return the share of a production thread.
+ *
+ * Batches are assigned to threads round-robin, so threads produce batches with nearby
+ * indices. Without batching, every thread produces one batch with a share of the JSONs.
+ * With byte-sized batches, every thread gets a contiguous share of the JSONs as a single
+ * share batch, which it cuts into batches of the target size.
+ *
+ * \param opt       The production options.
+ * \param thread_id The ID of the thread.
+ * \return The share of the thread.
+ */
+auto ThreadShare(const ProducerOptions& opt, size_t thread_id) -> ProductionShare;
+
 /**
  * \brief A thread producing JSONs
  * \param thread_id       The ID of this thread.
  * \param opt             Production options for this thread.
- * \param num_batches     Number of batches to produce.
- * \param num_items       Number of JSONs to produce per batch.
+ * \param share           The share of the production of this thread.
  * \param queue           The queue to store the produced JSONs in.
+ * \param reorder         The buffer to restore the batch order with, or nullptr to
+ *                        enqueue batches as soon as they are produced.
+ * \param pool            The pool to acquire batch buffers from, may be nullptr.
  * \param shutdown        Shutdown signal in case other threads encountered errors.
  * \param metrics_promise Production metrics from this single thread.
  */
-void ProductionThread(size_t thread_id, const ProducerOptions& opt, size_t num_batches,
-                      size_t num_items, ProductionQueue* queue,
+void ProductionThread(size_t thread_id, const ProducerOptions& opt,
+                      const ProductionShare& share, ProductionQueue* queue,
+                      ReorderBuffer* reorder, BatchPool* pool,
                       std::atomic<bool>* shutdown,
                       std::promise<ProductionMetrics>&& metrics_promise);
 
@@ -0,0 +1,157 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/pull.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#include "illex/arrow.h"
+
+namespace illex {
+
+PullGenerator::PullGenerator(const PullOptions& opts)
+    : opts_(opts),
+      seed_(opts.gen.seed),
+      first_json_(opts.first_json),
+      gen_(FromArrowSchema(*opts.schema, opts.gen)) {}
+
+auto PullGenerator::Make(const PullOptions& opts, std::unique_ptr<PullGenerator>* out)
+    -> Status {
+  if (opts.schema == nullptr) {
+    return Status(Error::GenericError, "Pull generator requires a schema.");
+  }
+  ILLEX_ROE(ValidateSchema(*opts.schema));
+  // The generator refers to its own random engine, so it may not be moved.
+  auto result = std::unique_ptr<PullGenerator>(new PullGenerator(opts));
+  ILLEX_ROE(Plan::Compile(*result->gen_.root(), &result->plan_));
+  *out = std::move(result);
+  return Status::OK();
+}
+
+void PullGenerator::Reset(int seed, size_t first_json) {
+  seed_ = seed;
+  first_json_ = first_json;
+  gen_.context().engine_->seed(seed);
+  held_.clear();
+  num_generated_ = 0;
+  num_written_ = 0;
+}
+
+auto PullGenerator::done() const -> bool {
+  return (num_written_ == num_generated_) && (num_generated_ >= opts_.num_jsons);
+}
+
+auto PullGenerator::GenerateInto(std::byte* dst, size_t capacity, size_t* jsons_written,
+                                 size_t* bytes_written) -> Status {
+  auto* engine = gen_.context().engine_;
+  size_t num_jsons = 0;
+  stream_.Reset(reinterpret_cast<char*>(dst), capacity);
+
+  // Start with the JSON that did not fit in the previous buffer.
+  if (num_written_ < num_generated_) {
+    if (held_.size() > capacity) {
+      return Status(Error::GenericError, "JSON of " + std::to_string(held_.size()) +
+                                             " bytes does not fit in buffer.");
+    }
+    std::memcpy(stream_.Push(held_.size()), held_.data(), held_.size());
+    held_.clear();
+    num_written_++;
+    num_jsons++;
+  }
+
+  while (num_generated_ < opts_.num_jsons) {
+    stream_.Mark();
+    if (opts_.deterministic) {
+      engine->seed(seed_, first_json_ + num_generated_);
+    }
+    plan_.Write(engine, &stream_);
+    stream_.Put(opts_.whitespace_char);
+    num_generated_++;
+    if (stream_.spilling()) {
+      // Hold the JSON back for the next buffer.
+      held_ = stream_.spilled();
+      break;
+    }
+    num_written_++;
+    num_jsons++;
+  }
+
+  if ((num_jsons == 0) && !held_.empty() && (held_.size() > capacity)) {
+    return Status(Error::GenericError, "JSON of " + std::to_string(held_.size()) +
+                                           " bytes does not fit in buffer.");
+  }
+  *jsons_written = num_jsons;
+  if (bytes_written != nullptr) {
+    *bytes_written = stream_.size();
+  }
+  return Status::OK();
+}
+
+auto GenerateParallel(const PullOptions& opts, std::vector<Region>* regions,
+                      size_t num_threads) -> Status {
+  if (opts.deterministic && (opts.num_jsons == std::numeric_limits<size_t>::max())) {
+    return Status(Error::GenericError,
+                  "Deterministic parallel generation requires a number of JSONs.");
+  }
+  num_threads = std::max<size_t>(1, std::min(num_threads, regions->size()));
+
+  // Create all generators up front, so errors are returned before spawning threads.
+  std::vector<std::unique_ptr<PullGenerator>> gens(num_threads);
+  for (auto& gen : gens) {
+    ILLEX_ROE(PullGenerator::Make(opts, &gen));
+  }
+
+  std::atomic<size_t> next(0);
+  std::vector<Status> statuses(num_threads, Status::OK());
+  auto fill = [&](size_t thread_id) {
+    auto* gen = gens[thread_id].get();
+    for (size_t r = next++; r < regions->size(); r = next++) {
+      auto& region = (*regions)[r];
+      if (opts.deterministic) {
+        gen->Reset(opts.gen.seed, opts.first_json + r * opts.num_jsons);
+      } else {
+        gen->Reset(opts.gen.seed + static_cast<int>(r), opts.first_json);
+      }
+      auto status =
+          gen->GenerateInto(region.data, region.capacity, &region.num_jsons,
+                            &region.num_bytes);
+      if (!status.ok()) {
+        statuses[thread_id] = status;
+        return;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t t = 1; t < num_threads; t++) {
+    threads.emplace_back(fill, t);
+  }
+  // The calling thread fills regions as well.
+  fill(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (const auto& status : statuses) {
+    ILLEX_ROE(status);
+  }
+  return Status::OK();
+}
+
+}  // namespace illex
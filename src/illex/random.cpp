@@ -0,0 +1,125 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/random.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace illex {
+
+/// The number of characters generated per iteration of FillChars.
+constexpr size_t kCharBlock = 64;
+
+auto ParseRandomAlgorithm(std::string_view name, RandomAlgorithm* out) -> bool {
+  if (name == "xoshiro256++") {
+    *out = RandomAlgorithm::Xoshiro256pp;
+  } else if (name == "pcg64") {
+    *out = RandomAlgorithm::PCG64;
+  } else if (name == "wyrand") {
+    *out = RandomAlgorithm::Wyrand;
+  } else if (name == "ranlux48") {
+    *out = RandomAlgorithm::Ranlux48;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/// Expand a seed into well-mixed state words, as recommended by the xoshiro authors.
+static auto SplitMix64(uint64_t* x) -> uint64_t {
+  uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+RandomEngine::RandomEngine(uint64_t seed, RandomAlgorithm algorithm)
+    : algorithm_(algorithm) {
+  this->seed(seed);
+}
+
+void RandomEngine::seed(uint64_t seed) {
+  // Only seed the state of the selected algorithm, since counter-based generation
+  // reseeds for every JSON.
+  if (algorithm_ == RandomAlgorithm::Ranlux48) {
+    ranlux_.seed(seed);
+    return;
+  }
+  uint64_t x = seed;
+  for (auto& word : s_) {
+    word = SplitMix64(&x);
+  }
+  if (algorithm_ == RandomAlgorithm::PCG64) {
+    pcg_ = (static_cast<__uint128_t>(s_[0]) << 64) | s_[1];
+    // The increment must be odd.
+    pcg_inc_ = (static_cast<__uint128_t>(s_[2]) << 64) | s_[3] | 1;
+  }
+}
+
+void RandomEngine::seed(uint64_t seed, uint64_t counter) {
+  uint64_t x = seed;
+  uint64_t key = SplitMix64(&x);
+  x = key ^ counter;
+  this->seed(SplitMix64(&x));
+}
+
+void RandomEngine::Fill(uint64_t* out, size_t n) {
+  // Branch on the algorithm once, so the loops are free of it.
+  switch (algorithm_) {
+    case RandomAlgorithm::Xoshiro256pp:
+      for (size_t i = 0; i < n; i++) {
+        out[i] = NextXoshiro();
+      }
+      break;
+    case RandomAlgorithm::PCG64:
+      for (size_t i = 0; i < n; i++) {
+        out[i] = NextPCG();
+      }
+      break;
+    case RandomAlgorithm::Wyrand:
+      for (size_t i = 0; i < n; i++) {
+        out[i] = NextWyrand();
+      }
+      break;
+    case RandomAlgorithm::Ranlux48:
+      for (size_t i = 0; i < n; i++) {
+        out[i] = NextRanlux();
+      }
+      break;
+  }
+}
+
+void RandomEngine::FillChars(char* out, size_t n, char lo, char hi) {
+  const auto first = static_cast<uint8_t>(lo);
+  const auto span = static_cast<uint32_t>(static_cast<uint8_t>(hi) - first) + 1;
+  uint64_t words[kCharBlock / 8];
+  char chars[kCharBlock];
+  for (size_t i = 0; i < n; i += kCharBlock) {
+    const size_t length = std::min(kCharBlock, n - i);
+    const size_t num_words = (length + 7) / 8;
+    Fill(words, num_words);
+    // Take the bytes from the least significant one up, so the result does not depend
+    // on the byte order of the platform.
+    for (size_t w = 0; w < num_words; w++) {
+      for (size_t b = 0; b < 8; b++) {
+        auto byte = static_cast<uint32_t>((words[w] >> (8 * b)) & 0xFF);
+        chars[8 * w + b] = static_cast<char>(first + ((byte * span) >> 8));
+      }
+    }
+    std::memcpy(out + i, chars, length);
+  }
+}
+
+}  // namespace illex
@@ -0,0 +1,265 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/replay.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "illex/log.h"
+#include "illex/scanner.h"
+
+namespace illex {
+
+/// Return a status describing the last system call error.
+static auto ErrnoStatus(const std::string& what) -> Status {
+  return Status(Error::IOError, what + ": " + std::strerror(errno));
+}
+
+ReplayData::ReplayData(ReplayData&& other) noexcept { *this = std::move(other); }
+
+auto ReplayData::operator=(ReplayData&& other) noexcept -> ReplayData& {
+  if (this != &other) {
+    Reset();
+    fd_ = std::exchange(other.fd_, -1);
+    map_ = std::exchange(other.map_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    segments_ = std::move(other.segments_);
+    num_jsons_ = std::exchange(other.num_jsons_, 0);
+  }
+  return *this;
+}
+
+ReplayData::~ReplayData() { Reset(); }
+
+void ReplayData::Reset() {
+  if (map_ != nullptr) {
+    munmap(map_, size_);
+    map_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+  size_ = 0;
+  segments_.clear();
+  num_jsons_ = 0;
+}
+
+/// Write all bytes to a file descriptor.
+static auto WriteAll(int fd, std::string_view data) -> Status {
+  while (!data.empty()) {
+    auto written = write(fd, data.data(), data.length());
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ErrnoStatus("Unable to write replay data");
+    }
+    data.remove_prefix(written);
+  }
+  return Status::OK();
+}
+
+/// Create an anonymous file, so data can be mapped and sent with sendfile().
+static auto CreateMemoryFile(int* out) -> Status {
+#if defined(__linux__)
+  int fd = memfd_create("illex-replay", MFD_CLOEXEC);
+#else
+  std::FILE* tmp = std::tmpfile();
+  int fd = tmp != nullptr ? dup(fileno(tmp)) : -1;
+  if (tmp != nullptr) {
+    std::fclose(tmp);
+  }
+#endif
+  if (fd < 0) {
+    return ErrnoStatus("Unable to create replay memory file");
+  }
+  *out = fd;
+  return Status::OK();
+}
+
+auto ReplayData::Generate(const ProducerOptions& opts, ReplayData* out) -> Status {
+  if (opts.pretty || !opts.whitespace || (opts.whitespace_char != '\n')) {
+    return Status(Error::GenericError,
+                  "Replaying requires JSONs that are delimited by a single newline.");
+  }
+
+  int fd = -1;
+  ILLEX_ROE(CreateMemoryFile(&fd));
+  out->Reset();
+  out->fd_ = fd;
+
+  // Produce all JSONs once.
+  ProductionQueue queue(opts.queue_capacity);
+  BatchPool pool;
+  std::atomic<bool> shutdown = false;
+  std::shared_ptr<Producer> producer;
+  ILLEX_ROE(Producer::Make(opts, &queue, &pool, &producer));
+  ILLEX_ROE(producer->Start(&shutdown));
+
+  const size_t total = TotalJSONs(opts);
+  size_t num_jsons = 0;
+  double starved = 0.0;
+  Status status;
+  JSONBatch batch;
+  char last = '\n';
+  while ((num_jsons < total) && status.ok()) {
+    if (queue.Dequeue(&batch, kShutdownPollInterval, &starved)) {
+      auto data = batch.data();
+      status = WriteAll(fd, data);
+      if (!data.empty()) {
+        last = data.back();
+      }
+      num_jsons += batch.num_jsons;
+      pool.Release(&batch);
+    }
+  }
+  if (!status.ok()) {
+    shutdown.store(true);
+  }
+  producer->Finish();
+  ILLEX_ROE(status);
+  // Terminate the last JSON, so it does not run into the first JSON of the next repeat.
+  if (last != '\n') {
+    ILLEX_ROE(WriteAll(fd, "\n"));
+  }
+
+  return out->MapFd(fd);
+}
+
+auto ReplayData::Map(const std::string& path, ReplayData* out) -> Status {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return ErrnoStatus("Unable to open " + path);
+  }
+  out->Reset();
+  out->fd_ = fd;
+
+  // The data is sent as a whole on every repeat, so the last JSON must be terminated, or
+  // it runs into the first JSON of the next repeat. The file is only read, so terminate
+  // a copy of it instead.
+  struct stat st = {};
+  if (fstat(fd, &st) != 0) {
+    return ErrnoStatus("Unable to query replay data size");
+  }
+  char last = '\n';
+  if ((st.st_size > 0) && (pread(fd, &last, 1, st.st_size - 1) != 1)) {
+    return ErrnoStatus("Unable to read " + path);
+  }
+  if (last != '\n') {
+    spdlog::info("Last JSON of {} is not terminated. Replaying a terminated copy.", path);
+    int copy = -1;
+    ILLEX_ROE(CreateMemoryFile(&copy));
+    out->fd_ = copy;
+    std::vector<char> chunk(kSegmentSize);
+    ssize_t bytes = 0;
+    while ((bytes = read(fd, chunk.data(), chunk.size())) != 0) {
+      if (bytes < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        auto status = ErrnoStatus("Unable to read " + path);
+        close(fd);
+        return status;
+      }
+      auto status = WriteAll(copy, std::string_view(chunk.data(), bytes));
+      if (!status.ok()) {
+        close(fd);
+        return status;
+      }
+    }
+    close(fd);
+    ILLEX_ROE(WriteAll(copy, "\n"));
+    fd = copy;
+  }
+  return out->MapFd(fd);
+}
+
+auto ReplayData::MapFd(int fd) -> Status {
+  struct stat st = {};
+  if (fstat(fd, &st) != 0) {
+    return ErrnoStatus("Unable to query replay data size");
+  }
+  if (st.st_size == 0) {
+    return Status(Error::IOError, "Replay data is empty.");
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  map_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  if (map_ == MAP_FAILED) {
+    map_ = nullptr;
+    return ErrnoStatus("Unable to map replay data");
+  }
+  // Advice values are not flags, so every advice takes a call of its own. They are only
+  // hints, so replaying continues without them.
+  if (madvise(map_, size_, MADV_SEQUENTIAL) != 0) {
+    spdlog::warn("Unable to advise sequential access to replay data: {}",
+                 std::strerror(errno));
+  }
+  if (madvise(map_, size_, MADV_WILLNEED) != 0) {
+    spdlog::warn("Unable to advise reading ahead replay data: {}", std::strerror(errno));
+  }
+
+  // Divide the data into segments that end after a newline. Segments only grow beyond
+  // the segment size if a single JSON is larger.
+  const auto* data = static_cast<const char*>(map_);
+  std::vector<size_t> newlines;
+  size_t offset = 0;
+  while (offset < size_) {
+    size_t end = std::min(offset + kSegmentSize, size_);
+    if (end < size_) {
+      const auto* last =
+          static_cast<const char*>(memrchr(data + offset, '\n', end - offset));
+      if (last == nullptr) {
+        last = static_cast<const char*>(std::memchr(data + end, '\n', size_ - end));
+      }
+      end = last != nullptr ? last - data + 1 : size_;
+    }
+    newlines.clear();
+    ScanNewlines(reinterpret_cast<const std::byte*>(data + offset), end - offset,
+                 &newlines);
+    // Count the non-empty records, like clients scanning the data do. A last JSON may
+    // not be terminated by a newline.
+    size_t num_jsons = 0;
+    size_t json_start = 0;
+    for (auto newline : newlines) {
+      if (newline > json_start) {
+        num_jsons++;
+      }
+      json_start = newline + 1;
+    }
+    if (json_start < end - offset) {
+      num_jsons++;
+    }
+    segments_.push_back({offset, end - offset, num_jsons});
+    num_jsons_ += num_jsons;
+    offset = end;
+  }
+
+  return Status::OK();
+}
+
+}  // namespace illex
@@ -0,0 +1,123 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "illex/producer.h"
+#include "illex/status.h"
+
+namespace illex {
+
+/// Options for replaying the same JSONs on every repeat.
+struct ReplayOptions {
+  /// Whether to generate all JSONs once up front, and replay them.
+  bool pregenerate = false;
+  /// A file with newline-delimited JSONs to replay, e.g. produced by illex file.
+  std::string path;
+  /// Whether to send the data with sendfile(), instead of from the mapping.
+  bool sendfile = false;
+
+  /// \brief Return whether replaying is enabled.
+  [[nodiscard]] auto enabled() const -> bool { return pregenerate || !path.empty(); }
+};
+
+/// A contiguous range of complete JSONs in replay data.
+struct ReplaySegment {
+  /// The offset of the first byte.
+  size_t offset = 0;
+  /// The number of bytes.
+  size_t length = 0;
+  /// The number of JSONs.
+  size_t num_jsons = 0;
+};
+
+/**
+ * \brief Newline-delimited JSONs that are memory-mapped, to be sent repeatedly.
+ *
+ * The data is backed by a file descriptor, either of a regular file or of an anonymous
+ * memory file, so it can be sent from the mapping or with sendfile(). The data is
+ * divided into segments of complete JSONs, which are the units of sending.
+ */
+class ReplayData {
+ public:
+  /// The approximate size of a segment.
+  static constexpr size_t kSegmentSize = 1024 * 1024;
+
+  ReplayData() = default;
+  ReplayData(const ReplayData&) = delete;
+  auto operator=(const ReplayData&) -> ReplayData& = delete;
+  ReplayData(ReplayData&& other) noexcept;
+  auto operator=(ReplayData&& other) noexcept -> ReplayData&;
+  ~ReplayData();
+
+  /**
+   * \brief Generate all JSONs once, into an anonymous memory file.
+   * \param[in]  opts The production options. JSONs may not be pretty-printed.
+   * \param[out] out  The replay data.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Generate(const ProducerOptions& opts, ReplayData* out) -> Status;
+
+  /**
+   * \brief Map a file with newline-delimited JSONs.
+   *
+   * If the last JSON of the file is not terminated, a terminated copy of the file is
+   * mapped instead, so repeats do not run into each other.
+   *
+   * \param[in]  path The path of the file.
+   * \param[out] out  The replay data.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Map(const std::string& path, ReplayData* out) -> Status;
+
+  /// \brief Return the mapped data.
+  [[nodiscard]] auto data() const -> std::string_view {
+    return std::string_view(static_cast<const char*>(map_), size_);
+  }
+
+  /// \brief Return the file descriptor backing the data.
+  [[nodiscard]] auto fd() const -> int { return fd_; }
+
+  /// \brief Return the segments of the data.
+  [[nodiscard]] auto segments() const -> const std::vector<ReplaySegment>& {
+    return segments_;
+  }
+
+  /// \brief Return the total number of JSONs.
+  [[nodiscard]] auto num_jsons() const -> size_t { return num_jsons_; }
+
+ private:
+  /// Map the file descriptor and divide the data into segments.
+  auto MapFd(int fd) -> Status;
+  /// Release the mapping and close the file descriptor.
+  void Reset();
+
+  /// The file descriptor.
+  int fd_ = -1;
+  /// The mapping.
+  void* map_ = nullptr;
+  /// The size of the mapping.
+  size_t size_ = 0;
+  /// The segments.
+  std::vector<ReplaySegment> segments_;
+  /// The total number of JSONs.
+  size_t num_jsons_ = 0;
+};
+
+}  // namespace illex
@@ -0,0 +1,149 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/scanner.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ILLEX_SCAN_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define ILLEX_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+namespace illex {
+
+/// Append the offsets of all set bits in a mask, relative to some base offset.
+static inline void AppendMask(uint64_t mask, size_t base, std::vector<size_t>* offsets) {
+  while (mask != 0) {
+    offsets->push_back(base + __builtin_ctzll(mask));
+    // Clear the lowest set bit.
+    mask &= mask - 1;
+  }
+}
+
+/// Scalar newline scanner, used as fallback and for the tails of vectorized scans.
+static void ScanScalar(const char* data, size_t size, size_t base,
+                       std::vector<size_t>* offsets) {
+  const char* pos = data;
+  const char* end = data + size;
+  while (pos < end) {
+    pos = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    if (pos == nullptr) {
+      return;
+    }
+    offsets->push_back(base + (pos - data));
+    pos++;
+  }
+}
+
+#if defined(ILLEX_SCAN_X86)
+
+__attribute__((target("avx512bw"))) static void ScanAVX512(
+    const char* data, size_t size, std::vector<size_t>* offsets) {
+  const __m512i newline = _mm512_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    __m512i chunk = _mm512_loadu_si512(reinterpret_cast<const void*>(data + i));
+    AppendMask(_mm512_cmpeq_epi8_mask(chunk, newline), i, offsets);
+  }
+  ScanScalar(data + i, size - i, i, offsets);
+}
+
+__attribute__((target("avx2"))) static void ScanAVX2(const char* data, size_t size,
+                                                     std::vector<size_t>* offsets) {
+  const __m256i newline = _mm256_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+    auto mask_lo =
+        static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)));
+    auto mask_hi =
+        static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)));
+    AppendMask(static_cast<uint64_t>(mask_hi) << 32 | mask_lo, i, offsets);
+  }
+  ScanScalar(data + i, size - i, i, offsets);
+}
+
+static void ScanSSE2(const char* data, size_t size, std::vector<size_t>* offsets) {
+  const __m128i newline = _mm_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 64 <= size; i += 64) {
+    uint64_t mask = 0;
+    for (size_t j = 0; j < 4; j++) {
+      __m128i chunk =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16 * j));
+      auto bits =
+          static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline)));
+      mask |= static_cast<uint64_t>(bits) << (16 * j);
+    }
+    AppendMask(mask, i, offsets);
+  }
+  ScanScalar(data + i, size - i, i, offsets);
+}
+
+using ScanFunction = void (*)(const char*, size_t, std::vector<size_t>*);
+
+/// Select the widest implementation supported by the CPU.
+static auto SelectScanFunction() -> ScanFunction {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) {
+    return ScanAVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return ScanAVX2;
+  }
+  return ScanSSE2;
+}
+
+void ScanNewlines(const std::byte* data, size_t size, std::vector<size_t>* offsets) {
+  static const ScanFunction scan = SelectScanFunction();
+  scan(reinterpret_cast<const char*>(data), size, offsets);
+}
+
+#elif defined(ILLEX_SCAN_NEON)
+
+void ScanNewlines(const std::byte* data, size_t size, std::vector<size_t>* offsets) {
+  const auto* chars = reinterpret_cast<const char*>(data);
+  const uint8x16_t newline = vdupq_n_u8('\n');
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(chars + i));
+    uint8x16_t eq = vceqq_u8(chunk, newline);
+    // NEON has no movemask; narrow the comparison result into 4 bits per byte instead.
+    uint8x8_t narrowed = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+    mask &= 0x8888888888888888ull;
+    while (mask != 0) {
+      offsets->push_back(i + (__builtin_ctzll(mask) >> 2));
+      mask &= mask - 1;
+    }
+  }
+  ScanScalar(chars + i, size - i, i, offsets);
+}
+
+#else
+
+void ScanNewlines(const std::byte* data, size_t size, std::vector<size_t>* offsets) {
+  ScanScalar(reinterpret_cast<const char*>(data), size, 0, offsets);
+}
+
+#endif
+
+}  // namespace illex
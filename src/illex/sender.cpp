@@ -0,0 +1,434 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/sender.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#endif
+
+#include "illex/log.h"
+#include "illex/protocol.h"
+#include "illex/scanner.h"
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define ILLEX_ZEROCOPY
+#endif
+
+namespace illex {
+
+/// Return a status describing the last system call error.
+static auto ErrnoStatus(const std::string& what) -> Status {
+  return Status(Error::ServerError, what + ": " + std::strerror(errno));
+}
+
+auto BatchSender::Create(int fd, const SenderOptions& options, BatchPool* pool,
+                         BatchSender* out) -> Status {
+  out->fd_ = fd;
+  out->options_ = options;
+  out->options_.max_coalesce = std::clamp<size_t>(options.max_coalesce, 1, IOV_MAX);
+  out->pool_ = pool;
+  out->zerocopy_ = false;
+
+  if (options.zerocopy) {
+#if defined(ILLEX_ZEROCOPY)
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+      out->zerocopy_ = true;
+    } else {
+      spdlog::warn("Could not enable MSG_ZEROCOPY: {}. Falling back to copying sends.",
+                   std::strerror(errno));
+    }
+#else
+    spdlog::warn("MSG_ZEROCOPY is not supported on this platform. "
+                 "Falling back to copying sends.");
+#endif
+  }
+
+  return Status::OK();
+}
+
+void BatchSender::Release(std::vector<JSONBatch>* batches) {
+  if (pool_ != nullptr) {
+    for (auto& batch : *batches) {
+      pool_->Release(&batch);
+    }
+  }
+  batches->clear();
+}
+
+void BatchSender::Release(std::vector<SharedBatch>* batches) { batches->clear(); }
+
+void BatchSender::Release(Pending* pending) {
+  Release(&pending->batches);
+  Release(&pending->shared);
+}
+
+/// Hold on to batches until their zero-copy send completes.
+static void Hold(std::vector<JSONBatch>* batches, std::vector<JSONBatch>* owned,
+                 std::vector<SharedBatch>* shared) {
+  *owned = std::move(*batches);
+}
+
+/// Hold on to shared batches until their zero-copy send completes.
+static void Hold(std::vector<SharedBatch>* batches, std::vector<JSONBatch>* owned,
+                 std::vector<SharedBatch>* shared) {
+  *shared = std::move(*batches);
+}
+
+void StampBatch(JSONBatch* batch, uint64_t first_seq, size_t interval) {
+  if (batch->framed) {
+    frame::WriteSeq(const_cast<char*>(batch->buffer->GetString()), first_seq);
+  }
+  if ((interval == 0) || batch->stamps.empty()) {
+    return;
+  }
+  const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+  // The batch is not shared yet, so its bytes can still be modified.
+  auto* data = const_cast<char*>(batch->buffer->GetString());
+  // Skip straight to the JSONs with a sequence number that is a multiple of the interval.
+  for (size_t i = (interval - first_seq % interval) % interval; i < batch->stamps.size();
+       i += interval) {
+    const auto offset = batch->stamps[i];
+    if (offset != kNoStamp) {
+      stamp::WriteNumber(data + offset + stamp::kSeqOffset, first_seq + i);
+      stamp::WriteNumber(data + offset + stamp::kTimeOffset, now);
+    }
+  }
+}
+
+void BatchSender::Stamp(JSONBatch* batch) {
+  StampBatch(batch, next_seq_, options_.stamp_interval);
+  next_seq_ += batch->num_jsons;
+}
+
+void BatchSender::Stamp(SharedBatch* batch) { next_seq_ += (*batch)->num_jsons; }
+
+auto BatchSender::Send(std::vector<JSONBatch>* batches) -> Status {
+  return SendAll(batches);
+}
+
+auto BatchSender::Send(std::vector<SharedBatch>* batches) -> Status {
+  return SendAll(batches);
+}
+
+void BatchSender::SetPacer(Pacer* pacer, bool splittable) {
+  pacer_ = pacer;
+  splittable_ = splittable;
+}
+
+auto BatchSender::SendChunk(std::string_view chunk, size_t num_jsons) -> Status {
+  pacer_->Wait(num_jsons, chunk.length());
+  iov_.clear();
+  iov_.push_back({const_cast<char*>(chunk.data()), chunk.length()});
+  return Write(false);
+}
+
+auto BatchSender::SendPaced(std::string_view data, size_t num_jsons) -> Status {
+  if (!splittable_) {
+    return SendChunk(data, num_jsons);
+  }
+
+  // Split the data after the newlines, into chunks that fit a pacing quantum.
+  newlines_.clear();
+  ScanNewlines(reinterpret_cast<const std::byte*>(data.data()), data.length(),
+               &newlines_);
+  size_t chunk_start = 0;
+  size_t chunk_end = 0;
+  size_t chunk_jsons = 0;
+  for (auto newline : newlines_) {
+    auto fits = pacer_->Fits(chunk_jsons + 1, newline + 1 - chunk_start);
+    if ((chunk_jsons > 0) && !fits) {
+      ILLEX_ROE(
+          SendChunk(data.substr(chunk_start, chunk_end - chunk_start), chunk_jsons));
+      chunk_start = chunk_end;
+      chunk_jsons = 0;
+    }
+    chunk_end = newline + 1;
+    chunk_jsons++;
+  }
+  // Send the last chunk, including any bytes after the last newline.
+  if (chunk_start < data.length()) {
+    ILLEX_ROE(SendChunk(data.substr(chunk_start), chunk_jsons));
+  }
+  return Status::OK();
+}
+
+template <typename T>
+auto BatchSender::SendPaced(std::vector<T>* batches) -> Status {
+  for (const auto& b : *batches) {
+    const auto& batch = Deref(b);
+    if ((batch.buffer == nullptr) || (batch.buffer->GetSize() == 0)) {
+      continue;
+    }
+    ILLEX_ROE(SendPaced(batch.data(), batch.num_jsons));
+  }
+
+  Release(batches);
+  return Status::OK();
+}
+
+template <typename T>
+auto BatchSender::SendAll(std::vector<T>* batches) -> Status {
+  // Paced batches are stamped before waiting for the pacer, which is included in the
+  // latency.
+  for (auto& batch : *batches) {
+    Stamp(&batch);
+  }
+
+  if (pacer_ != nullptr) {
+    return SendPaced(batches);
+  }
+
+  // Gather the data of all batches.
+  iov_.clear();
+  size_t total = 0;
+  for (const auto& b : *batches) {
+    const auto& batch = Deref(b);
+    if ((batch.buffer == nullptr) || (batch.buffer->GetSize() == 0)) {
+      continue;
+    }
+    auto data = batch.data();
+    iov_.push_back({const_cast<char*>(data.data()), data.length()});
+    total += data.length();
+  }
+
+  // Small sends are cheaper to copy than to pin and complete asynchronously.
+  const bool use_zerocopy = zerocopy_ && (total >= options_.zerocopy_threshold);
+  bool zerocopied = false;
+  ILLEX_ROE(Write(use_zerocopy, &zerocopied));
+
+  if (zerocopied) {
+    // The kernel may still read from these buffers. Keep them until it is done.
+    Pending pending;
+    pending.id = next_id_ - 1;
+    Hold(batches, &pending.batches, &pending.shared);
+    pending_.push_back(std::move(pending));
+    batches->clear();
+    return ReadCompletions(false);
+  }
+
+  Release(batches);
+  return Status::OK();
+}
+
+auto BatchSender::Send(std::string_view data, size_t num_jsons) -> Status {
+  if (data.empty()) {
+    return Status::OK();
+  }
+  if (pacer_ != nullptr) {
+    return SendPaced(data, num_jsons);
+  }
+
+  iov_.clear();
+  iov_.push_back({const_cast<char*>(data.data()), data.length()});
+  const bool use_zerocopy = zerocopy_ && (data.length() >= options_.zerocopy_threshold);
+  bool zerocopied = false;
+  ILLEX_ROE(Write(use_zerocopy, &zerocopied));
+
+  if (zerocopied) {
+    // The caller owns the data, so there is nothing to release. Only track the id.
+    Pending pending;
+    pending.id = next_id_ - 1;
+    pending_.push_back(std::move(pending));
+    return ReadCompletions(false);
+  }
+  return Status::OK();
+}
+
+auto BatchSender::SendFile(int fd, size_t offset, size_t length) -> Status {
+  auto off = static_cast<off_t>(offset);
+  const auto end = static_cast<off_t>(offset + length);
+  while (off < end) {
+    auto sent = sendfile(fd_, fd, &off, end - off);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ErrnoStatus("Unable to send file");
+    }
+    if (sent == 0) {
+      return Status(Error::ServerError, "Unexpected end of file while sending.");
+    }
+    metrics_.num_sends++;
+    metrics_.num_bytes += sent;
+  }
+  return Status::OK();
+}
+
+auto BatchSender::Write(bool use_zerocopy, bool* zerocopied) -> Status {
+  if (zerocopied != nullptr) {
+    *zerocopied = false;
+  }
+  int flags = MSG_NOSIGNAL;
+#if defined(ILLEX_ZEROCOPY)
+  if (use_zerocopy) {
+    flags |= MSG_ZEROCOPY;
+  }
+#endif
+
+  // Send everything, continuing after partial sends.
+  size_t first = 0;
+  while (first < iov_.size()) {
+    struct msghdr msg = {};
+    msg.msg_iov = iov_.data() + first;
+    msg.msg_iovlen = std::min<size_t>(iov_.size() - first, IOV_MAX);
+    auto sent = sendmsg(fd_, &msg, flags);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (use_zerocopy && (errno == ENOBUFS)) {
+        if (!pending_.empty()) {
+          // Too many outstanding zero-copy sends. Wait for the kernel to complete some,
+          // which releases at least one of them.
+          ILLEX_ROE(ReadCompletions(true));
+        } else {
+          // There is nothing left to wait for, so the pages cannot be pinned at all right
+          // now. Copy the rest instead of retrying.
+          flags = MSG_NOSIGNAL;
+          use_zerocopy = false;
+        }
+        continue;
+      }
+      return ErrnoStatus("Unable to send batches");
+    }
+    metrics_.num_sends++;
+    metrics_.num_bytes += sent;
+    if (use_zerocopy) {
+      // Every successful zero-copy send call gets the next notification id.
+      next_id_++;
+      metrics_.num_zerocopy++;
+      if (zerocopied != nullptr) {
+        *zerocopied = true;
+      }
+    }
+
+    // Skip the I/O vectors that were sent completely, and trim a partially sent one.
+    auto remaining = static_cast<size_t>(sent);
+    while ((first < iov_.size()) && (remaining >= iov_[first].iov_len)) {
+      remaining -= iov_[first].iov_len;
+      first++;
+    }
+    if (remaining > 0) {
+      iov_[first].iov_base = static_cast<char*>(iov_[first].iov_base) + remaining;
+      iov_[first].iov_len -= remaining;
+    }
+  }
+
+  return Status::OK();
+}
+
+auto BatchSender::ReadCompletions(bool wait) -> Status {
+#if defined(ILLEX_ZEROCOPY)
+  while (!pending_.empty()) {
+    // Whether the peer hung up, in which case poll no longer waits.
+    bool hung_up = false;
+    if (wait) {
+      // Notifications on the error queue are signaled as POLLERR, which is always
+      // reported.
+      struct pollfd pfd = {fd_, 0, 0};
+      if ((poll(&pfd, 1, -1) < 0) && (errno != EINTR)) {
+        return ErrnoStatus("Unable to poll for send completions");
+      }
+      hung_up = (pfd.revents & (POLLHUP | POLLNVAL)) != 0;
+    }
+
+    char control[128];
+    struct msghdr msg = {};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+        if (!wait) {
+          return Status::OK();
+        }
+        // POLLERR without a notification means the socket itself has an error.
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(fd_, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error != 0) {
+          errno = error;
+          return ErrnoStatus("Socket error while waiting for send completions");
+        }
+        if (hung_up) {
+          // The error queue is drained, and waiting again would return immediately.
+          // The batches may still be referenced by the socket, so they are not released.
+          return Status(Error::ServerError,
+                        "Client hung up before all zero-copy sends completed.");
+        }
+        continue;
+      }
+      return ErrnoStatus("Unable to read send completions");
+    }
+
+    for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      bool is_recverr =
+          ((cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == IP_RECVERR)) ||
+          ((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR));
+      if (!is_recverr) {
+        continue;
+      }
+      const auto* err =
+          reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cmsg));
+      if ((err->ee_errno != 0) || (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)) {
+        continue;
+      }
+      // The notification covers the range of ids [ee_info, ee_data].
+      if ((err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0) {
+        metrics_.num_zerocopy_copied += err->ee_data - err->ee_info + 1;
+      }
+      // TCP completes sends in order, so release everything up to the last id. Ids wrap
+      // around, so compare them through their difference.
+      while (!pending_.empty() &&
+             (static_cast<int32_t>(err->ee_data - pending_.front().id) >= 0)) {
+        Release(&pending_.front());
+        pending_.pop_front();
+      }
+    }
+    // Received a notification, drain the rest of the queue without waiting.
+    wait = false;
+  }
+#endif
+  return Status::OK();
+}
+
+auto BatchSender::Flush() -> Status {
+  while (!pending_.empty()) {
+    ILLEX_ROE(ReadCompletions(true));
+  }
+  return Status::OK();
+}
+
+}  // namespace illex
@@ -0,0 +1,252 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "illex/affinity.h"
+#include "illex/metrics.h"
+#include "illex/pacer.h"
+#include "illex/producer.h"
+#include "illex/status.h"
+
+namespace illex {
+
+/// Options for sending batches over a socket.
+struct SenderOptions {
+  /// Maximum number of ready batches to gather into a single send call.
+  size_t max_coalesce = 16;
+  /// Whether to send large batches using MSG_ZEROCOPY, if the platform supports it.
+  bool zerocopy = false;
+  /// Minimum number of bytes of a send call to use MSG_ZEROCOPY.
+  size_t zerocopy_threshold = 64 * 1024;
+  /**
+   * \brief Fill in the send stamps of every JSON whose sequence number is a multiple of
+   *        this, or 0 to not fill in stamps.
+   *
+   * The batches must be produced with stamps.
+   */
+  size_t stamp_interval = 0;
+  /// The CPUs to pin sender threads to, or empty to not pin them.
+  CpuSet cpus;
+  /// Live counters to add sent JSONs and starved time to, or nullptr for none.
+  LiveMetrics* live = nullptr;
+};
+
+/**
+ * \brief Fill in the send stamps of the sampled JSONs in a batch, with the current time.
+ *
+ * If the batch is framed, this also fills in the sequence number of its frame header.
+ *
+ * \param batch     The batch, produced with stamps.
+ * \param first_seq The sequence number of the first JSON in the batch.
+ * \param interval  Stamp JSONs whose sequence number is a multiple of this.
+ */
+void StampBatch(JSONBatch* batch, uint64_t first_seq, size_t interval);
+
+/// A batch that can be sent by multiple senders. It is released when all are done.
+using SharedBatch = std::shared_ptr<JSONBatch>;
+
+/// Access a batch that is owned directly.
+inline auto Deref(const JSONBatch& batch) -> const JSONBatch& { return batch; }
+
+/// Access a batch that is shared.
+inline auto Deref(const SharedBatch& batch) -> const JSONBatch& { return *batch; }
+
+/// Statistics of a batch sender.
+struct SenderMetrics {
+  /// Number of bytes sent.
+  size_t num_bytes = 0;
+  /// Number of send calls.
+  size_t num_sends = 0;
+  /// Number of send calls using MSG_ZEROCOPY.
+  size_t num_zerocopy = 0;
+  /// Number of MSG_ZEROCOPY sends for which the kernel fell back to copying.
+  size_t num_zerocopy_copied = 0;
+
+  inline auto operator+=(const SenderMetrics& rhs) -> SenderMetrics& {
+    num_bytes += rhs.num_bytes;
+    num_sends += rhs.num_sends;
+    num_zerocopy += rhs.num_zerocopy;
+    num_zerocopy_copied += rhs.num_zerocopy_copied;
+    return *this;
+  }
+};
+
+/**
+ * \brief Sends batches of JSONs over a socket, gathering multiple batches per call.
+ *
+ * All batches passed to Send() are written with as few sendmsg() calls as possible.
+ * Once sent, batch buffers are returned to a batch pool. When MSG_ZEROCOPY is used, the
+ * kernel may still read from the buffers after sendmsg() returns, so those batches are
+ * only returned to the pool once the kernel notifies their completion on the socket
+ * error queue.
+ */
+class BatchSender {
+ public:
+  /**
+   * \brief Create a new batch sender.
+   * \param[in]  fd      The native handle of a connected, blocking TCP socket.
+   * \param[in]  options The sender options.
+   * \param[in]  pool    The pool to return sent batch buffers to, may be nullptr.
+   * \param[out] out     The BatchSender object to populate.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Create(int fd, const SenderOptions& options, BatchPool* pool,
+                     BatchSender* out) -> Status;
+
+  /**
+   * \brief Send a number of batches.
+   * \param[in,out] batches The batches to send, this vector is emptied.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  auto Send(std::vector<JSONBatch>* batches) -> Status;
+
+  /**
+   * \brief Send a number of shared batches.
+   *
+   * Instead of returning the batches to the pool, the references to them are dropped
+   * once they are sent.
+   *
+   * \param[in,out] batches The batches to send, this vector is emptied.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  auto Send(std::vector<SharedBatch>* batches) -> Status;
+
+  /**
+   * \brief Send a range of JSONs that is owned by the caller.
+   *
+   * If MSG_ZEROCOPY is used, the data must remain valid and unmodified until Flush()
+   * returns.
+   *
+   * \param data      The JSONs to send.
+   * \param num_jsons The number of JSONs in the data.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  auto Send(std::string_view data, size_t num_jsons) -> Status;
+
+  /**
+   * \brief Send a range of a file with sendfile(), without copying it to user space.
+   *
+   * Sends are never paced or gathered.
+   *
+   * \param fd     The file descriptor of the file.
+   * \param offset The offset of the first byte to send.
+   * \param length The number of bytes to send.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  auto SendFile(int fd, size_t offset, size_t length) -> Status;
+
+  /**
+   * \brief Pace all following sends.
+   *
+   * Paced batches are not gathered, and never sent using MSG_ZEROCOPY. If the batches
+   * consist of newline-terminated JSONs, they can be split into chunks to follow the
+   * rate smoothly.
+   *
+   * \param pacer      The pacer, or nullptr to stop pacing.
+   * \param splittable Whether batches may be split after newlines.
+   */
+  void SetPacer(Pacer* pacer, bool splittable);
+
+  /**
+   * \brief Wait until the kernel has completed all outstanding zero-copy sends.
+   * \return Status::OK() if successful, an error if the socket failed or the client hung
+   *         up before all sends completed.
+   */
+  auto Flush() -> Status;
+
+  /// \brief Return whether MSG_ZEROCOPY is enabled on the socket.
+  [[nodiscard]] auto zerocopy() const -> bool { return zerocopy_; }
+
+  /// \brief Return the statistics of this sender.
+  [[nodiscard]] auto metrics() const -> SenderMetrics { return metrics_; }
+
+ private:
+  /// Batches of a zero-copy send that the kernel may still read from.
+  struct Pending {
+    /// The notification id of the last send call referring to these batches.
+    uint32_t id;
+    /// The batches.
+    std::vector<JSONBatch> batches;
+    /// The shared batches.
+    std::vector<SharedBatch> shared;
+  };
+
+  /// Gather batches into I/O vectors, send them, and release or hold them.
+  template <typename T>
+  auto SendAll(std::vector<T>* batches) -> Status;
+  /// Send batches in paced chunks, and release them.
+  template <typename T>
+  auto SendPaced(std::vector<T>* batches) -> Status;
+  /// Send data in paced chunks.
+  auto SendPaced(std::string_view data, size_t num_jsons) -> Status;
+  /// Wait for the pacer, and send a chunk of JSONs.
+  auto SendChunk(std::string_view chunk, size_t num_jsons) -> Status;
+  /**
+   * \brief Send all bytes described by the I/O vectors.
+   *
+   * Zero-copy sends fall back to copying when the kernel cannot pin more pages and no
+   * earlier zero-copy send is left to complete. Sets zerocopied, if not nullptr, to
+   * whether any of the bytes were sent with MSG_ZEROCOPY, so they must be held until
+   * completion.
+   */
+  auto Write(bool use_zerocopy, bool* zerocopied = nullptr) -> Status;
+  /// Return batches to the pool.
+  void Release(std::vector<JSONBatch>* batches);
+  /// Drop references to shared batches.
+  void Release(std::vector<SharedBatch>* batches);
+  /// Release the batches of an outstanding zero-copy send.
+  void Release(Pending* pending);
+  /// Fill in the send stamps of a batch, and advance the sequence number.
+  void Stamp(JSONBatch* batch);
+  /// Advance the sequence number. Shared batches are stamped before they are shared.
+  void Stamp(SharedBatch* batch);
+  /// Read completion notifications from the error queue, optionally waiting for one.
+  auto ReadCompletions(bool wait) -> Status;
+
+  /// The socket to send on.
+  int fd_ = -1;
+  /// The sender options.
+  SenderOptions options_;
+  /// The pool to return batch buffers to.
+  BatchPool* pool_ = nullptr;
+  /// Whether MSG_ZEROCOPY is enabled on the socket.
+  bool zerocopy_ = false;
+  /// The sequence number of the next JSON to send.
+  uint64_t next_seq_ = 0;
+  /// The notification id of the next zero-copy send call.
+  uint32_t next_id_ = 0;
+  /// Outstanding zero-copy sends, in order of their ids.
+  std::deque<Pending> pending_;
+  /// Reusable vector for the I/O vectors of a send call.
+  std::vector<struct iovec> iov_;
+  /// The pacer, if sends are paced.
+  Pacer* pacer_ = nullptr;
+  /// Whether paced batches may be split after newlines.
+  bool splittable_ = false;
+  /// Reusable vector for the newline offsets, used when splitting batches.
+  std::vector<size_t> newlines_;
+  /// Statistics.
+  SenderMetrics metrics_;
+};
+
+}  // namespace illex
@@ -15,15 +15,24 @@
 #include "illex/server.h"
 
 #include <concurrentqueue.h>
+#include <netinet/in.h>
 #include <putong/timer.h>
 #include <rapidjson/prettywriter.h>
+#include <sys/socket.h>
 
+#include <algorithm>
 #include <cassert>
 #include <csignal>
+#include <cstring>
+#include <iostream>
 #include <kissnet.hpp>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 #include "illex/arrow.h"
 #include "illex/log.h"
@@ -34,6 +43,11 @@ namespace kn = kissnet;
 
 auto Server::Create(const ServerOptions& options, Server* out) -> Status {
   assert(out != nullptr);
+  out->sender_options = options.sender;
+  out->pacing_options = options.pacing;
+  out->num_clients = options.num_clients;
+  out->fan_out = options.fan_out;
+  out->protocol = options.protocol;
   out->server =
       std::make_shared<Socket>(kn::endpoint("0.0.0.0:" + std::to_string(options.port)));
   try {
@@ -42,111 +56,378 @@ auto Server::Create(const ServerOptions& options, Server* out) -> Status {
     return Status(Error::ServerError, e.what());
   }
   out->server->listen();
-  spdlog::info("Listening on port {}...", options.port);
+  spdlog::info("Listening on port {}...", out->port());
   return Status::OK();
 }
 
-auto Server::SendJSONs(const ProducerOptions& prod_opts, const RepeatOptions& repeat_opts,
-                       StreamMetrics* metrics) -> Status {
-  // Check for some potential misuse.
-  assert(metrics != nullptr);
-  if (this->server == nullptr) {
-    return Status(Error::ServerError, "Server uninitialized. Use RawServer::Create().");
+auto Server::port() const -> uint16_t {
+  sockaddr_in address{};
+  socklen_t length = sizeof(address);
+  if ((server == nullptr) ||
+      (getsockname(server->get_native(), reinterpret_cast<sockaddr*>(&address),
+                   &length) != 0)) {
+    return 0;
   }
+  return ntohs(address.sin_port);
+}
 
-  // Create a concurrent queue for the JSON production threads.
-  ProductionQueue production_queue(1, prod_opts.num_threads, 0);
-  ProducerOptions prod_opts_int = prod_opts;
+/// Print a batch to stdout. Swap colors for each batch.
+static void PrintBatch(const JSONBatch& batch) {
+  static std::mutex mutex;
+  static bool color = false;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto data = batch.jsons();
+  std::cout << (color ? "\033[34m" : "\033[35m");
+  color = !color;
+  frame::Header header{};
+  if (batch.framed) {
+    std::memcpy(&header, batch.data().data(), sizeof(header));
+  }
+  if (header.magic == frame::kCompressedMagic) {
+    // The JSONs are not readable, so only describe them.
+    std::cout << "[" << batch.num_jsons << " JSONs, " << header.length
+              << " bytes compressed to " << header.wire_length << " bytes]" << std::endl;
+  } else {
+    std::cout << data.substr(0, data.length() - 1) << std::endl;
+  }
+  std::cout << "\033[39m";
+}
+
+/// State of the stream to a single client.
+struct ClientStream {
+  /// The client socket.
+  Socket socket;
+  /// The sender for this client.
+  BatchSender sender;
+  /// The pacer for this client.
+  Pacer pacer;
+  /// The number of JSONs sent to this client in the current run.
+  size_t num_messages = 0;
+  /// The time spent waiting for batches in the current run.
+  double starved = 0.0;
+  /// The status of the sender thread of this client.
+  Status status;
+  /// Live counters to add sent JSONs and starved time to, if any.
+  LiveMetrics* live = nullptr;
+};
+
+/// Add the JSONs and bytes sent to a client since some earlier point to its counters.
+static void AddSent(ClientStream* client, size_t num_messages, size_t num_bytes) {
+  if (client->live != nullptr) {
+    LiveMetrics::Add(&client->live->jsons_sent, client->num_messages - num_messages);
+    LiveMetrics::Add(&client->live->bytes_sent,
+                     client->sender.metrics().num_bytes - num_bytes);
+  }
+}
+
+/**
+ * \brief Send all batches that arrive in a queue to one client.
+ * \param[in]     queue          The queue to take batches from.
+ * \param[in]     total_messages The number of JSONs to send.
+ * \param[in]     max_coalesce   The maximum number of batches to send at once.
+ * \param[in]     verbose        Whether to print the batches to stdout.
+ * \param[in]     shutdown       Shutdown signal.
+ * \param[in,out] client         The client stream.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+template <typename T>
+static auto SendToClient(BoundedQueue<T>* queue, size_t total_messages,
+                         size_t max_coalesce, bool verbose, std::atomic<bool>* shutdown,
+                         ClientStream* client) -> Status {
+  std::vector<T> batches;
+  batches.reserve(max_coalesce);
+  size_t log_every = std::max(1ul, total_messages / 10);
+
+  // Attempt to pull all produced batches from the queue and send them over the socket.
+  while ((client->num_messages != total_messages) && !shutdown->load()) {
+    // Pop a batch from the queue, waiting for one if the producer has not caught up.
+    T batch;
+    const double starved = client->starved;
+    const bool dequeued =
+        queue->Dequeue(&batch, kShutdownPollInterval, &client->starved);
+    if (auto* live = client->live; live != nullptr) {
+      LiveMetrics::AddSeconds(&live->sender_starved_ns, client->starved - starved);
+      live->queue_depth.store(queue->size_approx(), std::memory_order_relaxed);
+    }
+    if (!dequeued) {
+      // Check if the client is still alive while producing.
+      if (!client->socket.get_status()) {
+        return Status(Error::ServerError, "Client socket error.");
+      }
+      continue;
+    }
+    batches.push_back(std::move(batch));
+    // Gather any other batches that are ready, so they can be sent at once.
+    while ((batches.size() < max_coalesce) && queue->TryDequeue(&batch)) {
+      batches.push_back(std::move(batch));
+    }
+
+    const size_t num_messages = client->num_messages;
+    const size_t num_bytes = client->sender.metrics().num_bytes;
+    for (const auto& b : batches) {
+      // If verbose is enabled, also print the JSON to stdout.
+      if (verbose) {
+        PrintBatch(Deref(b));
+      }
+
+      client->num_messages += Deref(b).num_jsons;
+
+      // Log some progress for large amounts.
+      if (client->num_messages % log_every < Deref(b).num_jsons) {
+        spdlog::info("{:.0}% | {}/{}",
+                     static_cast<double>(client->num_messages) /
+                         static_cast<double>(total_messages) * 100.,
+                     client->num_messages, total_messages);
+      }
+    }
+
+    // Send the batches. Their buffers are released once sent.
+    ILLEX_ROE(client->sender.Send(&batches));
+    AddSent(client, num_messages, num_bytes);
+  }
+  client->pacer.Stop();
+
+  // Wait for the kernel to finish any zero-copy sends.
+  return client->sender.Flush();
+}
+
+/**
+ * \brief Threads that are joined when they go out of scope.
+ *
+ * The shutdown signal is asserted first, so threads that did not finish yet, e.g. because
+ * setting up a run failed halfway, stop early. Producers that use the same signal and
+ * are destructed afterwards then stop as well.
+ */
+class ThreadJoiner {
+ public:
+  explicit ThreadJoiner(std::atomic<bool>* shutdown) : shutdown_(shutdown) {}
+  ThreadJoiner(const ThreadJoiner&) = delete;
+  auto operator=(const ThreadJoiner&) -> ThreadJoiner& = delete;
+  ~ThreadJoiner() {
+    shutdown_->store(true);
+    Join();
+  }
+
+  /// Add a thread to join.
+  void Add(std::thread thread) { threads_.push_back(std::move(thread)); }
+
+  /// Wait for all threads to finish.
+  void Join() {
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+    threads_.clear();
+  }
+
+ private:
+  std::atomic<bool>* shutdown_;
+  std::vector<std::thread> threads_;
+};
+
+/// Spawn a thread sending batches from a queue to one client.
+template <typename T>
+static auto SpawnSender(BoundedQueue<T>* queue, size_t total_messages,
+                        size_t max_coalesce, bool verbose, const CpuSet& cpus,
+                        std::atomic<bool>* shutdown, ClientStream* client)
+    -> std::thread {
+  return std::thread([=]() {
+    client->status = PinThread(cpus);
+    if (client->status.ok()) {
+      client->status =
+          SendToClient(queue, total_messages, max_coalesce, verbose, shutdown, client);
+    }
+    // Stop all other threads if anything went wrong.
+    if (!client->status.ok()) {
+      shutdown->store(true);
+    }
+  });
+}
 
+auto Server::AcceptClients(BatchPool* pool, std::vector<ClientStream>* clients)
+    -> Status {
   // Set signal handler for server->accept()
   std::signal(SIGINT, [](int) {
     spdlog::critical("Interrupted... exiting.\n");
     std::exit(0);
   });
 
-  // Accept a client.
-  spdlog::info("Waiting for client to connect...");
-  auto client = server->accept();
-  spdlog::info("Client connected.");
+  // Accept all clients, and set up their senders.
+  for (size_t c = 0; c < clients->size(); c++) {
+    auto& client = (*clients)[c];
+    spdlog::info("Waiting for client {}/{} to connect...", c + 1, clients->size());
+    client.socket = server->accept();
+    client.live = sender_options.live;
+    spdlog::info("Client connected.");
+    ILLEX_ROE(BatchSender::Create(client.socket.get_native(), sender_options, pool,
+                                  &client.sender));
+  }
 
   spdlog::info("Streaming JSONs...");
+  if (num_clients > 1) {
+    spdlog::info("{} {} clients.",
+                 fan_out == FanOut::Broadcast ? "Broadcasting to" : "Partitioning over",
+                 num_clients);
+  }
+  return Status::OK();
+}
+
+auto Server::ClientPacing() const -> PacingOptions {
+  // When partitioning, every client gets a share of the total rate.
+  auto pacing = pacing_options;
+  if (fan_out == FanOut::Partition) {
+    pacing.jsons_per_second /= static_cast<double>(num_clients);
+    pacing.bits_per_second /= static_cast<double>(num_clients);
+  }
+  return pacing;
+}
+
+auto Server::SendJSONs(const ProducerOptions& prod_opts, const RepeatOptions& repeat_opts,
+                       StreamMetrics* metrics) -> Status {
+  // Check for some potential misuse.
+  assert(metrics != nullptr);
+  if (this->server == nullptr) {
+    return Status(Error::ServerError, "Server uninitialized. Use RawServer::Create().");
+  }
+  if (num_clients == 0) {
+    return Status(Error::ServerError, "Number of clients must be at least 1.");
+  }
+
+  // A pool to recycle the batch buffers.
+  BatchPool batch_pool;
+  ProducerOptions prod_opts_int = prod_opts;
+  prod_opts_int.frame = protocol.framing == Framing::Length;
+  prod_opts_int.compression = protocol.compression;
+  if (prod_opts_int.frame && !prod_opts.whitespace) {
+    return Status(Error::ServerError, "Length framing requires whitespace after JSONs.");
+  }
+  if ((protocol.compression != Compression::None) && !prod_opts_int.frame) {
+    return Status(Error::ServerError, "Compression requires length framing.");
+  }
+
+  std::vector<ClientStream> clients(num_clients);
+  ILLEX_ROE(AcceptClients(&batch_pool, &clients));
   if (repeat_opts.times > 1) {
     spdlog::info("Repeating {} times.", repeat_opts.times);
     spdlog::info("  Interval: {} ms (+ production time).", repeat_opts.interval_ms);
   }
 
+  auto pacing = ClientPacing();
+  // Batches can only be split if every JSON ends with a newline, and none are inside.
+  // Frames are never split, as their headers may contain newline bytes.
+  const bool splittable = !prod_opts.pretty && prod_opts.whitespace &&
+                          (prod_opts.whitespace_char == '\n') && !prod_opts_int.frame;
+  if (pacing_options.enabled() && !splittable) {
+    spdlog::warn("JSONs are not newline-delimited. Pacing whole batches.");
+  }
+
   StreamMetrics result;
   putong::Timer t;
-
-  bool color = false;
+  // The sequence number of the next broadcast JSON. Like the sequence numbers of every
+  // sender, it continues across repeats, as the connections do.
+  uint64_t broadcast_seq = 0;
 
   for (size_t repeats = 0; repeats < repeat_opts.times; repeats++) {
-    size_t num_messages = 0;
-    size_t total_messages = prod_opts.num_batches * prod_opts.num_jsons;
-    // Set up and start producer concurrently.
     std::atomic<bool> shutdown = false;
-    std::shared_ptr<Producer> producer;
-    ILLEX_ROE(Producer::Make(prod_opts_int, &production_queue, &producer));
-    producer->Start(&shutdown);
+    // The queues outlive the producers and sender threads that use them, which are
+    // stopped if this run returns early.
+    std::vector<std::unique_ptr<ProductionQueue>> production_queues;
+    std::vector<std::unique_ptr<BoundedQueue<SharedBatch>>> client_queues;
+    std::vector<std::shared_ptr<Producer>> producers;
+    ThreadJoiner threads(&shutdown);
+    // Time the broadcasting thread spent waiting for the producer.
+    double starved = 0.0;
+    for (auto& client : clients) {
+      client.num_messages = 0;
+      client.starved = 0.0;
+      if (pacing_options.enabled()) {
+        client.pacer = Pacer(pacing);
+        client.sender.SetPacer(&client.pacer, splittable);
+      }
+    }
 
     // Start a timer.
     t.Start();
-    // Attempt to pull all produced batches from the production queue and send them over
-    // the socket.
-    while ((num_messages != total_messages) && !shutdown.load()) {
-      // Pop a batch from the queue.
-      JSONBatch batch;
-      while (!production_queue.try_dequeue(batch) && !shutdown.load()) {
-#ifndef NDEBUG
-        // Slow this down a bit in debug.
-        SPDLOG_DEBUG("Nothing in queue...");
-        std::this_thread::sleep_for(std::chrono::milliseconds(500));
-#else
-        std::this_thread::sleep_for(std::chrono::microseconds(100));
-#endif
-        // Check if the client is still alive while producing.
-        if (!client.get_status()) {
-          shutdown.store(true);
-          return Status(Error::ServerError, "Client socket error.");
-        }
-      }
-
-      // Attempt to send the message.
-      auto send_result = client.send(reinterpret_cast<std::byte*>(batch.data.data()),
-                                     batch.data.length());
 
-      auto send_result_socket = std::get<1>(send_result);
-      if (send_result_socket != kissnet::socket_status::valid) {
-        return Status(Error::ServerError, "Socket not valid after send: " +
-                                              std::to_string(send_result_socket));
+    if (fan_out == FanOut::Partition) {
+      // Every client gets its own producer and share of the JSONs.
+      for (size_t c = 0; c < num_clients; c++) {
+        auto part_opts = PartitionProduction(prod_opts_int, c, num_clients);
+        production_queues.push_back(
+            std::make_unique<ProductionQueue>(prod_opts.queue_capacity));
+        auto* queue = production_queues.back().get();
+        std::shared_ptr<Producer> producer;
+        ILLEX_ROE(Producer::Make(part_opts, queue, &batch_pool, &producer));
+        producers.push_back(producer);
+        ILLEX_ROE(producer->Start(&shutdown));
+        threads.Add(SpawnSender(queue, TotalJSONs(part_opts), sender_options.max_coalesce,
+                                prod_opts.verbose, sender_options.cpus, &shutdown,
+                                &clients[c]));
       }
-
-      // If verbose is enabled, also print the JSON to stdout. Swap colors for each batch.
-      if (prod_opts.verbose) {
-        std::cout << (color ? "\033[34m" : "\033[35m");
-        color = !color;
-        std::cout << batch.data.substr(0, batch.data.length() - 1) << std::endl;
-        std::cout << "\033[39m";
+      threads.Join();
+    } else {
+      // A single producer, of which every batch is sent to all clients.
+      production_queues.push_back(
+          std::make_unique<ProductionQueue>(prod_opts.queue_capacity));
+      auto& production_queue = *production_queues.back();
+      std::shared_ptr<Producer> producer;
+      ILLEX_ROE(Producer::Make(prod_opts_int, &production_queue, &batch_pool, &producer));
+      producers.push_back(producer);
+      ILLEX_ROE(producer->Start(&shutdown));
+
+      const size_t total_messages = TotalJSONs(prod_opts_int);
+      for (size_t c = 0; c < num_clients; c++) {
+        client_queues.push_back(
+            std::make_unique<BoundedQueue<SharedBatch>>(prod_opts.queue_capacity));
+        threads.Add(SpawnSender(client_queues.back().get(), total_messages,
+                                sender_options.max_coalesce, prod_opts.verbose,
+                                sender_options.cpus, &shutdown, &clients[c]));
       }
 
-      num_messages += batch.num_jsons;
-
-      // Log some progress for large amounts.
-      size_t log_every = std::max(1ul, total_messages / 10);
-      if (num_messages % log_every < prod_opts.num_jsons) {
-        spdlog::info("{:.0}% | {}/{}",
-                     static_cast<double>(num_messages) /
-                         static_cast<double>(total_messages) * 100.,
-                     num_messages, total_messages);
+      // Hand out every batch to all senders. The slowest client determines the pace.
+      // The batch is returned to the pool when all senders are done with it.
+      size_t num_dispatched = 0;
+      double blocked = 0.0;
+      while ((num_dispatched != total_messages) && !shutdown.load()) {
+        JSONBatch batch;
+        if (!production_queue.Dequeue(&batch, kShutdownPollInterval, &starved)) {
+          continue;
+        }
+        // Stamp the batch once, before it is shared by the senders.
+        StampBatch(&batch, broadcast_seq, sender_options.stamp_interval);
+        broadcast_seq += batch.num_jsons;
+        num_dispatched += batch.num_jsons;
+        auto shared = SharedBatch(new JSONBatch(std::move(batch)), [&](JSONBatch* b) {
+          batch_pool.Release(b);
+          delete b;
+        });
+        for (auto& queue : client_queues) {
+          if (!queue->Enqueue(SharedBatch(shared), shutdown, &blocked)) {
+            break;
+          }
+        }
       }
+      threads.Join();
+    }
+
+    for (auto& producer : producers) {
+      producer->Finish();
+      result.producer += producer->metrics();
     }
-    producer->Finish();
 
     // Stop the timer after sending all messages and update statistics.
     t.Stop();
-    result.num_messages += num_messages;
     result.time += t.seconds();
-    result.producer += producer->metrics();
+    result.producer.starved_time += starved;
+    result.sender = SenderMetrics();
+    result.pacing = PacingMetrics();
+    for (auto& client : clients) {
+      ILLEX_ROE(client.status);
+      result.num_messages += client.num_messages;
+      result.producer.starved_time += client.starved;
+      result.sender += client.sender.metrics();
+      result.pacing += client.pacer.metrics();
+    }
+    result.num_bytes = result.sender.num_bytes;
     *metrics = result;
 
     std::this_thread::sleep_for(std::chrono::milliseconds(repeat_opts.interval_ms));
@@ -158,6 +439,142 @@ auto Server::SendJSONs(const ProducerOptions& prod_opts, const RepeatOptions& re
   return Status::OK();
 }
 
+/**
+ * \brief Send a range of segments of replay data to one client.
+ * \param[in]     data         The replay data.
+ * \param[in]     first        The index of the first segment to send.
+ * \param[in]     last         The index one past the last segment to send.
+ * \param[in]     use_sendfile Whether to send the segments with sendfile().
+ * \param[in]     shutdown     Shutdown signal.
+ * \param[in,out] client       The client stream.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+static auto ReplayToClient(const ReplayData& data, size_t first, size_t last,
+                           bool use_sendfile, std::atomic<bool>* shutdown,
+                           ClientStream* client) -> Status {
+  const auto& segments = data.segments();
+  size_t total_messages = 0;
+  for (size_t s = first; s < last; s++) {
+    total_messages += segments[s].num_jsons;
+  }
+  size_t log_every = std::max(1ul, total_messages / 10);
+
+  for (size_t s = first; (s < last) && !shutdown->load(); s++) {
+    const auto& segment = segments[s];
+    const size_t num_messages = client->num_messages;
+    const size_t num_bytes = client->sender.metrics().num_bytes;
+    if (use_sendfile) {
+      ILLEX_ROE(client->sender.SendFile(data.fd(), segment.offset, segment.length));
+    } else {
+      ILLEX_ROE(client->sender.Send(data.data().substr(segment.offset, segment.length),
+                                    segment.num_jsons));
+    }
+    client->num_messages += segment.num_jsons;
+    AddSent(client, num_messages, num_bytes);
+
+    // Log some progress for large amounts.
+    if (client->num_messages % log_every < segment.num_jsons) {
+      spdlog::info("{:.0}% | {}/{}",
+                   static_cast<double>(client->num_messages) /
+                       static_cast<double>(total_messages) * 100.,
+                   client->num_messages, total_messages);
+    }
+  }
+  client->pacer.Stop();
+
+  // Wait for the kernel to finish any zero-copy sends.
+  return client->sender.Flush();
+}
+
+auto Server::ReplayJSONs(const ReplayData& data, const RepeatOptions& repeat_opts,
+                         bool use_sendfile, StreamMetrics* metrics) -> Status {
+  assert(metrics != nullptr);
+  if (this->server == nullptr) {
+    return Status(Error::ServerError, "Server uninitialized. Use RawServer::Create().");
+  }
+  if (num_clients == 0) {
+    return Status(Error::ServerError, "Number of clients must be at least 1.");
+  }
+  if ((protocol.framing != Framing::Newline) ||
+      (protocol.compression != Compression::None)) {
+    return Status(Error::ServerError, "Replayed JSONs cannot be framed or compressed.");
+  }
+  if (use_sendfile && pacing_options.enabled()) {
+    spdlog::warn("sendfile() cannot be paced. Sending from the mapping instead.");
+    use_sendfile = false;
+  }
+  if (use_sendfile) {
+    // Unlike sendmsg(), sendfile() cannot suppress SIGPIPE when a client disconnects.
+    std::signal(SIGPIPE, SIG_IGN);
+  }
+
+  std::vector<ClientStream> clients(num_clients);
+  ILLEX_ROE(AcceptClients(nullptr, &clients));
+  if (repeat_opts.times > 1) {
+    spdlog::info("Replaying {} times.", repeat_opts.times);
+    spdlog::info("  Interval: {} ms.", repeat_opts.interval_ms);
+  }
+
+  auto pacing = ClientPacing();
+  const size_t num_segments = data.segments().size();
+
+  StreamMetrics result;
+  putong::Timer t;
+
+  for (size_t repeats = 0; repeats < repeat_opts.times; repeats++) {
+    std::atomic<bool> shutdown = false;
+    std::vector<std::thread> threads;
+
+    t.Start();
+    for (size_t c = 0; c < num_clients; c++) {
+      auto* client = &clients[c];
+      client->num_messages = 0;
+      if (pacing_options.enabled()) {
+        client->pacer = Pacer(pacing);
+        client->sender.SetPacer(&client->pacer, true);
+      }
+      // When partitioning, every client gets a contiguous share of the segments.
+      size_t first = 0;
+      size_t last = num_segments;
+      if (fan_out == FanOut::Partition) {
+        first = c * num_segments / num_clients;
+        last = (c + 1) * num_segments / num_clients;
+      }
+      threads.emplace_back([=, &data, &shutdown]() {
+        client->status = PinThread(sender_options.cpus);
+        if (client->status.ok()) {
+          client->status =
+              ReplayToClient(data, first, last, use_sendfile, &shutdown, client);
+        }
+        // Stop all other threads if anything went wrong.
+        if (!client->status.ok()) {
+          shutdown.store(true);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    t.Stop();
+
+    result.time += t.seconds();
+    result.sender = SenderMetrics();
+    result.pacing = PacingMetrics();
+    for (auto& client : clients) {
+      ILLEX_ROE(client.status);
+      result.num_messages += client.num_messages;
+      result.sender += client.sender.metrics();
+      result.pacing += client.pacer.metrics();
+    }
+    result.num_bytes = result.sender.num_bytes;
+    *metrics = result;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(repeat_opts.interval_ms));
+  }
+
+  return Status::OK();
+}
+
 auto Server::Close() -> Status {
   try {
     server->close();
@@ -168,31 +585,193 @@ auto Server::Close() -> Status {
   return Status::OK();
 }
 
+/// Log streaming statistics. Production statistics are only logged if num_threads > 0.
 static void LogSendStats(const StreamMetrics& result, size_t num_threads) {
   spdlog::info("Streamed {} messages in {:.4f} seconds.", result.num_messages,
                result.time);
   spdlog::info("  {:.1f} messages/second (avg).", result.num_messages / result.time);
   spdlog::info("  {:.2f} gigabits/second (avg).",
                static_cast<double>(result.num_bytes * 8) / result.time * 1E-9);
-  result.producer.Log(num_threads);
+  spdlog::info("  {} send calls, {} using zero-copy ({} copied by the kernel).",
+               result.sender.num_sends, result.sender.num_zerocopy,
+               result.sender.num_zerocopy_copied);
+  if (result.pacing.num_sends > 0) {
+    result.pacing.Log();
+  }
+  if (num_threads > 0) {
+    result.producer.Log(num_threads);
+  }
+}
+
+/**
+ * \brief Stream JSONs into a shared-memory ring, instead of over TCP.
+ * \param[in]  server_options The server options, with the ring options.
+ * \param[in]  prod_opts      Options for the JSON production facilities.
+ * \param[in]  repeat_opts    Options for repeated streaming mode.
+ * \param[in]  replay         The data to replay, or nullptr to produce JSONs.
+ * \param[out] metrics        Streaming statistics.
+ * \return Status::OK() if successful, some error otherwise.
+ */
+static auto StreamToRing(const ServerOptions& server_options,
+                         const ProducerOptions& prod_opts,
+                         const RepeatOptions& repeat_opts, const ReplayData* replay,
+                         StreamMetrics* metrics) -> Status {
+  if (server_options.num_clients > 1) {
+    spdlog::warn("A ring has a single client. Ignoring the number of clients.");
+  }
+  if (server_options.pacing.enabled()) {
+    spdlog::warn("Streaming into a ring is not paced.");
+  }
+  if ((server_options.protocol.framing != Framing::Newline) ||
+      (server_options.protocol.compression != Compression::None)) {
+    return Status(Error::ServerError, "JSONs in a ring cannot be framed or compressed.");
+  }
+
+  ShmRing ring;
+  ILLEX_ROE(ShmRing::Create(server_options.ring, &ring));
+  auto* live = server_options.sender.live;
+  spdlog::info("Streaming JSONs into ring {} ({} slots of {} bytes)...",
+               server_options.ring.path, ring.num_slots(), ring.slot_size());
+
+  BatchPool batch_pool;
+  ProducerOptions prod_opts_int = prod_opts;
+  StreamMetrics result;
+  putong::Timer t;
+
+  for (size_t repeats = 0; repeats < repeat_opts.times; repeats++) {
+    t.Start();
+    if (replay != nullptr) {
+      ILLEX_ROE(ring.Write(replay->data()));
+      result.num_messages += replay->num_jsons();
+      result.num_bytes += replay->data().length();
+      if (live != nullptr) {
+        LiveMetrics::Add(&live->jsons_sent, replay->num_jsons());
+        LiveMetrics::Add(&live->bytes_sent, replay->data().length());
+      }
+    } else {
+      std::atomic<bool> shutdown = false;
+      ProductionQueue queue(prod_opts.queue_capacity);
+      std::shared_ptr<Producer> producer;
+      ILLEX_ROE(Producer::Make(prod_opts_int, &queue, &batch_pool, &producer));
+      ILLEX_ROE(producer->Start(&shutdown));
+
+      // Copy every batch into the ring, and return it to the pool right away. Stop if
+      // the producer fails.
+      const size_t total_messages = TotalJSONs(prod_opts_int);
+      size_t num_written = 0;
+      double starved = 0.0;
+      Status status;
+      while ((num_written != total_messages) && !shutdown.load()) {
+        JSONBatch batch;
+        if (!queue.Dequeue(&batch, kShutdownPollInterval, &starved)) {
+          continue;
+        }
+        StampBatch(&batch, num_written, server_options.sender.stamp_interval);
+        num_written += batch.num_jsons;
+        result.num_bytes += batch.data().length();
+        status = ring.Write(batch.data(), &shutdown);
+        if ((live != nullptr) && status.ok()) {
+          LiveMetrics::Add(&live->jsons_sent, batch.num_jsons);
+          LiveMetrics::Add(&live->bytes_sent, batch.data().length());
+        }
+        batch_pool.Release(&batch);
+        if (!status.ok()) {
+          shutdown.store(true);
+          break;
+        }
+      }
+      producer->Finish();
+      result.producer += producer->metrics();
+      result.producer.starved_time += starved;
+      ILLEX_ROE(status);
+      if (num_written != total_messages) {
+        return Status(Error::ServerError, "Production stopped before all JSONs were "
+                                          "written into the ring.");
+      }
+      result.num_messages += num_written;
+
+      // In case this is on repeat, increase the seed of the generator.
+      prod_opts_int.gen.seed += 42;
+    }
+    t.Stop();
+    result.time += t.seconds();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(repeat_opts.interval_ms));
+  }
+  result.sender.num_bytes = result.num_bytes;
+  result.sender.num_sends = ring.written();
+  *metrics = result;
+
+  // The ring file is removed when the ring is destructed, so wait for the client.
+  ring.Finish();
+  spdlog::info("Waiting for the client to release all slots...");
+  if (!ring.Drain(kRingDrainTimeout)) {
+    spdlog::warn("The client did not release all slots within {} s.",
+                 kRingDrainTimeout.count());
+  }
+  return Status::OK();
 }
 
 auto RunServer(const ServerOptions& server_options,
                const ProducerOptions& production_options,
-               const RepeatOptions& repeat_options, bool statistics) -> Status {
-  spdlog::info("Starting server...");
-  Server server;
-  ILLEX_ROE(Server::Create(server_options, &server));
+               const RepeatOptions& repeat_options, const ReplayOptions& replay_options,
+               bool statistics) -> Status {
+  // Prepare the data to replay before clients can connect.
+  ReplayData replay;
+  if (replay_options.enabled()) {
+    putong::Timer t;
+    t.Start();
+    if (replay_options.path.empty()) {
+      spdlog::info("Generating JSONs to replay...");
+      ILLEX_ROE(ReplayData::Generate(production_options, &replay));
+    } else {
+      spdlog::info("Mapping {} to replay...", replay_options.path);
+      ILLEX_ROE(ReplayData::Map(replay_options.path, &replay));
+    }
+    t.Stop();
+    spdlog::info("Prepared {} JSONs ({:.1f} MiB) in {:.4f} seconds.", replay.num_jsons(),
+                 static_cast<double>(replay.data().length()) / (1024. * 1024.),
+                 t.seconds());
+  }
+
+  // Let the producers and senders add to live counters, if they are reported.
+  LiveMetrics live;
+  std::unique_ptr<MetricsReporter> reporter;
+  ServerOptions server_opts = server_options;
+  ProducerOptions prod_opts = production_options;
+  if (server_options.metrics.enabled()) {
+    server_opts.sender.live = &live;
+    prod_opts.live = &live;
+    ILLEX_ROE(MetricsReporter::Start(server_options.metrics, &live, &reporter));
+  }
 
   StreamMetrics stats;
-  ILLEX_ROE(server.SendJSONs(production_options, repeat_options, &stats));
+  if (server_opts.ring.enabled()) {
+    ILLEX_ROE(StreamToRing(server_opts, prod_opts, repeat_options,
+                           replay_options.enabled() ? &replay : nullptr, &stats));
+  } else {
+    spdlog::info("Starting server...");
+    Server server;
+    ILLEX_ROE(Server::Create(server_opts, &server));
+
+    if (replay_options.enabled()) {
+      ILLEX_ROE(
+          server.ReplayJSONs(replay, repeat_options, replay_options.sendfile, &stats));
+    } else {
+      ILLEX_ROE(server.SendJSONs(prod_opts, repeat_options, &stats));
+    }
 
-  if (statistics) {
-    LogSendStats(stats, production_options.num_threads);
+    spdlog::info("Server shutting down...");
+    ILLEX_ROE(server.Close());
+  }
+
+  if (reporter != nullptr) {
+    reporter->Stop();
   }
 
-  spdlog::info("Server shutting down...");
-  ILLEX_ROE(server.Close());
+  if (statistics) {
+    LogSendStats(stats, replay_options.enabled() ? 0 : production_options.num_threads);
+  }
 
   return Status::OK();
 }
@@ -20,15 +20,20 @@
 
 #include "illex/client.h"
 #include "illex/document.h"
+#include "illex/metrics.h"
 #include "illex/producer.h"
+#include "illex/pacer.h"
 #include "illex/protocol.h"
+#include "illex/replay.h"
+#include "illex/sender.h"
+#include "illex/shm.h"
 #include "illex/status.h"
 
 namespace illex {
 
 /// Streaming statistics.
 struct StreamMetrics {
-  /// Number of messages transmitted.
+  /// Number of messages transmitted, to all clients.
   size_t num_messages = 0;
   /// Number of bytes transmitted.
   size_t num_bytes = 0;
@@ -36,6 +41,10 @@ struct StreamMetrics {
   double time = 0.0;
   /// Statistics of the production facilities.
   ProductionMetrics producer;
+  /// Statistics of the batch sender.
+  SenderMetrics sender;
+  /// Statistics of pacing, of the last run.
+  PacingMetrics pacing;
 };
 
 /// Repeat mode options.
@@ -46,12 +55,55 @@ struct RepeatOptions {
   size_t interval_ms = 250;
 };
 
+/// How JSONs are distributed over multiple clients.
+enum class FanOut {
+  /// Every client receives a disjoint share of the JSONs, from its own producer.
+  Partition,
+  /// Every client receives the same JSONs.
+  Broadcast
+};
+
 /// Server options.
 struct ServerOptions {
   /// The port to listen on.
   uint16_t port = ILLEX_DEFAULT_PORT;
+  /// The number of clients to accept and stream to.
+  size_t num_clients = 1;
+  /// How JSONs are distributed over the clients.
+  FanOut fan_out = FanOut::Partition;
+  /**
+   * \brief Protocol options.
+   *
+   * Length framing and compression are only supported when streaming generated JSONs
+   * over TCP. Batches are compressed by the production threads.
+   */
+  Protocol protocol;
+  /// Options for sending batches to the client.
+  SenderOptions sender;
+  /**
+   * \brief Options for pacing the stream.
+   *
+   * When partitioning, the rates apply to the total over all clients. When
+   * broadcasting, they apply to every client.
+   */
+  PacingOptions pacing;
+  /**
+   * \brief Options for streaming into a shared-memory ring instead of over TCP.
+   *
+   * A ring has a single reader on the same host, and is never paced.
+   */
+  RingOptions ring;
+  /**
+   * \brief Options for reporting live metrics while streaming.
+   *
+   * If enabled, RunServer() reports the live counters of its producers and senders.
+   */
+  MetricsOptions metrics;
 };
 
+/// State of the stream to a single client.
+struct ClientStream;
+
 /**
  * \brief A streaming server for raw JSONs directly over TCP.
  */
@@ -68,6 +120,10 @@ class Server {
 
   /**
    * \brief Send JSONs using this Server.
+   *
+   * This first waits for all clients to connect. Every client is served by its own
+   * sender thread.
+   *
    * \param[in] prod_opts Options for the JSON production facilities.
    * \param[in] repeat_opts Options for repeated streaming mode
    * \param[out] metrics Server statistics.
@@ -76,6 +132,24 @@ class Server {
   auto SendJSONs(const ProducerOptions& prod_opts, const RepeatOptions& repeat_opts,
                  StreamMetrics* metrics) -> Status;
 
+  /**
+   * \brief Send the same JSONs from replay data on every repeat.
+   *
+   * This first waits for all clients to connect. When partitioning, every client
+   * receives a contiguous share of the data.
+   *
+   * \param[in]  data         The data to replay.
+   * \param[in]  repeat_opts  Options for repeated streaming mode.
+   * \param[in]  use_sendfile Whether to send with sendfile(). Ignored when pacing.
+   * \param[out] metrics      Server statistics.
+   * \return Status::OK() if successful, some error status otherwise.
+   */
+  auto ReplayJSONs(const ReplayData& data, const RepeatOptions& repeat_opts,
+                   bool use_sendfile, StreamMetrics* metrics) -> Status;
+
+  /// \brief Return the port the server listens on, e.g. after creating it with port 0.
+  [[nodiscard]] auto port() const -> uint16_t;
+
   /**
    * \brief Close the Server.
    * \return Status::OK() if successful, some error status otherwise.
@@ -83,7 +157,17 @@ class Server {
   auto Close() -> Status;
 
  private:
+  /// Accept all clients, and create their senders.
+  auto AcceptClients(BatchPool* pool, std::vector<ClientStream>* clients) -> Status;
+  /// Return the pacing options for a single client.
+  [[nodiscard]] auto ClientPacing() const -> PacingOptions;
+
   std::shared_ptr<Socket> server;
+  SenderOptions sender_options;
+  PacingOptions pacing_options;
+  size_t num_clients = 1;
+  FanOut fan_out = FanOut::Partition;
+  Protocol protocol;
 };
 
 /**
@@ -91,11 +175,13 @@ class Server {
  * \param server_options     Server connection options.
  * \param production_options JSON production options.
  * \param repeat_options     Options related to how to repeat server functionality.
+ * \param replay_options     Options for replaying the same JSONs on every repeat.
  * \param statistics         Whether to measure and log statistics.
  * \return Status::OK if successful, some error otherwise.
  */
 auto RunServer(const ServerOptions& server_options,
                const ProducerOptions& production_options,
-               const RepeatOptions& repeat_options, bool statistics) -> Status;
+               const RepeatOptions& repeat_options, const ReplayOptions& replay_options,
+               bool statistics) -> Status;
 
 }  // namespace illex
@@ -0,0 +1,253 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/shm.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+namespace illex {
+
+/// Identifies a ring file.
+constexpr uint64_t kRingMagic = 0x474e4952584c4c49;  // "ILLXRING"
+/// The number of polls to yield for, before sleeping between polls.
+constexpr size_t kRingSpinPolls = 1024;
+/// The time to sleep between polls, once the other side has been idle for a while.
+constexpr auto kRingPollInterval = std::chrono::microseconds(10);
+
+/// The header at the start of a ring file.
+struct ShmRing::Header {
+  /// Set to kRingMagic once the header is initialized.
+  std::atomic<uint64_t> magic;
+  /// The number of slots.
+  uint64_t num_slots;
+  /// The capacity of a slot.
+  uint64_t slot_size;
+  /// The number of slots written. Only modified by the writer.
+  alignas(64) std::atomic<uint64_t> head;
+  /// The number of slots released. Only modified by the reader.
+  alignas(64) std::atomic<uint64_t> tail;
+  /// Whether the writer has finished.
+  alignas(64) std::atomic<uint64_t> finished;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "Ring cursors must be lock-free to be shared between processes.");
+
+/// Round up to a multiple of some alignment.
+static auto RoundUp(size_t value, size_t alignment) -> size_t {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+/// Wait a little while, before polling a cursor again.
+static void Backoff(size_t* polls) {
+  if (*polls < kRingSpinPolls) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(kRingPollInterval);
+  }
+  (*polls)++;
+}
+
+auto ShmRing::FileSize(size_t num_slots, size_t slot_size) -> size_t {
+  auto lengths = RoundUp(sizeof(Header), 64);
+  auto slots = RoundUp(lengths + num_slots * sizeof(uint64_t), 4096);
+  return slots + num_slots * slot_size;
+}
+
+auto ShmRing::Map(int fd, size_t size) -> Status {
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    return Status(Error::IOError,
+                  std::string("Unable to map ring file: ") + std::strerror(errno));
+  }
+  map_ = data;
+  size_ = size;
+  header_ = static_cast<Header*>(data);
+  return Status::OK();
+}
+
+void ShmRing::Locate() {
+  num_slots_ = header_->num_slots;
+  slot_size_ = header_->slot_size;
+  auto* base = static_cast<std::byte*>(map_);
+  auto lengths = RoundUp(sizeof(Header), 64);
+  lengths_ = reinterpret_cast<uint64_t*>(base + lengths);
+  slots_ = base + RoundUp(lengths + num_slots_ * sizeof(uint64_t), 4096);
+}
+
+auto ShmRing::Create(const RingOptions& options, ShmRing* out) -> Status {
+  assert(out != nullptr);
+  if (options.num_slots == 0) {
+    return Status(Error::GenericError, "Number of ring slots cannot be 0.");
+  }
+  if (options.slot_size == 0) {
+    return Status(Error::GenericError, "Ring slot size cannot be 0.");
+  }
+
+  // Replace any ring file of a previous run, so its readers never see new data.
+  unlink(options.path.c_str());
+  int fd = open(options.path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    return Status(Error::IOError,
+                  "Unable to create " + options.path + ": " + std::strerror(errno));
+  }
+  out->owned_path_ = options.path;
+  auto size = FileSize(options.num_slots, options.slot_size);
+  if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    return Status(Error::IOError,
+                  "Unable to size " + options.path + ": " + std::strerror(errno));
+  }
+  auto status = out->Map(fd, size);
+  // The mapping remains valid after closing the file.
+  close(fd);
+  ILLEX_ROE(status);
+
+  // Initialize the header, and only then mark it as a ring file.
+  auto* header = new (out->map_) Header();
+  header->num_slots = options.num_slots;
+  header->slot_size = options.slot_size;
+  header->magic.store(kRingMagic, std::memory_order_release);
+  out->Locate();
+  return Status::OK();
+}
+
+auto ShmRing::Open(const std::string& path, ShmRing* out) -> Status {
+  assert(out != nullptr);
+  int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(Error::IOError, "Unable to open " + path + ": " + std::strerror(errno));
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return Status(Error::IOError, "Unable to query size of " + path);
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  if (size < sizeof(Header)) {
+    close(fd);
+    return Status(Error::IOError, path + " is not a ring file.");
+  }
+  auto status = out->Map(fd, size);
+  close(fd);
+  ILLEX_ROE(status);
+
+  if (out->header_->magic.load(std::memory_order_acquire) != kRingMagic) {
+    return Status(Error::IOError, path + " is not a ring file.");
+  }
+  if (FileSize(out->header_->num_slots, out->header_->slot_size) != size) {
+    return Status(Error::IOError, "Size of ring file " + path + " does not match.");
+  }
+  out->Locate();
+  return Status::OK();
+}
+
+auto ShmRing::Write(std::string_view data, const std::atomic<bool>* shutdown)
+    -> Status {
+  assert(header_ != nullptr);
+  while (!data.empty()) {
+    auto length = data.length();
+    if (length > slot_size_) {
+      // Split after the last JSON that fits.
+      auto newline = data.rfind('\n', slot_size_ - 1);
+      if (newline == std::string_view::npos) {
+        return Status(Error::GenericError, "JSON larger than ring slot size of " +
+                                               std::to_string(slot_size_) + " bytes.");
+      }
+      length = newline + 1;
+    }
+
+    // Wait for the reader to release the slot.
+    auto head = header_->head.load(std::memory_order_relaxed);
+    size_t polls = 0;
+    while (head - header_->tail.load(std::memory_order_acquire) >= num_slots_) {
+      if ((shutdown != nullptr) && shutdown->load()) {
+        return Status::OK();
+      }
+      Backoff(&polls);
+    }
+
+    std::memcpy(slot(head), data.data(), length);
+    lengths_[slot_index(head)] = length;
+    header_->head.store(head + 1, std::memory_order_release);
+    data.remove_prefix(length);
+  }
+  return Status::OK();
+}
+
+void ShmRing::Finish() { header_->finished.store(1, std::memory_order_release); }
+
+auto ShmRing::Drain(std::chrono::milliseconds timeout,
+                    const std::atomic<bool>* shutdown) -> bool {
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  auto head = header_->head.load(std::memory_order_relaxed);
+  size_t polls = 0;
+  while (header_->tail.load(std::memory_order_acquire) < head) {
+    if (((shutdown != nullptr) && shutdown->load()) ||
+        (std::chrono::steady_clock::now() >= deadline)) {
+      return false;
+    }
+    Backoff(&polls);
+  }
+  return true;
+}
+
+auto ShmRing::Wait(uint64_t position) -> bool {
+  size_t polls = 0;
+  while (header_->head.load(std::memory_order_acquire) <= position) {
+    // The writer finishes after writing its last slot, so check the head once more.
+    if (header_->finished.load(std::memory_order_acquire) != 0) {
+      return header_->head.load(std::memory_order_acquire) > position;
+    }
+    Backoff(&polls);
+  }
+  return true;
+}
+
+void ShmRing::Release(uint64_t position) {
+  header_->tail.store(position, std::memory_order_release);
+}
+
+auto ShmRing::slot(uint64_t position) const -> std::byte* {
+  return slots_ + slot_index(position) * slot_size_;
+}
+
+auto ShmRing::slot_length(uint64_t position) const -> size_t {
+  return lengths_[slot_index(position)];
+}
+
+auto ShmRing::written() const -> uint64_t {
+  return header_->head.load(std::memory_order_acquire);
+}
+
+ShmRing::~ShmRing() {
+  if (map_ != nullptr) {
+    munmap(map_, size_);
+  }
+  if (!owned_path_.empty()) {
+    unlink(owned_path_.c_str());
+  }
+}
+
+}  // namespace illex
@@ -19,7 +19,7 @@
 namespace illex {
 
 auto RunStream(const StreamOptions& opt) -> Status {
-  return RunServer(opt.server, opt.production, opt.repeat, opt.statistics);
+  return RunServer(opt.server, opt.production, opt.repeat, opt.replay, opt.statistics);
 }
 
 }  // namespace illex
@@ -32,6 +32,8 @@ struct StreamOptions {
   ProducerOptions production;
   /// Options for repeated streaming mode
   RepeatOptions repeat;
+  /// Options for replaying the same JSONs on every repeat.
+  ReplayOptions replay;
   /// Whether to log statistics
   bool statistics = true;
   /// Repeat server creation, connecting, and sending JSONs indefinitely
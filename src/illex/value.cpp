@@ -17,6 +17,8 @@
 #include <rapidjson/allocators.h>
 #include <rapidjson/document.h>
 
+#include <cmath>
+#include <cstring>
 #include <random>
 #include <utility>
 
@@ -30,41 +32,89 @@ void Value::SetContext(Context context) {
   context_ = context;
 }
 
+void Value::Write(Writer* writer) { Get().Accept(*writer); }
+
 String::String(size_t length_min, size_t length_max)
     : length_min_(length_min), length_max_(length_max) {
   len_dist_ = UniformIntDistribution<size_t>(length_min_, length_max_);
-  chars_dist_ = UniformIntDistribution<char>('a', 'z');
 }
 
-auto String::Get() -> rapidjson::Value {
-  rapidjson::Value result;
+void String::Generate() {
   // Generate the length.
   size_t length = len_dist_(*context_.engine_);
 
-  std::string str(length, 0);
-  // Pull characters from the character distribution.
-  for (char& c : str) {
-    c = chars_dist_(*context_.engine_);
-  }
+  buffer_.resize(length);
+  // Fill all characters from bulk draws.
+  context_.engine_->FillChars(buffer_.data(), length, 'a', 'z');
+}
+
+auto String::Get() -> rapidjson::Value {
+  rapidjson::Value result;
+  Generate();
   // Call the overload SetString with allocator to make a copy of the string.
-  result.SetString(str.c_str(), str.length(), *context_.allocator_);
+  result.SetString(buffer_.c_str(), buffer_.length(), *context_.allocator_);
   return result;
 }
 
+void String::Write(Writer* writer) {
+  Generate();
+  writer->String(buffer_.c_str(), buffer_.length());
+}
+
+/// Write a non-negative number as a fixed number of decimal digits.
+static inline void WriteDigits(char* out, uint64_t value, size_t digits) {
+  for (size_t i = digits; i > 0; i--) {
+    out[i - 1] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  }
+}
+
+auto DateString::Format(RandomEngine* engine, char* out) -> size_t {
+  // Draw all fields from a single random number, in a fixed order. The product of all
+  // field ranges is about 2^34, which leaves plenty of random bits for every field.
+  auto bits = (*engine)();
+  auto y = year.Split(&bits);
+  auto mo = month.Split(&bits);
+  auto d = day.Split(&bits);
+  auto h = hour.Split(&bits);
+  auto mi = min.Split(&bits);
+  auto s = sec.Split(&bits);
+  auto tz = timezone.Split(&bits);
+
+  // Format like ISO8601 but without the timezone minutes, i.e.
+  // YYYY-MM-DDTHH:MM:SS+hh:00. The year range is fixed to four digits.
+  WriteDigits(out, y, 4);
+  out[4] = '-';
+  WriteDigits(out + 5, mo, 2);
+  out[7] = '-';
+  WriteDigits(out + 8, d, 2);
+  out[10] = 'T';
+  WriteDigits(out + 11, h, 2);
+  out[13] = ':';
+  WriteDigits(out + 14, mi, 2);
+  out[16] = ':';
+  WriteDigits(out + 17, s, 2);
+  out[19] = tz < 0 ? '-' : '+';
+  WriteDigits(out + 20, tz < 0 ? -tz : tz, 2);
+  std::memcpy(out + 22, ":00", 3);
+  return 25;
+}
+
 auto DateString::Get() -> rapidjson::Value {
   rapidjson::Value result;
-
-  // Format like ISO8601 but without the timezone
-  // Apparently this is from spdlog, but we might want to import this separately.
-  auto str = ::fmt::format(
-      "{:04d}-{:02d}-{:02d}T{:02d}:{:02d}:{:02d}{:+03d}:00", year(*context_.engine_),
-      month(*context_.engine_), day(*context_.engine_), hour(*context_.engine_),
-      min(*context_.engine_), sec(*context_.engine_), timezone(*context_.engine_));
+  char str[kMaxLength];
+  auto length = Format(context_.engine_, str);
   // Call the overload SetString with allocator to make a copy of the string.
-  result.SetString(str.c_str(), str.length(), *context_.allocator_);
+  result.SetString(str, length, *context_.allocator_);
   return result;
 }
 
+void DateString::Write(Writer* writer) {
+  char str[kMaxLength];
+  auto length = Format(context_.engine_, str);
+  writer->String(str, length, true);
+}
+
 DateString::DateString() {
   year = UniformIntDistribution<int64_t>(2000, 2020);
   month = UniformIntDistribution<uint8_t>(1, 12);
@@ -75,6 +125,58 @@ DateString::DateString() {
   timezone = UniformIntDistribution<int8_t>(-12, 12);
 }
 
+ZipfDistribution::ZipfDistribution(size_t n, double skew)
+    : uniform_(0, n > 0 ? n - 1 : 0), skew_(skew) {
+  // The negated comparison also rejects NaN, whose cumulative probabilities cannot be
+  // converted to integers.
+  if (!(skew > 0.0) || (n < 2)) {
+    return;
+  }
+  std::vector<double> weights(n);
+  double total = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    weights[i] = 1.0 / std::pow(static_cast<double>(i + 1), skew);
+    total += weights[i];
+  }
+  // The last index takes all bits above the last threshold.
+  cdf_.resize(n - 1);
+  double sum = 0.0;
+  for (size_t i = 0; i < n - 1; i++) {
+    sum += weights[i];
+    cdf_[i] = static_cast<uint64_t>(std::min(sum / total * 0x1p64, 0x1p64 - 0x1p11));
+  }
+}
+
+Pool::Pool(const std::shared_ptr<Value>& item, size_t size, double skew, uint64_t seed)
+    : doc_(std::make_shared<rj::Document>()), dist_(std::max<size_t>(size, 1), skew) {
+  RandomEngine engine(seed);
+  item->SetContext({&engine, &doc_->GetAllocator()});
+  size = dist_.n();
+  values_.reserve(size);
+  offsets_.reserve(size + 1);
+  for (size_t i = 0; i < size; i++) {
+    rj::StringBuffer buffer;
+    Writer writer(buffer);
+    auto value = item->Get();
+    value.Accept(writer);
+    offsets_.push_back(serialized_.size());
+    serialized_.append(buffer.GetString(), buffer.GetSize());
+    values_.push_back(std::move(value));
+  }
+  offsets_.push_back(serialized_.size());
+}
+
+auto Pool::Get() -> rj::Value {
+  // Make a deep copy, since the pooled values are owned by the pool.
+  return rj::Value(values_[dist_(*context_.engine_)], *context_.allocator_);
+}
+
+void Pool::Write(Writer* writer) {
+  auto i = dist_(*context_.engine_);
+  writer->RawValue(serialized_.data() + offsets_[i], offsets_[i + 1] - offsets_[i],
+                   values_[i].GetType());
+}
+
 Array::Array(std::shared_ptr<Value> item_generator, size_t max_length, size_t min_length)
     : min_length(min_length), max_length(max_length), item_(std::move(item_generator)) {
   length = UniformIntDistribution<int32_t>(min_length, max_length);
@@ -91,6 +193,15 @@ auto Array::Get() -> rapidjson::Value {
   return result;
 }
 
+void Array::Write(Writer* writer) {
+  auto len = this->length(*context_.engine_);
+  writer->StartArray();
+  for (int32_t i = 0; i < len; i++) {
+    item_->Write(writer);
+  }
+  writer->EndArray(static_cast<rapidjson::SizeType>(len));
+}
+
 FixedSizeArray::FixedSizeArray(size_t length, std::shared_ptr<Value> item_generator)
     : length_(length), item_(std::move(item_generator)) {}
 
@@ -104,12 +215,25 @@ auto FixedSizeArray::Get() -> rapidjson::Value {
   return result;
 }
 
+void FixedSizeArray::Write(Writer* writer) {
+  writer->StartArray();
+  for (size_t i = 0; i < length_; i++) {
+    item_->Write(writer);
+  }
+  writer->EndArray(length_);
+}
+
 void Member::AddTo(rapidjson::Value* object) {
   rapidjson::Value name(rapidjson::StringRef(name_.c_str()));
   rapidjson::Value val = value_->Get();
   object->AddMember(name, val, *context_.allocator_);
 }
 
+void Member::WriteTo(Writer* writer) {
+  writer->Key(name_.c_str(), name_.length());
+  value_->Write(writer);
+}
+
 Member::Member(std::string name, std::shared_ptr<Value> value)
     : name_(std::move(name)), value_(std::move(value)) {}
 
@@ -134,6 +258,14 @@ auto Object::Get() -> rj::Value {
   return result;
 }
 
+void Object::Write(Writer* writer) {
+  writer->StartObject();
+  for (auto& mg : members_) {
+    mg.WriteTo(writer);
+  }
+  writer->EndObject(members_.size());
+}
+
 void Object::AddMember(Member member) {
   member.SetContext(context_);
   members_.push_back(member);
@@ -148,8 +280,12 @@ Object::Object(const std::vector<Member>& members) {
 
 auto Null::Get() -> rj::Value { return rj::Value(rj::kNullType); }
 
+void Null::Write(Writer* writer) { writer->Null(); }
+
 auto Bool::Get() -> rj::Value {
   return rj::Value(((*this->context_.engine_)() % 2 == 0));
 }
 
+void Bool::Write(Writer* writer) { writer->Bool((*this->context_.engine_)() % 2 == 0); }
+
 }  // namespace illex
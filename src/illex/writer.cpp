@@ -0,0 +1,196 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "illex/writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "illex/log.h"
+
+namespace illex {
+
+/// Return a status describing the last system call error.
+static auto ErrnoStatus(const std::string& what) -> Status {
+  return Status(Error::IOError, what + ": " + std::strerror(errno));
+}
+
+/// Write all bytes at some offset of a file.
+static auto WriteAt(int fd, const std::byte* data, size_t length, size_t offset)
+    -> Status {
+  while (length > 0) {
+    auto written = pwrite(fd, data, length, static_cast<off_t>(offset));
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ErrnoStatus("Unable to write file");
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+  return Status::OK();
+}
+
+auto FileWriter::Open(const std::string& path, const WriterOptions& options,
+                      std::shared_ptr<FileWriter>* out) -> Status {
+  auto result = std::shared_ptr<FileWriter>(new FileWriter());
+  const size_t pages = (options.buffer_size + kDirectAlignment - 1) / kDirectAlignment;
+  result->buffer_size_ = std::max<size_t>(1, pages) * kDirectAlignment;
+
+  const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  if (options.direct) {
+#if defined(O_DIRECT)
+    result->fd_ = open(path.c_str(), flags | O_DIRECT, 0644);
+    result->direct_ = result->fd_ >= 0;
+    if (!result->direct_ && (errno == EINVAL)) {
+      spdlog::warn("File system does not support O_DIRECT. Writing through page cache.");
+    }
+#else
+    spdlog::warn("O_DIRECT is not supported on this platform. "
+                 "Writing through page cache.");
+#endif
+  }
+  if (result->fd_ < 0) {
+    result->fd_ = open(path.c_str(), flags, 0644);
+  }
+  if (result->fd_ < 0) {
+    return ErrnoStatus("Could not open " + path + " for writing");
+  }
+
+  // Allocate enough buffers to fill one while every thread is writing another.
+  const size_t num_threads = std::max<size_t>(1, options.num_threads);
+  for (size_t i = 0; i < 2 * num_threads; i++) {
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, kDirectAlignment, result->buffer_size_) != 0) {
+      return Status(Error::IOError, "Unable to allocate file write buffers.");
+    }
+    result->buffers_.emplace_back(static_cast<std::byte*>(buffer), std::free);
+    result->free_.enqueue(result->buffers_.back().get());
+  }
+  for (size_t i = 0; i < num_threads; i++) {
+    result->threads_.emplace_back(&FileWriter::WriterThread, result.get());
+  }
+
+  *out = result;
+  return Status::OK();
+}
+
+FileWriter::~FileWriter() {
+  if (fd_ >= 0) {
+    Close();
+  }
+}
+
+auto FileWriter::status() -> Status {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return status_;
+}
+
+void FileWriter::SetStatus(const Status& status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (status_.ok()) {
+    status_ = status;
+  }
+}
+
+void FileWriter::WriterThread() {
+  Chunk chunk;
+  while (true) {
+    chunks_.wait_dequeue(chunk);
+    if (chunk.data == nullptr) {
+      return;
+    }
+    // After an error, only recycle buffers, so Write() does not block forever.
+    if (status().ok()) {
+      auto status = WriteAt(fd_, chunk.data, chunk.length, chunk.offset);
+      if (!status.ok()) {
+        SetStatus(status);
+      }
+    }
+    free_.enqueue(chunk.data);
+  }
+}
+
+void FileWriter::Submit() {
+  chunks_.enqueue(Chunk{current_, offset_, fill_});
+  offset_ += fill_;
+  current_ = nullptr;
+  fill_ = 0;
+}
+
+auto FileWriter::Write(std::string_view data) -> Status {
+  while (!data.empty()) {
+    if (current_ == nullptr) {
+      ILLEX_ROE(status());
+      free_.wait_dequeue(current_);
+    }
+    auto length = std::min(data.length(), buffer_size_ - fill_);
+    std::memcpy(current_ + fill_, data.data(), length);
+    fill_ += length;
+    data.remove_prefix(length);
+    if (fill_ == buffer_size_) {
+      Submit();
+    }
+  }
+  return Status::OK();
+}
+
+auto FileWriter::Close() -> Status {
+  if (fd_ < 0) {
+    return status();
+  }
+  // Without O_DIRECT, the last buffer can be written like all others.
+  if (!direct_ && (fill_ > 0)) {
+    Submit();
+  }
+  for (size_t i = 0; i < threads_.size(); i++) {
+    chunks_.enqueue(Chunk{});
+  }
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+
+  if (fill_ > 0) {
+    // The size of the last buffer is not aligned, so write it through the page cache.
+#if defined(O_DIRECT)
+    int flags = fcntl(fd_, F_GETFL);
+    if ((flags < 0) || (fcntl(fd_, F_SETFL, flags & ~O_DIRECT) < 0)) {
+      SetStatus(ErrnoStatus("Unable to disable O_DIRECT"));
+    }
+#endif
+    if (status().ok()) {
+      SetStatus(WriteAt(fd_, current_, fill_, offset_));
+    }
+    free_.enqueue(current_);
+    offset_ += fill_;
+    current_ = nullptr;
+    fill_ = 0;
+  }
+
+  if (close(fd_) != 0) {
+    SetStatus(ErrnoStatus("Unable to close file"));
+  }
+  fd_ = -1;
+  return status();
+}
+
+}  // namespace illex
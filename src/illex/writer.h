@@ -0,0 +1,138 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <blockingconcurrentqueue.h>
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "illex/status.h"
+
+namespace illex {
+
+/// The alignment of buffers, file offsets and sizes required by O_DIRECT.
+constexpr size_t kDirectAlignment = 4096;
+
+/// Options for writing files.
+struct WriterOptions {
+  /// Whether to bypass the page cache with O_DIRECT, if the file system supports it.
+  bool direct = false;
+  /// The number of threads writing to the file concurrently.
+  size_t num_threads = 2;
+  /// The size of every write. Rounded up to a multiple of kDirectAlignment.
+  size_t buffer_size = 8 * 1024 * 1024;
+};
+
+/**
+ * \brief Writes a file with large, aligned writes from a pool of writer threads.
+ *
+ * Data is copied into aligned staging buffers. Every full buffer is written at its own
+ * offset in the file by one of the writer threads with pwrite(), so multiple writes are
+ * in flight while the caller fills the next buffer. With O_DIRECT, the last, partially
+ * filled buffer is written through the page cache, since its size is not aligned.
+ */
+class FileWriter {
+ public:
+  /**
+   * \brief Create or truncate a file, and start the writer threads.
+   * \param[in]  path    The path of the file.
+   * \param[in]  options The writer options.
+   * \param[out] out     A shared pointer in which to store the writer.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  static auto Open(const std::string& path, const WriterOptions& options,
+                   std::shared_ptr<FileWriter>* out) -> Status;
+
+  FileWriter(const FileWriter&) = delete;
+  auto operator=(const FileWriter&) -> FileWriter& = delete;
+  /// \brief Close the file if that has not happened yet, ignoring any errors.
+  ~FileWriter();
+
+  /**
+   * \brief Append data to the file.
+   *
+   * This blocks while all staging buffers are being written.
+   *
+   * \param data The data to append.
+   * \return Status::OK() if successful, some error of an earlier write otherwise.
+   */
+  auto Write(std::string_view data) -> Status;
+
+  /**
+   * \brief Write all remaining data, wait for the writer threads, and close the file.
+   * \return Status::OK() if successful, some error otherwise.
+   */
+  auto Close() -> Status;
+
+  /// \brief Return whether the file is written with O_DIRECT.
+  [[nodiscard]] auto direct() const -> bool { return direct_; }
+
+  /// \brief Return the number of bytes appended to the file.
+  [[nodiscard]] auto num_bytes() const -> size_t { return offset_ + fill_; }
+
+ private:
+  /// A filled staging buffer to write at some offset.
+  struct Chunk {
+    /// The buffer, or nullptr to stop a writer thread.
+    std::byte* data = nullptr;
+    /// The offset in the file.
+    size_t offset = 0;
+    /// The number of bytes to write.
+    size_t length = 0;
+  };
+
+  FileWriter() = default;
+  /// Write chunks until a stop chunk arrives.
+  void WriterThread();
+  /// Hand the current buffer to the writer threads.
+  void Submit();
+  /// Return the first error of any write.
+  auto status() -> Status;
+  /// Remember the first error of any write.
+  void SetStatus(const Status& status);
+
+  /// The file descriptor, or -1 if closed.
+  int fd_ = -1;
+  /// Whether the file is written with O_DIRECT.
+  bool direct_ = false;
+  /// The size of a staging buffer.
+  size_t buffer_size_ = 0;
+  /// Storage of all staging buffers.
+  std::vector<std::unique_ptr<std::byte, void (*)(void*)>> buffers_;
+  /// Staging buffers that are not in use.
+  moodycamel::BlockingConcurrentQueue<std::byte*> free_;
+  /// Filled buffers waiting to be written.
+  moodycamel::BlockingConcurrentQueue<Chunk> chunks_;
+  /// The writer threads.
+  std::vector<std::thread> threads_;
+  /// The buffer being filled by Write().
+  std::byte* current_ = nullptr;
+  /// The number of bytes in the current buffer.
+  size_t fill_ = 0;
+  /// The offset in the file of the current buffer.
+  size_t offset_ = 0;
+  /// Protects status_.
+  std::mutex mutex_;
+  /// The first error of any write.
+  Status status_;
+};
+
+}  // namespace illex
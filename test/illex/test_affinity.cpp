@@ -0,0 +1,50 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+#include <sched.h>
+
+#include "illex/affinity.h"
+
+namespace illex::test {
+
+TEST(Affinity, ParseCpuList) {
+  CpuSet cpus;
+  ASSERT_TRUE(ParseCpuList("0-3,8,10-11\n", &cpus).ok());
+  ASSERT_EQ(cpus, CpuSet({0, 1, 2, 3, 8, 10, 11}));
+  ASSERT_TRUE(ParseCpuList("", &cpus).ok());
+  ASSERT_TRUE(cpus.empty());
+  ASSERT_FALSE(ParseCpuList("3-1", &cpus).ok());
+  ASSERT_FALSE(ParseCpuList("a", &cpus).ok());
+  ASSERT_FALSE(ParseCpuList("1,,2", &cpus).ok());
+  ASSERT_FALSE(ResolveCpuSet("nodex", &cpus).ok());
+}
+
+TEST(Affinity, PinThread) {
+  cpu_set_t original;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(original), &original), 0);
+  // Pin to the CPU this thread runs on, which is always allowed.
+  int cpu = sched_getcpu();
+  ASSERT_GE(cpu, 0);
+  ASSERT_TRUE(PinThread({static_cast<size_t>(cpu)}).ok());
+  cpu_set_t set;
+  ASSERT_EQ(sched_getaffinity(0, sizeof(set), &set), 0);
+  ASSERT_EQ(CPU_COUNT(&set), 1);
+  ASSERT_TRUE(CPU_ISSET(cpu, &set));
+  // An empty set leaves the thread where it is.
+  ASSERT_TRUE(PinThread({}).ok());
+  ASSERT_EQ(sched_setaffinity(0, sizeof(original), &original), 0);
+}
+
+}  // namespace illex::test
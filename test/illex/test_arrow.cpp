@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <arrow/api.h>
+#include <arrow/util/key_value_metadata.h>
 #include <gtest/gtest.h>
 #include <rapidjson/writer.h>
 
@@ -31,6 +32,32 @@ static auto GenerateJSON(const arrow::Schema& schema, int seed = 0) -> std::stri
   return std::string(b.GetString());
 }
 
+static auto WriteJSON(const arrow::Schema& schema, int seed = 0) -> std::string {
+  auto gen = FromArrowSchema(schema, GenerateOptions(seed));
+  rapidjson::StringBuffer b;
+  Writer w(b);
+  gen.Write(&w);
+  return std::string(b.GetString());
+}
+
+static auto KitchenSinkSchema() -> arrow::Schema {
+  return arrow::Schema(
+      {arrow::field("uint64", arrow::uint64(), false),
+       arrow::field("bool", arrow::boolean(), false),
+       arrow::field("str", arrow::utf8(), false),
+       arrow::field("date", arrow::date64(), false),
+       arrow::field("list", arrow::list(arrow::field("item", arrow::utf8(), false)),
+                    false),
+       arrow::field("fsl",
+                    arrow::fixed_size_list(arrow::field("item", arrow::boolean(), false),
+                                           2),
+                    false),
+       arrow::field("struct",
+                    arrow::struct_({arrow::field("a", arrow::uint64(), false),
+                                    arrow::field("b", arrow::utf8(), false)}),
+                    false)});
+}
+
 TEST(Arrow, Empty) {
   auto schema = arrow::Schema({});
   ASSERT_EQ(GenerateJSON(schema), R"({})");
@@ -71,4 +98,48 @@ TEST(Arrow, FixedSizeList) {
             R"({"fsl":[1537412910361083904,1876889274928791552,18143394317626638336]})");
 }
 
-}  // namespace illex::test
\ No newline at end of file
+TEST(Arrow, WriteMatchesGet) {
+  auto schema = KitchenSinkSchema();
+  for (int seed = 0; seed < 16; seed++) {
+    ASSERT_EQ(WriteJSON(schema, seed), GenerateJSON(schema, seed));
+  }
+}
+
+TEST(Arrow, ValidateSchema) {
+  auto pooled = [](const std::string& skew) {
+    auto meta = arrow::key_value_metadata({"illex_POOL_SIZE", "illex_POOL_SKEW"},
+                                          {"4", skew});
+    // Pools are validated within nested types as well.
+    return arrow::Schema({arrow::field(
+        "struct", arrow::struct_({arrow::field("str", arrow::utf8(), false, meta)}),
+        false)});
+  };
+  ASSERT_TRUE(ValidateSchema(KitchenSinkSchema()).ok());
+  ASSERT_TRUE(ValidateSchema(pooled("0")).ok());
+  ASSERT_TRUE(ValidateSchema(pooled("1.5")).ok());
+  for (const auto& skew : {"-1", "nan", "inf", "skew"}) {
+    ASSERT_FALSE(ValidateSchema(pooled(skew)).ok()) << skew;
+  }
+}
+
+TEST(Arrow, Codec) {
+  std::unique_ptr<arrow::util::Codec> codec;
+  ASSERT_FALSE(MakeCodec(Compression::None, &codec).ok());
+  ASSERT_TRUE(MakeCodec(Compression::LZ4, &codec).ok());
+
+  std::string jsons = "{\"a\":1}\n{\"a\":2}\n";
+  std::string compressed(codec->MaxCompressedLen(jsons.size(), nullptr), '\0');
+  auto* in = reinterpret_cast<const uint8_t*>(jsons.data());
+  auto length = codec->Compress(jsons.size(), in, compressed.size(),
+                                reinterpret_cast<uint8_t*>(compressed.data()));
+  ASSERT_TRUE(length.ok());
+  std::string decompressed(jsons.size(), '\0');
+  auto result = codec->Decompress(*length, reinterpret_cast<uint8_t*>(compressed.data()),
+                                  decompressed.size(),
+                                  reinterpret_cast<uint8_t*>(decompressed.data()));
+  ASSERT_TRUE(result.ok());
+  ASSERT_EQ(*result, jsons.size());
+  ASSERT_EQ(decompressed, jsons);
+}
+
+}  // namespace illex::test
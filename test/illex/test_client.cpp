@@ -13,8 +13,26 @@
 // limitations under the License.
 
 #include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "illex/client_buffering.h"
+#include "illex/client_file.h"
+#include "illex/client_group.h"
+#include "illex/client_queueing.h"
+#include "illex/scanner.h"
 
 namespace illex {
 
@@ -22,6 +40,87 @@ inline static auto Cast(const char* str) -> std::byte* {
   return const_cast<std::byte*>(reinterpret_cast<const std::byte*>(str));
 }
 
+/**
+ * \brief A server on the loopback interface that sends fixed chunks of bytes.
+ *
+ * The n-th client that connects is sent the n-th stream of chunks, after which its
+ * connection is closed. The server pauses after every chunk, so clients typically
+ * receive every chunk separately. A hook can hold back a chunk, it is called with the
+ * index of the stream and of the chunk before the chunk is sent.
+ */
+class ChunkServer {
+ public:
+  explicit ChunkServer(std::vector<std::vector<std::string>> streams,
+                       std::function<void(size_t, size_t)> hook = nullptr)
+      : streams_(std::move(streams)),
+        hook_(std::move(hook)),
+        socket_(kissnet::endpoint("127.0.0.1:0")) {
+    socket_.bind();
+    socket_.listen();
+    sockaddr_in address{};
+    socklen_t length = sizeof(address);
+    getsockname(socket_.get_native(), reinterpret_cast<sockaddr*>(&address), &length);
+    port_ = ntohs(address.sin_port);
+    thread_ = std::thread([this]() {
+      std::vector<std::thread> senders;
+      for (size_t s = 0; s < streams_.size(); s++) {
+        senders.emplace_back([this, s, client = socket_.accept()]() mutable {
+          client.set_tcp_no_delay();
+          for (size_t i = 0; i < streams_[s].size(); i++) {
+            if (hook_) {
+              hook_(s, i);
+            }
+            const auto& chunk = streams_[s][i];
+            client.send(reinterpret_cast<const std::byte*>(chunk.data()), chunk.size());
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+          }
+          client.close();
+        });
+      }
+      for (auto& sender : senders) {
+        sender.join();
+      }
+    });
+  }
+  ~ChunkServer() { thread_.join(); }
+
+  /// \brief Return client options to connect to this server.
+  [[nodiscard]] auto client_options() const -> ClientOptions {
+    ClientOptions opts;
+    opts.host = "127.0.0.1";
+    opts.port = port_;
+    return opts;
+  }
+
+ private:
+  std::vector<std::vector<std::string>> streams_;
+  std::function<void(size_t, size_t)> hook_;
+  Socket socket_;
+  uint16_t port_ = 0;
+  std::thread thread_;
+};
+
+/// Return a test JSON of at least some size, that identifies its sequence number.
+static auto TestJSON(size_t seq, size_t size = 0) -> std::string {
+  auto json = "{\"seq\":" + std::to_string(seq) + ",\"pad\":\"";
+  json.append(size > json.size() + 2 ? size - json.size() - 2 : 0, 'x');
+  return json + "\"}";
+}
+
+/// Split the newline-terminated concatenation of some JSONs into chunks of some size.
+static auto Chunk(const std::vector<std::string>& jsons, size_t chunk_size)
+    -> std::vector<std::string> {
+  std::string all;
+  for (const auto& json : jsons) {
+    all += json + "\n";
+  }
+  std::vector<std::string> chunks;
+  for (size_t offset = 0; offset < all.size(); offset += chunk_size) {
+    chunks.push_back(all.substr(offset, chunk_size));
+  }
+  return chunks;
+}
+
 static void GetResultFrom(const char* str, std::pair<size_t, size_t>* result) {
   auto* buf = Cast(str);
   JSONBuffer b;
@@ -47,6 +146,716 @@ TEST(Client, Scan) {
   GetResultFrom("{}", &result);
   ASSERT_EQ(result.first, 0);
   ASSERT_EQ(result.second, 2);
+  GetResultFrom("1\n2\n3", &result);
+  ASSERT_EQ(result.first, 2);
+  ASSERT_EQ(result.second, 1);
+  GetResultFrom("1\n\n2\n", &result);
+  ASSERT_EQ(result.first, 2);
+  ASSERT_EQ(result.second, 0);
+}
+
+TEST(Client, Frame) {
+  // Frames allow records with newlines inside.
+  std::string jsons = "{\n}\n[1,\n2]\n";
+  std::vector<uint32_t> lengths = {4, 7};
+  std::string header(frame::Size(lengths.size()), '\0');
+  frame::Write(header.data(), lengths.data(), lengths.size(), 5);
+  frame::Header h{};
+  std::memcpy(&h, header.data(), sizeof(h));
+  ASSERT_EQ(h.num_jsons, 2);
+  ASSERT_EQ(h.length, jsons.size());
+  ASSERT_EQ(h.seq, 5);
+  ASSERT_TRUE(frame::Valid(h, lengths.data()));
+  h.length++;
+  ASSERT_FALSE(frame::Valid(h, lengths.data()));
+  h.length--;
+
+  // Compressed frames carry the length of the compressed JSONs.
+  frame::WriteCompressed(header.data(), 6);
+  std::memcpy(&h, header.data(), sizeof(h));
+  ASSERT_EQ(h.magic, frame::kCompressedMagic);
+  ASSERT_EQ(h.wire_length, 6);
+  ASSERT_TRUE(frame::Valid(h, lengths.data()));
+
+  JSONBuffer b;
+  ASSERT_TRUE(JSONBuffer::Create(Cast(jsons.c_str()), jsons.size(), &b).ok());
+  b.SetFrame(lengths, 10);
+  ASSERT_EQ(b.size(), jsons.size());
+  ASSERT_EQ(b.num_jsons(), 2);
+  ASSERT_EQ(b.range().first, 10);
+  ASSERT_EQ(b.range().last, 11);
+  ASSERT_EQ(b.newlines(), std::vector<size_t>({3, 10}));
+}
+
+TEST(Client, ScanNewlines) {
+  // Place newlines at various positions around the vector widths of all implementations.
+  for (size_t size = 0; size < 300; size += 7) {
+    std::string str(size, 'x');
+    std::vector<size_t> expected;
+    for (size_t i = 0; i < size; i++) {
+      if ((i % 13 == 0) || (i % 64 == 63)) {
+        str[i] = '\n';
+        expected.push_back(i);
+      }
+    }
+    std::vector<size_t> offsets;
+    ScanNewlines(reinterpret_cast<const std::byte*>(str.data()), str.size(), &offsets);
+    ASSERT_EQ(offsets, expected);
+  }
+}
+
+TEST(Client, BufferQueuesRequired) {
+  BufferingClient client;
+  JSONBufferQueue queue;
+  ASSERT_FALSE(BufferingClient::Create(ClientOptions(), &queue, nullptr, &client).ok());
+  ASSERT_FALSE(BufferingClient::Create(ClientOptions(), nullptr, &queue, &client).ok());
+}
+
+TEST(Client, BufferQueues) {
+  std::vector<std::string> jsons;
+  for (size_t i = 0; i < 1000; i++) {
+    jsons.push_back(TestJSON(i));
+  }
+  ChunkServer server({Chunk(jsons, 1000)});
+
+  std::vector<std::vector<std::byte>> storage(2, std::vector<std::byte>(256));
+  std::vector<JSONBuffer> buffers(2);
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  for (size_t i = 0; i < 2; i++) {
+    ASSERT_TRUE(JSONBuffer::Create(storage[i].data(), 256, &buffers[i]).ok());
+    free.enqueue(&buffers[i]);
+  }
+  BufferingClient client;
+  ASSERT_TRUE(
+      BufferingClient::Create(server.client_options(), &free, &filled, &client).ok());
+  Status status;
+  std::thread receiver([&]() { status = client.ReceiveJSONs(); });
+
+  // Consume the filled buffers in order, and return them.
+  size_t num_jsons = 0;
+  while (num_jsons < jsons.size()) {
+    JSONBuffer* buf = nullptr;
+    ASSERT_TRUE(filled.wait_dequeue_timed(buf, std::chrono::seconds(10)));
+    ASSERT_EQ(buf->range().first, num_jsons);
+    size_t start = 0;
+    for (auto newline : buf->newlines()) {
+      std::string json(reinterpret_cast<const char*>(buf->data()) + start,
+                       newline - start);
+      ASSERT_EQ(json, jsons[num_jsons++]);
+      start = newline + 1;
+    }
+    buf->Reset();
+    free.enqueue(buf);
+  }
+  receiver.join();
+  ASSERT_TRUE(status.ok()) << status.msg();
+  ASSERT_EQ(client.jsons_received(), jsons.size());
+  ASSERT_TRUE(client.Close().ok());
+}
+
+/// Check the JSONs in a consumed buffer, and overwrite all of its bytes.
+static void ConsumeBuffer(JSONBuffer* buf, const std::vector<std::string>& jsons,
+                          size_t* num_jsons, Seq first_seq = 0) {
+  ASSERT_EQ(buf->range().first, first_seq + *num_jsons);
+  size_t start = 0;
+  for (auto newline : buf->newlines()) {
+    std::string json(reinterpret_cast<const char*>(buf->data()) + start,
+                     newline - start);
+    ASSERT_EQ(json, jsons[(*num_jsons)++]);
+    start = newline + 1;
+  }
+  // Consumers may modify the whole buffer, including an incomplete JSON at its end.
+  std::memset(buf->mutable_data(), 'x', buf->capacity());
+  buf->Reset();
+}
+
+/// Return JSONs of various sizes, of which most span several receives of some bytes.
+static auto CarryOverJSONs(size_t max_size) -> std::vector<std::string> {
+  std::vector<std::string> jsons;
+  for (size_t i = 0; i < 200; i++) {
+    jsons.push_back(TestJSON(i, 20 + (i * 37) % (max_size - 20)));
+  }
+  return jsons;
+}
+
+/**
+ * \brief Receive JSONs that span several buffers through the buffer queues.
+ *
+ * With a single buffer, no next buffer is ever free when a buffer is handed off, so the
+ * incomplete JSON at its end is always spilled.
+ */
+static void CheckCarryOverQueued(size_t num_buffers) {
+  auto jsons = CarryOverJSONs(200);
+  ChunkServer server({Chunk(jsons, 64)});
+  std::vector<std::vector<std::byte>> storage(num_buffers, std::vector<std::byte>(256));
+  std::vector<JSONBuffer> buffers(num_buffers);
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  for (size_t i = 0; i < num_buffers; i++) {
+    ASSERT_TRUE(JSONBuffer::Create(storage[i].data(), 256, &buffers[i]).ok());
+    free.enqueue(&buffers[i]);
+  }
+  BufferingClient client;
+  ASSERT_TRUE(
+      BufferingClient::Create(server.client_options(), &free, &filled, &client).ok());
+  Status status;
+  std::thread receiver([&]() { status = client.ReceiveJSONs(); });
+  size_t num_jsons = 0;
+  while (num_jsons < jsons.size()) {
+    JSONBuffer* buf = nullptr;
+    ASSERT_TRUE(filled.wait_dequeue_timed(buf, std::chrono::seconds(10)));
+    ConsumeBuffer(buf, jsons, &num_jsons);
+    free.enqueue(buf);
+  }
+  receiver.join();
+  ASSERT_TRUE(status.ok()) << status.msg();
+  ASSERT_EQ(client.jsons_received(), jsons.size());
+}
+
+TEST(Client, CarryOverQueued) { CheckCarryOverQueued(2); }
+
+TEST(Client, CarryOverSpilled) { CheckCarryOverQueued(1); }
+
+TEST(Client, CarryOverLocked) {
+  auto jsons = CarryOverJSONs(200);
+  ChunkServer server({Chunk(jsons, 64)});
+  std::vector<std::vector<std::byte>> storage(2, std::vector<std::byte>(256));
+  std::vector<JSONBuffer> buffers(2);
+  std::vector<std::mutex> mutexes(2);
+  for (size_t i = 0; i < 2; i++) {
+    ASSERT_TRUE(JSONBuffer::Create(storage[i].data(), 256, &buffers[i]).ok());
+  }
+  BufferingClient client;
+  ASSERT_TRUE(BufferingClient::Create(server.client_options(),
+                                      {&buffers[0], &buffers[1]},
+                                      {&mutexes[0], &mutexes[1]}, &client)
+                  .ok());
+  Status status;
+  std::thread receiver([&]() { status = client.ReceiveJSONs(); });
+  // Consume buffers in the order of their sequence numbers.
+  size_t num_jsons = 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while ((num_jsons < jsons.size()) && (std::chrono::steady_clock::now() < deadline)) {
+    for (size_t i = 0; i < 2; i++) {
+      std::lock_guard<std::mutex> lock(mutexes[i]);
+      if (!buffers[i].empty() && (buffers[i].range().first == num_jsons)) {
+        ConsumeBuffer(&buffers[i], jsons, &num_jsons);
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  receiver.join();
+  ASSERT_TRUE(status.ok()) << status.msg();
+  ASSERT_EQ(num_jsons, jsons.size());
+}
+
+TEST(Client, CarryOverTooLarge) {
+  ChunkServer server({Chunk({TestJSON(0, 10), TestJSON(1, 300)}, 1000)});
+  std::vector<std::byte> storage(256);
+  JSONBuffer buffer;
+  ASSERT_TRUE(JSONBuffer::Create(storage.data(), 256, &buffer).ok());
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  free.enqueue(&buffer);
+  BufferingClient client;
+  ASSERT_TRUE(
+      BufferingClient::Create(server.client_options(), &free, &filled, &client).ok());
+  Status status;
+  std::thread receiver([&]() { status = client.ReceiveJSONs(); });
+  JSONBuffer* buf = nullptr;
+  ASSERT_TRUE(filled.wait_dequeue_timed(buf, std::chrono::seconds(10)));
+  ASSERT_EQ(buf->num_jsons(), 1);
+  buf->Reset();
+  free.enqueue(buf);
+  receiver.join();
+  ASSERT_FALSE(status.ok());
+  // The buffer is returned to the free queue after the error.
+  ASSERT_TRUE(free.try_dequeue(buf));
+}
+
+/// Return a JSON with a send stamp.
+static auto StampedJSON(size_t seq, std::chrono::system_clock::time_point sent)
+    -> std::string {
+  std::string json = "{\"a\":" + std::to_string(seq);
+  json.resize(json.size() + stamp::kSize);
+  auto* stamp = json.data() + json.size() - stamp::kSize;
+  stamp::WriteEmpty(stamp);
+  stamp::WriteNumber(stamp + stamp::kSeqOffset, seq);
+  stamp::WriteNumber(stamp + stamp::kTimeOffset,
+                     std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         sent.time_since_epoch())
+                         .count());
+  return json;
+}
+
+TEST(Client, BufferingSendStamps) {
+  auto sent = std::chrono::system_clock::now() - std::chrono::milliseconds(10);
+  std::vector<std::string> jsons;
+  for (size_t i = 0; i < 10; i++) {
+    jsons.push_back(StampedJSON(i, sent));
+  }
+  ChunkServer server({Chunk(jsons, 50)});
+  std::vector<std::byte> storage(256);
+  JSONBuffer buffer;
+  ASSERT_TRUE(JSONBuffer::Create(storage.data(), 256, &buffer).ok());
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  free.enqueue(&buffer);
+  auto opts = server.client_options();
+  opts.send_stamps = true;
+  BufferingClient client;
+  ASSERT_TRUE(BufferingClient::Create(opts, &free, &filled, &client).ok());
+
+  LatencyTracker tracker(16, 3, 1);
+  Status status;
+  std::thread receiver([&]() { status = client.ReceiveJSONs(&tracker); });
+  size_t num_jsons = 0;
+  while (num_jsons < jsons.size()) {
+    JSONBuffer* buf = nullptr;
+    ASSERT_TRUE(filled.wait_dequeue_timed(buf, std::chrono::seconds(10)));
+    ConsumeBuffer(buf, jsons, &num_jsons);
+    free.enqueue(buf);
+  }
+  receiver.join();
+  ASSERT_TRUE(status.ok()) << status.msg();
+
+  // The send time of every JSON is placed before its receive and queue times.
+  for (size_t i = 0; i < jsons.size(); i++) {
+    ASSERT_NE(tracker.Get(i, 0), TimePoint());
+    ASSERT_GE(tracker.Get(i, 1) - tracker.Get(i, 0), std::chrono::milliseconds(10));
+    ASSERT_LE(tracker.Get(i, 1), tracker.Get(i, 2));
+  }
+}
+
+TEST(Client, StopWaitingForBuffer) {
+  ChunkServer server({{"{}\n"}});
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  BufferingClient client;
+  ASSERT_TRUE(
+      BufferingClient::Create(server.client_options(), &free, &filled, &client).ok());
+  // Without free buffers, the client waits until it is stopped.
+  Status status;
+  std::thread receiver([&]() { status = client.ReceiveJSONs(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  client.Stop();
+  receiver.join();
+  ASSERT_TRUE(status.ok()) << status.msg();
+  ASSERT_EQ(client.jsons_received(), 0);
+  ASSERT_TRUE(client.Close().ok());
+}
+
+TEST(Client, CompressionRequiresFraming) {
+  BufferingClient client;
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  ClientOptions opts;
+  opts.protocol.compression = Compression::LZ4;
+  ASSERT_FALSE(BufferingClient::Create(opts, &free, &filled, &client).ok());
+}
+
+TEST(Client, SlabPool) {
+  auto pool = std::make_unique<SlabPool>(64);
+  std::shared_ptr<std::byte> a;
+  std::shared_ptr<std::byte> b;
+  ASSERT_TRUE(pool->Acquire(&a).ok());
+  ASSERT_TRUE(pool->Acquire(&b).ok());
+  ASSERT_EQ(pool->num_allocated(), 2);
+  // Released slabs are reused once the last reference is dropped.
+  auto* address = a.get();
+  auto view = JSONView{0, "{}", a};
+  a.reset();
+  view.owner.reset();
+  ASSERT_TRUE(pool->Acquire(&a).ok());
+  ASSERT_EQ(a.get(), address);
+  ASSERT_EQ(pool->num_allocated(), 2);
+  // Slabs may outlive the pool.
+  pool.reset();
+  a.reset();
+  b.reset();
+}
+
+TEST(Client, ViewsAcrossSlabs) {
+  // JSONs of 32 bytes in slabs of 80 bytes, so JSONs regularly cross the end of a slab.
+  std::vector<std::string> jsons;
+  for (size_t i = 0; i < 100; i++) {
+    jsons.push_back(TestJSON(i, 31));
+  }
+  ChunkServer server({Chunk(jsons, 50)});
+  JSONViewQueue queue;
+  QueueingClient client;
+  ASSERT_TRUE(QueueingClient::Create(server.client_options(), &queue, &client, 80).ok());
+
+  // Drop every view once it is checked, so the slabs can be recycled.
+  Status status;
+  std::thread receiver([&]() { status = client.ReceiveJSONs(); });
+  for (size_t i = 0; i < jsons.size(); i++) {
+    JSONView view;
+    ASSERT_TRUE(queue.wait_dequeue_timed(view, std::chrono::seconds(10)));
+    ASSERT_EQ(view.seq, i);
+    ASSERT_EQ(view.string, jsons[i]);
+  }
+  receiver.join();
+  ASSERT_TRUE(status.ok()) << status.msg();
+  ASSERT_EQ(client.jsons_received(), jsons.size());
+  // Filling all 3200 bytes took 40 or more slabs, but only a few were ever allocated.
+  ASSERT_LT(client.slab_pool().num_allocated(), 10);
+  ASSERT_TRUE(client.Close().ok());
+}
+
+TEST(Client, ViewLargerThanSlab) {
+  ChunkServer server({Chunk({TestJSON(0, 10), TestJSON(1, 100)}, 1000)});
+  JSONViewQueue queue;
+  QueueingClient client;
+  ASSERT_TRUE(QueueingClient::Create(server.client_options(), &queue, &client, 64).ok());
+  ASSERT_FALSE(client.ReceiveJSONs().ok());
+  // JSONs before the one that does not fit are delivered.
+  JSONView view;
+  ASSERT_TRUE(queue.try_dequeue(view));
+  ASSERT_EQ(view.string, TestJSON(0, 10));
+  ASSERT_FALSE(queue.try_dequeue(view));
+}
+
+/// Write a JSON Lines file with some JSONs, of which the last is not terminated.
+static auto WriteJSONLines(const std::string& name, size_t num_jsons) -> std::string {
+  auto path = testing::TempDir() + name;
+  std::ofstream ofs(path);
+  for (size_t i = 0; i < num_jsons; i++) {
+    ofs << "{\"json\":" << i << "}\n";
+  }
+  ofs << "{\"incomplete\":";
+  return path;
+}
+
+TEST(Client, FileItems) {
+  auto path = WriteJSONLines("illex_client_items.jsonl", 100);
+  FileClientOptions opts;
+  opts.path = path;
+  opts.seq = 10;
+  opts.chunk_size = 64;
+  JSONQueue queue;
+  FileClient client;
+  ASSERT_TRUE(FileClient::Create(opts, &queue, &client).ok());
+  ASSERT_TRUE(client.ReceiveJSONs().ok());
+  ASSERT_EQ(client.jsons_received(), 100);
+  for (size_t i = 0; i < 100; i++) {
+    JSONItem item;
+    ASSERT_TRUE(queue.try_dequeue(item));
+    ASSERT_EQ(item.seq, 10 + i);
+    ASSERT_EQ(item.string, "{\"json\":" + std::to_string(i) + "}");
+  }
+  ASSERT_TRUE(client.Close().ok());
+  std::remove(path.c_str());
+}
+
+TEST(Client, FileViews) {
+  auto path = WriteJSONLines("illex_client_views.jsonl", 100);
+  FileClientOptions opts;
+  opts.path = path;
+  JSONViewQueue queue;
+  {
+    FileClient client;
+    ASSERT_TRUE(FileClient::Create(opts, &queue, &client).ok());
+    ASSERT_TRUE(client.ReceiveJSONs().ok());
+    ASSERT_TRUE(client.Close().ok());
+  }
+  // Views keep the mapping alive after the client is gone.
+  for (size_t i = 0; i < 100; i++) {
+    JSONView view;
+    ASSERT_TRUE(queue.try_dequeue(view));
+    ASSERT_EQ(view.seq, i);
+    ASSERT_EQ(view.string, "{\"json\":" + std::to_string(i) + "}");
+  }
+  std::remove(path.c_str());
+}
+
+/// Read a file in buffers, and check that all JSONs arrive in order.
+static void CheckFileBuffers(bool zero_copy) {
+  auto path = WriteJSONLines("illex_client_buffers.jsonl", 1000);
+  FileClientOptions opts;
+  opts.path = path;
+  opts.zero_copy = zero_copy;
+  opts.chunk_size = 100;
+  opts.num_slices = 2;
+
+  // Buffers smaller than the chunk size for copies, so they limit the chunks.
+  std::vector<std::vector<std::byte>> storage(2, std::vector<std::byte>(64));
+  std::vector<JSONBuffer> buffers(2);
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  if (!zero_copy) {
+    for (size_t i = 0; i < 2; i++) {
+      ASSERT_TRUE(JSONBuffer::Create(storage[i].data(), 64, &buffers[i]).ok());
+      free.enqueue(&buffers[i]);
+    }
+  }
+
+  FileClient client;
+  ASSERT_TRUE(FileClient::Create(opts, &free, &filled, &client).ok());
+  Status status;
+  std::thread reader([&]() { status = client.ReceiveJSONs(); });
+
+  // Consume the buffers, and return them.
+  std::string received;
+  size_t num_jsons = 0;
+  while (num_jsons < 1000) {
+    JSONBuffer* buf = nullptr;
+    filled.wait_dequeue(buf);
+    ASSERT_EQ(buf->range().first, num_jsons);
+    num_jsons += buf->num_jsons();
+    received.append(reinterpret_cast<const char*>(buf->data()), buf->size());
+    buf->Reset();
+    free.enqueue(buf);
+  }
+  reader.join();
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(client.jsons_received(), 1000);
+  ASSERT_EQ(received.substr(received.length() - 13), "{\"json\":999}\n");
+  std::remove(path.c_str());
+}
+
+TEST(Client, FileBuffers) { CheckFileBuffers(false); }
+
+TEST(Client, FileSlices) { CheckFileBuffers(true); }
+
+TEST(Client, TrackSendStamps) {
+  LatencyTracker tracker(4, 3, 1);
+  std::string json = "{\"a\":0";
+  json.resize(json.size() + stamp::kSize);
+  stamp::WriteEmpty(json.data() + json.size() - stamp::kSize);
+
+  // An unstamped JSON leaves the send time empty.
+  auto now = Timer::now();
+  TrackLatency(&tracker, 0, json, true, now, now);
+  ASSERT_EQ(tracker.Get(0, 0), TimePoint());
+  ASSERT_EQ(tracker.Get(0, 1), now);
+  ASSERT_EQ(tracker.Get(0, 2), now);
+
+  // A stamped JSON is converted to the steady clock.
+  auto sent = std::chrono::system_clock::now() - std::chrono::milliseconds(10);
+  stamp::WriteNumber(json.data() + json.size() - stamp::kSize + stamp::kSeqOffset, 1);
+  stamp::WriteNumber(json.data() + json.size() - stamp::kSize + stamp::kTimeOffset,
+                     std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         sent.time_since_epoch())
+                         .count());
+  now = Timer::now();
+  TrackLatency(&tracker, 1, json, true, now, now);
+  ASSERT_NE(tracker.Get(1, 0), TimePoint());
+  ASSERT_GE(now - tracker.Get(1, 0), std::chrono::milliseconds(10));
+  ASSERT_EQ(tracker.Get(1, 1), now);
+
+  // A stamp with another sequence number is ignored.
+  TrackLatency(&tracker, 2, json, true, now, now);
+  ASSERT_EQ(tracker.Get(2, 0), TimePoint());
+}
+
+/// Receive JSONs that span several receives on multiple connections sharing buffers.
+static void CheckGroupBuffers(ReceiveEngine engine, bool locked) {
+  std::vector<std::vector<std::string>> streams;
+  streams.push_back(CarryOverJSONs(200));
+  streams.push_back(CarryOverJSONs(150));
+  ChunkServer server({Chunk(streams[0], 64), Chunk(streams[1], 48)});
+  ClientGroupOptions opts;
+  opts.client = server.client_options();
+  opts.num_connections = 2;
+  opts.seq_range = 1000;
+  opts.engine = engine;
+
+  std::vector<std::vector<std::byte>> storage(3, std::vector<std::byte>(256));
+  std::vector<JSONBuffer> buffers(3);
+  std::vector<std::mutex> mutexes(3);
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(JSONBuffer::Create(storage[i].data(), 256, &buffers[i]).ok());
+    free.enqueue(&buffers[i]);
+  }
+  ClientGroup group;
+  if (locked) {
+    ASSERT_TRUE(ClientGroup::Create(opts, {&buffers[0], &buffers[1], &buffers[2]},
+                                    {&mutexes[0], &mutexes[1], &mutexes[2]}, &group)
+                    .ok());
+  } else {
+    ASSERT_TRUE(ClientGroup::Create(opts, &free, &filled, &group).ok());
+  }
+  Status status;
+  std::thread receiver([&]() { status = group.ReceiveJSONs(); });
+
+  // Every buffer holds complete JSONs of a single connection, in the order of its
+  // stream.
+  std::vector<size_t> num_jsons(2, 0);
+  auto consume = [&](JSONBuffer* buf) {
+    auto c = group.connection(buf->range().first);
+    ASSERT_LT(c, 2);
+    ConsumeBuffer(buf, streams[c], &num_jsons[c], c * opts.seq_range);
+  };
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while ((num_jsons[0] + num_jsons[1] < streams[0].size() + streams[1].size()) &&
+         (std::chrono::steady_clock::now() < deadline)) {
+    if (locked) {
+      for (size_t i = 0; i < 3; i++) {
+        std::lock_guard<std::mutex> lock(mutexes[i]);
+        if (buffers[i].empty()) {
+          continue;
+        }
+        // Consume the buffers of a connection in the order of their sequence numbers.
+        auto c = group.connection(buffers[i].range().first);
+        if (group.connection_seq(buffers[i].range().first) == num_jsons[c]) {
+          consume(&buffers[i]);
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    } else {
+      JSONBuffer* buf = nullptr;
+      if (filled.wait_dequeue_timed(buf, std::chrono::milliseconds(10))) {
+        consume(buf);
+        free.enqueue(buf);
+      }
+    }
+  }
+  receiver.join();
+  ASSERT_TRUE(status.ok()) << status.msg();
+  ASSERT_EQ(num_jsons[0], streams[0].size());
+  ASSERT_EQ(num_jsons[1], streams[1].size());
+  ASSERT_EQ(group.jsons_received(), streams[0].size() + streams[1].size());
+}
+
+TEST(Client, GroupQueuedBuffers) {
+  CheckGroupBuffers(ReceiveEngine::Threads, false);
+  CheckGroupBuffers(ReceiveEngine::Epoll, false);
+}
+
+TEST(Client, GroupLockedBuffers) {
+  CheckGroupBuffers(ReceiveEngine::Threads, true);
+  CheckGroupBuffers(ReceiveEngine::Epoll, true);
+}
+
+/// Return a frame holding some JSONs, each followed by a newline.
+static auto Frame(const std::vector<std::string>& jsons, uint64_t seq) -> std::string {
+  std::vector<uint32_t> lengths;
+  std::string payload;
+  for (const auto& json : jsons) {
+    lengths.push_back(static_cast<uint32_t>(json.size() + 1));
+    payload += json + "\n";
+  }
+  std::string frame(frame::Size(jsons.size()), '\0');
+  frame::Write(frame.data(), lengths.data(), lengths.size(), seq);
+  return frame + payload;
+}
+
+TEST(Client, InvalidFrames) {
+  // A frame that does not start at the next JSON of the stream.
+  auto out_of_order = Frame({TestJSON(0)}, 5);
+  // A frame claiming more JSONs than bytes, which is rejected before its lengths are
+  // received.
+  std::string too_many(sizeof(frame::Header), '\0');
+  frame::Header header{frame::kMagic, UINT32_MAX, 10, 0, 10};
+  std::memcpy(too_many.data(), &header, sizeof(header));
+  // A compressed frame claiming more bytes than its JSONs can be compressed to, which is
+  // rejected before its compressed JSONs are received.
+  auto too_large = Frame({TestJSON(0)}, 0);
+  frame::WriteCompressed(too_large.data(), uint64_t{1} << 40);
+
+  for (const auto& frame : {out_of_order, too_many, too_large}) {
+    ChunkServer server({{frame}});
+    std::vector<std::byte> storage(256);
+    JSONBuffer buffer;
+    ASSERT_TRUE(JSONBuffer::Create(storage.data(), 256, &buffer).ok());
+    JSONBufferQueue free;
+    JSONBufferQueue filled;
+    free.enqueue(&buffer);
+    auto opts = server.client_options();
+    opts.protocol.framing = Framing::Length;
+    opts.protocol.compression = Compression::LZ4;
+    BufferingClient client;
+    ASSERT_TRUE(BufferingClient::Create(opts, &free, &filled, &client).ok());
+    ASSERT_FALSE(client.ReceiveJSONs().ok());
+    ASSERT_EQ(client.jsons_received(), 0);
+    // The buffer is returned to the free queue after the error.
+    JSONBuffer* buf = nullptr;
+    ASSERT_TRUE(free.try_dequeue(buf));
+  }
+}
+
+TEST(Client, GroupEpollDoesNotBlock) {
+  // The first connection is held in the middle of a frame, until all JSONs of the
+  // second connection are consumed.
+  auto held = Frame({TestJSON(0, 40), TestJSON(1, 40)}, 0);
+  std::vector<std::string> jsons;
+  std::string frames;
+  for (size_t i = 0; i < 10; i++) {
+    jsons.push_back(TestJSON(i, 30));
+    frames += Frame({jsons.back()}, i);
+  }
+  std::promise<void> release;
+  auto released = release.get_future().share();
+  ChunkServer server({{held.substr(0, 50), held.substr(50)}, {frames}},
+                     [released](size_t stream, size_t chunk) {
+                       if ((stream == 0) && (chunk == 1)) {
+                         released.wait();
+                       }
+                     });
+
+  ClientGroupOptions opts;
+  opts.client = server.client_options();
+  opts.client.protocol.framing = Framing::Length;
+  opts.num_connections = 2;
+  opts.seq_range = 1000;
+  opts.engine = ReceiveEngine::Epoll;
+  std::vector<std::vector<std::byte>> storage(2, std::vector<std::byte>(256));
+  std::vector<JSONBuffer> buffers(2);
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  for (size_t i = 0; i < 2; i++) {
+    ASSERT_TRUE(JSONBuffer::Create(storage[i].data(), 256, &buffers[i]).ok());
+    free.enqueue(&buffers[i]);
+  }
+  ClientGroup group;
+  ASSERT_TRUE(ClientGroup::Create(opts, &free, &filled, &group).ok());
+  Status status;
+  std::thread receiver([&]() { status = group.ReceiveJSONs(); });
+
+  // The first connection holds one of the buffers, the other buffer is enough to
+  // receive all frames of the second connection.
+  size_t num_jsons = 0;
+  JSONBuffer* buf = nullptr;
+  while ((num_jsons < jsons.size()) &&
+         filled.wait_dequeue_timed(buf, std::chrono::seconds(10))) {
+    ConsumeBuffer(buf, jsons, &num_jsons, opts.seq_range);
+    free.enqueue(buf);
+  }
+  release.set_value();
+  ASSERT_EQ(num_jsons, jsons.size());
+
+  // The first connection completes its frame once the rest arrives.
+  ASSERT_TRUE(filled.wait_dequeue_timed(buf, std::chrono::seconds(10)));
+  size_t held_jsons = 0;
+  ConsumeBuffer(buf, {TestJSON(0, 40), TestJSON(1, 40)}, &held_jsons);
+  free.enqueue(buf);
+  receiver.join();
+  ASSERT_TRUE(status.ok()) << status.msg();
+  ASSERT_EQ(group.jsons_received(), jsons.size() + 2);
+}
+
+TEST(Client, GroupSeq) {
+  ClientGroupOptions opts;
+  opts.num_connections = 0;
+  JSONQueue queue;
+  ClientGroup group;
+  ASSERT_FALSE(ClientGroup::Create(opts, &queue, &group).ok());
+  opts.num_connections = 2;
+  opts.seq_range = 0;
+  ASSERT_FALSE(ClientGroup::Create(opts, &queue, &group).ok());
+  opts.seq_range = kDefaultConnectionSeqRange;
+  opts.engine = ReceiveEngine::Epoll;
+  opts.num_engine_threads = 0;
+  ASSERT_FALSE(ClientGroup::Create(opts, &queue, &group).ok());
+
+  // Sequence numbers identify the connection and the position in its stream.
+  ASSERT_EQ(group.connection(5), 0);
+  ASSERT_EQ(group.connection(3 * kDefaultConnectionSeqRange + 5), 3);
+  ASSERT_EQ(group.connection_seq(3 * kDefaultConnectionSeqRange + 5), 5);
 }
 
-}  // namespace illex
\ No newline at end of file
+}  // namespace illex
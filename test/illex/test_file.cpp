@@ -23,8 +23,8 @@
 namespace illex {
 
 TEST(File, File) {
-  auto path =
-      std::string(::testing::UnitTest::GetInstance()->current_test_info()->name());
+  auto path = ::testing::TempDir() + "illex_" +
+              ::testing::UnitTest::GetInstance()->current_test_info()->name();
   FileOptions opts;
   opts.production.schema = arrow::schema({arrow::field("test", arrow::uint64(), false)});
   opts.production.num_jsons = 16;
@@ -43,8 +43,8 @@ TEST(File, File) {
 }
 
 TEST(File, PrettyFile) {
-  auto path =
-      std::string(::testing::UnitTest::GetInstance()->current_test_info()->name());
+  auto path = ::testing::TempDir() + "illex_" +
+              ::testing::UnitTest::GetInstance()->current_test_info()->name();
   FileOptions opts;
   opts.production.schema = arrow::schema(
       {arrow::field("a", arrow::null(), false), arrow::field("b", arrow::null(), false)});
@@ -54,6 +54,7 @@ TEST(File, PrettyFile) {
   opts.out_path = path;
   std::stringstream ss;
   RunFile(opts, &ss);
+  std::filesystem::remove(path);
   auto str0 = ss.str();
   ASSERT_EQ(str0,
             "{\n"
@@ -62,4 +63,33 @@ TEST(File, PrettyFile) {
             "}\n");
 }
 
+TEST(File, Shards) {
+  auto name = ::testing::TempDir() + "illex_" +
+              ::testing::UnitTest::GetInstance()->current_test_info()->name();
+  FileOptions opts;
+  opts.production.schema = arrow::schema({arrow::field("test", arrow::uint64(), false)});
+  opts.production.num_jsons = 15;
+  opts.production.num_threads = 4;
+  opts.shard = true;
+  opts.out_path = name + "-%02d.jsonl";
+  ASSERT_TRUE(RunFile(opts).ok());
+  // Every shard gets a share of the JSONs.
+  size_t total = 0;
+  for (size_t s = 0; s < 4; s++) {
+    auto path = name + "-0" + std::to_string(s) + ".jsonl";
+    ASSERT_TRUE(std::filesystem::exists(path));
+    auto ifs = std::ifstream(path);
+    std::string str((std::istreambuf_iterator<char>(ifs)),
+                    std::istreambuf_iterator<char>());
+    ASSERT_EQ(std::count(str.begin(), str.end(), '\n'), s < 3 ? 4 : 3);
+    total += std::count(str.begin(), str.end(), '\n');
+    ASSERT_TRUE(std::filesystem::remove(path));
+  }
+  ASSERT_EQ(total, 15);
+
+  // The output path must contain a single integer conversion.
+  opts.out_path = name + "-%s.jsonl";
+  ASSERT_FALSE(RunFile(opts).ok());
+}
+
 }  // namespace illex
\ No newline at end of file
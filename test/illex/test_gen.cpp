@@ -15,6 +15,8 @@
 #include <gtest/gtest.h>
 #include <rapidjson/writer.h>
 
+#include <string>
+
 #include "illex/document.h"
 #include "illex/value.h"
 
@@ -47,4 +49,23 @@ TEST(Generators, TwoValuesFromOneGenerator) {
   ASSERT_STREQ(b.GetString(), "nullnull");
 }
 
+TEST(Generators, DateString) {
+  RandomEngine engine(0);
+  DateString date;
+  for (int i = 0; i < 1024; i++) {
+    char str[DateString::kMaxLength];
+    auto length = date.Format(&engine, str);
+    ASSERT_EQ(length, 25);
+    std::string value(str, length);
+    auto year = std::stoi(value.substr(0, 4));
+    ASSERT_GE(year, 2000);
+    ASSERT_LE(year, 2020);
+    ASSERT_EQ(value[4], '-');
+    ASSERT_EQ(value[10], 'T');
+    ASSERT_TRUE((value[19] == '+') || (value[19] == '-'));
+    ASSERT_LE(std::stoi(value.substr(20, 2)), 12);
+    ASSERT_EQ(value.substr(22), ":00");
+  }
+}
+
 }  // namespace illex::test
\ No newline at end of file
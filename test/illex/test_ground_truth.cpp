@@ -0,0 +1,182 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+#include <gtest/gtest.h>
+#include <rapidjson/document.h>
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "illex/file.h"
+#include "illex/ground_truth.h"
+#include "illex/pull.h"
+
+namespace illex::test {
+
+static auto KitchenSinkSchema() -> std::shared_ptr<arrow::Schema> {
+  return arrow::schema(
+      {arrow::field("uint64", arrow::uint64(), false),
+       arrow::field("bool", arrow::boolean(), false),
+       arrow::field("str", arrow::utf8(), false),
+       arrow::field("date", arrow::date64(), false),
+       arrow::field("list", arrow::list(arrow::field("item", arrow::utf8(), false)),
+                    false),
+       arrow::field("fsl",
+                    arrow::fixed_size_list(arrow::field("item", arrow::boolean(), false),
+                                           2),
+                    false),
+       arrow::field("struct",
+                    arrow::struct_({arrow::field("a", arrow::uint64(), false),
+                                    arrow::field("b", arrow::date64(), false)}),
+                    false)});
+}
+
+/// Parse newline-delimited JSONs, and append them to a table.
+static auto ParseJSONs(const std::shared_ptr<arrow::Schema>& schema,
+                       const std::string& jsons) -> std::shared_ptr<arrow::Table> {
+  std::unique_ptr<RecordBatchAppender> appender;
+  EXPECT_TRUE(RecordBatchAppender::Make(schema, &appender).ok());
+  std::istringstream lines(jsons);
+  std::string line;
+  while (std::getline(lines, line)) {
+    rapidjson::Document doc;
+    doc.Parse(line.c_str(), line.length());
+    EXPECT_FALSE(doc.HasParseError());
+    EXPECT_TRUE(appender->Append(doc).ok());
+  }
+  std::shared_ptr<arrow::RecordBatch> batch;
+  EXPECT_TRUE(appender->Flush(&batch).ok());
+  return arrow::Table::FromRecordBatches(schema, {batch}).ValueOrDie();
+}
+
+/// Read all record batches of an Arrow IPC file into a table.
+static auto ReadTable(const std::shared_ptr<arrow::Schema>& schema,
+                      const std::string& path) -> std::shared_ptr<arrow::Table> {
+  auto file = arrow::io::ReadableFile::Open(path).ValueOrDie();
+  auto reader = arrow::ipc::RecordBatchFileReader::Open(file).ValueOrDie();
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  for (int i = 0; i < reader->num_record_batches(); i++) {
+    batches.push_back(reader->ReadRecordBatch(i).ValueOrDie());
+  }
+  return arrow::Table::FromRecordBatches(schema, batches).ValueOrDie();
+}
+
+TEST(GroundTruth, DateToMillis) {
+  int64_t millis = 1;
+  ASSERT_TRUE(DateToMillis("1970-01-01T00:00:00+00:00", &millis).ok());
+  ASSERT_EQ(millis, 0);
+  ASSERT_TRUE(DateToMillis("2000-03-01T12:30:15-05:00", &millis).ok());
+  ASSERT_EQ(millis, 951931815000);
+  ASSERT_TRUE(DateToMillis("2020-12-31T23:59:59+12:00", &millis).ok());
+  ASSERT_EQ(millis, 1609415999000);
+  ASSERT_FALSE(DateToMillis("2000-03-01", &millis).ok());
+  ASSERT_FALSE(DateToMillis("2000-03-01T12:30:15Z05:00", &millis).ok());
+}
+
+TEST(GroundTruth, MatchesJSONs) {
+  GroundTruthOptions opts;
+  opts.gen = GenerateOptions(0);
+  opts.schema = KitchenSinkSchema();
+  opts.num_jsons = 10;
+  opts.first_json = 3;
+  opts.max_rows = 4;
+  std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+  ASSERT_TRUE(GenerateGroundTruth(opts, &batches).ok());
+  ASSERT_EQ(batches.size(), 3);
+  ASSERT_EQ(batches[0]->num_rows(), 4);
+  ASSERT_EQ(batches[1]->num_rows(), 4);
+  ASSERT_EQ(batches[2]->num_rows(), 2);
+
+  // Generate the same JSONs as text, and parse them.
+  PullOptions pull;
+  pull.gen = opts.gen;
+  pull.schema = opts.schema;
+  pull.num_jsons = opts.num_jsons;
+  pull.deterministic = true;
+  pull.first_json = opts.first_json;
+  std::unique_ptr<PullGenerator> gen;
+  ASSERT_TRUE(PullGenerator::Make(pull, &gen).ok());
+  std::vector<std::byte> buffer(64 * 1024);
+  size_t num_jsons = 0;
+  size_t num_bytes = 0;
+  ASSERT_TRUE(
+      gen->GenerateInto(buffer.data(), buffer.size(), &num_jsons, &num_bytes).ok());
+  ASSERT_EQ(num_jsons, opts.num_jsons);
+  auto text = std::string(reinterpret_cast<const char*>(buffer.data()), num_bytes);
+
+  auto expected = ParseJSONs(opts.schema, text);
+  auto truth = arrow::Table::FromRecordBatches(opts.schema, batches).ValueOrDie();
+  ASSERT_TRUE(truth->Equals(*expected));
+}
+
+TEST(GroundTruth, Malformed) {
+  auto schema = arrow::schema({arrow::field("a", arrow::uint64(), false)});
+  std::unique_ptr<RecordBatchAppender> appender;
+  ASSERT_TRUE(RecordBatchAppender::Make(schema, &appender).ok());
+  rapidjson::Document doc;
+  doc.Parse(R"({"b":1})");
+  ASSERT_FALSE(appender->Append(doc).ok());
+  doc.Parse(R"({"a":"1"})");
+  ASSERT_FALSE(appender->Append(doc).ok());
+  doc.Parse(R"([1])");
+  ASSERT_FALSE(appender->Append(doc).ok());
+}
+
+/// Removes some files when it goes out of scope, also when a test fails.
+struct RemoveFiles {
+  ~RemoveFiles() {
+    for (const auto& path : paths) {
+      std::error_code error;
+      std::filesystem::remove(path, error);
+    }
+  }
+  std::vector<std::string> paths;
+};
+
+TEST(GroundTruth, File) {
+  auto name = ::testing::TempDir() + "illex_" +
+              ::testing::UnitTest::GetInstance()->current_test_info()->name();
+  FileOptions opts;
+  opts.production.gen = GenerateOptions(0);
+  opts.production.schema = KitchenSinkSchema();
+  opts.production.num_jsons = 8;
+  opts.production.num_batches = 4;
+  opts.production.batching = true;
+  // Multiple threads must produce the JSONs in the order of the ground truth.
+  opts.production.num_threads = 3;
+  opts.out_path = name + ".jsonl";
+  opts.arrow_path = name + ".arrow";
+  RemoveFiles outputs{{opts.out_path, opts.arrow_path}};
+  ASSERT_TRUE(RunFile(opts).ok());
+  ASSERT_TRUE(std::filesystem::exists(opts.out_path));
+  ASSERT_TRUE(std::filesystem::exists(opts.arrow_path));
+
+  auto ifs = std::ifstream(opts.out_path);
+  std::string jsons((std::istreambuf_iterator<char>(ifs)),
+                    std::istreambuf_iterator<char>());
+  auto expected = ParseJSONs(opts.production.schema, jsons);
+  ASSERT_EQ(expected->num_rows(), 32);
+  auto truth = ReadTable(opts.production.schema, opts.arrow_path);
+  ASSERT_TRUE(truth->Equals(*expected));
+}
+
+}  // namespace illex::test
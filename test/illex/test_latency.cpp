@@ -0,0 +1,122 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "illex/latency.h"
+
+namespace illex::test {
+
+TEST(Latency, Buckets) {
+  // Small values are exact.
+  for (uint64_t v = 0; v < LatencyHistogram::kSubBuckets; v++) {
+    ASSERT_EQ(LatencyHistogram::BucketIndex(v), v);
+  }
+  // Every value lies within its bucket, and buckets are contiguous.
+  for (uint64_t v : {128ul, 129ul, 1000ul, 123456789ul, UINT64_MAX}) {
+    auto i = LatencyHistogram::BucketIndex(v);
+    ASSERT_LT(i, LatencyHistogram::kNumBuckets);
+    ASSERT_LE(LatencyHistogram::BucketLowest(i), v);
+    ASSERT_GE(LatencyHistogram::BucketHighest(i), v);
+    if (i + 1 < LatencyHistogram::kNumBuckets) {
+      ASSERT_EQ(LatencyHistogram::BucketLowest(i + 1),
+                LatencyHistogram::BucketHighest(i) + 1);
+    }
+  }
+}
+
+TEST(Latency, Percentiles) {
+  LatencyHistogram h;
+  for (uint64_t v = 1; v <= 10000; v++) {
+    h.Record(v * 1000);
+  }
+  ASSERT_EQ(h.count(), 10000);
+  ASSERT_EQ(h.min(), 1000);
+  ASSERT_EQ(h.max(), 10000000);
+  // Percentiles are within the relative precision of a bucket.
+  auto near = [](uint64_t value, double expected) {
+    return std::abs(static_cast<double>(value) - expected) <=
+           expected / LatencyHistogram::kSubBuckets;
+  };
+  ASSERT_TRUE(near(h.Percentile(50.0), 5E6));
+  ASSERT_TRUE(near(h.Percentile(99.0), 9.9E6));
+  ASSERT_TRUE(near(h.Percentile(99.9), 9.99E6));
+  ASSERT_EQ(h.Percentile(100.0), 10000000);
+}
+
+TEST(Latency, Recorder) {
+  LatencyRecorder recorder(2);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+      for (uint64_t i = 0; i < 1000; i++) {
+        recorder.Record(t % 2, 100 + t);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto stage0 = recorder.Snapshot(0);
+  ASSERT_EQ(stage0.count(), 2000);
+  ASSERT_EQ(stage0.min(), 100);
+  ASSERT_EQ(stage0.max(), 102);
+  ASSERT_EQ(recorder.Snapshot(1).count(), 2000);
+
+  std::stringstream ss;
+  recorder.Print(&ss);
+  ASSERT_NE(ss.str().find("p99.9"), std::string::npos);
+}
+
+TEST(Latency, TrackerRecordsIntervals) {
+  LatencyRecorder recorder(1);
+  LatencyTracker tracker(4, 2, 1);
+  tracker.SetRecorder(&recorder);
+  auto start = Timer::now();
+  for (size_t seq = 0; seq < 100; seq++) {
+    tracker.Put(seq, 0, start);
+    tracker.Put(seq, 1, start + std::chrono::microseconds(seq));
+  }
+  // All intervals are recorded, even though the tracker wrapped around.
+  auto h = recorder.Snapshot(0);
+  ASSERT_EQ(h.count(), 100);
+  ASSERT_EQ(h.max(), 99000);
+}
+
+TEST(Latency, TrackerSkipsStaleTimePoints) {
+  LatencyRecorder recorder(1);
+  LatencyTracker tracker(2, 2, 1);
+  tracker.SetRecorder(&recorder);
+  auto start = Timer::now();
+  ASSERT_TRUE(tracker.Put(0, 0, start));
+  // Sequence number 2 takes over the sample of 0, and clears it.
+  ASSERT_TRUE(tracker.Put(2, 1, start + std::chrono::microseconds(2)));
+  ASSERT_EQ(tracker.Get(0, 0), TimePoint());
+  // A late time point of 0 is not paired with the time points of 2.
+  ASSERT_FALSE(tracker.Put(0, 1, start + std::chrono::microseconds(1)));
+  ASSERT_EQ(tracker.Get(0, 1), start + std::chrono::microseconds(2));
+  ASSERT_EQ(recorder.Snapshot(0).count(), 0);
+  // Stages of the same sequence number are still paired.
+  ASSERT_TRUE(tracker.Put(4, 0, start));
+  ASSERT_TRUE(tracker.Put(4, 1, start + std::chrono::microseconds(4)));
+  ASSERT_EQ(recorder.Snapshot(0).count(), 1);
+  ASSERT_EQ(recorder.Snapshot(0).max(), 4000);
+}
+
+}  // namespace illex::test
@@ -0,0 +1,180 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <array>
+#include <chrono>
+#include <kissnet.hpp>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "illex/metrics.h"
+
+namespace illex::test {
+
+using Socket = kissnet::socket<kissnet::protocol::tcp>;
+
+/// Return a port on the loopback interface that is not in use.
+static auto FreePort() -> uint16_t {
+  Socket socket(kissnet::endpoint("127.0.0.1:0"));
+  socket.bind();
+  sockaddr_in address{};
+  socklen_t length = sizeof(address);
+  getsockname(socket.get_native(), reinterpret_cast<sockaddr*>(&address), &length);
+  socket.close();
+  return ntohs(address.sin_port);
+}
+
+/// Request a path from a metrics endpoint, and return the response or an empty string.
+static auto Scrape(uint16_t port, const std::string& path) -> std::string {
+  Socket socket(kissnet::endpoint("127.0.0.1:" + std::to_string(port)));
+  if (!socket.connect()) {
+    return "";
+  }
+  auto request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  socket.send(reinterpret_cast<const std::byte*>(request.data()), request.size());
+  // The endpoint closes the connection after every response.
+  std::string response;
+  std::array<std::byte, 4096> buffer{};
+  while (true) {
+    auto [size, status] = socket.recv(buffer.data(), buffer.size());
+    if ((status != kissnet::socket_status::valid) || (size == 0)) {
+      break;
+    }
+    response.append(reinterpret_cast<const char*>(buffer.data()), size);
+  }
+  socket.close();
+  return response;
+}
+
+/// Check the status line and headers of a response, and return its body.
+static auto Body(const std::string& response, const std::string& code,
+                 const std::string& content_type) -> std::string {
+  EXPECT_EQ(response.rfind("HTTP/1.1 " + code + "\r\n", 0), 0) << response;
+  EXPECT_NE(response.find("\r\nContent-Type: " + content_type + "\r\n"),
+            std::string::npos);
+  auto end = response.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    ADD_FAILURE() << "Response has no body: " << response;
+    return "";
+  }
+  auto body = response.substr(end + 4);
+  EXPECT_NE(response.find("\r\nContent-Length: " + std::to_string(body.size()) + "\r\n"),
+            std::string::npos);
+  return body;
+}
+
+TEST(Metrics, Interval) {
+  LiveMetrics live;
+  auto first = MetricsSnapshot::Take(live);
+  LiveMetrics::Add(&live.jsons_sent, 1000);
+  LiveMetrics::Add(&live.bytes_sent, 125000);
+  LiveMetrics::Add(&live.jsons_received, 500);
+  LiveMetrics::AddSeconds(&live.producer_blocked_ns, 0.25);
+  LiveMetrics::AddSeconds(&live.sender_starved_ns, -1.0);
+  live.queue_depth = 3;
+  auto last = MetricsSnapshot::Take(live);
+  last.time = first.time + std::chrono::milliseconds(500);
+
+  auto interval = MetricsInterval::Between(first, last);
+  ASSERT_DOUBLE_EQ(interval.seconds, 0.5);
+  ASSERT_DOUBLE_EQ(interval.jsons_sent_per_second, 2000.0);
+  ASSERT_DOUBLE_EQ(interval.bits_sent_per_second, 2E6);
+  ASSERT_DOUBLE_EQ(interval.jsons_received_per_second, 1000.0);
+  ASSERT_DOUBLE_EQ(interval.producer_blocked, 0.5);
+  // Negative times are never added.
+  ASSERT_DOUBLE_EQ(interval.sender_starved, 0.0);
+  ASSERT_EQ(interval.queue_depth, 3);
+
+  // An empty interval has no rates.
+  interval = MetricsInterval::Between(last, last);
+  ASSERT_DOUBLE_EQ(interval.jsons_sent_per_second, 0.0);
+}
+
+TEST(Metrics, Formats) {
+  LiveMetrics live;
+  LiveMetrics::Add(&live.jsons_sent, 42);
+  auto snapshot = MetricsSnapshot::Take(live);
+  MetricsInterval interval;
+
+  auto text = ToPrometheus(snapshot, interval);
+  ASSERT_NE(text.find("# TYPE illex_jsons_sent_total counter\n"), std::string::npos);
+  ASSERT_NE(text.find("\nillex_jsons_sent_total 42\n"), std::string::npos);
+  ASSERT_NE(text.find("# TYPE illex_queue_depth gauge\n"), std::string::npos);
+
+  auto json = ToJSON(snapshot, interval);
+  ASSERT_EQ(json.front(), '{');
+  ASSERT_EQ(json.back(), '}');
+  ASSERT_NE(json.find("\"jsons_sent\":42,"), std::string::npos);
+}
+
+TEST(Metrics, Reporter) {
+  LiveMetrics live;
+  MetricsOptions opts;
+  ASSERT_FALSE(opts.enabled());
+  opts.interval_ms = 1;
+  ASSERT_TRUE(opts.enabled());
+  opts.port = FreePort();
+  std::unique_ptr<MetricsReporter> reporter;
+  ASSERT_TRUE(MetricsReporter::Start(opts, &live, &reporter).ok());
+  LiveMetrics::Add(&live.jsons_produced, 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  ASSERT_FALSE(Scrape(opts.port, "/metrics").empty());
+  // The port of a running reporter cannot be used by another one.
+  std::unique_ptr<MetricsReporter> other;
+  ASSERT_FALSE(MetricsReporter::Start(opts, &live, &other).ok());
+  reporter->Stop();
+  // Stopping again, e.g. on destruction, has no effect.
+  reporter->Stop();
+  // A stopped reporter no longer serves scrapes, and releases its port.
+  ASSERT_TRUE(Scrape(opts.port, "/metrics").empty());
+  ASSERT_TRUE(MetricsReporter::Start(opts, &live, &other).ok());
+}
+
+TEST(Metrics, Endpoint) {
+  LiveMetrics live;
+  LiveMetrics::Add(&live.jsons_sent, 42);
+  LiveMetrics::Add(&live.bytes_received, 7);
+  MetricsOptions opts;
+  opts.port = FreePort();
+  std::unique_ptr<MetricsReporter> reporter;
+  ASSERT_TRUE(MetricsReporter::Start(opts, &live, &reporter).ok());
+
+  auto text = Body(Scrape(opts.port, "/metrics"), "200 OK", "text/plain; version=0.0.4");
+  ASSERT_EQ(text.rfind("# HELP ", 0), 0);
+  ASSERT_NE(
+      text.find("# TYPE illex_jsons_sent_total counter\nillex_jsons_sent_total 42\n"),
+      std::string::npos);
+  ASSERT_NE(text.find("\nillex_bytes_received_total 7\n"), std::string::npos);
+  ASSERT_NE(text.find("# TYPE illex_queue_depth gauge\n"), std::string::npos);
+  ASSERT_EQ(text.back(), '\n');
+  // The root path serves the same format.
+  ASSERT_EQ(Body(Scrape(opts.port, "/"), "200 OK", "text/plain; version=0.0.4"), text);
+
+  // Every scrape reads the current counters.
+  LiveMetrics::Add(&live.jsons_sent, 8);
+  auto json = Body(Scrape(opts.port, "/metrics.json"), "200 OK", "application/json");
+  ASSERT_EQ(json.front(), '{');
+  ASSERT_EQ(json.back(), '}');
+  ASSERT_NE(json.find("\"jsons_sent\":50,"), std::string::npos);
+  ASSERT_NE(json.find("\"bytes_received\":7,"), std::string::npos);
+
+  Body(Scrape(opts.port, "/other"), "404 Not Found", "text/plain");
+}
+
+}  // namespace illex::test
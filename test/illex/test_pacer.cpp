@@ -0,0 +1,54 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include "illex/pacer.h"
+
+namespace illex::test {
+
+TEST(Pacer, Fits) {
+  PacingOptions opts;
+  opts.jsons_per_second = 1E5;
+  opts.bits_per_second = 8E7;
+  Pacer pacer(opts);
+  // A quantum of 100 us allows for 10 JSONs or 1000 bytes.
+  ASSERT_TRUE(pacer.Fits(10, 1000));
+  ASSERT_FALSE(pacer.Fits(11, 100));
+  ASSERT_FALSE(pacer.Fits(2, 1001));
+  // A single JSON always fits.
+  ASSERT_TRUE(pacer.Fits(1, 1E6));
+}
+
+TEST(Pacer, Rate) {
+  PacingOptions opts;
+  opts.jsons_per_second = 1E4;
+  Pacer pacer(opts);
+  auto start = Pacer::Clock::now();
+  for (size_t i = 0; i < 200; i++) {
+    pacer.Wait(1, 10);
+  }
+  pacer.Stop();
+  auto elapsed = std::chrono::duration<double>(Pacer::Clock::now() - start).count();
+  // The first JSON is sent immediately, the other 199 at 10k JSON/s take 19.9 ms.
+  ASSERT_GE(elapsed, 0.0195);
+  // Scheduling delays may only slow the pacer down, so the achieved rate is bounded from
+  // above by 200 JSONs in 19.9 ms.
+  auto metrics = pacer.metrics();
+  ASSERT_EQ(metrics.num_sends, 200);
+  ASSERT_GT(metrics.jsons_per_second, 0.0);
+  ASSERT_LE(metrics.jsons_per_second, 200 / 0.0199);
+}
+
+}  // namespace illex::test
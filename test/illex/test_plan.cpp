@@ -0,0 +1,143 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <arrow/api.h>
+#include <arrow/util/key_value_metadata.h>
+#include <gtest/gtest.h>
+#include <rapidjson/stringbuffer.h>
+
+#include "illex/arrow.h"
+#include "illex/plan.h"
+#include "illex/value.h"
+
+namespace illex::test {
+
+/// Check whether a plan generates the same JSONs as the tree it was compiled from.
+static void CompareWithTree(const arrow::Schema& schema, int seed, size_t num_jsons) {
+  auto tree = FromArrowSchema(schema, GenerateOptions(seed));
+  auto compiled = FromArrowSchema(schema, GenerateOptions(seed));
+  Plan plan;
+  ASSERT_TRUE(Plan::Compile(*compiled.root(), &plan).ok());
+  for (size_t i = 0; i < num_jsons; i++) {
+    rapidjson::StringBuffer buffer;
+    plan.Write(compiled.context().engine_, &buffer);
+    ASSERT_EQ(std::string(buffer.GetString(), buffer.GetSize()), tree.GetString());
+  }
+}
+
+TEST(Plan, Empty) {
+  auto schema = arrow::Schema({});
+  auto gen = FromArrowSchema(schema, GenerateOptions(0));
+  Plan plan;
+  ASSERT_TRUE(Plan::Compile(*gen.root(), &plan).ok());
+  rapidjson::StringBuffer buffer;
+  plan.Write(gen.context().engine_, &buffer);
+  ASSERT_STREQ(buffer.GetString(), "{}");
+}
+
+TEST(Plan, AllTypes) {
+  auto schema = arrow::Schema(
+      {arrow::field("uint64", arrow::uint64(), false),
+       arrow::field("bool", arrow::boolean(), false),
+       arrow::field("str", arrow::utf8(), false),
+       arrow::field("date", arrow::date64(), false),
+       arrow::field("null", arrow::null(), false),
+       arrow::field("fsl",
+                    arrow::fixed_size_list(arrow::field("item", arrow::uint64(), false),
+                                           3),
+                    false),
+       arrow::field("struct",
+                    arrow::struct_({arrow::field("a", arrow::uint64(), false),
+                                    arrow::field("b", arrow::utf8(), false)}),
+                    false)});
+  CompareWithTree(schema, 0, 64);
+}
+
+TEST(Plan, NestedLists) {
+  // Lists of lists of structs with lists, including empty lists.
+  auto inner = arrow::field(
+      "inner",
+      arrow::struct_({arrow::field("x", arrow::uint64(), false),
+                      arrow::field("y", arrow::list(arrow::field("item", arrow::boolean(),
+                                                                 false)),
+                                   false)}),
+      false);
+  auto list = arrow::field("outer", arrow::list(arrow::field("mid", arrow::list(inner),
+                                                             false)),
+                           false);
+  auto schema = arrow::Schema({list, arrow::field("after", arrow::utf8(), false)});
+  CompareWithTree(schema, 1, 64);
+}
+
+TEST(Plan, EscapedKeys) {
+  auto schema = arrow::Schema({arrow::field("a\"b\\c", arrow::boolean(), false)});
+  CompareWithTree(schema, 2, 4);
+}
+
+TEST(Plan, Fragments) {
+  auto schema = arrow::Schema(
+      {arrow::field("a", arrow::uint64(), false),
+       arrow::field("s",
+                    arrow::struct_({arrow::field("x", arrow::null(), false),
+                                    arrow::field("y", arrow::uint64(), false)}),
+                    false),
+       arrow::field("b", arrow::uint64(), false)});
+  auto gen = FromArrowSchema(schema, GenerateOptions(0));
+  Plan plan;
+  ASSERT_TRUE(Plan::Compile(*gen.root(), &plan).ok());
+  // All constant bytes between the random leaf values are coalesced.
+  const auto& ops = plan.ops();
+  ASSERT_EQ(ops.size(), 7);
+  ASSERT_EQ(plan.literal(ops[0]), R"({"a":)");
+  ASSERT_EQ(ops[1].code, OpCode::UInt64);
+  ASSERT_EQ(plan.literal(ops[2]), R"(,"s":{"x":null,"y":)");
+  ASSERT_EQ(ops[3].code, OpCode::UInt64);
+  ASSERT_EQ(plan.literal(ops[4]), R"(},"b":)");
+  ASSERT_EQ(ops[5].code, OpCode::UInt64);
+  ASSERT_EQ(plan.literal(ops[6]), R"(})");
+  CompareWithTree(schema, 0, 16);
+}
+
+TEST(Plan, Pooled) {
+  auto meta = arrow::key_value_metadata({"illex_POOL_SIZE", "illex_POOL_SKEW"},
+                                        {"4", "1.5"});
+  auto schema = arrow::Schema({arrow::field("str", arrow::utf8(), false, meta),
+                               arrow::field("date", arrow::date64(), false, meta)});
+  CompareWithTree(schema, 3, 64);
+
+  // Every value comes from the pool, and the pool is the same for every seed.
+  auto gen = FromArrowSchema(schema, GenerateOptions(0));
+  auto other = FromArrowSchema(schema, GenerateOptions(1));
+  auto pool = std::static_pointer_cast<Pool>(
+      std::static_pointer_cast<Object>(gen.root())->members()[0].value());
+  auto other_pool = std::static_pointer_cast<Pool>(
+      std::static_pointer_cast<Object>(other.root())->members()[0].value());
+  ASSERT_EQ(pool->offsets().size(), 5);
+  ASSERT_EQ(pool->serialized(), other_pool->serialized());
+  Plan plan;
+  ASSERT_TRUE(Plan::Compile(*gen.root(), &plan).ok());
+  ASSERT_EQ(plan.ops()[1].code, OpCode::Pooled);
+}
+
+TEST(Plan, Uncompilable) {
+  // A generator that does not implement Compile.
+  struct Custom : public Value {
+    auto Get() -> rj::Value override { return rj::Value(rj::kNullType); }
+  };
+  Custom custom;
+  Plan plan;
+  ASSERT_FALSE(Plan::Compile(custom, &plan).ok());
+}
+
+}  // namespace illex::test
@@ -14,9 +14,17 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <future>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "illex/producer.h"
+#include "illex/sender.h"
 
 namespace illex::test {
 
@@ -35,20 +43,328 @@ TEST(Producer, Producer) {
       arrow::schema({arrow::field("test", arrow::uint64(), false)->WithMetadata(meta)});
   std::atomic<bool> shutdown = false;
 
-  ProductionQueue queue(opts.num_batches, 1, 0);
-  ProductionThread(0, opts, opts.num_batches, opts.num_jsons, &queue, &shutdown,
+  ProductionQueue queue(opts.num_batches);
+  BatchPool pool;
+  ProductionShare share{opts.num_batches, opts.num_jsons};
+  ProductionThread(0, opts, share, &queue, nullptr, &pool, &shutdown,
                    std::move(metrics));
   JSONBatch test;
   // Pull all batches from the queue.
   for (size_t i = 0; i < opts.num_batches; i++) {
-    ASSERT_TRUE(queue.try_dequeue(test));
+    ASSERT_TRUE(queue.TryDequeue(&test));
+    ASSERT_EQ(test.num_jsons, opts.num_jsons);
+    ASSERT_EQ(test.data().substr(0, strlen("{\"test\":")), "{\"test\":");
+    pool.Release(&test);
+    ASSERT_EQ(test.buffer, nullptr);
   }
 
   // And if it returned the right number of produced bytes.
   ASSERT_EQ(metrics_f.get().num_chars,
             opts.num_batches * opts.num_jsons * strlen("{\"test\":0}\n"));
 
-  ASSERT_FALSE(queue.try_dequeue(test));
+  ASSERT_FALSE(queue.TryDequeue(&test));
+}
+
+TEST(Producer, Framed) {
+  ProducerOptions opts;
+  opts.num_batches = 2;
+  opts.num_jsons = 3;
+  opts.pretty = true;
+  opts.frame = true;
+  opts.schema = arrow::schema(
+      {arrow::field("a", arrow::null(), false), arrow::field("b", arrow::null(), false)});
+  std::promise<ProductionMetrics> metrics;
+
+  ProductionQueue queue(opts.num_batches);
+  ProductionShare share{opts.num_batches, opts.num_jsons};
+  std::atomic<bool> shutdown = false;
+  ProductionThread(0, opts, share, &queue, nullptr, nullptr, &shutdown,
+                   std::move(metrics));
+
+  const std::string json = "{\n    \"a\": null,\n    \"b\": null\n}\n";
+  JSONBatch batch;
+  ASSERT_TRUE(queue.TryDequeue(&batch));
+  ASSERT_TRUE(batch.framed);
+  ASSERT_EQ(batch.jsons(), json + json + json);
+
+  // The header holds the length of every pretty-printed JSON.
+  frame::Header header{};
+  std::memcpy(&header, batch.data().data(), sizeof(header));
+  std::vector<uint32_t> lengths(header.num_jsons);
+  std::memcpy(lengths.data(), batch.data().data() + sizeof(header),
+              lengths.size() * sizeof(uint32_t));
+  ASSERT_EQ(header.num_jsons, 3);
+  ASSERT_TRUE(frame::Valid(header, lengths.data()));
+  ASSERT_EQ(lengths[0], json.size());
+
+  // The sequence number is filled in when sending.
+  StampBatch(&batch, 42, 0);
+  std::memcpy(&header, batch.data().data(), sizeof(header));
+  ASSERT_EQ(header.seq, 42);
+
+  // Frames need a whitespace after every JSON.
+  opts.whitespace = false;
+  std::shared_ptr<Producer> producer;
+  ASSERT_FALSE(Producer::Make(opts, &queue, nullptr, &producer).ok());
+}
+
+TEST(Producer, ByteSized) {
+  ProducerOptions opts;
+  opts.num_jsons = 100;
+  opts.batch_bytes = 64;
+  opts.frame = true;
+  opts.schema = arrow::schema(
+      {arrow::field("a", arrow::null(), false), arrow::field("b", arrow::null(), false)});
+  std::promise<ProductionMetrics> metrics;
+  auto metrics_f = metrics.get_future();
+
+  // Every batch holds at least one JSON, so the queue can hold all of them.
+  ProductionQueue queue(opts.num_jsons);
+  std::atomic<bool> shutdown = false;
+  ProductionThread(0, opts, ThreadShare(opts, 0), &queue, nullptr, nullptr, &shutdown,
+                   std::move(metrics));
+
+  size_t num_jsons = 0;
+  size_t num_batches = 0;
+  JSONBatch batch;
+  while (queue.TryDequeue(&batch)) {
+    frame::Header header{};
+    std::memcpy(&header, batch.data().data(), sizeof(header));
+    ASSERT_EQ(header.num_jsons, batch.num_jsons);
+    std::vector<uint32_t> lengths(header.num_jsons);
+    std::memcpy(lengths.data(), batch.data().data() + sizeof(header),
+                lengths.size() * sizeof(uint32_t));
+    ASSERT_TRUE(frame::Valid(header, lengths.data()));
+    // Every batch but the last reached the target, by less than its last JSON.
+    auto jsons = batch.jsons();
+    if (num_jsons + batch.num_jsons < opts.num_jsons) {
+      ASSERT_GE(jsons.size(), opts.batch_bytes);
+      ASSERT_LT(jsons.size() - lengths.back(), opts.batch_bytes);
+    }
+    ASSERT_EQ(jsons.back(), '\n');
+    num_jsons += batch.num_jsons;
+    num_batches++;
+  }
+  // The total number of JSONs is exact.
+  ASSERT_EQ(num_jsons, opts.num_jsons);
+  ASSERT_EQ(metrics_f.get().num_batches, num_batches);
+
+  // Batches of threads that run ahead cannot be ordered by their index.
+  opts.num_threads = 2;
+  opts.ordered = true;
+  std::shared_ptr<Producer> producer;
+  ASSERT_FALSE(Producer::Make(opts, &queue, nullptr, &producer).ok());
+
+  // Producers need room for at least one batch in the queue.
+  opts.num_threads = 1;
+  opts.queue_capacity = 0;
+  ASSERT_FALSE(Producer::Make(opts, &queue, nullptr, &producer).ok());
+}
+
+TEST(Producer, BatchSizer) {
+  BatchSizer fixed(1024, false);
+  fixed.Observe(0, 8);
+  ASSERT_EQ(fixed.target(), 1024);
+
+  // Batches shrink while the queue is empty, and grow back while it is full.
+  BatchSizer sizer(1024, true);
+  for (int i = 0; i < 16; i++) {
+    sizer.Observe(0, 8);
+  }
+  ASSERT_EQ(sizer.target(), 1024 / kAdaptiveBatchRange);
+  for (int i = 0; i < 16; i++) {
+    sizer.Observe(8, 8);
+  }
+  ASSERT_EQ(sizer.target(), 1024);
+}
+
+/// Produce all JSONs with some number of threads, and return them in queue order.
+static auto Produce(ProducerOptions opts, size_t num_threads,
+                    std::vector<size_t>* indices = nullptr) -> std::vector<std::string> {
+  opts.num_threads = num_threads;
+  ProductionQueue queue(TotalJSONs(opts));
+  std::shared_ptr<Producer> producer;
+  std::atomic<bool> shutdown = false;
+  EXPECT_TRUE(Producer::Make(opts, &queue, nullptr, &producer).ok());
+  EXPECT_TRUE(producer->Start(&shutdown).ok());
+  EXPECT_TRUE(producer->Finish().ok());
+
+  std::vector<std::string> result;
+  JSONBatch batch;
+  while (queue.TryDequeue(&batch)) {
+    if (indices != nullptr) {
+      indices->push_back(batch.index);
+    }
+    auto data = batch.data();
+    size_t start = 0;
+    for (size_t end = data.find('\n'); end != std::string_view::npos;
+         end = data.find('\n', start)) {
+      result.emplace_back(data.substr(start, end - start));
+      start = end + 1;
+    }
+  }
+  return result;
+}
+
+/// Produce all JSONs with some number of threads, and return them sorted.
+static auto ProduceSorted(const ProducerOptions& opts, size_t num_threads)
+    -> std::vector<std::string> {
+  auto result = Produce(opts, num_threads);
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+TEST(Producer, Deterministic) {
+  ProducerOptions opts;
+  opts.gen.seed = 0;
+  opts.deterministic = true;
+  opts.batching = true;
+  opts.num_batches = 7;
+  opts.num_jsons = 3;
+
+  std::vector<std::string> keys = {"illex_MIN_LENGTH", "illex_MAX_LENGTH"};
+  std::vector<std::string> values = {"32", "32"};
+  auto meta = std::make_shared<arrow::KeyValueMetadata>(keys, values);
+  opts.schema =
+      arrow::schema({arrow::field("test", arrow::utf8(), false)->WithMetadata(meta)});
+
+  auto expected = ProduceSorted(opts, 1);
+  ASSERT_EQ(expected.size(), 21);
+  ASSERT_EQ(ProduceSorted(opts, 3), expected);
+
+  // Partitions together produce the same JSONs as well.
+  std::vector<std::string> parts;
+  for (size_t p = 0; p < 2; p++) {
+    auto part = ProduceSorted(PartitionProduction(opts, p, 2), 2);
+    parts.insert(parts.end(), part.begin(), part.end());
+  }
+  std::sort(parts.begin(), parts.end());
+  ASSERT_EQ(parts, expected);
+
+  // Without batching too.
+  opts.batching = false;
+  opts.num_jsons = 10;
+  ASSERT_EQ(ProduceSorted(opts, 4), ProduceSorted(opts, 1));
+}
+
+TEST(Producer, Ordered) {
+  ProducerOptions opts;
+  opts.gen.seed = 0;
+  opts.deterministic = true;
+  opts.ordered = true;
+  opts.reorder_window = 2;
+  opts.batching = true;
+  opts.num_batches = 16;
+  opts.num_jsons = 2;
+  opts.schema = arrow::schema({arrow::field("test", arrow::utf8(), false)});
+
+  std::vector<size_t> indices;
+  auto expected = Produce(opts, 1);
+  ASSERT_EQ(Produce(opts, 4, &indices), expected);
+  ASSERT_EQ(indices.size(), opts.num_batches);
+  for (size_t i = 0; i < indices.size(); i++) {
+    ASSERT_EQ(indices[i], i);
+  }
+}
+
+TEST(Producer, ReorderBuffer) {
+  ProductionQueue queue(4);
+  ReorderBuffer reorder(3);
+  std::atomic<bool> shutdown = false;
+  double blocked = 0.0;
+
+  ASSERT_TRUE(reorder.Admit(2, shutdown, &blocked));
+  ASSERT_TRUE(reorder.Insert(JSONBatch{nullptr, 1, 2}, &queue, shutdown, &blocked));
+  ASSERT_TRUE(reorder.Insert(JSONBatch{nullptr, 1, 1}, &queue, shutdown, &blocked));
+  // Nothing is enqueued until the first batch arrives.
+  JSONBatch batch;
+  ASSERT_FALSE(queue.TryDequeue(&batch));
+
+  // Index 3 falls outside of the window, until the first batch is inserted.
+  std::atomic<bool> stop = true;
+  ASSERT_FALSE(reorder.Admit(3, stop, &blocked));
+  ASSERT_TRUE(reorder.Insert(JSONBatch{nullptr, 1, 0}, &queue, shutdown, &blocked));
+  ASSERT_TRUE(reorder.Admit(3, shutdown, &blocked));
+
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(queue.TryDequeue(&batch));
+    ASSERT_EQ(batch.index, i);
+  }
+  ASSERT_FALSE(queue.TryDequeue(&batch));
+
+  // A thread waiting for admission is woken up once its batch falls within the window.
+  std::promise<void> waiting;
+  auto admitter = std::thread([&]() {
+    waiting.set_value();
+    ASSERT_TRUE(reorder.Admit(6, shutdown, &blocked));
+  });
+  waiting.get_future().wait();
+  ASSERT_TRUE(reorder.Insert(JSONBatch{nullptr, 1, 3}, &queue, shutdown, &blocked));
+  admitter.join();
+}
+
+TEST(Producer, ReorderBufferFullQueue) {
+  ProductionQueue queue(1);
+  ReorderBuffer reorder(4);
+  std::atomic<bool> shutdown = false;
+  double blocked = 0.0;
+  double starved = 0.0;
+
+  ASSERT_TRUE(reorder.Insert(JSONBatch{nullptr, 1, 0}, &queue, shutdown, &blocked));
+  // The queue is full, so this thread waits for room to enqueue the second batch.
+  std::promise<void> inserting;
+  auto inserter = std::thread([&]() {
+    inserting.set_value();
+    ASSERT_TRUE(reorder.Insert(JSONBatch{nullptr, 1, 1}, &queue, shutdown, &blocked));
+  });
+  inserting.get_future().wait();
+  // Other threads can still insert their batches.
+  ASSERT_TRUE(reorder.Insert(JSONBatch{nullptr, 1, 2}, &queue, shutdown, &blocked));
+
+  JSONBatch batch;
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(queue.Dequeue(&batch, std::chrono::seconds(10), &starved));
+    ASSERT_EQ(batch.index, i);
+  }
+  inserter.join();
+  ASSERT_FALSE(queue.TryDequeue(&batch));
+}
+
+TEST(Producer, BoundedQueue) {
+  ProductionQueue queue(1);
+  std::atomic<bool> shutdown = false;
+  double blocked = 0.0;
+  double starved = 0.0;
+  JSONBatch batch;
+  ASSERT_TRUE(queue.Enqueue(JSONBatch{nullptr, 1}, shutdown, &blocked));
+  // The queue is full, so enqueueing blocks until shutdown is signaled.
+  auto waiter = std::thread([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    shutdown.store(true);
+  });
+  ASSERT_FALSE(queue.Enqueue(JSONBatch{nullptr, 2}, shutdown, &blocked));
+  waiter.join();
+  ASSERT_GT(blocked, 0.0);
+  // Dequeueing frees a slot.
+  ASSERT_TRUE(queue.Dequeue(&batch, std::chrono::microseconds(0), &starved));
+  ASSERT_EQ(batch.num_jsons, 1);
+  ASSERT_FALSE(queue.Dequeue(&batch, std::chrono::microseconds(1000), &starved));
+  ASSERT_GT(starved, 0.0);
+  shutdown.store(false);
+  ASSERT_TRUE(queue.Enqueue(JSONBatch{nullptr, 3}, shutdown, &blocked));
+}
+
+TEST(Producer, BatchPool) {
+  BatchPool pool;
+  auto buffer = pool.Acquire();
+  buffer->Put('x');
+  auto* address = buffer.get();
+  JSONBatch batch = {std::move(buffer), 1};
+  pool.Release(&batch);
+  // Released buffers are recycled, and handed out empty.
+  auto recycled = pool.Acquire();
+  ASSERT_EQ(recycled.get(), address);
+  ASSERT_EQ(recycled->GetSize(), 0);
 }
 
 }  // namespace illex::test
\ No newline at end of file
@@ -0,0 +1,105 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <arrow/api.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "illex/arrow.h"
+#include "illex/plan.h"
+#include "illex/pull.h"
+
+namespace illex::test {
+
+static auto TestSchema() -> std::shared_ptr<arrow::Schema> {
+  auto item = arrow::field("item", arrow::utf8(), false);
+  return arrow::schema({arrow::field("a", arrow::uint64(), false),
+                        arrow::field("b", arrow::list(item), false)});
+}
+
+/// Generate JSONs into a string buffer through a plan, one after another.
+static auto Expected(const PullOptions& opts, size_t num_jsons) -> std::string {
+  auto gen = FromArrowSchema(*opts.schema, opts.gen);
+  Plan plan;
+  EXPECT_TRUE(Plan::Compile(*gen.root(), &plan).ok());
+  rapidjson::StringBuffer buffer;
+  for (size_t i = 0; i < num_jsons; i++) {
+    plan.Write(gen.context().engine_, &buffer);
+    buffer.Put(opts.whitespace_char);
+  }
+  return std::string(buffer.GetString(), buffer.GetSize());
+}
+
+TEST(Pull, GenerateInto) {
+  PullOptions opts;
+  opts.gen = GenerateOptions(0);
+  opts.schema = TestSchema();
+  opts.num_jsons = 100;
+  std::unique_ptr<PullGenerator> gen;
+  ASSERT_TRUE(PullGenerator::Make(opts, &gen).ok());
+
+  // JSONs that do not fit are held back for the next buffer, so concatenating all
+  // buffers yields the same JSONs as generating them one after another.
+  std::string result;
+  std::vector<std::byte> buffer(1024);
+  size_t num_jsons = 0;
+  while (!gen->done()) {
+    size_t jsons = 0;
+    size_t bytes = 0;
+    ASSERT_TRUE(gen->GenerateInto(buffer.data(), buffer.size(), &jsons, &bytes).ok());
+    ASSERT_GT(jsons, 0);
+    ASSERT_EQ(static_cast<char>(buffer[bytes - 1]), '\n');
+    result.append(reinterpret_cast<const char*>(buffer.data()), bytes);
+    num_jsons += jsons;
+  }
+  ASSERT_EQ(num_jsons, 100);
+  ASSERT_EQ(gen->num_jsons(), 100);
+  ASSERT_EQ(result, Expected(opts, 100));
+
+  // A buffer that cannot hold a single JSON is an error.
+  gen->Reset(0, 0);
+  size_t jsons = 0;
+  ASSERT_FALSE(gen->GenerateInto(buffer.data(), 2, &jsons).ok());
+}
+
+TEST(Pull, Parallel) {
+  PullOptions opts;
+  opts.gen = GenerateOptions(4);
+  opts.schema = TestSchema();
+  opts.num_jsons = 16;
+  std::vector<std::vector<std::byte>> memory(8, std::vector<std::byte>(1 << 16));
+  std::vector<Region> regions;
+  for (auto& m : memory) {
+    regions.push_back({m.data(), m.size()});
+  }
+  ASSERT_TRUE(GenerateParallel(opts, &regions, 3).ok());
+  for (size_t r = 0; r < regions.size(); r++) {
+    ASSERT_EQ(regions[r].num_jsons, 16);
+    auto region_opts = opts;
+    region_opts.gen.seed += static_cast<int>(r);
+    ASSERT_EQ(std::string(reinterpret_cast<const char*>(regions[r].data),
+                          regions[r].num_bytes),
+              Expected(region_opts, 16));
+  }
+
+  // Deterministic regions must have a limited number of JSONs.
+  opts.deterministic = true;
+  opts.num_jsons = std::numeric_limits<size_t>::max();
+  ASSERT_FALSE(GenerateParallel(opts, &regions, 2).ok());
+}
+
+}  // namespace illex::test
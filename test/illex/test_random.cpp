@@ -0,0 +1,145 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "illex/random.h"
+#include "illex/value.h"
+
+namespace illex::test {
+
+static const RandomAlgorithm kAlgorithms[] = {
+    RandomAlgorithm::Xoshiro256pp, RandomAlgorithm::PCG64, RandomAlgorithm::Wyrand,
+    RandomAlgorithm::Ranlux48};
+
+TEST(Random, FillMatchesDraws) {
+  for (auto algorithm : kAlgorithms) {
+    RandomEngine a(42, algorithm);
+    RandomEngine b(42, algorithm);
+    std::vector<uint64_t> values(100);
+    a.Fill(values.data(), values.size());
+    for (auto value : values) {
+      ASSERT_EQ(value, b());
+    }
+  }
+}
+
+TEST(Random, Reseed) {
+  for (auto algorithm : kAlgorithms) {
+    RandomEngine engine(1, algorithm);
+    auto first = engine();
+    engine();
+    engine.seed(1);
+    ASSERT_EQ(engine(), first);
+  }
+}
+
+TEST(Random, Counter) {
+  for (auto algorithm : kAlgorithms) {
+    RandomEngine a(0, algorithm);
+    RandomEngine b(0, algorithm);
+    a.seed(7, 1000);
+    b();
+    b.seed(7, 1000);
+    auto value = a();
+    ASSERT_EQ(value, b());
+    // Neighbouring counters and other seeds give other values.
+    b.seed(7, 1001);
+    ASSERT_NE(value, b());
+    b.seed(8, 1000);
+    ASSERT_NE(value, b());
+  }
+}
+
+TEST(Random, FillChars) {
+  for (auto algorithm : kAlgorithms) {
+    RandomEngine engine(0, algorithm);
+    // Not a multiple of the block or word size.
+    std::string chars(1000, '\0');
+    engine.FillChars(chars.data(), chars.size(), 'a', 'z');
+    std::vector<size_t> counts(26);
+    for (auto c : chars) {
+      ASSERT_GE(c, 'a');
+      ASSERT_LE(c, 'z');
+      counts[c - 'a']++;
+    }
+    for (auto count : counts) {
+      ASSERT_GT(count, 0);
+    }
+  }
+}
+
+TEST(Random, Split) {
+  UniformIntDistribution<int8_t> dist(-12, 12);
+  RandomEngine engine;
+  std::vector<size_t> counts(25);
+  for (size_t i = 0; i < 1000; i++) {
+    auto bits = engine();
+    for (size_t j = 0; j < 4; j++) {
+      auto value = dist.Split(&bits);
+      ASSERT_GE(value, -12);
+      ASSERT_LE(value, 12);
+      counts[value + 12]++;
+    }
+  }
+  for (auto count : counts) {
+    ASSERT_GT(count, 0);
+  }
+  // The full range passes the bits through.
+  UniformIntDistribution<uint64_t> full;
+  uint64_t bits = 1234;
+  ASSERT_EQ(full.Split(&bits), 1234);
+}
+
+TEST(Random, Zipf) {
+  RandomEngine engine;
+  std::vector<size_t> counts(8);
+  ZipfDistribution zipf(counts.size(), 1.0);
+  for (size_t i = 0; i < 10000; i++) {
+    auto index = zipf(engine);
+    ASSERT_LT(index, counts.size());
+    counts[index]++;
+  }
+  // Lower indices are drawn more often, with a frequency inverse to their rank.
+  for (size_t i = 1; i < counts.size(); i++) {
+    ASSERT_GT(counts[i], 0);
+    ASSERT_GT(counts[i - 1], counts[i]);
+  }
+  ASSERT_NEAR(static_cast<double>(counts[0]) / counts[1], 2.0, 0.3);
+  // Without skew, only the uniform distribution is used.
+  ZipfDistribution uniform(counts.size());
+  ASSERT_EQ(uniform.n(), counts.size());
+  for (size_t i = 0; i < 100; i++) {
+    ASSERT_LT(uniform(engine), counts.size());
+  }
+  // A skew that is not a number also picks indices uniformly.
+  ZipfDistribution nan(counts.size(), std::numeric_limits<double>::quiet_NaN());
+  for (size_t i = 0; i < 100; i++) {
+    ASSERT_LT(nan(engine), counts.size());
+  }
+}
+
+TEST(Random, ParseAlgorithm) {
+  RandomAlgorithm algorithm;
+  ASSERT_TRUE(ParseRandomAlgorithm("pcg64", &algorithm));
+  ASSERT_EQ(algorithm, RandomAlgorithm::PCG64);
+  ASSERT_FALSE(ParseRandomAlgorithm("mt19937", &algorithm));
+}
+
+}  // namespace illex::test
@@ -0,0 +1,109 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <arrow/api.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "illex/replay.h"
+
+namespace illex::test {
+
+TEST(Replay, Map) {
+  // Write JSONs spanning multiple segments, of which the last is not terminated.
+  std::string path = testing::TempDir() + "illex_replay_map.jsonl";
+  const std::string json = "{\"a\":" + std::string(100, '1') + "}";
+  const size_t num_jsons = 2 * ReplayData::kSegmentSize / json.length() + 1;
+  {
+    std::ofstream ofs(path);
+    for (size_t i = 0; i < num_jsons; i++) {
+      ofs << json;
+      if (i + 1 < num_jsons) {
+        ofs << '\n';
+      }
+    }
+  }
+
+  ReplayData data;
+  ASSERT_TRUE(ReplayData::Map(path, &data).ok());
+  ASSERT_EQ(data.num_jsons(), num_jsons);
+  ASSERT_GE(data.segments().size(), 3);
+
+  // Segments must be contiguous, and only contain complete JSONs.
+  size_t offset = 0;
+  size_t total = 0;
+  for (const auto& segment : data.segments()) {
+    ASSERT_EQ(segment.offset, offset);
+    ASSERT_LE(segment.length, ReplayData::kSegmentSize);
+    auto bytes = data.data().substr(segment.offset, segment.length);
+    ASSERT_EQ(bytes.front(), '{');
+    ASSERT_EQ(bytes.length() % (json.length() + 1) == 0, bytes.back() == '\n');
+    offset += segment.length;
+    total += segment.num_jsons;
+  }
+  ASSERT_EQ(offset, data.data().length());
+  ASSERT_EQ(total, num_jsons);
+  // The last JSON is terminated, so it does not run into the next repeat.
+  ASSERT_EQ(data.data().length(), num_jsons * (json.length() + 1));
+  ASSERT_EQ(data.data().back(), '\n');
+
+  std::remove(path.c_str());
+}
+
+TEST(Replay, MapEmptyLines) {
+  // Empty lines are not JSONs, as clients do not count them either.
+  std::string path = testing::TempDir() + "illex_replay_empty_lines.jsonl";
+  {
+    std::ofstream ofs(path);
+    ofs << "\n{\"a\":1}\n\n\n{\"a\":2}\n\n{\"a\":3}";
+  }
+  ReplayData data;
+  ASSERT_TRUE(ReplayData::Map(path, &data).ok());
+  ASSERT_EQ(data.num_jsons(), 3);
+  ASSERT_EQ(data.segments().size(), 1);
+  ASSERT_EQ(data.segments()[0].num_jsons, 3);
+  std::remove(path.c_str());
+}
+
+TEST(Replay, Generate) {
+  ProducerOptions opts;
+  opts.num_jsons = 1000;
+  opts.num_threads = 2;
+  opts.schema = arrow::schema({arrow::field("a", arrow::null(), false)});
+  ReplayData data;
+  ASSERT_TRUE(ReplayData::Generate(opts, &data).ok());
+  ASSERT_EQ(data.num_jsons(), opts.num_jsons);
+  ASSERT_GT(data.fd(), 0);
+
+  // Every JSON is terminated, so the data can be sent back to back.
+  auto bytes = data.data();
+  ASSERT_EQ(bytes.back(), '\n');
+  auto num_newlines = std::count(bytes.begin(), bytes.end(), '\n');
+  ASSERT_EQ(static_cast<size_t>(num_newlines), opts.num_jsons);
+
+  // Pretty-printed JSONs cannot be replayed.
+  opts.pretty = true;
+  ASSERT_FALSE(ReplayData::Generate(opts, &data).ok());
+}
+
+TEST(Replay, MapMissing) {
+  ReplayData data;
+  ASSERT_FALSE(ReplayData::Map(testing::TempDir() + "illex_replay_missing", &data).ok());
+}
+
+}  // namespace illex::test
@@ -0,0 +1,143 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "illex/protocol.h"
+#include "illex/sender.h"
+
+namespace illex::test {
+
+TEST(Sender, Coalesce) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  // Receive everything on the other end.
+  std::string received;
+  std::thread receiver([&]() {
+    char buf[4096];
+    ssize_t bytes = 0;
+    while ((bytes = read(fds[1], buf, sizeof(buf))) > 0) {
+      received.append(buf, bytes);
+    }
+  });
+
+  BatchPool pool;
+  BatchSender sender;
+  ASSERT_TRUE(BatchSender::Create(fds[0], SenderOptions(), &pool, &sender).ok());
+
+  std::string expected;
+  std::vector<JSONBatch> batches;
+  for (size_t i = 0; i < 4; i++) {
+    auto buffer = pool.Acquire();
+    auto json = "{\"batch\":" + std::to_string(i) + "}\n";
+    for (auto c : json) {
+      buffer->Put(c);
+    }
+    expected += json;
+    batches.push_back(JSONBatch{std::move(buffer), 1});
+  }
+
+  ASSERT_TRUE(sender.Send(&batches).ok());
+  ASSERT_TRUE(sender.Flush().ok());
+  ASSERT_TRUE(batches.empty());
+  // All four batches are sent with a single call.
+  ASSERT_EQ(sender.metrics().num_sends, 1);
+  ASSERT_EQ(sender.metrics().num_bytes, expected.length());
+
+  close(fds[0]);
+  receiver.join();
+  close(fds[1]);
+  ASSERT_EQ(received, expected);
+}
+
+TEST(Sender, SendFile) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+
+  std::string received;
+  std::thread receiver([&]() {
+    char buf[4096];
+    ssize_t bytes = 0;
+    while ((bytes = read(fds[1], buf, sizeof(buf))) > 0) {
+      received.append(buf, bytes);
+    }
+  });
+
+  std::string path = testing::TempDir() + "illex_sender_sendfile.jsonl";
+  std::string contents = "{\"a\":0}\n{\"a\":1}\n{\"a\":2}\n";
+  std::ofstream(path) << contents;
+  FILE* file = std::fopen(path.c_str(), "r");
+  ASSERT_NE(file, nullptr);
+
+  BatchSender sender;
+  ASSERT_TRUE(BatchSender::Create(fds[0], SenderOptions(), nullptr, &sender).ok());
+  // Send the middle JSON from the file, and the first one from memory.
+  ASSERT_TRUE(sender.SendFile(fileno(file), 8, 8).ok());
+  ASSERT_TRUE(sender.Send(std::string_view(contents).substr(0, 8), 1).ok());
+  ASSERT_TRUE(sender.Flush().ok());
+  ASSERT_EQ(sender.metrics().num_bytes, 16);
+
+  close(fds[0]);
+  receiver.join();
+  close(fds[1]);
+  std::fclose(file);
+  std::remove(path.c_str());
+  ASSERT_EQ(received, "{\"a\":1}\n{\"a\":0}\n");
+}
+
+TEST(Sender, StampBatch) {
+  BatchPool pool;
+  auto buffer = pool.Acquire();
+  std::vector<size_t> stamps;
+  for (size_t i = 0; i < 4; i++) {
+    std::string json = "{\"json\":" + std::to_string(i);
+    for (auto c : json) {
+      buffer->Put(c);
+    }
+    stamps.push_back(buffer->GetSize());
+    stamp::WriteEmpty(buffer->Push(stamp::kSize));
+    buffer->Put('\n');
+  }
+  JSONBatch batch{std::move(buffer), 4, 0, std::move(stamps)};
+
+  // Sequence numbers 10 to 13, so only 10 and 12 are stamped.
+  StampBatch(&batch, 10, 2);
+
+  std::string_view data(batch.buffer->GetString(), batch.buffer->GetSize());
+  for (size_t i = 0; i < 4; i++) {
+    auto end = data.find('\n');
+    uint64_t seq = 0;
+    uint64_t time = 0;
+    ASSERT_TRUE(stamp::Parse(data.substr(0, end), &seq, &time));
+    if (i % 2 == 0) {
+      ASSERT_EQ(seq, 10 + i);
+      ASSERT_GT(time, 0);
+    } else {
+      ASSERT_EQ(seq, 0);
+      ASSERT_EQ(time, 0);
+    }
+    data.remove_prefix(end + 1);
+  }
+}
+
+}  // namespace illex::test
@@ -0,0 +1,242 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <arrow/api.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "illex/client_buffering.h"
+#include "illex/client_queueing.h"
+#include "illex/server.h"
+
+namespace illex::test {
+
+/// Return options to produce some small JSONs.
+static auto TestProduction(size_t num_jsons) -> ProducerOptions {
+  ProducerOptions opts;
+  opts.num_jsons = num_jsons;
+  opts.schema = arrow::schema({arrow::field("a", arrow::null(), false)});
+  return opts;
+}
+
+/**
+ * \brief Stream JSONs from a server on the loopback interface to some clients.
+ * \param[in]  server_opts The server options. The port is ignored.
+ * \param[in]  prod_opts   The production options.
+ * \param[out] received    The JSONs received by every client.
+ * \param[out] metrics     The streaming statistics of the server.
+ */
+static void Stream(ServerOptions server_opts, const ProducerOptions& prod_opts,
+                   std::vector<std::vector<JSONItem>>* received,
+                   StreamMetrics* metrics) {
+  server_opts.port = 0;
+  Server server;
+  ASSERT_TRUE(Server::Create(server_opts, &server).ok());
+  Status server_status;
+  std::thread sender([&]() {
+    server_status = server.SendJSONs(prod_opts, RepeatOptions{1, 0}, metrics);
+  });
+
+  const size_t num_clients = server_opts.num_clients;
+  std::vector<JSONQueue> queues(num_clients);
+  std::vector<QueueingClient> clients(num_clients);
+  std::vector<Status> statuses(num_clients);
+  std::vector<std::thread> receivers;
+  ClientOptions client_opts;
+  client_opts.host = "127.0.0.1";
+  client_opts.port = server.port();
+  for (size_t c = 0; c < num_clients; c++) {
+    ASSERT_TRUE(QueueingClient::Create(client_opts, &queues[c], &clients[c]).ok());
+    receivers.emplace_back([&, c]() { statuses[c] = clients[c].ReceiveJSONs(); });
+  }
+  for (auto& receiver : receivers) {
+    receiver.join();
+  }
+  sender.join();
+  ASSERT_TRUE(server_status.ok()) << server_status.msg();
+  ASSERT_TRUE(server.Close().ok());
+
+  received->resize(num_clients);
+  for (size_t c = 0; c < num_clients; c++) {
+    ASSERT_TRUE(statuses[c].ok()) << statuses[c].msg();
+    JSONItem item;
+    while (queues[c].try_dequeue(item)) {
+      (*received)[c].push_back(item);
+    }
+    ASSERT_EQ((*received)[c].size(), clients[c].jsons_received());
+  }
+}
+
+/**
+ * \brief Stream JSONs from a server on the loopback interface to a BufferingClient.
+ * \param[in]  server_opts The server options, with a single client. The port is ignored.
+ * \param[in]  prod_opts   The production options.
+ * \param[in]  repeat_opts The repeat options.
+ * \param[out] received    The received JSONs, in order.
+ * \param[in]  tracker     The latency tracker of the client, may be nullptr.
+ * \param[in]  live        The live metrics of the client, may be nullptr.
+ */
+static void StreamBuffered(ServerOptions server_opts, const ProducerOptions& prod_opts,
+                           const RepeatOptions& repeat_opts,
+                           std::vector<std::string>* received,
+                           LatencyTracker* tracker = nullptr,
+                           LiveMetrics* live = nullptr) {
+  server_opts.port = 0;
+  Server server;
+  ASSERT_TRUE(Server::Create(server_opts, &server).ok());
+  Status server_status;
+  StreamMetrics metrics;
+  std::thread sender([&]() {
+    server_status = server.SendJSONs(prod_opts, repeat_opts, &metrics);
+  });
+
+  std::vector<std::vector<std::byte>> storage(4, std::vector<std::byte>(1 << 16));
+  std::vector<JSONBuffer> buffers(4);
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  for (size_t i = 0; i < 4; i++) {
+    ASSERT_TRUE(JSONBuffer::Create(storage[i].data(), 1 << 16, &buffers[i]).ok());
+    free.enqueue(&buffers[i]);
+  }
+  ClientOptions client_opts;
+  client_opts.host = "127.0.0.1";
+  client_opts.port = server.port();
+  client_opts.protocol = server_opts.protocol;
+  client_opts.live = live;
+  BufferingClient client;
+  ASSERT_TRUE(BufferingClient::Create(client_opts, &free, &filled, &client).ok());
+  Status client_status;
+  std::thread receiver([&]() { client_status = client.ReceiveJSONs(tracker); });
+
+  // Consume the buffers in order.
+  const size_t expected = TotalJSONs(prod_opts) * repeat_opts.times;
+  JSONBuffer* buf = nullptr;
+  while ((received->size() < expected) &&
+         filled.wait_dequeue_timed(buf, std::chrono::seconds(10))) {
+    ASSERT_EQ(buf->range().first, received->size());
+    size_t start = 0;
+    for (auto newline : buf->newlines()) {
+      received->emplace_back(reinterpret_cast<const char*>(buf->data()) + start,
+                             newline - start);
+      start = newline + 1;
+    }
+    buf->Reset();
+    free.enqueue(buf);
+  }
+  receiver.join();
+  sender.join();
+  ASSERT_TRUE(server_status.ok()) << server_status.msg();
+  ASSERT_TRUE(client_status.ok()) << client_status.msg();
+  ASSERT_TRUE(server.Close().ok());
+  ASSERT_EQ(client.jsons_received(), expected);
+}
+
+TEST(Server, Partition) {
+  ServerOptions opts;
+  opts.num_clients = 3;
+  auto prod_opts = TestProduction(100);
+  std::vector<std::vector<JSONItem>> received;
+  StreamMetrics metrics;
+  Stream(opts, prod_opts, &received, &metrics);
+
+  // Every client receives a disjoint share, which together hold all JSONs.
+  size_t total = 0;
+  for (const auto& jsons : received) {
+    ASSERT_GE(jsons.size(), 33);
+    ASSERT_LE(jsons.size(), 34);
+    total += jsons.size();
+  }
+  ASSERT_EQ(total, prod_opts.num_jsons);
+  ASSERT_EQ(metrics.num_messages, prod_opts.num_jsons);
+}
+
+TEST(Server, Broadcast) {
+  ServerOptions opts;
+  opts.num_clients = 2;
+  opts.fan_out = FanOut::Broadcast;
+  auto prod_opts = TestProduction(100);
+  prod_opts.gen.seed = 0;
+  std::vector<std::vector<JSONItem>> received;
+  StreamMetrics metrics;
+  Stream(opts, prod_opts, &received, &metrics);
+
+  // Every client receives the same JSONs.
+  ASSERT_EQ(received[0].size(), prod_opts.num_jsons);
+  ASSERT_EQ(received[1].size(), prod_opts.num_jsons);
+  for (size_t i = 0; i < prod_opts.num_jsons; i++) {
+    ASSERT_EQ(received[0][i].seq, i);
+    ASSERT_EQ(received[0][i].string, received[1][i].string);
+  }
+  ASSERT_EQ(metrics.num_messages, 2 * prod_opts.num_jsons);
+}
+
+TEST(Server, Framed) {
+  ServerOptions opts;
+  opts.fan_out = FanOut::Broadcast;
+  opts.protocol.framing = Framing::Length;
+  auto prod_opts = TestProduction(25);
+  prod_opts.batching = true;
+  prod_opts.num_batches = 4;
+  // Broadcast frames are numbered across repeats, as every connection is.
+  std::vector<std::string> received;
+  LatencyTracker tracker(256, 2, 1);
+  StreamBuffered(opts, prod_opts, RepeatOptions{2, 0}, &received, &tracker);
+  ASSERT_EQ(received.size(), 200);
+  for (size_t i = 0; i < received.size(); i++) {
+    ASSERT_EQ(received[i].front(), '{');
+    ASSERT_EQ(received[i].back(), '}');
+    // Every JSON of a frame is tracked before its buffer is handed off.
+    ASSERT_NE(tracker.Get(i, 0), TimePoint());
+    ASSERT_LE(tracker.Get(i, 0), tracker.Get(i, 1));
+  }
+}
+
+TEST(Server, Compressed) {
+  ServerOptions opts;
+  opts.protocol.framing = Framing::Length;
+  opts.protocol.compression = Compression::LZ4;
+  auto prod_opts = TestProduction(25);
+  prod_opts.batching = true;
+  prod_opts.num_batches = 4;
+  std::vector<std::string> received;
+  LiveMetrics live;
+  StreamBuffered(opts, prod_opts, RepeatOptions{1, 0}, &received, nullptr, &live);
+  ASSERT_EQ(received.size(), 100);
+  for (const auto& json : received) {
+    ASSERT_EQ(json.front(), '{');
+    ASSERT_EQ(json.back(), '}');
+  }
+  // The client reports the time it spent decompressing the frames.
+  ASSERT_GT(live.decompress_ns.load(), 0);
+  ASSERT_GT(MetricsSnapshot::Take(live).decompress_time, 0.0);
+}
+
+TEST(Server, RingStopsWhenProductionFails) {
+  ServerOptions opts;
+  opts.ring.path = ::testing::TempDir() + "illex_server.ring";
+  opts.ring.num_slots = 2;
+  opts.ring.slot_size = 1024;
+  // The production threads cannot be pinned, so they stop before producing any JSON.
+  auto prod_opts = TestProduction(100);
+  prod_opts.cpus = {CPU_SETSIZE};
+  auto status = RunServer(opts, prod_opts, RepeatOptions{1, 0}, ReplayOptions{}, false);
+  ASSERT_FALSE(status.ok());
+}
+
+}  // namespace illex::test
@@ -0,0 +1,136 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#include "illex/client_shm.h"
+#include "illex/latency.h"
+#include "illex/shm.h"
+
+namespace illex {
+
+/// Return a ring file path for the current test.
+static auto RingPath() -> std::string {
+  return ::testing::TempDir() + "illex_" +
+         ::testing::UnitTest::GetInstance()->current_test_info()->name() + ".ring";
+}
+
+TEST(Shm, Ring) {
+  RingOptions opts;
+  opts.path = RingPath();
+  opts.num_slots = 2;
+  opts.slot_size = 16;
+  ShmRing writer;
+  ASSERT_TRUE(ShmRing::Create(opts, &writer).ok());
+  ShmRing reader;
+  ASSERT_TRUE(ShmRing::Open(opts.path, &reader).ok());
+  ASSERT_EQ(reader.num_slots(), 2);
+  ASSERT_EQ(reader.slot_size(), 16);
+
+  // Data larger than a slot is split after the last newline that fits.
+  ASSERT_TRUE(writer.Write("{\"a\":10}\n{\"b\":20}\n").ok());
+  ASSERT_EQ(writer.written(), 2);
+  ASSERT_TRUE(reader.Wait(0));
+  ASSERT_EQ(reader.slot_length(0), 9);
+  ASSERT_EQ(std::string(reinterpret_cast<const char*>(reader.slot(0)), 9),
+            "{\"a\":10}\n");
+  ASSERT_TRUE(reader.Wait(1));
+  ASSERT_EQ(reader.slot_length(1), 9);
+
+  // The writer cannot overwrite slots that are not released.
+  std::atomic<bool> shutdown = true;
+  ASSERT_TRUE(writer.Write("{}\n", &shutdown).ok());
+  ASSERT_EQ(writer.written(), 2);
+  reader.Release(1);
+  ASSERT_TRUE(writer.Write("{}\n").ok());
+  ASSERT_EQ(reader.slot(2), reader.slot(0));
+  ASSERT_EQ(reader.slot_length(2), 3);
+
+  // The writer stops waiting for the reader to release its slots.
+  ASSERT_FALSE(writer.Drain(std::chrono::milliseconds(1)));
+  ASSERT_FALSE(writer.Drain(std::chrono::seconds(10), &shutdown));
+
+  // A JSON must fit in a slot.
+  reader.Release(3);
+  ASSERT_TRUE(writer.Drain(std::chrono::milliseconds(0)));
+  ASSERT_FALSE(writer.Write("{\"too_long\":true}\n").ok());
+
+  writer.Finish();
+  ASSERT_FALSE(reader.Wait(3));
+
+  // Only ring files can be opened.
+  ShmRing other;
+  ASSERT_FALSE(ShmRing::Open(opts.path + ".missing", &other).ok());
+}
+
+TEST(Shm, Client) {
+  RingOptions opts;
+  opts.path = RingPath();
+  opts.num_slots = 4;
+  opts.slot_size = 64;
+  ShmRing writer;
+  ASSERT_TRUE(ShmRing::Create(opts, &writer).ok());
+
+  JSONBufferQueue free;
+  JSONBufferQueue filled;
+  RingClient client;
+  ASSERT_FALSE(RingClient::Create({opts.path, 0}, nullptr, &filled, &client).ok());
+  ASSERT_TRUE(RingClient::Create({opts.path, 0}, &free, &filled, &client).ok());
+
+  // Write more slots than the ring holds, so slots must be reused.
+  constexpr size_t num_jsons = 64;
+  std::thread server([&]() {
+    for (size_t i = 0; i < num_jsons; i++) {
+      ASSERT_TRUE(writer.Write("{\"i\":" + std::to_string(i) + "}\n").ok());
+    }
+    writer.Finish();
+  });
+
+  // Return every buffer after checking it, from another thread.
+  size_t num_consumed = 0;
+  std::thread consumer([&]() {
+    while (num_consumed < num_jsons) {
+      JSONBuffer* buf = nullptr;
+      filled.wait_dequeue(buf);
+      ASSERT_EQ(buf->range().first, num_consumed);
+      auto json = std::string(reinterpret_cast<const char*>(buf->data()), buf->size());
+      ASSERT_EQ(json, "{\"i\":" + std::to_string(num_consumed) + "}\n");
+      num_consumed += buf->num_jsons();
+      buf->Reset();
+      free.enqueue(buf);
+    }
+  });
+
+  LatencyTracker tracker(num_jsons, 2, 1);
+  ASSERT_TRUE(client.ReceiveJSONs(&tracker).ok());
+  server.join();
+  consumer.join();
+  ASSERT_EQ(client.jsons_received(), num_jsons);
+  ASSERT_EQ(num_consumed, num_jsons);
+  // The JSONs of every slot are tracked before the slot is handed off.
+  for (size_t i = 0; i < num_jsons; i++) {
+    ASSERT_NE(tracker.Get(i, 0), TimePoint());
+    ASSERT_LE(tracker.Get(i, 0), tracker.Get(i, 1));
+  }
+  ASSERT_TRUE(client.Close().ok());
+  ASSERT_FALSE(client.Close().ok());
+  ASSERT_TRUE(writer.Drain(std::chrono::seconds(10)));
+}
+
+}  // namespace illex
@@ -0,0 +1,65 @@
+// Copyright 2020 Teratide B.V.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "illex/writer.h"
+
+namespace illex::test {
+
+/// Write data in pieces with some writer options, and check the resulting file.
+static void WriteAndCheck(const WriterOptions& opts, const std::string& name) {
+  std::string path = testing::TempDir() + name;
+  std::string expected;
+  for (size_t i = 0; i < 1000; i++) {
+    expected += "{\"json\":" + std::to_string(i) + "}\n";
+  }
+
+  std::shared_ptr<FileWriter> writer;
+  ASSERT_TRUE(FileWriter::Open(path, opts, &writer).ok());
+  // Write in odd-sized pieces, so they straddle the buffers.
+  for (size_t offset = 0; offset < expected.length(); offset += 777) {
+    ASSERT_TRUE(writer->Write(std::string_view(expected).substr(offset, 777)).ok());
+  }
+  ASSERT_TRUE(writer->Close().ok());
+  ASSERT_EQ(writer->num_bytes(), expected.length());
+
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  ASSERT_EQ(ss.str(), expected);
+  std::remove(path.c_str());
+}
+
+TEST(Writer, Buffered) {
+  WriterOptions opts;
+  opts.num_threads = 3;
+  opts.buffer_size = kDirectAlignment;
+  WriteAndCheck(opts, "illex_writer_buffered.jsonl");
+}
+
+TEST(Writer, Direct) {
+  // Falls back to buffered writes if the file system does not support O_DIRECT.
+  WriterOptions opts;
+  opts.direct = true;
+  opts.buffer_size = 2 * kDirectAlignment;
+  WriteAndCheck(opts, "illex_writer_direct.jsonl");
+}
+
+}  // namespace illex::test